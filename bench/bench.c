@@ -0,0 +1,840 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: bench.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Microbenchmarks of the hot paths of the server: decoding signatures, handing scripts over between the stages
+ * of the server, verifying them per key type, scanning a growing list of certificates and loading certificate
+ * directories. Keys and certificates are generated in a temporary directory. Every result is written to stdout as one JSON object per line:
+ *     {"bench":"verify_signature","key":"RSA-2048","ns_per_op":...,"stddev_ns":...,"ops_per_s":...,"samples":...,"iterations":...}
+ * ns_per_op is the mean over the samples and stddev_ns its standard deviation across samples.
+ *
+ * The verify_allocs results count the heap allocations of one verification once the contexts are warm,
+ * separately for the server code (malloc, calloc and realloc are wrapped at link time) and for OpenSSL
+ * (through CRYPTO_set_mem_functions). The benchmark fails if the server code allocates on these paths. The
+ * OpenSSL counts are informational: the providers of OpenSSL 3.0 allocate a new digest context on every
+ * EVP_DigestInit_ex and the big numbers of the public key operations are allocated internally.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/err.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+#include <openssl/pem.h>
+#include <openssl/dsa.h>
+
+#include "base64.h"
+#include "debug.h"
+#include "cert_utils.h"
+#include "ingest.h"
+#include "merkle.h"
+#include "mpmc_queue.h"
+#include "verify.h"
+#include "verify_cache.h"
+#include "server.h"
+
+/* Globals normally defined by the server */
+int debug = DEBUG_DISABLED;
+long int counter = 0;
+
+#define BENCH_DEFAULT_SAMPLES       10
+#define BENCH_MAX_SAMPLES           100
+#define BENCH_MIN_SAMPLE_NS         20000000L   // iterations are calibrated so a sample lasts at least 20 ms
+#define BENCH_DEFAULT_MAX_CERTS     10000
+#define BENCH_SCRIPT_SIZE           1024
+#define BENCH_PARAMS_SIZE           128
+#define BENCH_NAME_SIZE             64
+#define BENCH_DIR_SIZE              128
+#define BENCH_PATH_SIZE             (BENCH_DIR_SIZE + BENCH_NAME_SIZE)
+#define BENCH_ALLOC_WARMUP          10
+#define BENCH_ALLOC_ITERATIONS      100
+
+typedef void (*bench_fn_t)(void* arg);
+
+typedef struct bench_key
+{
+    const char* name;
+    EVP_PKEY* pkey;
+} bench_key_t;
+
+typedef struct verify_arg
+{
+    verify_ctx_t* verifier;
+    cert_store_t* store;
+    signed_script_t* signed_script;
+} verify_arg_t;
+
+typedef struct hash_arg
+{
+    EVP_MD_CTX* md_ctx;
+    const char* script;
+    size_t script_size;
+    size_t chunk_size;
+    unsigned char* leaves;
+} hash_arg_t;
+
+typedef struct decode_arg
+{
+    char* signature;
+    size_t signature_size;
+} decode_arg_t;
+
+static FILE* results;
+static int num_samples = BENCH_DEFAULT_SAMPLES;
+static char work_dir[] = "/tmp/server_bench.XXXXXX";
+
+/* Heap allocations made by the server code and by OpenSSL, the certificates are loaded by several threads */
+static long app_allocs = 0;
+static long openssl_allocs = 0;
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    __atomic_add_fetch(&app_allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t num, size_t size)
+{
+    __atomic_add_fetch(&app_allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(num, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    __atomic_add_fetch(&app_allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+static void* count_openssl_malloc(size_t size, const char* file, int line)
+{
+    (void) file;
+    (void) line;
+    __atomic_add_fetch(&openssl_allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+static void* count_openssl_realloc(void* ptr, size_t size, const char* file, int line)
+{
+    (void) file;
+    (void) line;
+    __atomic_add_fetch(&openssl_allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+static void count_openssl_free(void* ptr, const char* file, int line)
+{
+    (void) file;
+    (void) line;
+    free(ptr);
+}
+
+static long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+/* Time fn: the calibration of the number of iterations per sample doubles as warm up */
+static void run_bench(const char* bench, const char* params, bench_fn_t fn, void* arg)
+{
+    double ns_per_op[BENCH_MAX_SAMPLES];
+    long iterations = 1;
+    double mean = 0, variance = 0;
+
+    for(;;)
+    {
+        long start = now_ns();
+        for(long i = 0; i < iterations; i++)
+        {
+            fn(arg);
+        }
+        long elapsed = now_ns() - start;
+        if(elapsed >= BENCH_MIN_SAMPLE_NS || iterations >= (1L << 30))
+        {
+            break;
+        }
+        iterations *= (elapsed > BENCH_MIN_SAMPLE_NS / 10) ? 2 : 10;
+    }
+
+    for(int s = 0; s < num_samples; s++)
+    {
+        long start = now_ns();
+        for(long i = 0; i < iterations; i++)
+        {
+            fn(arg);
+        }
+        ns_per_op[s] = (double) (now_ns() - start) / iterations;
+        mean += ns_per_op[s];
+    }
+    mean /= num_samples;
+    for(int s = 0; s < num_samples; s++)
+    {
+        variance += (ns_per_op[s] - mean) * (ns_per_op[s] - mean);
+    }
+    variance = (num_samples > 1) ? variance / (num_samples - 1) : 0;
+
+    fprintf(results, "{\"bench\":\"%s\",%s,\"ns_per_op\":%.1f,\"stddev_ns\":%.1f,\"ops_per_s\":%.1f,\"samples\":%d,\"iterations\":%ld}\n",
+            bench, params, mean, sqrt(variance), mean > 0 ? 1e9 / mean : 0, num_samples, iterations);
+    fflush(results);
+}
+
+static EVP_PKEY* generate_dsa_key(int bits)
+{
+    EVP_PKEY* params = NULL;
+    EVP_PKEY* pkey = NULL;
+    EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_new_from_name(NULL, "DSA", NULL);
+
+    if(ctx && EVP_PKEY_paramgen_init(ctx) > 0 && EVP_PKEY_CTX_set_dsa_paramgen_bits(ctx, bits) > 0)
+    {
+        EVP_PKEY_paramgen(ctx, &params);
+    }
+    EVP_PKEY_CTX_free(ctx);
+    if(!params)
+    {
+        return NULL;
+    }
+
+    ctx = EVP_PKEY_CTX_new_from_pkey(NULL, params, NULL);
+    if(ctx && EVP_PKEY_keygen_init(ctx) > 0)
+    {
+        EVP_PKEY_keygen(ctx, &pkey);
+    }
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(params);
+    return pkey;
+}
+
+static int is_eddsa(EVP_PKEY* pkey)
+{
+    return EVP_PKEY_ED25519 == EVP_PKEY_get_base_id(pkey) || EVP_PKEY_ED448 == EVP_PKEY_get_base_id(pkey);
+}
+
+static int add_extension(X509* cert, int nid, const char* value)
+{
+    X509V3_CTX ctx;
+    X509V3_set_ctx_nodb(&ctx);
+    X509V3_set_ctx(&ctx, cert, cert, NULL, NULL, 0);
+    X509_EXTENSION* ext = X509V3_EXT_conf_nid(NULL, &ctx, nid, value);
+    if(!ext)
+    {
+        return ERROR;
+    }
+    X509_add_ext(cert, ext, -1);
+    X509_EXTENSION_free(ext);
+    return OK;
+}
+
+/* Write a self-signed code signing certificate accepted by load_certs */
+static int write_cert(EVP_PKEY* pkey, long serial, const char* path)
+{
+    char common_name[64];
+    int ret = ERROR;
+    X509* cert = X509_new();
+    FILE* fp = NULL;
+
+    snprintf(common_name, sizeof(common_name), "bench %ld", serial);
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), serial);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+    X509_set_pubkey(cert, pkey);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC, (unsigned char*) common_name, -1, -1, 0);
+    X509_set_issuer_name(cert, X509_get_subject_name(cert));
+
+    if(OK == add_extension(cert, NID_key_usage, "critical,digitalSignature")
+       && OK == add_extension(cert, NID_ext_key_usage, "codeSigning")
+       && OK == add_extension(cert, NID_subject_key_identifier, "hash")
+       && X509_sign(cert, pkey, is_eddsa(pkey) ? NULL : EVP_sha256()) > 0
+       && NULL != (fp = fopen(path, "w")))
+    {
+        ret = PEM_write_X509(fp, cert) ? OK : ERROR;
+        fclose(fp);
+    }
+    X509_free(cert);
+    return ret;
+}
+
+/* Sign script the way tests/tools/sign_scripts.sh does and build the signed file: base64 signature, newline, script */
+static char* sign_script(EVP_PKEY* pkey, const char* script, size_t script_size, size_t* signed_size)
+{
+    unsigned char signature[MAX_SIGNATURE_SIZE];
+    size_t signature_size = sizeof(signature);
+    char* signed_file = NULL;
+    EVP_MD_CTX* md_ctx = EVP_MD_CTX_new();
+
+    if(md_ctx
+       && EVP_DigestSignInit(md_ctx, NULL, is_eddsa(pkey) ? NULL : EVP_sha256(), NULL, pkey) > 0
+       && EVP_DigestSign(md_ctx, signature, &signature_size, (const unsigned char*) script, script_size) > 0)
+    {
+        signed_file = malloc(4 * ((signature_size + 2) / 3) + 1 + script_size + 1);
+    }
+    EVP_MD_CTX_free(md_ctx);
+    if(!signed_file)
+    {
+        return NULL;
+    }
+
+    int encoded_size = EVP_EncodeBlock((unsigned char*) signed_file, signature, signature_size);
+    signed_file[encoded_size] = '\n';
+    memcpy(signed_file + encoded_size + 1, script, script_size);
+    *signed_size = encoded_size + 1 + script_size;
+    return signed_file;
+}
+
+/* Feed a signed file to the ingest functions, as if it was received from a fifo */
+static int ingest_signed_file(signed_script_t* signed_script, const char* data, size_t size)
+{
+    begin_ingest(signed_script);
+    while(size > 0)
+    {
+        size_t available;
+        char* free_space = ingest_reserve(signed_script, &available);
+        if(!free_space)
+        {
+            return ERROR;
+        }
+        if(available > size)
+        {
+            available = size;
+        }
+        memcpy(free_space, data, available);
+        if(INGEST_OK != ingest_append(signed_script, available))
+        {
+            return ERROR;
+        }
+        data += available;
+        size -= available;
+    }
+    return (INGEST_OK == end_ingest(signed_script)) ? OK : ERROR;
+}
+
+static void bench_decode(void* arg)
+{
+    decode_arg_t* decode = (decode_arg_t*) arg;
+    unsigned char decoded[MAX_DECODED_SIGNATURE_SIZE];
+    size_t consumed;
+    base64_decode(decoded, sizeof(decoded), decode->signature, decode->signature_size, &consumed);
+}
+
+static void bench_verify(void* arg)
+{
+    verify_arg_t* verify = (verify_arg_t*) arg;
+    verify_signature(verify->verifier, verify->store, verify->signed_script);
+}
+
+/* Hashing a v1 script in one pass, against checking the chunks of a v2 script */
+static void bench_script_digest(void* arg)
+{
+    hash_arg_t* hash = (hash_arg_t*) arg;
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    EVP_DigestInit_ex(hash->md_ctx, EVP_sha256(), NULL);
+    EVP_DigestUpdate(hash->md_ctx, hash->script, hash->script_size);
+    EVP_DigestFinal_ex(hash->md_ctx, digest, NULL);
+}
+
+static void bench_merkle_chunks(void* arg)
+{
+    hash_arg_t* hash = (hash_arg_t*) arg;
+    size_t bad_chunk;
+    check_merkle_chunks(hash->script, hash->script_size, hash->chunk_size, hash->leaves, &bad_chunk);
+}
+
+/* One hand-off between two stages of the server, without contention */
+static void bench_queue(void* arg)
+{
+    mpmc_queue_t* queue = (mpmc_queue_t*) arg;
+    void* item;
+    mpmc_push(queue, queue);
+    mpmc_pop(queue, &item);
+}
+
+static void bench_load(void* arg)
+{
+    cert_store_t* store = load_certs((const char*) arg);
+    cleanup_certs(&store);
+}
+
+/* Every base64 kernel the CPU supports, the server then uses the fastest one */
+static void run_decode_benches(void)
+{
+    static const size_t sizes[] = {64, 128, 256, 512, 1024, 2048, 3072};
+    unsigned char raw[3072];
+    char encoded[MAX_SIGNATURE_SIZE + 1];
+    char params[BENCH_PARAMS_SIZE];
+
+    for(int kernel = 0; kernel < BASE64_NUM_KERNELS; kernel++)
+    {
+        if(select_base64_kernel(kernel) != kernel)
+        {
+            continue;
+        }
+        for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        {
+            RAND_bytes(raw, sizes[i]);
+            decode_arg_t arg = {.signature = encoded};
+            arg.signature_size = EVP_EncodeBlock((unsigned char*) encoded, raw, sizes[i]);
+            snprintf(params, sizeof(params), "\"kernel\":\"%s\",\"signature_bytes\":%lu", base64_kernel_name(kernel), sizes[i]);
+            run_bench("decode_signature", params, bench_decode, &arg);
+        }
+    }
+    select_base64_kernel(BASE64_KERNEL_AUTO);
+}
+
+static void run_queue_benches(void)
+{
+    mpmc_queue_t queue;
+    if(MPMC_QUEUE_OK != init_mpmc_queue(&queue, 64))
+    {
+        fprintf(stderr, "Cannot allocate the queue\n");
+        return;
+    }
+    run_bench("mpmc_queue", "\"op\":\"push_pop\"", bench_queue, &queue);
+    free_mpmc_queue(&queue);
+}
+
+static void run_hash_benches(void)
+{
+    static const size_t sizes[] = {64 * 1024, 1024 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024};
+    static const size_t chunk_size = 64 * 1024;
+    char params[BENCH_PARAMS_SIZE];
+    size_t max_size = sizes[sizeof(sizes) / sizeof(sizes[0]) - 1];
+    hash_arg_t arg = {.md_ctx = EVP_MD_CTX_new(), .chunk_size = chunk_size};
+    char* script = malloc(max_size);
+    arg.leaves = malloc(merkle_num_chunks(max_size, chunk_size) * SHA256_DIGEST_LENGTH);
+
+    if(!arg.md_ctx || !script || !arg.leaves)
+    {
+        fprintf(stderr, "Cannot allocate the scripts to hash\n");
+        EVP_MD_CTX_free(arg.md_ctx);
+        free(arg.leaves);
+        free(script);
+        return;
+    }
+    RAND_bytes((unsigned char*) script, max_size);
+    arg.script = script;
+    start_merkle_pool();
+
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        arg.script_size = sizes[i];
+        for(size_t c = 0; c < merkle_num_chunks(sizes[i], chunk_size); c++)
+        {
+            size_t size = (sizes[i] - c * chunk_size < chunk_size) ? sizes[i] - c * chunk_size : chunk_size;
+            merkle_leaf(arg.md_ctx, script + c * chunk_size, size, arg.leaves + c * SHA256_DIGEST_LENGTH);
+        }
+        snprintf(params, sizeof(params), "\"script_bytes\":%lu", sizes[i]);
+        run_bench("script_digest", params, bench_script_digest, &arg);
+        snprintf(params, sizeof(params), "\"script_bytes\":%lu,\"chunk_bytes\":%lu,\"cpus\":%ld", sizes[i], chunk_size,
+                 sysconf(_SC_NPROCESSORS_ONLN));
+        run_bench("merkle_chunks", params, bench_merkle_chunks, &arg);
+    }
+
+    stop_merkle_pool();
+    EVP_MD_CTX_free(arg.md_ctx);
+    free(arg.leaves);
+    free(script);
+}
+
+static int make_dir(char* path, size_t size, const char* name)
+{
+    snprintf(path, size, "%s/%s", work_dir, name);
+    return (0 == mkdir(path, 0700)) ? OK : ERROR;
+}
+
+/* Allocations of one verification after the warm up, written as a result line. Returns the allocations of the
+   server code and of OpenSSL per verification */
+static void count_allocs(const char* bench, const char* key, bench_fn_t fn, void* arg, double* app, double* openssl)
+{
+    for(int i = 0; i < BENCH_ALLOC_WARMUP; i++)
+    {
+        fn(arg);
+    }
+    long app_start = __atomic_load_n(&app_allocs, __ATOMIC_RELAXED);
+    long openssl_start = __atomic_load_n(&openssl_allocs, __ATOMIC_RELAXED);
+    for(int i = 0; i < BENCH_ALLOC_ITERATIONS; i++)
+    {
+        fn(arg);
+    }
+    *app = (double) (__atomic_load_n(&app_allocs, __ATOMIC_RELAXED) - app_start) / BENCH_ALLOC_ITERATIONS;
+    *openssl = (double) (__atomic_load_n(&openssl_allocs, __ATOMIC_RELAXED) - openssl_start) / BENCH_ALLOC_ITERATIONS;
+    fprintf(results, "{\"bench\":\"%s\",\"key\":\"%s\",\"app_allocs_per_op\":%.2f,\"openssl_allocs_per_op\":%.2f,\"iterations\":%d}\n",
+            bench, key, *app, *openssl, BENCH_ALLOC_ITERATIONS);
+    fflush(results);
+}
+
+typedef struct cached_verify_arg
+{
+    verify_cache_t* cache;
+    verify_arg_t verify;
+} cached_verify_arg_t;
+
+static void bench_verify_cached(void* arg)
+{
+    cached_verify_arg_t* cached = (cached_verify_arg_t*) arg;
+    verify_signature_cached(cached->cache, cached->verify.verifier, cached->verify.store, cached->verify.signed_script);
+}
+
+/* The steady state of a worker must not allocate in the server code, with or without a cache hit */
+static int check_verify_allocs(verify_arg_t* arg, const char* key)
+{
+    double app, openssl;
+    verify_cache_t cache;
+    int ret = OK;
+
+    count_allocs("verify_allocs", key, bench_verify, arg, &app, &openssl);
+    if(app > 0)
+    {
+        fprintf(stderr, "verify_signature allocates %.2f times per verification with %s\n", app, key);
+        ret = ERROR;
+    }
+
+    if(VERIFY_CACHE_INIT_OK != init_verify_cache(&cache, VERIFY_CACHE_DEFAULT_CAPACITY, VERIFY_CACHE_DEFAULT_CAPACITY / VERIFY_CACHE_NEGATIVE_RATIO))
+    {
+        return ERROR;
+    }
+    cached_verify_arg_t cached = {.cache = &cache, .verify = *arg};
+    count_allocs("verify_cached_allocs", key, bench_verify_cached, &cached, &app, &openssl);
+    if(app > 0)
+    {
+        fprintf(stderr, "A verification cache hit allocates %.2f times with %s\n", app, key);
+        ret = ERROR;
+    }
+    free_verify_cache(&cache);
+    return ret;
+}
+
+static int run_verify_benches(verify_ctx_t* verifier, bench_key_t* keys, int num_keys, const char* script)
+{
+    char name[BENCH_NAME_SIZE];
+    char dir[BENCH_DIR_SIZE];
+    char path[BENCH_PATH_SIZE];
+    char params[BENCH_PARAMS_SIZE];
+    signed_script_t signed_script;
+    int ret = OK;
+
+    memset(&signed_script, 0, sizeof(signed_script));
+    init_ingest(&signed_script);
+
+    for(int k = 0; k < num_keys; k++)
+    {
+        size_t signed_size;
+        char* signed_file = sign_script(keys[k].pkey, script, BENCH_SCRIPT_SIZE, &signed_size);
+
+        snprintf(name, sizeof(name), "verify_%s", keys[k].name);
+        make_dir(dir, sizeof(dir), name);
+        snprintf(path, sizeof(path), "%s/cert.pem", dir);
+        cert_store_t* store = (OK == write_cert(keys[k].pkey, k + 1, path)) ? load_certs(dir) : NULL;
+
+        if(!signed_file || !store || OK != ingest_signed_file(&signed_script, signed_file, signed_size)
+           || VERIFY_SIGNATURE_VALID != verify_signature(verifier, store, &signed_script))
+        {
+            fprintf(stderr, "Cannot prepare the verify benchmark for %s\n", keys[k].name);
+            ret = ERROR;
+        }
+        else
+        {
+            verify_arg_t arg = {.verifier = verifier, .store = store, .signed_script = &signed_script};
+            snprintf(params, sizeof(params), "\"key\":\"%s\"", keys[k].name);
+            run_bench("verify_signature", params, bench_verify, &arg);
+            if(OK != check_verify_allocs(&arg, keys[k].name))
+            {
+                ret = ERROR;
+            }
+        }
+        cleanup_certs(&store);
+        free(signed_file);
+    }
+    cleanup_ingest(&signed_script);
+    return ret;
+}
+
+/* Move the certificate named name to position in the list scanned by verify_signature */
+static void move_cert(cert_store_t* store, const char* name, int position)
+{
+    cert_container_t** link = &store->certs;
+    while(*link && 0 != strcmp((*link)->name, name))
+    {
+        link = &(*link)->next;
+    }
+    if(!*link)
+    {
+        return;
+    }
+    cert_container_t* cert = *link;
+    *link = cert->next;
+
+    link = &store->certs;
+    for(int i = 0; i < position && *link; i++)
+    {
+        link = &(*link)->next;
+    }
+    cert->next = *link;
+    *link = cert;
+}
+
+/* Directory of num_certs certificates hard linked from the pool of fillers, the last one being the matching
+   certificate if match is set. It is created once and shared by the benchmarks */
+static int make_cert_dir(char* dir, size_t size, const char* pool, int num_certs, int match)
+{
+    char name[BENCH_NAME_SIZE];
+    char from[BENCH_PATH_SIZE];
+    char to[BENCH_PATH_SIZE];
+    struct stat st;
+
+    snprintf(name, sizeof(name), "certs_%d_%s", num_certs, match ? "match" : "absent");
+    snprintf(dir, size, "%s/%s", work_dir, name);
+    if(0 == stat(dir, &st))
+    {
+        return OK;
+    }
+    if(OK != make_dir(dir, size, name))
+    {
+        return ERROR;
+    }
+    for(int i = 0; i < num_certs; i++)
+    {
+        if(match && i == num_certs - 1)
+        {
+            snprintf(from, sizeof(from), "%s/match.pem", pool);
+            snprintf(to, sizeof(to), "%s/match.pem", dir);
+        }
+        else
+        {
+            snprintf(from, sizeof(from), "%s/filler_%05d.pem", pool, i);
+            snprintf(to, sizeof(to), "%s/filler_%05d.pem", dir, i);
+        }
+        if(0 != link(from, to))
+        {
+            return ERROR;
+        }
+    }
+    return OK;
+}
+
+/* Cost of verify_signature without key identifier hint as the list of certificates grows, with the
+   matching certificate at the front, in the middle, at the end, or absent. The other certificates
+   hold an RSA-2048 key, like the matching one, so each of them costs a failed verification */
+static void run_scaling_benches(verify_ctx_t* verifier, EVP_PKEY* match_key, EVP_PKEY* filler_key, int max_certs, const char* script)
+{
+    static const char* positions[] = {"front", "middle", "end", "absent"};
+    char pool[BENCH_DIR_SIZE];
+    char path[BENCH_PATH_SIZE];
+    char dir[BENCH_DIR_SIZE];
+    char params[BENCH_PARAMS_SIZE];
+    signed_script_t signed_script;
+    size_t signed_size;
+
+    make_dir(pool, sizeof(pool), "pool");
+    snprintf(path, sizeof(path), "%s/match.pem", pool);
+    if(OK != write_cert(match_key, 1, path))
+    {
+        fprintf(stderr, "Cannot write the matching certificate\n");
+        return;
+    }
+    for(int i = 0; i < max_certs; i++)
+    {
+        snprintf(path, sizeof(path), "%s/filler_%05d.pem", pool, i);
+        if(OK != write_cert(filler_key, i + 2, path))
+        {
+            fprintf(stderr, "Cannot write the certificate %s\n", path);
+            return;
+        }
+    }
+
+    char* signed_file = sign_script(match_key, script, BENCH_SCRIPT_SIZE, &signed_size);
+    memset(&signed_script, 0, sizeof(signed_script));
+    init_ingest(&signed_script);
+    if(!signed_file || OK != ingest_signed_file(&signed_script, signed_file, signed_size))
+    {
+        fprintf(stderr, "Cannot prepare the signed script of the scaling benchmark\n");
+        free(signed_file);
+        cleanup_ingest(&signed_script);
+        return;
+    }
+
+    for(int num_certs = 1; num_certs <= max_certs; num_certs *= 10)
+    {
+        for(size_t p = 0; p < sizeof(positions) / sizeof(positions[0]); p++)
+        {
+            int match = (0 != strcmp(positions[p], "absent"));
+            if(OK != make_cert_dir(dir, sizeof(dir), pool, num_certs, match))
+            {
+                fprintf(stderr, "Cannot create the directory of %d certificates\n", num_certs);
+                continue;
+            }
+
+            cert_store_t* store = load_certs(dir);
+            if(!store)
+            {
+                continue;
+            }
+            if(match)
+            {
+                int position = (0 == strcmp(positions[p], "front")) ? 0 : (0 == strcmp(positions[p], "middle")) ? num_certs / 2 : num_certs - 1;
+                move_cert(store, "match.pem", position);
+            }
+
+            verify_arg_t arg = {.verifier = verifier, .store = store, .signed_script = &signed_script};
+            snprintf(params, sizeof(params), "\"certs\":%d,\"position\":\"%s\"", num_certs, positions[p]);
+            run_bench("verify_scaling", params, bench_verify, &arg);
+            cleanup_certs(&store);
+        }
+
+        /* Startup cost of a directory of the same size */
+        snprintf(dir, sizeof(dir), "%s/certs_%d_absent", work_dir, num_certs);
+        snprintf(params, sizeof(params), "\"certs\":%d", num_certs);
+        run_bench("load_certs", params, bench_load, dir);
+    }
+
+    free(signed_file);
+    cleanup_ingest(&signed_script);
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+    (void) st;
+    (void) flag;
+    (void) ftw;
+    return remove(path);
+}
+
+static void print_usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-r <samples>] [-n <max_certs>]\n", prog);
+    fprintf(stderr, "       -r <samples> : number of timed samples per benchmark (default: %d)\n", BENCH_DEFAULT_SAMPLES);
+    fprintf(stderr, "       -n <max_certs> : largest list of certificates for the scaling benchmarks (default: %d)\n", BENCH_DEFAULT_MAX_CERTS);
+}
+
+int main(int argc, char* argv[])
+{
+    int opt;
+    int max_certs = BENCH_DEFAULT_MAX_CERTS;
+    char script[BENCH_SCRIPT_SIZE];
+    verify_ctx_t verifier;
+    int ret;
+
+    /* Before anything else, so that every allocation of OpenSSL is counted and freed by the same functions */
+    CRYPTO_set_mem_functions(count_openssl_malloc, count_openssl_realloc, count_openssl_free);
+
+    while ((opt = getopt(argc, argv, "r:n:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'r':
+                num_samples = atoi(optarg);
+                if(num_samples < 1 || num_samples > BENCH_MAX_SAMPLES)
+                {
+                    fprintf(stderr, "The number of samples must be between 1 and %d\n", BENCH_MAX_SAMPLES);
+                    return ERROR;
+                }
+                break;
+            case 'n':
+                max_certs = atoi(optarg);
+                if(max_certs < 1 || max_certs > 99999)
+                {
+                    fprintf(stderr, "The number of certificates must be between 1 and 99999\n");
+                    return ERROR;
+                }
+                break;
+            default:
+                print_usage(argv[0]);
+                return ERROR;
+        }
+    }
+
+    /* The results go to stdout, the messages printed by the server modules are silenced */
+    results = fdopen(dup(STDOUT_FILENO), "w");
+    if(!results || !freopen("/dev/null", "w", stdout))
+    {
+        fprintf(stderr, "Cannot redirect the output\n");
+        return ERROR;
+    }
+    if(!mkdtemp(work_dir))
+    {
+        fprintf(stderr, "Cannot create the working directory\n");
+        return ERROR;
+    }
+
+    /* A small shell script, the content does not matter since nothing is executed */
+    for(size_t i = 0; i < sizeof(script); i++)
+    {
+        script[i] = (i % 64 == 63) ? '\n' : "echo benchmark "[i % 16];
+    }
+
+    fprintf(stderr, "Generating keys in %s...\n", work_dir);
+    bench_key_t keys[] = {
+        {"RSA-2048", EVP_PKEY_Q_keygen(NULL, NULL, "RSA", (size_t) 2048)},
+        {"RSA-4096", EVP_PKEY_Q_keygen(NULL, NULL, "RSA", (size_t) 4096)},
+        {"DSA-2048", generate_dsa_key(2048)},
+        {"ED448", EVP_PKEY_Q_keygen(NULL, NULL, "ED448")},
+    };
+    int num_keys = sizeof(keys) / sizeof(keys[0]);
+    EVP_PKEY* filler_key = EVP_PKEY_Q_keygen(NULL, NULL, "RSA", (size_t) 2048);
+    for(int k = 0; k < num_keys; k++)
+    {
+        if(!keys[k].pkey || !filler_key)
+        {
+            fprintf(stderr, "Cannot generate the keys\n");
+            ERR_print_errors_fp(stderr);
+            return ERROR;
+        }
+    }
+
+    if(VERIFY_CTX_OK != init_verify_ctx(&verifier))
+    {
+        return ERROR;
+    }
+    run_decode_benches();
+    run_queue_benches();
+    run_hash_benches();
+    ret = run_verify_benches(&verifier, keys, num_keys, script);
+    fprintf(stderr, "Generating %d certificates...\n", max_certs);
+    run_scaling_benches(&verifier, keys[0].pkey, filler_key, max_certs, script);
+    cleanup_verify_ctx(&verifier);
+
+    for(int k = 0; k < num_keys; k++)
+    {
+        EVP_PKEY_free(keys[k].pkey);
+    }
+    EVP_PKEY_free(filler_key);
+    nftw(work_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    fclose(results);
+    return ret;
+}
@@ -0,0 +1,50 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: base64.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __BASE64_H_
+#define __BASE64_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BASE64_ERROR                   -1
+
+/* Kernels of base64_decode, BASE64_KERNEL_AUTO picks the fastest one the CPU supports */
+#define BASE64_KERNEL_AUTO             -1
+#define BASE64_KERNEL_SCALAR            0
+#define BASE64_KERNEL_SSE4              1
+#define BASE64_KERNEL_AVX2              2
+#define BASE64_NUM_KERNELS              3
+
+/* Largest decoded size of size base64 characters */
+#define BASE64_DECODED_SIZE(size)       (((size) / 4) * 3)
+
+int select_base64_kernel(int kernel);
+int base64_kernel_supported(int kernel);
+const char* base64_kernel_name(int kernel);
+int base64_decode(unsigned char* out, size_t out_size, const char* in, size_t in_size, size_t* consumed);
+
+#endif /* __BASE64_H_ */
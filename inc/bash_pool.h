@@ -0,0 +1,78 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: bash_pool.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __BASH_POOL_H_
+#define __BASH_POOL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define BASH_POOL_OK                    0
+#define BASH_POOL_ERROR                -1
+
+#define BASH_POOL_MAX_SIZE              64
+/* The whole environment of the interpreters of a pool, nothing of the environment of the server is passed on */
+#define BASH_POOL_ENV_PATH              "PATH=/usr/local/sbin:/usr/local/bin:/usr/sbin:/usr/bin:/sbin:/bin"
+
+/* When the refill thread is asked to replace a taken interpreter */
+#define BASH_POOL_REFILL_EAGER          0   // right away, while the script is written to it
+#define BASH_POOL_REFILL_DEFERRED       1   // once the script finished
+
+/* A bash process started in advance, blocked on reading its stdin */
+typedef struct warm_bash
+{
+    pid_t pid;
+    int stdin_fd;
+    int output_fd;
+} warm_bash_t;
+
+/* The interpreters are spawned by a thread of the pool, never by the thread handling the requests */
+typedef struct bash_pool
+{
+    warm_bash_t idle[BASH_POOL_MAX_SIZE];
+    int num_idle;
+    int size;                           // 0 disables the pool, every script spawns its own bash
+    int refill;
+    pthread_mutex_t lock;               // protects idle, num_idle, refill_requested and stopping
+    pthread_cond_t wakeup;
+    pthread_t thread;
+    int running;                        // the refill thread was started
+    int refill_requested;
+    int stopping;
+    long warm_hits;                     // scripts given to an idle interpreter
+    long cold_spawns;                   // scripts that waited for bash to be spawned
+    long discarded;                     // idle interpreters found dead when taken
+} bash_pool_t;
+
+int init_bash_pool(bash_pool_t* pool, int size, int refill);
+void cleanup_bash_pool(bash_pool_t* pool);
+pid_t acquire_bash(bash_pool_t* pool, long id, int* stdin_fd, int* output_fd);
+void refill_bash_pool(bash_pool_t* pool);
+void print_bash_pool_stats(bash_pool_t* pool);
+
+#endif /* __BASH_POOL_H_ */
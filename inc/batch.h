@@ -0,0 +1,67 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: batch.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __BATCH_H_
+#define __BATCH_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cert_utils.h"
+#include "server.h"
+
+#define BATCH_OK                        0
+#define BATCH_ERROR                    -1
+#define BATCH_NOT_ALL_VALID            -2
+
+#define BATCH_FILE_SUFFIX               ".signed"
+#define BATCH_MAX_THREADS               256
+#define BATCH_MAX_KEY_TYPES             32
+#define BATCH_KEY_TYPE_SIZE             32
+
+/* Outcome of the verification of one file */
+typedef struct batch_entry
+{
+    char* path;
+    int verdict;
+    const char* error;                  // why the file could not be verified, NULL otherwise
+    const cert_container_t* signer;
+    char key_type[BATCH_KEY_TYPE_SIZE]; // type and size of the key that validated the file
+    size_t size;
+    long verify_ns;                     // time spent on the signature, reading and hashing excluded
+} batch_entry_t;
+
+typedef struct batch
+{
+    cert_store_t* certs;
+    batch_entry_t* entries;
+    size_t num_entries;
+    size_t next_entry;                  // next file to verify, shared by the threads
+} batch_t;
+
+int run_verify_batch(cert_store_t* certs, const char* target, int num_threads);
+
+#endif /* __BATCH_H_ */
@@ -0,0 +1,94 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: cert_cache.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __CERT_CACHE_H_
+#define __CERT_CACHE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <openssl/sha.h>
+
+#include "cert_utils.h"
+
+#define CERT_CACHE_OK                   0
+#define CERT_CACHE_ERROR               -1
+
+#define CERT_CACHE_MAGIC                "SVSCERTC"
+#define CERT_CACHE_MAGIC_SIZE           8
+#define CERT_CACHE_VERSION              2
+
+/* Outcome of the validation of a cached file */
+#define CERT_CACHE_ACCEPTED             0
+#define CERT_CACHE_REJECTED             1
+
+/* Layout of the cache file: a header, then the entries sorted by name. Only the verdicts are cached, the
+   certificates are always parsed from their own files */
+typedef struct cert_cache_header
+{
+    char magic[CERT_CACHE_MAGIC_SIZE];
+    uint32_t version;
+    uint32_t num_entries;
+    char certpath[MAX_FILEPATH_CHARS_SIZE + 1];     // directory the entries were loaded from
+} cert_cache_header_t;
+
+/* One file of the certificate directory. It matches the file only if its name, size, mtime and sha256 are the same */
+typedef struct cert_cache_entry
+{
+    char name[MAX_CERT_NAME_SIZE];
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    unsigned char content_hash[SHA256_DIGEST_LENGTH];
+    uint32_t status;                                // CERT_CACHE_ACCEPTED or CERT_CACHE_REJECTED
+} cert_cache_entry_t;
+
+typedef struct cert_cache
+{
+    char path[MAX_FILEPATH_CHARS_SIZE + 1];
+    char certpath[MAX_FILEPATH_CHARS_SIZE + 1];
+    /* The cache file found at startup, mapped read only */
+    unsigned char* map;
+    size_t map_size;
+    const cert_cache_entry_t* entries;
+    uint32_t num_entries;
+    /* The entries of the files seen while loading, written back by save_cert_cache */
+    cert_cache_entry_t* new_entries;
+    size_t num_new_entries;
+    size_t new_entries_capacity;
+    long hits;
+    long misses;
+} cert_cache_t;
+
+int open_cert_cache(cert_cache_t* cache, const char* path, const char* certpath);
+void close_cert_cache(cert_cache_t* cache);
+const cert_cache_entry_t* lookup_cert_cache(cert_cache_t* cache, const char* name, const struct stat* st, const unsigned char* content_hash);
+int add_cert_cache_entry(cert_cache_t* cache, const char* name, const struct stat* st, const unsigned char* content_hash,
+                         uint32_t status);
+int save_cert_cache(cert_cache_t* cache);
+
+#endif /* __CERT_CACHE_H_ */
@@ -0,0 +1,71 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: cert_registry.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __CERT_REGISTRY_H_
+#define __CERT_REGISTRY_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "cert_utils.h"
+
+#define CERT_REGISTRY_OK                0
+#define CERT_REGISTRY_ERROR            -1
+
+#define CERT_MAX_READERS                256     // one per worker and per verifier thread
+#define CERT_READER_IDLE                0       // epoch of a reader that does not use any store
+
+/* Epoch announced by one reader while it uses a store, on its own cache line since it is written for every script */
+typedef struct cert_reader
+{
+    unsigned long epoch;
+} __attribute__((aligned(64))) cert_reader_t;
+
+/* The certificate store in use, replaced when the certificate directory changes. Readers never wait: a
+   replaced store is freed by the watcher thread once every reader that could still use it is done */
+typedef struct cert_registry
+{
+    cert_store_t* current;
+    unsigned long epoch;                        // incremented every time a store is published
+    cert_reader_t readers[CERT_MAX_READERS];
+    int num_readers;
+    char path[MAX_FILEPATH_CHARS_SIZE + 1];
+    char cache_path[MAX_FILEPATH_CHARS_SIZE + 1];  // empty if the certificates are not cached
+    int inotify_fd;                             // -1 if the directory is not watched
+    int stop_fd;                                // eventfd that stops the watcher thread
+    pthread_t thread;
+    long reloads;
+} cert_registry_t;
+
+int init_cert_registry(cert_registry_t* registry, cert_store_t* store, const char* path, const char* cache_path);
+void cleanup_cert_registry(cert_registry_t* registry);
+int register_cert_reader(cert_registry_t* registry);
+cert_store_t* enter_certs(cert_registry_t* registry, int reader);
+void exit_certs(cert_registry_t* registry, int reader);
+int start_cert_watcher(cert_registry_t* registry);
+
+#endif /* __CERT_REGISTRY_H_ */
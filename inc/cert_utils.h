@@ -30,8 +30,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <openssl/x509.h>
+#include <openssl/evp.h>
 
 #define MAX_FILEPATH_CHARS_SIZE 300
+#define MAX_CERT_NAME_SIZE      255
+#define MAX_CERT_FILE_SIZE      (1024 * 1024)
 
 #define VALID_CERTIFICATE       0
 #define INVALID_CERTIFICATE     -1
@@ -39,18 +42,58 @@
 #define NOT_SELFSIGNED          0
 #define IS_SELFSIGNED           -1
 
+#define CERT_FINGERPRINT_SIZE   32      // SHA-256 of the DER encoded certificate
+#define MAX_KEY_ID_SIZE         64
+#define CERT_INDEX_BUCKETS      1024    // must be a power of two
+
+#define CERT_STORE_ALLOW_EMPTY  1       // flag of load_cert_store
+
+#define CERT_LOAD_MAX_THREADS       64
+#define CERT_LOAD_FILES_PER_THREAD  16  // smaller directories are loaded by fewer threads
+
+struct cert_container;
+
+/* Entry of the hash index from a key identifier to its certificate */
+typedef struct cert_index_entry
+{
+    const unsigned char* id;
+    size_t id_size;
+    struct cert_container* cert;
+    struct cert_index_entry* next;
+} cert_index_entry_t;
+
 typedef struct cert_container
 {
     X509* cert;
+    EVP_PKEY* pub_key;                      // owned by cert
+    EVP_PKEY_CTX* verify_template;          // verification set up for SHA-256 signatures, NULL for pure EdDSA keys
+    int index;                              // position in the store, indexes the per-thread verification contexts
     struct cert_container* next;
-    char name[255];
+    char name[MAX_CERT_NAME_SIZE];
+    unsigned char fingerprint[CERT_FINGERPRINT_SIZE];
+    unsigned char key_id[MAX_KEY_ID_SIZE]; // SubjectKeyIdentifier, if the certificate has one
+    size_t key_id_size;
+    cert_index_entry_t fingerprint_entry;
+    cert_index_entry_t key_id_entry;
 } cert_container_t;
 
+/* The loaded certificates as a linked list plus a hash index over their fingerprints and key identifiers */
+typedef struct cert_store
+{
+    cert_container_t* certs;
+    cert_index_entry_t* index[CERT_INDEX_BUCKETS];
+    int count;
+    unsigned long generation; // unique for every loaded store
+} cert_store_t;
+
 X509* read_pem_cert(const char *certfile);
 X509* read_der_cert(const char *certfile);
 X509* read_cert(const char *certfile);
-cert_container_t* load_certs(const char *certpath);
-void cleanup_certs(cert_container_t** certs);
+X509* read_cert_mem(const unsigned char* data, size_t size);
+cert_store_t* load_certs(const char *certpath);
+cert_store_t* load_cert_store(const char *certpath, const char *cache_path, int flags);
+void cleanup_certs(cert_store_t** store);
+cert_container_t* find_cert_by_id(const cert_store_t* store, const unsigned char* id, size_t id_size);
 int validate_selfsigned_cert(X509* cert);
 int validate_codesigning_cert(X509* cert);
 
@@ -31,42 +31,40 @@
 #include <stdlib.h>
 #include <openssl/err.h>
 
+#include "logger.h"
+
 #define DEBUG_ENABLED                       1
 #define DEBUG_DISABLED                      0
 
+/* Each message is one record of the logger, written at once with its time and request by the writer thread.
+   The messages depending on -d are compiled out of release builds */
 #define PRINT_DEBUG(debug, msg, ...) \
-    if(debug) \
+    if(LOG_DEBUG_COMPILED && (debug)) \
     { \
-        printf("DEBUG: " ); \
-        printf(msg, ##__VA_ARGS__); \
-        printf("\n"); \
+        log_message(LOG_LEVEL_DEBUG, msg, ##__VA_ARGS__); \
     }
 
 #define PRINT_INFO(msg, ...) \
-        printf("INFO : " ); \
-        printf(msg, ##__VA_ARGS__); \
-        printf("\n"); 
+    { \
+        log_message(LOG_LEVEL_INFO, msg, ##__VA_ARGS__); \
+    }
 
 #define PRINT_ERROR_DEBUG(debug, msg, ...) \
-    if(debug) \
+    if(LOG_DEBUG_COMPILED && (debug)) \
     { \
-        fprintf(stderr, "ERROR: "); \
-        fprintf(stderr, msg, ##__VA_ARGS__); \
-        fprintf(stderr, "\n"); \
+        log_message(LOG_LEVEL_ERROR, msg, ##__VA_ARGS__); \
     }
 
 #define PRINT_WARN_DEBUG(debug, msg, ...) \
-    if(debug) \
+    if(LOG_DEBUG_COMPILED && (debug)) \
     { \
-        printf("WARN : " ); \
-        printf(msg, ##__VA_ARGS__); \
-        printf("\n"); \
+        log_message(LOG_LEVEL_WARN, msg, ##__VA_ARGS__); \
     }
 
 #define PRINT_ERROR(msg, ...) \
-        fprintf(stderr, "ERROR: " ); \
-        fprintf(stderr, msg, ##__VA_ARGS__); \
-        fprintf(stderr, "\n");
+    { \
+        log_message(LOG_LEVEL_ERROR, msg, ##__VA_ARGS__); \
+    }
 
 extern int debug;
 
@@ -0,0 +1,67 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: event_loop.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __EVENT_LOOP_H_
+#define __EVENT_LOOP_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+
+#define EVENT_LOOP_OK                   0
+#define EVENT_LOOP_ERROR               -1
+
+#define EVENT_LOOP_MAX_EVENTS           64
+
+struct event_source;
+typedef void (*event_handler_t)(struct event_source* source, uint32_t events);
+typedef void (*event_release_t)(struct event_source* source);
+
+/* A file descriptor watched by the event loop. It is usually embedded in a bigger structure */
+typedef struct event_source
+{
+    int fd;                             // -1 once the source is closed
+    event_handler_t handler;
+    event_release_t release;            // called once no pending event can refer to the source anymore
+    struct event_source* next_released;
+} event_source_t;
+
+typedef struct event_loop
+{
+    int epoll_fd;
+    int running;
+    event_source_t* released;           // closed sources waiting for the end of the current batch of events
+} event_loop_t;
+
+int init_event_loop(event_loop_t* loop);
+void cleanup_event_loop(event_loop_t* loop);
+int event_loop_add(event_loop_t* loop, event_source_t* source, uint32_t events);
+int event_loop_modify(event_loop_t* loop, event_source_t* source, uint32_t events);
+void event_loop_close(event_loop_t* loop, event_source_t* source);
+int run_event_loop(event_loop_t* loop);
+
+#endif /* __EVENT_LOOP_H_ */
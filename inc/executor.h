@@ -0,0 +1,111 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: executor.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __EXECUTOR_H_
+#define __EXECUTOR_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/types.h>
+
+#include "event_loop.h"
+#include "run_script.h"
+#include "cert_utils.h"
+#include "bash_pool.h"
+#include "server.h"
+#include "output_sink.h"
+
+#define EXECUTOR_OK                     0
+#define EXECUTOR_ERROR                 -1
+
+#define EXECUTOR_DEFAULT_MAX_CHILDREN   4
+#define EXECUTOR_MAX_READS_PER_EVENT    16
+#define EXECUTOR_MAX_SPARE_JOBS         64  // retired jobs kept with their buffer for the next scripts
+
+struct script_job;
+struct executor;
+
+/* Called once the job is retired, in submission order. Without it the output of the script is printed */
+typedef void (*job_done_t)(struct script_job* job, void* ctx);
+
+/* One of the file descriptors of a running job watched by the event loop */
+typedef struct job_channel
+{
+    event_source_t source;
+    struct script_job* job;
+} job_channel_t;
+
+typedef struct script_job
+{
+    job_channel_t input;                // stdin of bash, the script is written to it
+    job_channel_t output;               // stdout and stderr of bash
+    job_channel_t process;              // pidfd of bash, readable once bash exited
+    struct executor* executor;
+    long id;
+    int verdict;                        // the script is only executed if it is VERIFY_SIGNATURE_VALID
+    char signer[MAX_CERT_NAME_SIZE];    // name of the certificate that validated the script
+    char* script;                       // points into buffer or mapped
+    size_t script_size;
+    char* buffer;                       // the file was received in it, kept when the job is recycled
+    size_t buffer_size;
+    char* mapped;                       // mapping of a sealed file that script points into, instead of buffer
+    size_t mapped_size;
+    size_t written;
+    pid_t pid;
+    int exited;
+    int done;
+    int refs;                           // the executor and every channel still known by the event loop
+    struct timespec start;
+    script_result_t result;
+    job_done_t on_done;
+    void* ctx;
+    struct script_job* next;            // next job in submission order
+    struct script_job* next_waiting;    // next job waiting for a free child slot
+    struct script_job* next_spare;
+} script_job_t;
+
+typedef struct executor
+{
+    event_loop_t* loop;
+    int max_children;
+    bash_pool_t* pool;                  // interpreters started in advance, may be NULL
+    int running;
+    script_job_t* head;                 // oldest job not retired yet
+    script_job_t* tail;
+    script_job_t* waiting_head;
+    script_job_t* waiting_tail;
+    script_job_t* spare_jobs;           // retired jobs, reused by reserve_script
+    int num_spare_jobs;
+    int stopped;                        // cleanup_executor was called, the jobs released later are freed
+} executor_t;
+
+int init_executor(executor_t* executor, event_loop_t* loop, int max_children, bash_pool_t* pool);
+void cleanup_executor(executor_t* executor);
+script_job_t* reserve_script(executor_t* executor, long id, int sink, job_done_t on_done, void* ctx);
+void resume_script(script_job_t* job, signed_script_t* signed_script, int verdict, const char* signer);
+
+#endif /* __EXECUTOR_H_ */
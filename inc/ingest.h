@@ -0,0 +1,63 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: ingest.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __INGEST_H_
+#define __INGEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "server.h"
+
+#define INGEST_OK                       0
+#define INGEST_ERROR                   -1
+#define INGEST_TOO_LARGE               -2
+#define INGEST_EMPTY                   -3
+#define INGEST_REJECTED                -4  // a chunk of a v2 script does not match its hash
+
+#define INGEST_INITIAL_BUFFER_SIZE      16384
+#define INGEST_MIN_READ_SIZE            4096
+
+/* A passed file is mapped in place only if its content and size cannot change any more */
+#define INGEST_REQUIRED_SEALS           (F_SEAL_WRITE | F_SEAL_SHRINK | F_SEAL_GROW)
+#define INGEST_MAX_MAPPED_SIZE          (1024L * 1024 * 1024) // largest sealed file, -m does not apply to them
+
+/* Largest script accepted by the server, set with -m */
+extern size_t max_script_size;
+
+int init_ingest(signed_script_t* signed_script);
+void cleanup_ingest(signed_script_t* signed_script);
+void begin_ingest(signed_script_t* signed_script);
+char* ingest_reserve(signed_script_t* signed_script, size_t* available);
+int ingest_append(signed_script_t* signed_script, size_t size);
+int ingest_file(signed_script_t* signed_script, int fd);
+int end_ingest(signed_script_t* signed_script);
+char* detach_ingest_mapping(signed_script_t* signed_script, size_t* mapped_size);
+char* detach_ingest_buffer(signed_script_t* signed_script, char* spare, size_t spare_size, size_t* buffer_size);
+int complete_ingest(signed_script_t* signed_script, int ingest_ret);
+int parse_signed_script(signed_script_t* signed_script, size_t file_size);
+
+#endif /* __INGEST_H_ */
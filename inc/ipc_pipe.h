@@ -31,6 +31,7 @@
 
 #define READ_PIPE_OK                    0
 #define READ_PIPE_ERROR                -1
+#define READ_PIPE_EMPTY                -2
 
 #define READ_PIPE_INIT_OK               0
 #define READ_PIPE_INIT_ERROR           -1
@@ -38,7 +39,7 @@
 #define SERVER_PIPE_PATH            "./fifo"
 
 
-int init_pipe(signed_script_t* signed_script);
-int read_from_pipe(signed_script_t* signed_script);
+int init_pipe(signed_script_t* signed_script, const char* pipe_path);
+int read_from_pipe(signed_script_t* signed_script, const char* pipe_path);
 
 #endif /* __IPC_PIPE_H_ */
@@ -0,0 +1,153 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: ipc_socket.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __IPC_SOCKET_H_
+#define __IPC_SOCKET_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "event_loop.h"
+#include "run_script.h"
+#include "server.h"
+
+#define SOCKET_OK                       0
+#define SOCKET_ERROR                   -1
+#define SOCKET_AGAIN                   -2  // the client has to make room before the rest can be sent
+#define SOCKET_BUSY                    -3  // the handler cannot take the request yet, see resume_socket_server
+
+#define SOCKET_BACKLOG                  64
+#define SOCKET_REPLY_CHUNK_SIZE         65536
+#define SOCKET_MAX_QUEUED_REPLIES       64  // a connection is not read while that many replies wait for its client
+#define SOCKET_MAX_SPARE_REQUESTS       64  // answered requests kept by a connection for its next requests
+
+/*
+ * Protocol over a SOCK_STREAM unix domain socket. All integers are in network byte order.
+ *
+ * A client sends any number of requests on its connection, without waiting for the replies:
+ *     uint32 length | length bytes of a signed script (same format as for the fifo)
+ * or, to pass the signed script as a file instead of its bytes:
+ *     uint32 SOCKET_FRAME_PASSED_FD, sent with the file descriptor of a regular file in SCM_RIGHTS
+ * A memfd sealed with F_SEAL_WRITE, F_SEAL_SHRINK and F_SEAL_GROW is mapped, verified and executed in place,
+ * without the -m limit. Any other file is copied when it is received.
+ *
+ * Every request gets its replies on the same connection, in order. A reply is made of frames:
+ *     uint32 type | uint32 request | uint32 length | length bytes of payload
+ * where request numbers the requests of the connection starting from 1.
+ *     SOCKET_REPLY_OUTPUT : a chunk of the output of the script (zero or more frames)
+ *     SOCKET_REPLY_RESULT : the last frame of the reply, its payload is
+ *                           int32 verdict (VERIFY_SIGNATURE_*) | int32 exit status (-1 if not executed) |
+ *                           name of the certificate that validated the script (possibly empty)
+ */
+#define SOCKET_REPLY_OUTPUT             1
+#define SOCKET_REPLY_RESULT             2
+
+#define SOCKET_FRAME_HEADER_SIZE        4
+#define SOCKET_FRAME_PASSED_FD          0xFFFFFFFFu
+#define SOCKET_MAX_PASSED_FDS           4       // more file descriptors passed with one header are closed
+#define SOCKET_REPLY_HEADER_SIZE        12
+
+struct socket_request;
+
+/* Verify and execute one request. The handler answers it later, exactly once, with socket_reply.
+   signed_script is NULL if the request could not be parsed, it still has to be answered in order.
+   Returns SOCKET_OK once it took the request, or SOCKET_BUSY to have the connection hold it and stop
+   reading until resume_socket_server */
+typedef int (*request_handler_t)(signed_script_t* signed_script, struct socket_request* request, void* ctx);
+
+struct socket_connection;
+
+typedef struct socket_server
+{
+    event_source_t source;
+    event_loop_t* loop;
+    char path[MAX_FILEPATH_CHARS_SIZE + 1];
+    request_handler_t on_request;
+    void* ctx;
+    int num_connections;
+    struct socket_connection* connections;  // every connection not freed yet, closed by cleanup_socket_server
+    struct socket_connection* held_head;    // connections holding a request, in the order they were held
+    struct socket_connection* held_tail;
+} socket_server_t;
+
+/* A reply waiting for the client to read it. Its frames are sent as the socket makes room for them */
+typedef struct queued_reply
+{
+    struct queued_reply* next;
+    uint32_t request;
+    int output_fd;                      // sink holding the output of the script, -1 if there is none
+    size_t output_size;
+    size_t output_sent;                 // bytes of the output already sent
+    size_t chunk_remaining;             // bytes of the current output frame still to be sent
+    unsigned char header[SOCKET_REPLY_HEADER_SIZE];
+    size_t header_sent;                 // bytes of the header of the current output frame already sent
+    unsigned char result[SOCKET_REPLY_HEADER_SIZE + 8 + MAX_CERT_NAME_SIZE];
+    size_t result_size;
+    size_t result_sent;
+} queued_reply_t;
+
+typedef struct socket_connection
+{
+    event_source_t source;
+    socket_server_t* server;
+    unsigned char header[SOCKET_FRAME_HEADER_SIZE];
+    size_t header_received;
+    size_t frame_remaining;             // bytes of the current request still to be received
+    uint32_t request;                   // number of the current request on this connection
+    int ingest_ret;
+    int passed_fd;                      // file descriptor passed with the current header, -1 if none
+    signed_script_t signed_script;
+    int pending;                        // requests not answered yet, they keep the connection allocated
+    int released;                       // the connection is closed and waits for its pending requests
+    queued_reply_t* replies_head;       // replies not read by the client yet, in order
+    queued_reply_t* replies_tail;
+    int num_replies;
+    uint32_t events;                    // events the connection is watched for
+    struct socket_request* held;        // received request the handler could not take yet, nothing is read meanwhile
+    struct socket_connection* next_held;
+    struct socket_request* spare_requests;  // answered requests whose reply is sent, reused for the next ones
+    int num_spare_requests;
+    struct socket_connection* prev;     // in the connections of the server
+    struct socket_connection* next;
+} socket_connection_t;
+
+/* A received request waiting for its reply. Once answered it holds its reply until the client read it */
+typedef struct socket_request
+{
+    queued_reply_t reply;               // first, a queued reply is the request it answers
+    socket_connection_t* conn;
+    uint32_t request;
+    long id;                            // number of the script, its trace ID
+    struct socket_request* next_spare;
+} socket_request_t;
+
+int init_socket_server(socket_server_t* server, event_loop_t* loop, const char* path, request_handler_t on_request, void* ctx);
+void resume_socket_server(socket_server_t* server);
+void cleanup_socket_server(socket_server_t* server);
+void socket_reply(socket_request_t* request, int verdict, const char* signer, script_result_t* result);
+
+#endif /* __IPC_SOCKET_H_ */
@@ -0,0 +1,74 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: listener.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __LISTENER_H_
+#define __LISTENER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "cert_utils.h"
+#include "event_loop.h"
+#include "server.h"
+
+#define LISTENER_OK                     0
+#define LISTENER_ERROR                 -1
+#define LISTENER_BUSY                  -2  // the handler cannot take the script yet, see resume_fifo_listener
+
+#define LISTENER_MAX_READS_PER_EVENT    16  // bound the work done for one fifo before serving the others
+
+/* Called for every complete and parsed script. Returns LISTENER_OK once it took the script, or LISTENER_BUSY to
+   have the fifo hold it until resume_fifo_listener */
+typedef int (*script_handler_t)(signed_script_t* signed_script, void* ctx);
+
+struct listener;
+
+/* One named pipe of the fifo directory, e.g. one per tenant */
+typedef struct fifo_source
+{
+    event_source_t source;
+    char path[MAX_FILEPATH_CHARS_SIZE + 1];
+    signed_script_t signed_script;      // the script being received on this fifo
+    int ingest_ret;                     // status of the script being received
+    int held;                           // the parsed script waits for the handler, the fifo stays closed meanwhile
+    struct listener* listener;
+} fifo_source_t;
+
+typedef struct listener
+{
+    event_loop_t* loop;
+    fifo_source_t* fifos;
+    int num_fifos;
+    script_handler_t on_script;
+    void* ctx;
+    int next_resumed;                   // fifo whose held script is offered first by the next resume
+} listener_t;
+
+int init_fifo_listener(listener_t* listener, event_loop_t* loop, const char* fifo_dir, script_handler_t on_script, void* ctx);
+void resume_fifo_listener(listener_t* listener);
+void cleanup_listener(listener_t* listener);
+
+#endif /* __LISTENER_H_ */
@@ -0,0 +1,105 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: logger.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __LOGGER_H_
+#define __LOGGER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#define LOGGER_OK                       0
+#define LOGGER_ERROR                   -1
+
+#define LOG_LEVEL_DEBUG                 0
+#define LOG_LEVEL_INFO                  1
+#define LOG_LEVEL_WARN                  2
+#define LOG_LEVEL_ERROR                 3
+
+/* What a thread logging a message does when the ring buffer is full */
+#define LOG_POLICY_BLOCK                0   // wait for the writer thread to make room
+#define LOG_POLICY_DROP                 1   // drop the message, the writer reports how many were dropped
+
+#define LOG_DEFAULT_CAPACITY            4096    // records, a power of two
+#define LOG_INLINE_SIZE                 240     // longer texts are copied to the heap
+
+/* Debug messages are compiled out of release builds (make RELEASE=1) */
+#ifdef LOG_RELEASE
+#define LOG_DEBUG_COMPILED              0
+#else
+#define LOG_DEBUG_COMPILED              1
+#endif
+
+/* One message. Its text is a head and a tail whose lines are each prefixed with the time, the request and
+   the level, around raw bytes written as they are (e.g. the output of a script) */
+typedef struct log_record
+{
+    uint64_t time_ns;           // CLOCK_REALTIME when the message was logged
+    long request_id;            // number of the script being handled, 0 if none
+    int level;
+    char* heap_text;            // the text when it does not fit in inline_text, freed by the writer
+    size_t head_size;
+    size_t raw_size;
+    int raw_fd;                 // the raw bytes are in this file from offset 0 instead of the text, closed by the writer
+    size_t tail_size;
+    char inline_text[LOG_INLINE_SIZE];
+} log_record_t;
+
+/* A slot of the ring buffer. Its sequence tells whether it is free or holds a record for the writer */
+typedef struct log_slot
+{
+    size_t sequence;
+    log_record_t record;
+} log_slot_t;
+
+/* Bounded multi-producer single-consumer ring buffer, after the queue of Dmitry Vyukov */
+typedef struct logger
+{
+    log_slot_t* slots;
+    size_t mask;                                // capacity - 1
+    int policy;
+    size_t enqueue_pos __attribute__((aligned(64)));
+    size_t dequeue_pos __attribute__((aligned(64)));
+    long dropped __attribute__((aligned(64)));
+    long dropped_reported;
+    int sleeping;                               // the writer waits on wakeup
+    int stopping;
+    int running;
+    pthread_mutex_t lock;
+    pthread_cond_t wakeup;
+    pthread_t thread;
+} logger_t;
+
+int start_logger(size_t capacity, int policy);
+void stop_logger(void);
+void log_message(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void log_block(int level, const char* head, const char* data, size_t size, const char* tail);
+void log_file_block(int level, const char* head, int fd, size_t size, const char* tail);
+void set_log_request(long request_id);
+int parse_log_policy(const char* name);
+
+#endif /* __LOGGER_H_ */
@@ -0,0 +1,54 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: merkle.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __MERKLE_H_
+#define __MERKLE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#define MERKLE_OK                       0
+#define MERKLE_ERROR                   -1
+#define MERKLE_MISMATCH                -2
+
+/* The leaves and the inner nodes are hashed with different prefixes, so that one cannot pass for the other */
+#define MERKLE_LEAF_PREFIX              0x00
+#define MERKLE_NODE_PREFIX              0x01
+
+#define MERKLE_MAX_THREADS              64
+#define MERKLE_CHUNKS_PER_THREAD        8   // smaller scripts are checked by fewer threads
+
+size_t merkle_num_chunks(size_t size, size_t chunk_size);
+int merkle_leaf_init(EVP_MD_CTX* md_ctx);
+int merkle_leaf(EVP_MD_CTX* md_ctx, const char* chunk, size_t chunk_size, unsigned char* leaf);
+int merkle_root(EVP_MD_CTX* md_ctx, unsigned char* leaves, size_t num_leaves, unsigned char* root);
+int start_merkle_pool(void);
+void stop_merkle_pool(void);
+int check_merkle_chunks(const char* data, size_t size, size_t chunk_size, const unsigned char* leaves, size_t* bad_chunk);
+
+#endif /* __MERKLE_H_ */
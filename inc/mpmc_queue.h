@@ -0,0 +1,61 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: mpmc_queue.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __MPMC_QUEUE_H_
+#define __MPMC_QUEUE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MPMC_QUEUE_OK                   0
+#define MPMC_QUEUE_ERROR               -1
+#define MPMC_QUEUE_FULL                -2
+#define MPMC_QUEUE_EMPTY               -3
+
+/* A slot of the ring. Its sequence says whose turn it is: the producer of position pos fills it when
+   sequence == pos, the consumer of position pos empties it when sequence == pos + 1 */
+typedef struct mpmc_cell
+{
+    size_t sequence;
+    void* item;
+} mpmc_cell_t;
+
+/* Bounded lock-free queue for any number of producers and consumers (D. Vyukov's ring). Producers and
+   consumers only contend on their own position, each on its own cache line */
+typedef struct mpmc_queue
+{
+    mpmc_cell_t* cells;
+    size_t mask;                                        // capacity - 1, the capacity is a power of two
+    size_t enqueue_pos __attribute__((aligned(64)));
+    size_t dequeue_pos __attribute__((aligned(64)));
+} mpmc_queue_t;
+
+int init_mpmc_queue(mpmc_queue_t* queue, size_t capacity);
+void free_mpmc_queue(mpmc_queue_t* queue);
+int mpmc_push(mpmc_queue_t* queue, void* item);
+int mpmc_pop(mpmc_queue_t* queue, void** item);
+
+#endif /* __MPMC_QUEUE_H_ */
@@ -0,0 +1,82 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: output_sink.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __OUTPUT_SINK_H_
+#define __OUTPUT_SINK_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "server.h"
+
+#define OUTPUT_SINK_OK                  0
+#define OUTPUT_SINK_ERROR              -1
+#define OUTPUT_SINK_AGAIN              -2  // nothing to read from the pipe for now
+#define OUTPUT_SINK_END                -3  // the script closed its output
+#define OUTPUT_SINK_LIMIT              -4  // the limit is reached and the script has to be killed
+
+/* Where the output of a script goes */
+#define OUTPUT_SINK_LOG                 0   // the log of the server
+#define OUTPUT_SINK_FILE                1   // a file of the output directory named after the number of the script
+#define OUTPUT_SINK_CLIENT              2   // the connection of the socket client that sent the script
+
+/* What happens to a script whose output reaches the limit */
+#define OUTPUT_LIMIT_TRUNCATE           0   // the rest of the output is discarded
+#define OUTPUT_LIMIT_KILL               1   // the script is killed
+
+#define OUTPUT_DEFAULT_LIMIT            (64L * 1024 * 1024)
+#define OUTPUT_SPLICE_SIZE              (1024 * 1024)   // most bytes moved by one splice
+#define OUTPUT_COPY_BUFFER_SIZE         16384           // when the kernel cannot splice between the files
+#define OUTPUT_FILE_FORMAT              "%s/script.%ld.out"
+#define OUTPUT_PATH_SIZE                (MAX_FILEPATH_CHARS_SIZE + 32)  // the output directory and the file name
+
+/* The output of one script. It is moved from the pipe of bash to fd inside the kernel with splice, fd is a memfd
+   that keeps the output until it can be printed or sent in order, or the output file itself */
+typedef struct output_sink
+{
+    int type;
+    int fd;                                     // -1 until the sink is opened
+    size_t size;                                // bytes kept in fd
+    size_t discarded;                           // bytes written by the script beyond the limit
+    int limited;                                // the output reached the limit
+    char path[OUTPUT_PATH_SIZE];                // file of an OUTPUT_SINK_FILE sink
+} output_sink_t;
+
+/* Set with --output, --output-dir, --output-limit and --output-limit-policy */
+extern int output_sink_type;                    // for the scripts received on named pipes
+extern char output_dir[MAX_FILEPATH_CHARS_SIZE + 1];
+extern size_t output_limit;
+extern int output_limit_policy;
+
+void init_output_sink(output_sink_t* sink, int type);
+int open_output_sink(output_sink_t* sink, long id);
+int drain_output(output_sink_t* sink, int pipe_fd);
+void close_output_sink(output_sink_t* sink);
+int parse_output_sink(const char* name);
+int parse_output_limit_policy(const char* name);
+
+#endif /* __OUTPUT_SINK_H_ */
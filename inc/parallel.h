@@ -0,0 +1,62 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: parallel.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __PARALLEL_H_
+#define __PARALLEL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#define PARALLEL_OK                     0
+#define PARALLEL_ERROR                 -1
+
+/* Run by every thread taking part in a job. The threads share the work through arg, usually by taking the
+   next item from an atomic index, and return once there is none left */
+typedef void (*parallel_task_t)(void* arg);
+
+/* Long-lived threads that help the caller of run_parallel with one job at a time */
+typedef struct parallel_pool
+{
+    pthread_t* threads;
+    int num_threads;
+    pthread_mutex_t busy;               // held by the caller whose job the threads run
+    pthread_mutex_t mutex;
+    pthread_cond_t job_ready;
+    pthread_cond_t job_done;
+    parallel_task_t task;
+    void* arg;
+    unsigned long job;                  // number of the current job, a thread takes part in it once
+    int num_wanted;                     // threads that may still join the current job
+    int num_running;                    // threads running the task of the current job
+    int stop;
+} parallel_pool_t;
+
+int init_parallel_pool(parallel_pool_t* pool, int num_threads);
+int run_parallel(parallel_pool_t* pool, int num_threads, parallel_task_t task, void* arg);
+void cleanup_parallel_pool(parallel_pool_t* pool);
+
+#endif /* __PARALLEL_H_ */
@@ -29,16 +29,37 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/types.h>
 
 #include "server.h"
+#include "output_sink.h"
 
 #define EXECUTING_SCRIPT_OK                  0
 #define EXECUTING_SCRIPT_FAILED              -1
-#define SCRIPT_OUTPUT_BUFFER_SIZE           256
 
-#define BASH_OUTPUT_FILE            "/tmp/server_script_output.txt"
-#define BASH_COMMAND                "/bin/bash > " BASH_OUTPUT_FILE
+#define BASH_PATH                   "/bin/bash"
 
-int run_script(signed_script_t* signed_script);
+/* Outcome of an executed script. The output sink holds what the script wrote to stdout and stderr */
+typedef struct script_result
+{
+    int exit_status;        // exit status of bash, or -1 if the script was not executed or was killed
+    int term_signal;        // signal that killed bash, or 0
+    output_sink_t output;
+    long wall_time_us;      // from the spawn of bash until it was reaped
+    long user_time_us;      // CPU time of bash and of the commands it waited for
+    long system_time_us;
+} script_result_t;
+
+struct bash_pool;
+
+int run_script(signed_script_t* signed_script, struct bash_pool* pool, script_result_t* result);
+pid_t spawn_bash(int* stdin_fd, int* output_fd, char* const envp[]);
+void finish_script_result(script_result_t* result, long id, int status, const struct timespec* start, const struct rusage* usage);
+void print_script_output(long id, const script_result_t* result);
+void print_script_exit(long id, const script_result_t* result);
+void init_script_result(script_result_t* result, int sink);
+void free_script_result(script_result_t* result);
 
 #endif /* __RUN_SCRIPT_H_ */
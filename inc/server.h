@@ -29,6 +29,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+
+#include <openssl/sha.h>
+#include <openssl/evp.h>
 
 #include "cert_utils.h"
 
@@ -37,8 +41,25 @@
 
 #define MIN_SIGNATURE_SIZE                  32
 #define MAX_SIGNATURE_SIZE                  4096
-#define MAX_SCRIPT_SIZE                     8192
-#define MAX_FILE_SIZE                       (MAX_SIGNATURE_SIZE + MAX_SCRIPT_SIZE + 1)
+#define MAX_DECODED_SIGNATURE_SIZE          (MAX_SIGNATURE_SIZE / 4 * 3)
+#define MAX_KEY_ID_HINT_SIZE                (2 * MAX_KEY_ID_SIZE + 1) // hex key identifier followed by ':'
+#define MAX_HEADER_SIZE                     (MAX_KEY_ID_HINT_SIZE + MAX_SIGNATURE_SIZE)
+#define MAX_SCRIPT_SIZE                     (4 * 1024 * 1024) // default, can be changed with -m
+
+#define KEY_ID_HINT_SEPARATOR               ':'
+
+/* Signed script formats. A v1 signature covers the sha256 of the script. A v2 file starts its signature line with
+   "SVS2 <chunk size> ", the next line holds the base64 sha256 of every chunk of the script (the leaves of a Merkle
+   tree) and the signature covers the v2 signed message: magic, chunk size, script size and Merkle root */
+#define SIGNED_SCRIPT_V1                    1
+#define SIGNED_SCRIPT_V2                    2
+#define SIGNED_SCRIPT_V2_MAGIC              "SVS2"
+#define SIGNED_SCRIPT_V2_PREFIX             SIGNED_SCRIPT_V2_MAGIC " "
+#define SIGNED_SCRIPT_V2_MAX_PREFIX_SIZE    (sizeof(SIGNED_SCRIPT_V2_PREFIX) - 1 + 8) // with the chunk size and its space
+#define SIGNED_MESSAGE_V2_SIZE              (4 + 4 + 8 + SHA256_DIGEST_LENGTH)
+#define MIN_CHUNK_SIZE                      4096
+#define MAX_CHUNK_SIZE                      (1024 * 1024) // the chunk size is a power of two between these
+#define MAX_SIGNATURE_LINE_SIZE             (SIGNED_SCRIPT_V2_MAX_PREFIX_SIZE + MAX_HEADER_SIZE)
 
 #define VERIFY_SIGNATURE_VALID               0
 #define VERIFY_SIGNATURE_ERROR              -1
@@ -55,9 +76,33 @@ typedef struct signed_script
 {
     size_t signature_size;
     size_t script_size;
+    char* buffer; // the received file, signature and script point inside it
+    char* mapped; // read only mapping of a sealed file passed by the client, used instead of buffer if not NULL
+    size_t mapped_size;
+    size_t buffer_size; // allocated size of buffer, it grows with the received files
+    size_t received_size; // bytes of the file received so far
+    size_t script_offset; // offset of the script in buffer, zero until the signature line is received
+    size_t signature_line_size; // size of the signature line with its newline in buffer, zero until it is received
+    EVP_MD_CTX* digest_ctx; // sha256 of the script, updated as the script is received
     char* signature;
+    unsigned char decoded_signature[MAX_DECODED_SIGNATURE_SIZE]; // decoded while the signature line is parsed
+    int decoded_signature_size;
     char* script;
     int  valid; // for redundent check
+    long int id; // number of the script as received by the server
+    unsigned char key_id[MAX_KEY_ID_SIZE]; // optional identifier of the signing certificate
+    size_t key_id_size; // zero if the script does not carry a key identifier
+    cert_container_t* signer; // certificate that validated the signature
+    unsigned char script_digest[SHA256_DIGEST_LENGTH]; // sha256 of the script
+    int script_digest_ready; // script_digest is computed at most once per script
+    int format; // SIGNED_SCRIPT_V1 or SIGNED_SCRIPT_V2
+    size_t chunk_size; // v2: size of the chunks of the script, the last one may be shorter
+    unsigned char* chunk_hashes; // v2: hash of every chunk as listed in the file, checked as the chunks arrive
+    size_t chunk_hashes_size; // allocated size of chunk_hashes, it is reused by the next files
+    size_t num_chunks; // v2: number of hashes in chunk_hashes, zero until they are parsed
+    size_t chunks_checked; // v2: chunks received so far, all of them match their hash
+    unsigned char signed_message[SIGNED_MESSAGE_V2_SIZE]; // v2: what the signature covers, script_digest is its sha256
+    uint64_t ingest_start; // when the first byte of the file was received, see stats_now
 } signed_script_t;
 
 extern long int counter;
@@ -0,0 +1,113 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: stats.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __STATS_H_
+#define __STATS_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define STATS_OK                        0
+#define STATS_ERROR                    -1
+
+/* Latency histograms, one per stage of the handling of a script. The values are in nanoseconds */
+#define STATS_INGEST                    0   // from the first received byte until the script is parsed
+#define STATS_DECODE                    1   // base64 decoding of the signature
+#define STATS_VERIFY_QUEUE              2   // waiting in the queue of the verifier threads
+#define STATS_VERIFY_ATTEMPT            3   // verification of the signature with one certificate
+#define STATS_VERIFY                    4   // whole verification, including the cache lookup
+#define STATS_SPAWN                     5   // getting a bash interpreter, from the pool or spawned
+#define STATS_EXECUTE                   6   // from the start of bash until it is reaped
+#define STATS_OUTPUT                    7   // printing the output of the script or sending it to the client
+#define STATS_NUM_STAGES                8
+
+/* Position in the certificate list of the certificate that validated a signature, 0 is the first */
+#define STATS_CERT_POSITION             STATS_NUM_STAGES
+/* Scripts already waiting for a verifier thread when one more is queued */
+#define STATS_VERIFY_QUEUE_DEPTH        (STATS_NUM_STAGES + 1)
+#define STATS_NUM_HISTOGRAMS            (STATS_NUM_STAGES + 2)
+
+/* Counters */
+#define STATS_SCRIPTS_RECEIVED          0
+#define STATS_BYTES_INGESTED            1
+#define STATS_INGEST_ERRORS             2
+#define STATS_VERDICT_VALID             3
+#define STATS_VERDICT_INVALID           4
+#define STATS_VERDICT_ERROR             5
+#define STATS_KEY_ID_LOOKUPS            6   // verifications that tried only the certificate named by the script
+#define STATS_EXECUTION_FAILURES        7
+#define STATS_OUTPUT_BYTES              8
+#define STATS_VERIFY_STALLS             9   // times a source held its script because the verifier threads were all busy
+#define STATS_VERIFY_STEALS             10  // scripts a verifier thread took from the queue of another one
+#define STATS_OUTPUT_LIMITED            11  // scripts whose output reached the limit, truncated or killed
+#define STATS_CACHE_HITS                12  // verification cache of valid verdicts
+#define STATS_NEGATIVE_CACHE_HITS       13  // verification cache of invalid verdicts
+#define STATS_CACHE_MISSES              14
+#define STATS_NEGATIVE_CACHE_MISSES     15
+#define STATS_CACHE_EVICTIONS           16
+#define STATS_NEGATIVE_CACHE_EVICTIONS  17
+#define STATS_POOL_WARM_HITS            18  // scripts given to an idle interpreter of the pool
+#define STATS_POOL_COLD_SPAWNS          19  // scripts that waited for bash to be spawned although the pool is enabled
+#define STATS_POOL_DISCARDED            20  // idle interpreters found dead when taken
+#define STATS_NUM_COUNTERS              21
+
+#define STATS_FORMAT_PROMETHEUS         0
+#define STATS_FORMAT_JSON               1
+
+/* Log-linear buckets as in HDR histograms: every power of two is split in 2^STATS_SUB_BUCKET_BITS
+   buckets, so a percentile is known within 12.5% whatever its magnitude */
+#define STATS_SUB_BUCKET_BITS           3
+#define STATS_SUB_BUCKETS               (1 << STATS_SUB_BUCKET_BITS)
+#define STATS_NUM_BUCKETS               ((64 - STATS_SUB_BUCKET_BITS + 1) * STATS_SUB_BUCKETS)
+
+typedef struct stats_histogram
+{
+    uint64_t buckets[STATS_NUM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+} stats_histogram_t;
+
+/* The statistics recorded by one thread. Only that thread writes them, the dumps add up all the shards */
+typedef struct stats_shard
+{
+    stats_histogram_t histograms[STATS_NUM_HISTOGRAMS];
+    uint64_t counters[STATS_NUM_COUNTERS];
+    struct stats_shard* next;
+} stats_shard_t;
+
+uint64_t stats_now(void);
+const char* stats_stage_name(int stage);
+void stats_record(int histogram, uint64_t value);
+void stats_record_since(int stage, uint64_t start);
+void stats_count(int counter, uint64_t value);
+int stats_dump(FILE* stream, int format);
+int parse_stats_format(const char* name);
+void block_stats_signal(void);
+int start_stats_reporter(const char* fifo_path, int format);
+
+#endif /* __STATS_H_ */
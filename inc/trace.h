@@ -0,0 +1,48 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: trace.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define TRACE_OK                        0
+#define TRACE_ERROR                    -1
+
+#define TRACE_DEFAULT_SAMPLE_RATE       1.0
+#define TRACE_EVENT_SIZE                1024    // longest event, a certificate name is at most MAX_CERT_NAME_SIZE
+
+/* Spans of the stages of the sampled scripts, written as Chrome trace events (JSON array format). The number of a
+   script is its trace ID, the row of its spans in the timeline */
+
+int start_trace(const char* path, double sample_rate);
+int trace_sampled(long id);
+void trace_begin(long id);
+void trace_span(long id, int stage, uint64_t start, const char* arg_name, const char* arg_value);
+
+#endif /* __TRACE_H_ */
@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <openssl/err.h>
+#include <openssl/evp.h>
 
 #include "cert_utils.h"
 #include "server.h"
@@ -38,7 +39,23 @@
 #define VERIFY_SIGNATURE_ERROR              -1
 #define VERIFY_SIGNATURE_INVALID            -2
 
-int verify_signature(cert_container_t* certs, signed_script_t* signed_script);
-int decode_signature(unsigned char* decoded_signature, const char* signature, size_t signature_size);
+#define VERIFY_CTX_OK                        0
+#define VERIFY_CTX_ERROR                    -1
+
+/* The state verify_signature needs, set up once per thread and reused by every request. Once the certificates
+   in use have their context, a verification does not allocate anything itself */
+typedef struct verify_ctx
+{
+    EVP_MD_CTX* md_ctx;                                 // SHA-256 of the scripts and of the cache keys
+    EVP_MD_CTX* eddsa_ctx;                              // reset for every pure EdDSA verification
+    EVP_PKEY_CTX** pkey_ctxs;                           // by certificate index, duplicated from its template on first use
+    int num_pkey_ctxs;
+    unsigned long store_generation;                     // store the contexts were duplicated from
+} verify_ctx_t;
+
+int init_verify_ctx(verify_ctx_t* ctx);
+void cleanup_verify_ctx(verify_ctx_t* ctx);
+int verify_signature(verify_ctx_t* ctx, cert_store_t* store, signed_script_t* signed_script);
+int compute_script_digest(verify_ctx_t* ctx, signed_script_t* signed_script);
 
 #endif /* __VERIFY_H_ */
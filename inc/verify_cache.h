@@ -0,0 +1,88 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: verify_cache.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __VERIFY_CACHE_H_
+#define __VERIFY_CACHE_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <openssl/sha.h>
+
+#include "cert_utils.h"
+#include "server.h"
+#include "verify.h"
+
+#define VERIFY_CACHE_INIT_OK                 0
+#define VERIFY_CACHE_INIT_ERROR             -1
+
+#define VERIFY_CACHE_DEFAULT_CAPACITY       1024
+#define VERIFY_CACHE_NEGATIVE_RATIO         4     // default negative capacity is capacity / ratio
+#define VERIFY_CACHE_KEY_SIZE               (2 * SHA256_DIGEST_LENGTH)
+
+typedef struct verify_cache_entry
+{
+    unsigned char key[VERIFY_CACHE_KEY_SIZE]; // sha256(script) followed by sha256(signature line)
+    int verdict;
+    cert_container_t* cert;                   // certificate that validated the script, NULL for invalid verdicts
+    struct verify_cache_entry* hash_next;
+    struct verify_cache_entry* lru_prev;      // towards the most recently used entry
+    struct verify_cache_entry* lru_next;      // towards the least recently used entry
+} verify_cache_entry_t;
+
+/* Fixed capacity hash table whose entries are kept in least recently used order */
+typedef struct lru_cache
+{
+    verify_cache_entry_t* entries;
+    verify_cache_entry_t** buckets;
+    size_t capacity;
+    size_t num_buckets;
+    size_t size;
+    verify_cache_entry_t* lru_head;
+    verify_cache_entry_t* lru_tail;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    int stats_hits;                 // counters of the statistics
+    int stats_misses;
+    int stats_evictions;
+} lru_cache_t;
+
+/* Verdicts of recently verified scripts. Valid and invalid verdicts are kept apart so that
+   replayed invalid scripts cannot evict the valid ones */
+typedef struct verify_cache
+{
+    lru_cache_t positive;
+    lru_cache_t negative;
+    unsigned long store_generation;  // generation of the certificate store the verdicts were computed with
+} verify_cache_t;
+
+int init_verify_cache(verify_cache_t* cache, size_t capacity, size_t negative_capacity);
+void free_verify_cache(verify_cache_t* cache);
+void flush_verify_cache(verify_cache_t* cache);
+int verify_signature_cached(verify_cache_t* cache, verify_ctx_t* ctx, cert_store_t* store, signed_script_t* signed_script);
+void print_verify_cache_stats(verify_cache_t* cache);
+
+#endif /* __VERIFY_CACHE_H_ */
@@ -0,0 +1,112 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: verify_pool.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __VERIFY_POOL_H_
+#define __VERIFY_POOL_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "cert_utils.h"
+#include "cert_registry.h"
+#include "event_loop.h"
+#include "executor.h"
+#include "mpmc_queue.h"
+#include "server.h"
+#include "verify.h"
+#include "verify_cache.h"
+
+#define VERIFY_POOL_OK                  0
+#define VERIFY_POOL_ERROR              -1
+#define VERIFY_POOL_FULL               -2  // every request is in use, the caller holds the script until on_room
+
+#define VERIFY_POOL_MAX_VERIFIERS       64
+#define VERIFY_POOL_REQUESTS_PER_VERIFIER 4 // scripts queued or being verified at the same time, per verifier
+
+struct verify_pool;
+
+/* Called on the event loop once a request is free again after verify_pool_room reported the pool full */
+typedef void (*verify_room_t)(void* ctx);
+
+/* A received script on its way through the verifier threads. The script is moved into the request, the
+   fifo or connection it came from gets the empty buffers of the request and goes on receiving */
+typedef struct verify_request
+{
+    signed_script_t signed_script;
+    script_job_t* job;                  // place of the script in the executor, reserved when it was received
+    int verdict;
+    char signer[MAX_CERT_NAME_SIZE];    // copied while the certificates are held, they may be replaced later
+    uint64_t queued;                    // when the request was queued, see stats_now
+} verify_request_t;
+
+typedef struct verifier
+{
+    struct verify_pool* pool;
+    int id;
+    pthread_t thread;
+    int reader;                         // reader number of the verifier in the registry
+    verify_cache_t cache;               // private verification cache of the verifier
+    verify_ctx_t ctx;                   // contexts reused by every verification of the verifier
+    mpmc_queue_t queue;                 // requests sent to this verifier, idle verifiers steal from it
+} verifier_t;
+
+/* Verifier threads fed by the event loop. The loop keeps receiving while they verify, the verified requests
+   come back to it through done and an eventfd, and it hands them to the executor */
+typedef struct verify_pool
+{
+    event_source_t source;              // eventfd written by the verifiers when they push to done
+    event_loop_t* loop;
+    cert_registry_t* registry;          // certificates shared between all verifiers, read only
+    verifier_t* verifiers;
+    int num_verifiers;
+    int num_started;                    // verifier threads running, they are joined by the cleanup
+    verify_request_t* requests;
+    verify_request_t** free_requests;   // requests not in use, only touched by the event loop
+    int num_free;
+    int num_requests;
+    mpmc_queue_t done;
+    sem_t queued;                       // requests waiting in the queues of the verifiers
+    unsigned long pushes;               // requests queued so far, a verifier that missed one waits for it to change
+    int num_retrying;                   // verifiers waiting for the next push
+    pthread_mutex_t retry_lock;
+    pthread_cond_t retry_wakeup;
+    int full;                           // a caller was told that every request is in use
+    verify_room_t on_room;
+    void* room_ctx;
+    int stopping;
+} verify_pool_t;
+
+int init_verify_pool(verify_pool_t* pool, event_loop_t* loop, cert_registry_t* registry, int num_verifiers, size_t cache_capacity,
+                     size_t negative_cache_capacity, verify_room_t on_room, void* room_ctx);
+void cleanup_verify_pool(verify_pool_t* pool);
+int verify_pool_room(verify_pool_t* pool);
+int queue_verification(verify_pool_t* pool, signed_script_t* signed_script, script_job_t* job);
+int check_script(verify_cache_t* cache, verify_ctx_t* ctx, cert_store_t* certs, signed_script_t* signed_script);
+
+#endif /* __VERIFY_POOL_H_ */
@@ -0,0 +1,78 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: worker.h
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef __WORKER_H_
+#define __WORKER_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "cert_utils.h"
+#include "cert_registry.h"
+#include "server.h"
+#include "verify.h"
+#include "verify_cache.h"
+#include "run_script.h"
+#include "executor.h"
+#include "bash_pool.h"
+
+#define WORKER_INIT_OK                  0
+#define WORKER_INIT_ERROR              -1
+
+#define MAX_WORKERS                     256
+#define MAX_PIPE_PATH_SIZE              64
+#define WORKER_NOT_PINNED              -1
+
+#define WORKER_PIPE_PATH_FORMAT     "./fifo.%d"
+
+typedef struct worker
+{
+    int id;
+    int cpu;                        // CPU the worker is pinned to, or WORKER_NOT_PINNED
+    pthread_t thread;
+    char pipe_path[MAX_PIPE_PATH_SIZE];
+    cert_registry_t* registry;      // certificates shared between all workers, read only
+    int reader;                     // reader number of the worker in the registry
+    signed_script_t signed_script;  // private buffer of the worker
+    verify_cache_t cache;           // private verification cache of the worker
+    verify_ctx_t verifier;          // contexts reused by every verification of the worker
+    executor_t* executor;           // executes the scripts of an event worker, NULL for fifo workers
+    struct verify_pool* verifiers;  // verifier threads of an event worker, NULL if it verifies the scripts itself
+    struct listener* listener;      // sources of an event worker whose held scripts are resumed by the verifiers
+    struct socket_server* socket_server;
+    bash_pool_t pool;               // interpreters started in advance for the scripts of the worker
+} worker_t;
+
+int init_worker(worker_t* worker, int id, const char* pipe_path, int cpu, cert_registry_t* registry, size_t cache_capacity, size_t negative_cache_capacity,
+                int pool_size, int pool_refill);
+int start_workers(worker_t* workers, int num_workers);
+void join_workers(worker_t* workers, int num_workers);
+void* worker_loop(void* arg);
+int run_event_worker(worker_t* worker, const char* fifo_dir, const char* socket_path, int max_children, int num_verifiers);
+int handle_script(worker_t* worker, signed_script_t* signed_script, script_result_t* result);
+
+#endif /* __WORKER_H_ */
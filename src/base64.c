@@ -0,0 +1,292 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: base64.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define BASE64_X86
+#include <immintrin.h>
+#endif
+
+#include "base64.h"
+
+#define BASE64_INVALID                  0xFF
+#define BASE64_PADDING                  '='
+
+/* Value of every character of the base64 alphabet, BASE64_INVALID for any other byte */
+static const uint8_t decode_table[256] =
+{
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0x3E, 0xFF, 0xFF, 0xFF, 0x3F,
+    0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x3B, 0x3C, 0x3D, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E,
+    0x0F, 0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F, 0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2A, 0x2B, 0x2C, 0x2D, 0x2E, 0x2F, 0x30, 0x31, 0x32, 0x33, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+/* A kernel decodes whole blocks of alphabet characters from the start of in and returns the number of
+   characters it consumed, a multiple of 4. It stops at the first block holding any other byte and leaves
+   the padding and the end of the text to base64_decode */
+typedef size_t (*decode_blocks_fn_t)(unsigned char* out, size_t out_size, const char* in, size_t in_size);
+
+static size_t decode_blocks_scalar(unsigned char* out, size_t out_size, const char* in, size_t in_size)
+{
+    size_t i = 0, o = 0;
+    while(i + 4 <= in_size && o + 3 <= out_size)
+    {
+        uint32_t a = decode_table[(uint8_t) in[i]];
+        uint32_t b = decode_table[(uint8_t) in[i + 1]];
+        uint32_t c = decode_table[(uint8_t) in[i + 2]];
+        uint32_t d = decode_table[(uint8_t) in[i + 3]];
+        if((a | b | c | d) & 0x80)
+        {
+            break;
+        }
+        uint32_t value = (a << 18) | (b << 12) | (c << 6) | d;
+        out[o] = value >> 16;
+        out[o + 1] = value >> 8;
+        out[o + 2] = value;
+        i += 4;
+        o += 3;
+    }
+    return i;
+}
+
+#ifdef BASE64_X86
+
+/* The SIMD kernels classify every byte by its two nibbles: a byte is in the alphabet if the bits selected by its
+   low nibble and by its high nibble do not intersect. The value of a character is then the character plus an
+   offset that only depends on its high nibble, except for '/'. Four 6-bit values are merged into 3 bytes with
+   two multiply-add instructions. They store whole registers, so they stop while out has room for one */
+
+__attribute__((target("sse4.1")))
+static size_t decode_blocks_sse4(unsigned char* out, size_t out_size, const char* in, size_t in_size)
+{
+    const __m128i lut_lo = _mm_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                         0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m128i lut_hi = _mm_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                         0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m128i lut_roll = _mm_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    const __m128i slash = _mm_set1_epi8('/');
+    const __m128i merge_pairs = _mm_set1_epi32(0x01400140);
+    const __m128i merge_quads = _mm_set1_epi32(0x00011000);
+    const __m128i pack = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+
+    size_t i = 0, o = 0;
+    while(i + 16 <= in_size && o + 16 <= out_size)
+    {
+        __m128i chars = _mm_loadu_si128((const __m128i*) (in + i));
+        __m128i hi = _mm_and_si128(_mm_srli_epi32(chars, 4), nibble);
+        __m128i lo = _mm_and_si128(chars, nibble);
+        if(!_mm_testz_si128(_mm_shuffle_epi8(lut_lo, lo), _mm_shuffle_epi8(lut_hi, hi)))
+        {
+            break;
+        }
+        __m128i roll = _mm_shuffle_epi8(lut_roll, _mm_add_epi8(_mm_cmpeq_epi8(chars, slash), hi));
+        __m128i values = _mm_add_epi8(chars, roll);
+        __m128i merged = _mm_madd_epi16(_mm_maddubs_epi16(values, merge_pairs), merge_quads);
+        _mm_storeu_si128((__m128i*) (out + o), _mm_shuffle_epi8(merged, pack));
+        i += 16;
+        o += 12;
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t decode_blocks_avx2(unsigned char* out, size_t out_size, const char* in, size_t in_size)
+{
+    const __m256i lut_lo = _mm256_setr_epi8(0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A,
+                                            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+                                            0x11, 0x11, 0x13, 0x1A, 0x1B, 0x1B, 0x1B, 0x1A);
+    const __m256i lut_hi = _mm256_setr_epi8(0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+                                            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+                                            0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+    const __m256i lut_roll = _mm256_setr_epi8(0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0,
+                                              0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0);
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    const __m256i slash = _mm256_set1_epi8('/');
+    const __m256i merge_pairs = _mm256_set1_epi32(0x01400140);
+    const __m256i merge_quads = _mm256_set1_epi32(0x00011000);
+    const __m256i pack = _mm256_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+                                          2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+    /* The 12 bytes of each lane are moved next to each other */
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 7, 7);
+
+    size_t i = 0, o = 0;
+    while(i + 32 <= in_size && o + 32 <= out_size)
+    {
+        __m256i chars = _mm256_loadu_si256((const __m256i*) (in + i));
+        __m256i hi = _mm256_and_si256(_mm256_srli_epi32(chars, 4), nibble);
+        __m256i lo = _mm256_and_si256(chars, nibble);
+        if(!_mm256_testz_si256(_mm256_shuffle_epi8(lut_lo, lo), _mm256_shuffle_epi8(lut_hi, hi)))
+        {
+            break;
+        }
+        __m256i roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(_mm256_cmpeq_epi8(chars, slash), hi));
+        __m256i values = _mm256_add_epi8(chars, roll);
+        __m256i merged = _mm256_madd_epi16(_mm256_maddubs_epi16(values, merge_pairs), merge_quads);
+        merged = _mm256_permutevar8x32_epi32(_mm256_shuffle_epi8(merged, pack), lanes);
+        _mm256_storeu_si256((__m256i*) (out + o), merged);
+        i += 32;
+        o += 24;
+    }
+    return i;
+}
+
+static const decode_blocks_fn_t kernels[BASE64_NUM_KERNELS] = {decode_blocks_scalar, decode_blocks_sse4, decode_blocks_avx2};
+
+#else
+
+static const decode_blocks_fn_t kernels[BASE64_NUM_KERNELS] = {decode_blocks_scalar, NULL, NULL};
+
+#endif /* BASE64_X86 */
+
+static const char* kernel_names[BASE64_NUM_KERNELS] = {"scalar", "sse4", "avx2"};
+
+/* Chosen on the first decoding unless select_base64_kernel was called before */
+static decode_blocks_fn_t decode_blocks = NULL;
+
+int base64_kernel_supported(int kernel)
+{
+    if(kernel < 0 || kernel >= BASE64_NUM_KERNELS || !kernels[kernel])
+    {
+        return 0;
+    }
+#ifdef BASE64_X86
+    if(BASE64_KERNEL_AVX2 == kernel)
+    {
+        return __builtin_cpu_supports("avx2");
+    }
+    if(BASE64_KERNEL_SSE4 == kernel)
+    {
+        return __builtin_cpu_supports("sse4.1");
+    }
+#endif
+    return 1;
+}
+
+const char* base64_kernel_name(int kernel)
+{
+    return (kernel >= 0 && kernel < BASE64_NUM_KERNELS) ? kernel_names[kernel] : "unknown";
+}
+
+/* Use kernel for the following decodings, or the fastest one the CPU supports with BASE64_KERNEL_AUTO.
+   Returns the kernel in use or BASE64_ERROR if the CPU does not support it */
+int select_base64_kernel(int kernel)
+{
+    if(BASE64_KERNEL_AUTO == kernel)
+    {
+        kernel = BASE64_NUM_KERNELS - 1;
+        while(!base64_kernel_supported(kernel))
+        {
+            kernel--;
+        }
+    }
+    if(!base64_kernel_supported(kernel))
+    {
+        return BASE64_ERROR;
+    }
+    __atomic_store_n(&decode_blocks, kernels[kernel], __ATOMIC_RELAXED);
+    return kernel;
+}
+
+/* Decode the base64 text at the start of in, which ends at the first byte that is neither in the alphabet nor
+   padding, or after in_size bytes. *consumed is set to the length of the text so that the caller can check the
+   byte that ends it. The text must be padded to a multiple of 4 characters with zero unused bits, and decode
+   to at most out_size bytes. Returns the decoded size or BASE64_ERROR */
+int base64_decode(unsigned char* out, size_t out_size, const char* in, size_t in_size, size_t* consumed)
+{
+    decode_blocks_fn_t kernel = __atomic_load_n(&decode_blocks, __ATOMIC_RELAXED);
+    if(!kernel)
+    {
+        select_base64_kernel(BASE64_KERNEL_AUTO);
+        kernel = __atomic_load_n(&decode_blocks, __ATOMIC_RELAXED);
+    }
+
+    /* The scalar loop finishes the blocks a SIMD kernel left because out is almost full */
+    size_t i = kernel(out, out_size, in, in_size);
+    size_t o = i / 4 * 3;
+    i += decode_blocks_scalar(out + o, out_size - o, in + i, in_size - i);
+    o = i / 4 * 3;
+
+    /* Then come at most 3 characters of the last group and its padding */
+    size_t data = 0;
+    while(data < 4 && i + data < in_size && decode_table[(uint8_t) in[i + data]] != BASE64_INVALID)
+    {
+        data++;
+    }
+    size_t end = i + data;
+    size_t padding = 0;
+    while(padding < 2 && end < in_size && BASE64_PADDING == in[end])
+    {
+        end++;
+        padding++;
+    }
+    *consumed = end;
+
+    if(0 == data && 0 == padding)
+    {
+        return (int) o;
+    }
+    /* 4 characters left means that out is full */
+    if(4 == data || data + padding != 4 || data < 2)
+    {
+        return BASE64_ERROR;
+    }
+
+    uint32_t value = (decode_table[(uint8_t) in[i]] << 18) | (decode_table[(uint8_t) in[i + 1]] << 12);
+    if(3 == data)
+    {
+        value |= decode_table[(uint8_t) in[i + 2]] << 6;
+    }
+    size_t size = data - 1;
+    if((value & ((3 == data) ? 0xFF : 0xFFFF)) != 0 || o + size > out_size)
+    {
+        return BASE64_ERROR;
+    }
+    out[o] = value >> 16;
+    if(3 == data)
+    {
+        out[o + 1] = value >> 8;
+    }
+    return (int) (o + size);
+}
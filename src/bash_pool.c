@@ -0,0 +1,225 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: bash_pool.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/wait.h>
+
+#include "debug.h"
+#include "bash_pool.h"
+#include "run_script.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
+
+extern char** environ;
+
+static char* clean_environment[] = {BASH_POOL_ENV_PATH, NULL};
+
+/* Closing its stdin makes an idle interpreter run an empty script and exit */
+static void discard_bash(warm_bash_t* bash)
+{
+    close(bash->stdin_fd);
+    close(bash->output_fd);
+    while(waitpid(bash->pid, NULL, 0) < 0 && EINTR == errno);
+}
+
+/* Start interpreters until the pool is full. Each one reads its stdin and runs exactly one script.
+   bash is spawned without the lock, the thread handling the requests can take the idle ones meanwhile */
+static void fill_bash_pool(bash_pool_t* pool)
+{
+    pthread_mutex_lock(&pool->lock);
+    while(!pool->stopping && pool->num_idle < pool->size)
+    {
+        pthread_mutex_unlock(&pool->lock);
+        warm_bash_t bash;
+        bash.pid = spawn_bash(&bash.stdin_fd, &bash.output_fd, clean_environment);
+        if(bash.pid < 0)
+        {
+            PRINT_ERROR_DEBUG(debug, "Cannot start an interpreter for the pool");
+            return;
+        }
+        pthread_mutex_lock(&pool->lock);
+        if(pool->stopping || pool->num_idle == pool->size)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            discard_bash(&bash);
+            return;
+        }
+        pool->idle[pool->num_idle++] = bash;
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void* refill_thread(void* arg)
+{
+    bash_pool_t* pool = (bash_pool_t*)arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while(!pool->stopping)
+    {
+        if(!pool->refill_requested)
+        {
+            pthread_cond_wait(&pool->wakeup, &pool->lock);
+            continue;
+        }
+        pool->refill_requested = 0;
+        pthread_mutex_unlock(&pool->lock);
+        fill_bash_pool(pool);
+        pthread_mutex_lock(&pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/* Wake the refill thread up, it replaces the interpreters taken since the last refill */
+void refill_bash_pool(bash_pool_t* pool)
+{
+    if(pool->running)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->refill_requested = 1;
+        pthread_cond_signal(&pool->wakeup);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+int init_bash_pool(bash_pool_t* pool, int size, int refill)
+{
+    memset(pool, 0, sizeof(bash_pool_t));
+    if(size < 0 || size > BASH_POOL_MAX_SIZE)
+    {
+        PRINT_ERROR("The size of the interpreter pool must be between 0 and %d", BASH_POOL_MAX_SIZE);
+        return BASH_POOL_ERROR;
+    }
+    pool->size = size;
+    pool->refill = refill;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->wakeup, NULL);
+    if(size > 0)
+    {
+        /* The first interpreters are started before the first script is accepted */
+        fill_bash_pool(pool);
+        if(0 != pthread_create(&pool->thread, NULL, refill_thread, pool))
+        {
+            PRINT_ERROR("Cannot start the refill thread of the interpreter pool");
+            cleanup_bash_pool(pool);
+            return BASH_POOL_ERROR;
+        }
+        pool->running = 1;
+    }
+    return BASH_POOL_OK;
+}
+
+void cleanup_bash_pool(bash_pool_t* pool)
+{
+    if(pool->running)
+    {
+        pthread_mutex_lock(&pool->lock);
+        pool->stopping = 1;
+        pthread_cond_signal(&pool->wakeup);
+        pthread_mutex_unlock(&pool->lock);
+        pthread_join(pool->thread, NULL);
+        pool->running = 0;
+    }
+    while(pool->num_idle > 0)
+    {
+        discard_bash(&pool->idle[--pool->num_idle]);
+    }
+    pool->size = 0;
+}
+
+/* Hand out an idle interpreter to script id, or spawn a new one if the pool is empty or disabled */
+pid_t acquire_bash(bash_pool_t* pool, long id, int* stdin_fd, int* output_fd)
+{
+    uint64_t start = stats_now();
+
+    while(pool && pool->size > 0)
+    {
+        /* The oldest interpreter is taken first, it had the most time to start */
+        pthread_mutex_lock(&pool->lock);
+        if(0 == pool->num_idle)
+        {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        warm_bash_t bash = pool->idle[0];
+        pool->num_idle--;
+        memmove(&pool->idle[0], &pool->idle[1], pool->num_idle * sizeof(warm_bash_t));
+        pthread_mutex_unlock(&pool->lock);
+
+        /* An interpreter killed while waiting would lose the script */
+        if(0 != waitpid(bash.pid, NULL, WNOHANG))
+        {
+            close(bash.stdin_fd);
+            close(bash.output_fd);
+            pool->discarded++;
+            stats_count(STATS_POOL_DISCARDED, 1);
+            continue;
+        }
+
+        pool->warm_hits++;
+        stats_count(STATS_POOL_WARM_HITS, 1);
+        if(BASH_POOL_REFILL_EAGER == pool->refill)
+        {
+            refill_bash_pool(pool);
+        }
+        *stdin_fd = bash.stdin_fd;
+        *output_fd = bash.output_fd;
+        stats_record_since(STATS_SPAWN, start);
+        trace_span(id, STATS_SPAWN, start, "interpreter", "warm");
+        return bash.pid;
+    }
+
+    if(pool && pool->size > 0)
+    {
+        pool->cold_spawns++;
+        stats_count(STATS_POOL_COLD_SPAWNS, 1);
+        /* The pool ran dry, with deferred refill it would stay empty until this script finished */
+        refill_bash_pool(pool);
+    }
+    /* With a pool, a script gets the same environment whether or not it found an idle interpreter */
+    pid_t pid = spawn_bash(stdin_fd, output_fd, (pool && pool->size > 0) ? clean_environment : environ);
+    stats_record_since(STATS_SPAWN, start);
+    trace_span(id, STATS_SPAWN, start, "interpreter", "spawned");
+    return pid;
+}
+
+void print_bash_pool_stats(bash_pool_t* pool)
+{
+    if(pool->size > 0)
+    {
+        pthread_mutex_lock(&pool->lock);
+        int num_idle = pool->num_idle;
+        pthread_mutex_unlock(&pool->lock);
+        PRINT_DEBUG(debug, "Interpreter pool: %d/%d idle, %ld warm hits, %ld cold spawns, %ld discarded",
+                    num_idle, pool->size, pool->warm_hits, pool->cold_spawns, pool->discarded);
+    }
+}
@@ -0,0 +1,439 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: batch.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+#include <openssl/x509.h>
+
+#include "debug.h"
+#include "batch.h"
+#include "ingest.h"
+#include "verify.h"
+#include "server.h"
+#include "parallel.h"
+
+/* Aggregated timings of the files verified with keys of one type */
+typedef struct key_type_stats
+{
+    char key_type[BATCH_KEY_TYPE_SIZE];
+    long files;
+    long total_ns;
+} key_type_stats_t;
+
+static long elapsed_ns(const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000000L + (end->tv_nsec - start->tv_nsec);
+}
+
+static int add_entry(batch_t* batch, size_t* capacity, const char* path)
+{
+    if(batch->num_entries == *capacity)
+    {
+        size_t new_capacity = *capacity ? 2 * *capacity : 1024;
+        batch_entry_t* entries = realloc(batch->entries, new_capacity * sizeof(batch_entry_t));
+        if(!entries)
+        {
+            PRINT_ERROR("Memory allocation failed");
+            return BATCH_ERROR;
+        }
+        batch->entries = entries;
+        *capacity = new_capacity;
+    }
+
+    batch_entry_t* entry = &batch->entries[batch->num_entries];
+    memset(entry, 0, sizeof(batch_entry_t));
+    entry->path = strdup(path);
+    entry->verdict = VERIFY_SIGNATURE_ERROR;
+    if(!entry->path)
+    {
+        PRINT_ERROR("Memory allocation failed");
+        return BATCH_ERROR;
+    }
+    batch->num_entries++;
+    return BATCH_OK;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    return strcmp(((const batch_entry_t*) a)->path, ((const batch_entry_t*) b)->path);
+}
+
+/* Every file of dir ending with BATCH_FILE_SUFFIX, sorted by name so that the table is reproducible */
+static int list_directory(batch_t* batch, const char* dir_path)
+{
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    size_t capacity = 0;
+    size_t suffix_len = strlen(BATCH_FILE_SUFFIX);
+
+    dir = opendir(dir_path);
+    if (!dir)
+    {
+        PRINT_ERROR("Cannot open the directory %s", dir_path);
+        return BATCH_ERROR;
+    }
+
+    while ((entry = readdir(dir)) != NULL)
+    {
+        char path[MAX_FILEPATH_CHARS_SIZE + 1];
+        size_t name_len = strlen(entry->d_name);
+        if(name_len < suffix_len || 0 != strcmp(entry->d_name + name_len - suffix_len, BATCH_FILE_SUFFIX))
+        {
+            continue;
+        }
+
+        int len = snprintf(path, sizeof(path), "%s%c%s", dir_path, '/', entry->d_name);
+        if(len < 0 || len >= (int) sizeof(path))
+        {
+            PRINT_WARN_DEBUG(debug, "Skipping %s since the full path name is too long", entry->d_name);
+            continue;
+        }
+        if(stat(path, &st) < 0 || !S_ISREG(st.st_mode))
+        {
+            continue;
+        }
+        if(BATCH_OK != add_entry(batch, &capacity, path))
+        {
+            closedir(dir);
+            return BATCH_ERROR;
+        }
+    }
+    closedir(dir);
+
+    qsort(batch->entries, batch->num_entries, sizeof(batch_entry_t), compare_entries);
+    return BATCH_OK;
+}
+
+/* A manifest lists one file per line, empty lines and lines starting with # are ignored */
+static int read_manifest(batch_t* batch, const char* manifest_path)
+{
+    char line[MAX_FILEPATH_CHARS_SIZE + 2];
+    size_t capacity = 0;
+    int ret = BATCH_OK;
+
+    FILE* manifest = fopen(manifest_path, "r");
+    if(!manifest)
+    {
+        PRINT_ERROR("Cannot open the manifest %s", manifest_path);
+        return BATCH_ERROR;
+    }
+
+    while(BATCH_OK == ret && fgets(line, sizeof(line), manifest))
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if('\0' == line[0] || '#' == line[0])
+        {
+            continue;
+        }
+        ret = add_entry(batch, &capacity, line);
+    }
+    fclose(manifest);
+    return ret;
+}
+
+/* Read a whole file through the ingest functions, so it is parsed and hashed like a received script */
+static const char* read_signed_file(signed_script_t* signed_script, const char* path, size_t* file_size)
+{
+    int ingest_ret = INGEST_OK;
+    struct stat st;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return "cannot open the file";
+    }
+    if(0 == fstat(fd, &st))
+    {
+        *file_size = st.st_size;
+    }
+
+    begin_ingest(signed_script);
+    while(INGEST_OK == ingest_ret)
+    {
+        size_t available;
+        char* free_space = ingest_reserve(signed_script, &available);
+        if(NULL == free_space)
+        {
+            ingest_ret = INGEST_ERROR;
+            break;
+        }
+
+        ssize_t read_size = read(fd, free_space, available);
+        if(read_size < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if(read_size <= 0)
+        {
+            ingest_ret = (read_size < 0) ? INGEST_ERROR : INGEST_OK;
+            break;
+        }
+        ingest_ret = ingest_append(signed_script, read_size);
+    }
+    close(fd);
+
+    if(INGEST_TOO_LARGE == ingest_ret)
+    {
+        return "the script is too large";
+    }
+    if(INGEST_REJECTED == ingest_ret)
+    {
+        return "a chunk does not match its hash";
+    }
+    if(INGEST_OK != ingest_ret)
+    {
+        return "cannot read the file";
+    }
+    ingest_ret = end_ingest(signed_script);
+    if(INGEST_REJECTED == ingest_ret)
+    {
+        return "a chunk does not match its hash";
+    }
+    if(INGEST_OK != ingest_ret)
+    {
+        return "malformed signed script";
+    }
+    return NULL;
+}
+
+static void verify_entry(batch_t* batch, verify_ctx_t* verifier, signed_script_t* signed_script, batch_entry_t* entry)
+{
+    struct timespec start, end;
+
+    entry->error = read_signed_file(signed_script, entry->path, &entry->size);
+    if(entry->error)
+    {
+        return;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    entry->verdict = verify_signature(verifier, batch->certs, signed_script);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    entry->verify_ns = elapsed_ns(&start, &end);
+
+    if(VERIFY_SIGNATURE_VALID == entry->verdict && signed_script->signer)
+    {
+        EVP_PKEY* pkey = X509_get0_pubkey(signed_script->signer->cert);
+        entry->signer = signed_script->signer;
+        snprintf(entry->key_type, sizeof(entry->key_type), "%s-%d",
+                 pkey ? EVP_PKEY_get0_type_name(pkey) : "?", pkey ? EVP_PKEY_get_bits(pkey) : 0);
+    }
+    else if(VERIFY_SIGNATURE_ERROR == entry->verdict)
+    {
+        entry->error = "verification error";
+    }
+}
+
+static void batch_thread(void* arg)
+{
+    batch_t* batch = (batch_t*) arg;
+    signed_script_t signed_script;
+    verify_ctx_t verifier;
+
+    memset(&signed_script, 0, sizeof(signed_script));
+    if(INGEST_OK != init_ingest(&signed_script))
+    {
+        return;
+    }
+    if(VERIFY_CTX_OK != init_verify_ctx(&verifier))
+    {
+        cleanup_ingest(&signed_script);
+        return;
+    }
+
+    for(;;)
+    {
+        size_t i = __atomic_fetch_add(&batch->next_entry, 1, __ATOMIC_RELAXED);
+        if(i >= batch->num_entries)
+        {
+            break;
+        }
+        verify_entry(batch, &verifier, &signed_script, &batch->entries[i]);
+    }
+
+    cleanup_verify_ctx(&verifier);
+    cleanup_ingest(&signed_script);
+}
+
+static const char* verdict_name(const batch_entry_t* entry)
+{
+    switch(entry->verdict)
+    {
+        case VERIFY_SIGNATURE_VALID:
+            return "VALID";
+        case VERIFY_SIGNATURE_INVALID:
+            return "INVALID";
+        default:
+            return "ERROR";
+    }
+}
+
+static void add_key_type_stats(key_type_stats_t* stats, int* num_stats, const char* key_type, long ns)
+{
+    int i;
+    for(i = 0; i < *num_stats; i++)
+    {
+        if(0 == strcmp(stats[i].key_type, key_type))
+        {
+            break;
+        }
+    }
+    if(i == *num_stats)
+    {
+        if(*num_stats == BATCH_MAX_KEY_TYPES)
+        {
+            return;
+        }
+        snprintf(stats[i].key_type, sizeof(stats[i].key_type), "%s", key_type);
+        (*num_stats)++;
+    }
+    stats[i].files++;
+    stats[i].total_ns += ns;
+}
+
+/* The table of verdicts in the order of the files, then the aggregated figures */
+static int print_report(batch_t* batch, long total_ns, int num_threads)
+{
+    key_type_stats_t stats[BATCH_MAX_KEY_TYPES];
+    int num_stats = 0;
+    long valid = 0, invalid = 0, errors = 0;
+    size_t total_size = 0;
+
+    memset(stats, 0, sizeof(stats));
+    printf("%-8s %-10s %10s %12s  %-32s %s\n", "VERDICT", "KEY", "VERIFY_US", "SIZE", "CERTIFICATE", "FILE");
+    for(size_t i = 0; i < batch->num_entries; i++)
+    {
+        batch_entry_t* entry = &batch->entries[i];
+        const char* key_type = entry->signer ? entry->key_type : "-";
+
+        printf("%-8s %-10s %10ld %12lu  %-32s %s",
+               verdict_name(entry), key_type, entry->verify_ns / 1000, entry->size,
+               entry->signer ? entry->signer->name : "-", entry->path);
+        if(entry->error)
+        {
+            printf(" (%s)", entry->error);
+        }
+        printf("\n");
+
+        total_size += entry->size;
+        if(VERIFY_SIGNATURE_VALID == entry->verdict)
+        {
+            valid++;
+        }
+        else if(VERIFY_SIGNATURE_INVALID == entry->verdict)
+        {
+            invalid++;
+        }
+        else
+        {
+            errors++;
+        }
+        if(!entry->error)
+        {
+            /* Files rejected by every certificate are accounted apart, they paid for every key */
+            add_key_type_stats(stats, &num_stats, entry->signer ? entry->key_type : "unverified", entry->verify_ns);
+        }
+    }
+
+    double seconds = total_ns / 1e9;
+    printf("\n");
+    printf("Verified %lu files in %.3f s with %d threads: %ld valid, %ld invalid, %ld errors\n",
+           batch->num_entries, seconds, num_threads, valid, invalid, errors);
+    printf("Throughput: %.1f files/s, %.2f MB/s\n",
+           seconds > 0 ? batch->num_entries / seconds : 0.0, seconds > 0 ? total_size / seconds / (1024 * 1024) : 0.0);
+    printf("%-12s %8s %14s %12s\n", "KEY", "FILES", "TOTAL_MS", "AVG_US");
+    for(int i = 0; i < num_stats; i++)
+    {
+        printf("%-12s %8ld %14.3f %12.1f\n", stats[i].key_type, stats[i].files,
+               stats[i].total_ns / 1e6, stats[i].total_ns / 1e3 / stats[i].files);
+    }
+
+    return (valid == (long) batch->num_entries) ? BATCH_OK : BATCH_NOT_ALL_VALID;
+}
+
+/* Verify every signed file of a directory, or every file listed in a manifest, with num_threads
+   threads and print a verdict per file. Nothing is executed */
+int run_verify_batch(cert_store_t* certs, const char* target, int num_threads)
+{
+    batch_t batch = {.certs = certs, .entries = NULL, .num_entries = 0, .next_entry = 0};
+    parallel_pool_t pool;
+    struct timespec start, end;
+    struct stat st;
+    int num_used;
+    int ret;
+
+    if(stat(target, &st) < 0)
+    {
+        PRINT_ERROR("Cannot find %s", target);
+        return BATCH_ERROR;
+    }
+    ret = S_ISDIR(st.st_mode) ? list_directory(&batch, target) : read_manifest(&batch, target);
+    if(BATCH_OK != ret || 0 == batch.num_entries)
+    {
+        if(BATCH_OK == ret)
+        {
+            PRINT_ERROR("No signed script found in %s", target);
+        }
+        for(size_t i = 0; i < batch.num_entries; i++)
+        {
+            free(batch.entries[i].path);
+        }
+        free(batch.entries);
+        return BATCH_ERROR;
+    }
+
+    if(num_threads > BATCH_MAX_THREADS)
+    {
+        num_threads = BATCH_MAX_THREADS;
+    }
+    if((size_t) num_threads > batch.num_entries)
+    {
+        num_threads = batch.num_entries;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    init_parallel_pool(&pool, num_threads - 1);
+    num_used = run_parallel(&pool, num_threads, batch_thread, &batch);
+    cleanup_parallel_pool(&pool);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    ret = print_report(&batch, elapsed_ns(&start, &end), num_used);
+
+    for(size_t i = 0; i < batch.num_entries; i++)
+    {
+        free(batch.entries[i].path);
+    }
+    free(batch.entries);
+    return ret;
+}
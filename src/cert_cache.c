@@ -0,0 +1,267 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: cert_cache.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cert_cache.h"
+#include "debug.h"
+
+/* The entries are read in place from the mapping, so they must stay aligned after the header */
+_Static_assert(sizeof(cert_cache_header_t) % 8 == 0, "the cache entries must be 8-byte aligned");
+
+#define CERT_CACHE_INITIAL_ENTRIES      64
+
+/* Check that a mapped cache file is complete, sorted and was built for this certificate directory */
+static int check_cert_cache(cert_cache_t* cache)
+{
+    const cert_cache_header_t* header = (const cert_cache_header_t*) cache->map;
+    if(cache->map_size < sizeof(cert_cache_header_t) || memcmp(header->magic, CERT_CACHE_MAGIC, CERT_CACHE_MAGIC_SIZE) != 0 ||
+       header->version != CERT_CACHE_VERSION)
+    {
+        PRINT_INFO("The certificate cache %s has an unknown format, it is rebuilt", cache->path);
+        return CERT_CACHE_ERROR;
+    }
+    if(memchr(header->certpath, '\0', sizeof(header->certpath)) == NULL || strcmp(header->certpath, cache->certpath) != 0)
+    {
+        PRINT_INFO("The certificate cache %s was built for another directory, it is rebuilt", cache->path);
+        return CERT_CACHE_ERROR;
+    }
+
+    size_t entries_size = (size_t) header->num_entries * sizeof(cert_cache_entry_t);
+    if(entries_size != cache->map_size - sizeof(cert_cache_header_t))
+    {
+        PRINT_INFO("The certificate cache %s does not have the size of its entries, it is rebuilt", cache->path);
+        return CERT_CACHE_ERROR;
+    }
+    const cert_cache_entry_t* entries = (const cert_cache_entry_t*) (cache->map + sizeof(cert_cache_header_t));
+
+    for(uint32_t i = 0; i < header->num_entries; i++)
+    {
+        if(memchr(entries[i].name, '\0', sizeof(entries[i].name)) == NULL ||
+           (i > 0 && strcmp(entries[i - 1].name, entries[i].name) >= 0) ||
+           (entries[i].status != CERT_CACHE_ACCEPTED && entries[i].status != CERT_CACHE_REJECTED))
+        {
+            PRINT_INFO("The certificate cache %s is corrupted, it is rebuilt", cache->path);
+            return CERT_CACHE_ERROR;
+        }
+    }
+
+    cache->entries = entries;
+    cache->num_entries = header->num_entries;
+    return CERT_CACHE_OK;
+}
+
+/* Map the cache file of a certificate directory. A missing or invalid file gives an empty cache, which is
+   written by save_cert_cache once the directory is loaded */
+int open_cert_cache(cert_cache_t* cache, const char* path, const char* certpath)
+{
+    memset(cache, 0, sizeof(cert_cache_t));
+    if(strlen(path) >= sizeof(cache->path) || strlen(certpath) >= sizeof(cache->certpath))
+    {
+        PRINT_ERROR("The certificate cache path is too long");
+        return CERT_CACHE_ERROR;
+    }
+    strcpy(cache->path, path);
+    strcpy(cache->certpath, certpath);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        if(errno != ENOENT)
+        {
+            PRINT_INFO("Cannot open the certificate cache %s (%s), it is rebuilt", path, strerror(errno));
+        }
+        return CERT_CACHE_OK;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) < 0 || st.st_size == 0)
+    {
+        close(fd);
+        return CERT_CACHE_OK;
+    }
+    void* map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(MAP_FAILED == map)
+    {
+        PRINT_INFO("Cannot map the certificate cache %s (%s), it is rebuilt", path, strerror(errno));
+        return CERT_CACHE_OK;
+    }
+
+    cache->map = map;
+    cache->map_size = st.st_size;
+    if(CERT_CACHE_OK != check_cert_cache(cache))
+    {
+        munmap(cache->map, cache->map_size);
+        cache->map = NULL;
+        cache->map_size = 0;
+    }
+    return CERT_CACHE_OK;
+}
+
+void close_cert_cache(cert_cache_t* cache)
+{
+    if(cache->map)
+    {
+        munmap(cache->map, cache->map_size);
+    }
+    free(cache->new_entries);
+    memset(cache, 0, sizeof(cert_cache_t));
+}
+
+static int compare_entry_name(const void* key, const void* entry)
+{
+    return strcmp((const char*) key, ((const cert_cache_entry_t*) entry)->name);
+}
+
+/* Return the cached entry of a file if the file did not change since it was cached, NULL otherwise. It can be
+   called by several threads at once, unlike add_cert_cache_entry */
+const cert_cache_entry_t* lookup_cert_cache(cert_cache_t* cache, const char* name, const struct stat* st, const unsigned char* content_hash)
+{
+    const cert_cache_entry_t* entry = NULL;
+    if(cache->num_entries > 0)
+    {
+        entry = bsearch(name, cache->entries, cache->num_entries, sizeof(cert_cache_entry_t), compare_entry_name);
+    }
+    if(!entry || entry->size != (uint64_t) st->st_size || entry->mtime_sec != (int64_t) st->st_mtim.tv_sec ||
+       entry->mtime_nsec != (int64_t) st->st_mtim.tv_nsec || memcmp(entry->content_hash, content_hash, SHA256_DIGEST_LENGTH) != 0)
+    {
+        __atomic_add_fetch(&cache->misses, 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+    __atomic_add_fetch(&cache->hits, 1, __ATOMIC_RELAXED);
+    return entry;
+}
+
+/* Record the verdict of a file of the directory for the next start */
+int add_cert_cache_entry(cert_cache_t* cache, const char* name, const struct stat* st, const unsigned char* content_hash,
+                         uint32_t status)
+{
+    if(strlen(name) >= MAX_CERT_NAME_SIZE)
+    {
+        return CERT_CACHE_ERROR;
+    }
+    if(cache->num_new_entries == cache->new_entries_capacity)
+    {
+        size_t capacity = cache->new_entries_capacity ? 2 * cache->new_entries_capacity : CERT_CACHE_INITIAL_ENTRIES;
+        cert_cache_entry_t* entries = realloc(cache->new_entries, capacity * sizeof(cert_cache_entry_t));
+        if(!entries)
+        {
+            PRINT_ERROR("Memory allocation failed");
+            return CERT_CACHE_ERROR;
+        }
+        cache->new_entries = entries;
+        cache->new_entries_capacity = capacity;
+    }
+
+    cert_cache_entry_t* entry = &cache->new_entries[cache->num_new_entries++];
+    memset(entry, 0, sizeof(cert_cache_entry_t));
+    strcpy(entry->name, name);
+    entry->size = st->st_size;
+    entry->mtime_sec = st->st_mtim.tv_sec;
+    entry->mtime_nsec = st->st_mtim.tv_nsec;
+    memcpy(entry->content_hash, content_hash, SHA256_DIGEST_LENGTH);
+    entry->status = status;
+    return CERT_CACHE_OK;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    return strcmp(((const cert_cache_entry_t*) a)->name, ((const cert_cache_entry_t*) b)->name);
+}
+
+static int write_all(int fd, const void* data, size_t size)
+{
+    const unsigned char* curr = data;
+    while(size > 0)
+    {
+        ssize_t written = write(fd, curr, size);
+        if(written < 0)
+        {
+            if(errno == EINTR)
+            {
+                continue;
+            }
+            return CERT_CACHE_ERROR;
+        }
+        curr += written;
+        size -= written;
+    }
+    return CERT_CACHE_OK;
+}
+
+/* Replace the cache file by the entries recorded while loading, unless every file was found unchanged in it */
+int save_cert_cache(cert_cache_t* cache)
+{
+    if(0 == cache->misses && cache->num_new_entries == cache->num_entries && cache->map)
+    {
+        return CERT_CACHE_OK;
+    }
+
+    qsort(cache->new_entries, cache->num_new_entries, sizeof(cert_cache_entry_t), compare_entries);
+
+    cert_cache_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CERT_CACHE_MAGIC, CERT_CACHE_MAGIC_SIZE);
+    header.version = CERT_CACHE_VERSION;
+    header.num_entries = cache->num_new_entries;
+    strcpy(header.certpath, cache->certpath);
+
+    /* Written next to the cache and renamed over it so that a concurrent start never maps a partial file */
+    char tmp_path[MAX_FILEPATH_CHARS_SIZE + 8];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache->path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if(fd < 0)
+    {
+        PRINT_ERROR("Cannot create the certificate cache %s (%s)", tmp_path, strerror(errno));
+        return CERT_CACHE_ERROR;
+    }
+    if(CERT_CACHE_OK != write_all(fd, &header, sizeof(header)) ||
+       CERT_CACHE_OK != write_all(fd, cache->new_entries, cache->num_new_entries * sizeof(cert_cache_entry_t)) || fsync(fd) < 0)
+    {
+        PRINT_ERROR("Cannot write the certificate cache %s (%s)", tmp_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return CERT_CACHE_ERROR;
+    }
+    close(fd);
+    if(rename(tmp_path, cache->path) < 0)
+    {
+        PRINT_ERROR("Cannot replace the certificate cache %s (%s)", cache->path, strerror(errno));
+        unlink(tmp_path);
+        return CERT_CACHE_ERROR;
+    }
+    PRINT_DEBUG(debug, "Saved %zu entries to the certificate cache %s", cache->num_new_entries, cache->path);
+    return CERT_CACHE_OK;
+}
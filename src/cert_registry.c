@@ -0,0 +1,252 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: cert_registry.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+
+#include "debug.h"
+#include "cert_utils.h"
+#include "cert_registry.h"
+
+/* Changes of the directory closer than this are handled by one reload, e.g. several certificates copied at once */
+#define CERT_RELOAD_SETTLE_MS           200
+/* Polling period of the watcher while a reader still uses a replaced store */
+#define CERT_RELOAD_GRACE_POLL_US       1000
+
+#define CERT_WATCH_EVENTS   (IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE)
+
+/* The registry takes over store, it is freed by cleanup_cert_registry or when it is replaced. cache_path, if not
+   NULL, is the certificate cache updated by the reloads */
+int init_cert_registry(cert_registry_t* registry, cert_store_t* store, const char* path, const char* cache_path)
+{
+    memset(registry, 0, sizeof(cert_registry_t));
+    registry->current = store;
+    registry->epoch = 1;
+    registry->inotify_fd = -1;
+    registry->stop_fd = -1;
+    strncpy(registry->path, path, sizeof(registry->path) - 1);
+    registry->path[sizeof(registry->path) - 1] = '\0';
+    if(cache_path)
+    {
+        strncpy(registry->cache_path, cache_path, sizeof(registry->cache_path) - 1);
+        registry->cache_path[sizeof(registry->cache_path) - 1] = '\0';
+    }
+    return CERT_REGISTRY_OK;
+}
+
+/* Stop the watcher thread, if any, and free the store in use */
+void cleanup_cert_registry(cert_registry_t* registry)
+{
+    if(registry->inotify_fd >= 0)
+    {
+        uint64_t stop = 1;
+        if(write(registry->stop_fd, &stop, sizeof(stop)) == sizeof(stop))
+        {
+            pthread_join(registry->thread, NULL);
+        }
+        close(registry->inotify_fd);
+        close(registry->stop_fd);
+        registry->inotify_fd = -1;
+    }
+    cleanup_certs(&registry->current);
+}
+
+/* Returns the reader number to give to enter_certs and exit_certs, or CERT_REGISTRY_ERROR */
+int register_cert_reader(cert_registry_t* registry)
+{
+    int reader = __atomic_fetch_add(&registry->num_readers, 1, __ATOMIC_ACQ_REL);
+    if(reader >= CERT_MAX_READERS)
+    {
+        PRINT_ERROR("Too many readers of the certificate store");
+        return CERT_REGISTRY_ERROR;
+    }
+    registry->readers[reader].epoch = CERT_READER_IDLE;
+    return reader;
+}
+
+/* Take the store in use. It stays valid until exit_certs, even if it is replaced meanwhile.
+   The epoch is announced before the store is read, see wait_for_readers */
+cert_store_t* enter_certs(cert_registry_t* registry, int reader)
+{
+    unsigned long epoch = __atomic_load_n(&registry->epoch, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&registry->readers[reader].epoch, epoch, __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&registry->current, __ATOMIC_SEQ_CST);
+}
+
+void exit_certs(cert_registry_t* registry, int reader)
+{
+    __atomic_store_n(&registry->readers[reader].epoch, CERT_READER_IDLE, __ATOMIC_RELEASE);
+}
+
+/* Wait until no reader can use a store replaced when the epoch became epoch: a reader is either idle
+   or entered after the replacement, in which case it announced epoch or later */
+static void wait_for_readers(cert_registry_t* registry, unsigned long epoch)
+{
+    int num_readers = __atomic_load_n(&registry->num_readers, __ATOMIC_ACQUIRE);
+    num_readers = (num_readers > CERT_MAX_READERS) ? CERT_MAX_READERS : num_readers;
+
+    for(int i = 0; i < num_readers; i++)
+    {
+        for(;;)
+        {
+            unsigned long reader_epoch = __atomic_load_n(&registry->readers[i].epoch, __ATOMIC_SEQ_CST);
+            if(CERT_READER_IDLE == reader_epoch || reader_epoch >= epoch)
+            {
+                break;
+            }
+            usleep(CERT_RELOAD_GRACE_POLL_US);
+        }
+    }
+}
+
+/* Load the directory again, publish the new store and free the previous one once it is not used anymore.
+   If the directory cannot be read the store in use is kept */
+static void reload_certs(cert_registry_t* registry)
+{
+    cert_store_t* store = load_cert_store(registry->path, registry->cache_path[0] ? registry->cache_path : NULL, CERT_STORE_ALLOW_EMPTY);
+    if(NULL == store)
+    {
+        PRINT_ERROR("Cannot reload the certificates of %s, the previous certificates are kept", registry->path);
+        return;
+    }
+
+    cert_store_t* old = __atomic_exchange_n(&registry->current, store, __ATOMIC_SEQ_CST);
+    unsigned long epoch = __atomic_add_fetch(&registry->epoch, 1, __ATOMIC_SEQ_CST);
+    registry->reloads++;
+
+    if(0 == store->count)
+    {
+        PRINT_INFO("No certificate is loaded anymore, every script will be rejected");
+    }
+    PRINT_INFO("Certificates reloaded from %s (%d certificates, reload %ld)", registry->path, store->count, registry->reloads);
+
+    wait_for_readers(registry, epoch);
+    cleanup_certs(&old);
+}
+
+/* Read and discard the pending events, returns -1 if the watched directory is gone */
+static int drain_events(cert_registry_t* registry)
+{
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t size;
+    int ret = 0;
+
+    while((size = read(registry->inotify_fd, buffer, sizeof(buffer))) > 0)
+    {
+        for(char* ptr = buffer; ptr < buffer + size; ptr += sizeof(struct inotify_event) + ((struct inotify_event*) ptr)->len)
+        {
+            const struct inotify_event* event = (const struct inotify_event*) ptr;
+            if(event->mask & IN_IGNORED)
+            {
+                ret = -1;
+            }
+            else if(event->len > 0)
+            {
+                PRINT_DEBUG(debug, "Certificate directory changed: %s", event->name);
+            }
+        }
+    }
+    return ret;
+}
+
+static void* watch_certs(void* arg)
+{
+    cert_registry_t* registry = (cert_registry_t*) arg;
+
+    for(;;)
+    {
+        struct pollfd fds[2] = {
+            {.fd = registry->inotify_fd, .events = POLLIN},
+            {.fd = registry->stop_fd, .events = POLLIN},
+        };
+        if(poll(fds, 2, -1) < 0)
+        {
+            if(EINTR == errno)
+            {
+                continue;
+            }
+            PRINT_ERROR("Cannot watch the certificate directory anymore");
+            return NULL;
+        }
+        if(fds[1].revents)
+        {
+            return NULL;
+        }
+
+        int gone = drain_events(registry);
+
+        /* Wait for the directory to settle before loading it */
+        while(!gone && poll(fds, 1, CERT_RELOAD_SETTLE_MS) > 0)
+        {
+            gone = drain_events(registry);
+        }
+        if(gone)
+        {
+            PRINT_ERROR("The certificate directory %s was removed, the current certificates are kept", registry->path);
+            return NULL;
+        }
+
+        reload_certs(registry);
+    }
+    return NULL;
+}
+
+/* Watch the certificate directory and reload it when its content changes. The server keeps working
+   with the loaded certificates if the directory cannot be watched */
+int start_cert_watcher(cert_registry_t* registry)
+{
+    registry->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(registry->inotify_fd < 0)
+    {
+        PRINT_ERROR("Cannot watch the certificate directory, certificates will not be reloaded");
+        return CERT_REGISTRY_ERROR;
+    }
+
+    registry->stop_fd = eventfd(0, EFD_CLOEXEC);
+    if(registry->stop_fd < 0 || inotify_add_watch(registry->inotify_fd, registry->path, CERT_WATCH_EVENTS) < 0 ||
+       0 != pthread_create(&registry->thread, NULL, watch_certs, registry))
+    {
+        PRINT_ERROR("Cannot watch the certificate directory %s, certificates will not be reloaded", registry->path);
+        close(registry->inotify_fd);
+        if(registry->stop_fd >= 0)
+        {
+            close(registry->stop_fd);
+        }
+        registry->inotify_fd = -1;
+        registry->stop_fd = -1;
+        return CERT_REGISTRY_ERROR;
+    }
+
+    PRINT_INFO("Watching %s for certificate changes", registry->path);
+    return CERT_REGISTRY_OK;
+}
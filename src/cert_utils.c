@@ -26,13 +26,27 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <openssl/x509.h>
+#include <openssl/x509v3.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
+#include <openssl/sha.h>
 #include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "cert_utils.h"
+#include "cert_cache.h"
+#include "stats.h"
 #include "debug.h"
+#include "parallel.h"
+
+/* Incremented for every loaded store so that users of a store can detect that the certificates changed */
+static unsigned long store_generation = 0;
 
 /* Function to read a PEM certificate */
 X509* read_pem_cert(const char *certfile) 
@@ -71,18 +85,114 @@ X509* read_cert(const char *certfile)
     return cert;
 }
 
-/* Free up all memory located for certificates */
-void cleanup_certs(cert_container_t** certs)
+/* Free up all memory located for a list of certificates */
+static void cleanup_cert_list(cert_container_t** certs)
 {
     cert_container_t* cert_curr = *certs;
     cert_container_t* cert_next = NULL;
     while(NULL != cert_curr)
     {
+        EVP_PKEY_CTX_free(cert_curr->verify_template);
         X509_free(cert_curr->cert);
         cert_next = cert_curr->next;
         free(cert_curr);
         cert_curr = cert_next;
     }
+    *certs = NULL;
+}
+
+/* Free up all memory located for the certificate store */
+void cleanup_certs(cert_store_t** store)
+{
+    if(NULL == *store)
+    {
+        return;
+    }
+    cleanup_cert_list(&(*store)->certs);
+    free(*store);
+    *store = NULL;
+}
+
+/* FNV-1a hash of a key identifier */
+static size_t hash_cert_id(const unsigned char* id, size_t id_size)
+{
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < id_size; i++)
+    {
+        hash ^= id[i];
+        hash *= 16777619u;
+    }
+    return hash & (CERT_INDEX_BUCKETS - 1);
+}
+
+static void index_cert_id(cert_store_t* store, cert_index_entry_t* entry, cert_container_t* cert, const unsigned char* id, size_t id_size)
+{
+    size_t bucket = hash_cert_id(id, id_size);
+    entry->id = id;
+    entry->id_size = id_size;
+    entry->cert = cert;
+    entry->next = store->index[bucket];
+    store->index[bucket] = entry;
+}
+
+/* Compute the identifiers a signed script can use to designate this certificate */
+static int compute_cert_ids(cert_container_t* cert_cont)
+{
+    unsigned int fingerprint_size = 0;
+    if(!X509_digest(cert_cont->cert, EVP_sha256(), cert_cont->fingerprint, &fingerprint_size) || CERT_FINGERPRINT_SIZE != fingerprint_size)
+    {
+        return INVALID_CERTIFICATE;
+    }
+
+    cert_cont->key_id_size = 0;
+    const ASN1_OCTET_STRING* skid = X509_get0_subject_key_id(cert_cont->cert);
+    if(skid && ASN1_STRING_length(skid) > 0 && ASN1_STRING_length(skid) <= MAX_KEY_ID_SIZE)
+    {
+        cert_cont->key_id_size = ASN1_STRING_length(skid);
+        memcpy(cert_cont->key_id, ASN1_STRING_get0_data(skid), cert_cont->key_id_size);
+    }
+    return VALID_CERTIFICATE;
+}
+
+/* The public key operation is set up once per certificate, verifiers duplicate the context instead of creating one */
+static int prepare_cert_verification(cert_container_t* cert_cont)
+{
+    cert_cont->verify_template = NULL;
+    cert_cont->pub_key = X509_get0_pubkey(cert_cont->cert);
+    if(!cert_cont->pub_key)
+    {
+        return INVALID_CERTIFICATE;
+    }
+
+    /* Pure EdDSA signs the script itself, it has no context to prepare */
+    int key_type = EVP_PKEY_base_id(cert_cont->pub_key);
+    if(EVP_PKEY_ED25519 == key_type || EVP_PKEY_ED448 == key_type)
+    {
+        return VALID_CERTIFICATE;
+    }
+
+    /* The digest algorithm determines the encoding of the digest for RSA and its expected size for DSA and ECDSA */
+    EVP_PKEY_CTX* pkey_ctx = EVP_PKEY_CTX_new(cert_cont->pub_key, NULL);
+    if(!pkey_ctx || EVP_PKEY_verify_init(pkey_ctx) <= 0 || EVP_PKEY_CTX_set_signature_md(pkey_ctx, EVP_sha256()) <= 0)
+    {
+        EVP_PKEY_CTX_free(pkey_ctx);
+        return INVALID_CERTIFICATE;
+    }
+    cert_cont->verify_template = pkey_ctx;
+    return VALID_CERTIFICATE;
+}
+
+/* Look up a certificate by its SHA-256 fingerprint or its SubjectKeyIdentifier */
+cert_container_t* find_cert_by_id(const cert_store_t* store, const unsigned char* id, size_t id_size)
+{
+    for(cert_index_entry_t* entry = store->index[hash_cert_id(id, id_size)]; entry != NULL; entry = entry->next)
+    {
+        if(entry->id_size == id_size && 0 == memcmp(entry->id, id, id_size))
+        {
+            return entry->cert;
+        }
+    }
+    return NULL;
 }
 
 int validate_selfsigned_cert(X509* cert)
@@ -143,26 +253,224 @@ int validate_codesigning_cert(X509* cert)
     return INVALID_CERTIFICATE;
 }
 
-/* Load certificates from a directory to a linked list */
-cert_container_t* load_certs(const char *certpath)
+/* Read a whole certificate file along with its status, which is what the cache matches it against */
+static unsigned char* read_cert_file(const char* filepath, size_t* size, struct stat* st)
+{
+    int fd = open(filepath, O_RDONLY | O_CLOEXEC);
+    if(fd < 0)
+    {
+        return NULL;
+    }
+    if(fstat(fd, st) < 0 || !S_ISREG(st->st_mode) || st->st_size > MAX_CERT_FILE_SIZE)
+    {
+        close(fd);
+        return NULL;
+    }
+
+    unsigned char* data = malloc(st->st_size > 0 ? st->st_size : 1);
+    size_t read_size = 0;
+    while(data && read_size < (size_t) st->st_size)
+    {
+        ssize_t len = read(fd, data + read_size, st->st_size - read_size);
+        if(len < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if(len <= 0)
+        {
+            free(data);
+            data = NULL;
+            break;
+        }
+        read_size += len;
+    }
+    close(fd);
+    *size = read_size;
+    return data;
+}
+
+/* Function to read a certificate from memory, trying PEM first, then DER */
+X509* read_cert_mem(const unsigned char* data, size_t size)
+{
+    X509* cert = NULL;
+    BIO* bio = BIO_new_mem_buf(data, size);
+    if(bio)
+    {
+        cert = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+        BIO_free(bio);
+    }
+    if(cert == NULL)
+    {
+        const unsigned char* der = data;
+        cert = d2i_X509(NULL, &der, size);
+    }
+    return cert;
+}
+
+/* Return why a certificate cannot be used to sign scripts, NULL if it can */
+static const char* check_cert(X509* cert)
+{
+    if(!cert)
+    {
+        return "the certificate cannot be read";
+    }
+    if(IS_SELFSIGNED != validate_selfsigned_cert(cert))
+    {
+        return "the certificate is not self-signed";
+    }
+    if(VALID_CERTIFICATE != validate_codesigning_cert(cert))
+    {
+        return "the certificate's key usage is not codeSigning";
+    }
+    return NULL;
+}
+
+/* One file of the certificate directory, read and validated by any of the loader threads. The outcome is
+   reported in the order of the directory once every file is done */
+typedef struct cert_file
+{
+    char name[MAX_CERT_NAME_SIZE];
+    const char* skip_reason;                    // NULL if the certificate is loaded
+    cert_container_t* cert_cont;
+    int alloc_failed;
+    int was_read;                               // st and content_hash are set
+    struct stat st;
+    unsigned char content_hash[SHA256_DIGEST_LENGTH];
+    const cert_cache_entry_t* cached;
+} cert_file_t;
+
+typedef struct cert_loader
+{
+    const char* certpath;
+    cert_file_t* files;
+    size_t num_files;
+    size_t next_file;
+    cert_cache_t* cache;
+} cert_loader_t;
+
+/* Read and validate one certificate file, or take the outcome of the checks from the cache if the file did not
+   change since it was validated. Nothing is printed here, the outcome is kept in file */
+static void load_cert_file(cert_loader_t* loader, cert_file_t* file)
+{
+    char filepath[MAX_FILEPATH_CHARS_SIZE+1];
+    size_t size = 0;
+    X509* cert = NULL;
+
+    snprintf(filepath, sizeof(filepath), "%s%c%s", loader->certpath, '/', file->name);
+    unsigned char* data = read_cert_file(filepath, &size, &file->st);
+    if(!data)
+    {
+        file->skip_reason = "the file cannot be read";
+        return;
+    }
+    file->was_read = 1;
+
+    if(loader->cache)
+    {
+        SHA256(data, size, file->content_hash);
+        file->cached = lookup_cert_cache(loader->cache, file->name, &file->st, file->content_hash);
+    }
+
+    if(file->cached && CERT_CACHE_REJECTED == file->cached->status)
+    {
+        free(data);
+        file->skip_reason = "the certificate was rejected when it was cached";
+        return;
+    }
+
+    /* The certificate always comes from the file whose hash was just compared, the cache only spares the checks */
+    cert = read_cert_mem(data, size);
+    free(data);
+    file->skip_reason = file->cached ? (cert ? NULL : "the certificate cannot be read") : check_cert(cert);
+    if(file->skip_reason)
+    {
+        X509_free(cert);
+        return;
+    }
+
+    cert_container_t* cert_cont = malloc(sizeof(cert_container_t));
+    if(!cert_cont)
+    {
+        X509_free(cert);
+        file->alloc_failed = 1;
+        return;
+    }
+    strcpy(cert_cont->name, file->name);
+    cert_cont->cert = cert;
+    cert_cont->next = NULL;
+
+    if(VALID_CERTIFICATE != compute_cert_ids(cert_cont))
+    {
+        file->skip_reason = "the certificate fingerprint cannot be computed";
+        X509_free(cert);
+        free(cert_cont);
+        return;
+    }
+    if(VALID_CERTIFICATE != prepare_cert_verification(cert_cont))
+    {
+        file->skip_reason = "the public key of the certificate cannot be used for verification";
+        X509_free(cert);
+        free(cert_cont);
+        return;
+    }
+    file->cert_cont = cert_cont;
+}
+
+static void cert_loader_thread(void* arg)
+{
+    cert_loader_t* loader = (cert_loader_t*) arg;
+    for(;;)
+    {
+        size_t i = __atomic_fetch_add(&loader->next_file, 1, __ATOMIC_RELAXED);
+        if(i >= loader->num_files)
+        {
+            break;
+        }
+        if(NULL == loader->files[i].skip_reason)
+        {
+            load_cert_file(loader, &loader->files[i]);
+        }
+    }
+}
+
+/* Record the outcome of a file for the next start */
+static void cache_cert_file(cert_cache_t* cache, const cert_file_t* file)
+{
+    if(!file->was_read)
+    {
+        return;
+    }
+    if(file->cached)
+    {
+        /* A cached certificate that cannot be used any more is dropped, so that it is validated again */
+        if(file->cert_cont || CERT_CACHE_REJECTED == file->cached->status)
+        {
+            add_cert_cache_entry(cache, file->name, &file->st, file->content_hash, file->cached->status);
+        }
+    }
+    else
+    {
+        add_cert_cache_entry(cache, file->name, &file->st, file->content_hash,
+                             file->cert_cont ? CERT_CACHE_ACCEPTED : CERT_CACHE_REJECTED);
+    }
+}
+
+/* Every entry of the directory in readdir order, with the entries that are not loaded already skipped */
+static int list_cert_files(const char* certpath, cert_file_t** files, size_t* num_files)
 {
     DIR *dir;
     struct dirent *entry;
-    char filepath[MAX_FILEPATH_CHARS_SIZE+1];
-    int len;
-    cert_container_t* certs = NULL;
-    cert_container_t* cert_cont_curr;
-    cert_container_t* cert_cont_new;
-    X509* cert_new = NULL;
-    int cert_counter = 0;
+    size_t capacity = 0;
 
     dir = opendir(certpath);
     if (!dir) 
     {
         PRINT_ERROR("Cannot open certificates directory");
-        return NULL;
+        return INVALID_CERTIFICATE;
     }
 
+    *files = NULL;
+    *num_files = 0;
     while ((entry = readdir(dir)) != NULL) 
     {
         if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) 
@@ -170,76 +478,175 @@ cert_container_t* load_certs(const char *certpath)
             continue;
         }
 
+        if(*num_files == capacity)
+        {
+            size_t new_capacity = capacity ? 2 * capacity : 256;
+            cert_file_t* new_files = realloc(*files, new_capacity * sizeof(cert_file_t));
+            if(!new_files)
+            {
+                PRINT_ERROR("Memory allocation failed");
+                closedir(dir);
+                free(*files);
+                *files = NULL;
+                return INVALID_CERTIFICATE;
+            }
+            *files = new_files;
+            capacity = new_capacity;
+        }
+
+        cert_file_t* file = &(*files)[(*num_files)++];
+        memset(file, 0, sizeof(cert_file_t));
+        snprintf(file->name, sizeof(file->name), "%.*s", (int) sizeof(file->name) - 1, entry->d_name);
+
         /* Only read files */
         if(entry->d_type != DT_REG)
         {
-            PRINT_WARN_DEBUG(debug, "Skipping %s since it is not a file", entry->d_name);
-            continue;
+            file->skip_reason = "it is not a file";
         }
-        /* Get full path of the file */
-        len = snprintf(filepath, MAX_FILEPATH_CHARS_SIZE, "%s%c%s", certpath, '/', entry->d_name);
-        if(len < 0 || len >= MAX_FILEPATH_CHARS_SIZE)
+        /* The full path of the file must fit */
+        else if(strlen(entry->d_name) >= sizeof(file->name) || strlen(certpath) + 1 + strlen(entry->d_name) >= MAX_FILEPATH_CHARS_SIZE)
         {
-            PRINT_WARN_DEBUG(debug, "Skipping %s since the full path name is too long", entry->d_name);
-            continue;
+            file->skip_reason = "the full path name is too long";
         }
+    }
+    closedir(dir);
+    return VALID_CERTIFICATE;
+}
+
+/* Load certificates from a directory to a linked list and index them by identifier. With CERT_STORE_ALLOW_EMPTY,
+   a directory without any valid certificate gives an empty store instead of NULL. With a cache_path, the files
+   that did not change since the previous load are not validated again.
+   The files are read and validated by up to one thread per CPU, the list keeps the order of the directory */
+cert_store_t* load_cert_store(const char *certpath, const char *cache_path, int flags)
+{
+    cert_container_t* certs = NULL;
+    cert_container_t* cert_cont_curr = NULL;
+    int cert_counter = 0;
+    int alloc_failed = 0;
+    cert_store_t* store = NULL;
+    cert_cache_t cache_data;
+    cert_loader_t loader;
+    parallel_pool_t pool;
+    int num_used;
+    uint64_t start = stats_now();
+
+    memset(&loader, 0, sizeof(loader));
+    loader.certpath = certpath;
+    if(INVALID_CERTIFICATE == list_cert_files(certpath, &loader.files, &loader.num_files))
+    {
+        return NULL;
+    }
+
+    if(cache_path && CERT_CACHE_OK == open_cert_cache(&cache_data, cache_path, certpath))
+    {
+        loader.cache = &cache_data;
+    }
+
+    /* Initialize OpenSSL algorithms */
+    OpenSSL_add_all_algorithms();
 
-        /* Initialize OpenSSL algorithms*/
-        OpenSSL_add_all_algorithms();
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    long max_threads = (loader.num_files + CERT_LOAD_FILES_PER_THREAD - 1) / CERT_LOAD_FILES_PER_THREAD;
+    if(num_threads > max_threads)
+    {
+        num_threads = max_threads;
+    }
+    if(num_threads > CERT_LOAD_MAX_THREADS)
+    {
+        num_threads = CERT_LOAD_MAX_THREADS;
+    }
+    init_parallel_pool(&pool, num_threads - 1);
+    num_used = run_parallel(&pool, num_threads, cert_loader_thread, &loader);
+    cleanup_parallel_pool(&pool);
 
-        /* Read one certificate */
-        cert_new = read_cert(filepath);
-        if (!cert_new) 
+    for(size_t i = 0; i < loader.num_files; i++)
+    {
+        cert_file_t* file = &loader.files[i];
+        alloc_failed |= file->alloc_failed;
+        if(loader.cache)
         {
-            PRINT_WARN_DEBUG(debug, "Skipping %s since the certificate cannot be read", entry->d_name);
-            continue;
+            cache_cert_file(loader.cache, file);
         }
-    
-        /* Check if the certificate is self-signed */
-        if(IS_SELFSIGNED != validate_selfsigned_cert(cert_new))
+
+        if(!file->cert_cont)
         {
-            PRINT_WARN_DEBUG(debug, "Skipping %s since the certificate is not self-signed", entry->d_name);
-            X509_free(cert_new);
+            if(file->skip_reason)
+            {
+                PRINT_WARN_DEBUG(debug, "Skipping %s since %s", file->name, file->skip_reason);
+            }
             continue;
         }
 
-        /* Check if the certificate has correct Key Usage */
-        if(VALID_CERTIFICATE != validate_codesigning_cert(cert_new))
+        if(!certs)
         {
-            PRINT_WARN_DEBUG(debug, "Skipping %s since the certificate's key usage is not codeSigning", entry->d_name);
-            X509_free(cert_new);
-            continue;
+            certs = file->cert_cont;
+            cert_cont_curr = file->cert_cont;
         }
-
-        cert_cont_new = malloc(sizeof(cert_container_t));
-
-        if(!cert_cont_new)
+        else
         {
-            PRINT_ERROR("Memory allocation failed");
-            closedir(dir);
-            cleanup_certs(&certs);
-            return NULL;
+            cert_cont_curr->next = file->cert_cont;
+            cert_cont_curr = cert_cont_curr->next;
         }
 
-        strncpy(cert_cont_new->name, entry->d_name, sizeof(cert_cont_new->name));
-        cert_cont_new->cert = cert_new;
-        cert_cont_new->next = NULL;
+        PRINT_INFO("Successfully loaded certificate %s", file->name);
+        file->cert_cont->index = cert_counter++;
+    }
+    free(loader.files);
 
-        if(!certs)
+    if(alloc_failed)
+    {
+        PRINT_ERROR("Memory allocation failed");
+        cleanup_cert_list(&certs);
+        if(loader.cache)
         {
-            certs = cert_cont_new;
-            cert_cont_curr = cert_cont_new;
+            close_cert_cache(loader.cache);
         }
-        else
+        return NULL;
+    }
+
+    double elapsed_ms = (stats_now() - start) / 1e6;
+    if(loader.cache)
+    {
+        save_cert_cache(loader.cache);
+        PRINT_INFO("Loaded a total of %d certificates in %.1f ms with %d thread(s) (%ld of %ld files from the cache)", cert_counter,
+                   elapsed_ms, num_used, loader.cache->hits, loader.cache->hits + loader.cache->misses);
+        close_cert_cache(loader.cache);
+    }
+    else
+    {
+        PRINT_INFO("Loaded a total of %d certificates in %.1f ms with %d thread(s)", cert_counter, elapsed_ms, num_used);
+    }
+
+    if(NULL == certs && !(flags & CERT_STORE_ALLOW_EMPTY))
+    {
+        return NULL;
+    }
+
+    store = calloc(1, sizeof(cert_store_t));
+    if(!store)
+    {
+        PRINT_ERROR("Memory allocation failed");
+        cleanup_cert_list(&certs);
+        return NULL;
+    }
+    store->certs = certs;
+    store->count = cert_counter;
+    store->generation = __atomic_add_fetch(&store_generation, 1, __ATOMIC_RELAXED);
+
+    /* Index every certificate by its fingerprint and, if present, its SubjectKeyIdentifier */
+    for(cert_container_t* cert_curr = certs; cert_curr != NULL; cert_curr = cert_curr->next)
+    {
+        index_cert_id(store, &cert_curr->fingerprint_entry, cert_curr, cert_curr->fingerprint, CERT_FINGERPRINT_SIZE);
+        if(cert_curr->key_id_size > 0)
         {
-            cert_cont_curr->next = cert_cont_new;
-            cert_cont_curr = cert_cont_curr->next;
+            index_cert_id(store, &cert_curr->key_id_entry, cert_curr, cert_curr->key_id, cert_curr->key_id_size);
         }
-
-        PRINT_INFO("Successfully loaded certificate %s", entry->d_name);
-        cert_counter++;
     }
-    closedir(dir);
-    PRINT_INFO("Loaded a total of %d certificates", cert_counter);
-    return certs;
+
+    return store;
+}
+
+cert_store_t* load_certs(const char *certpath)
+{
+    return load_cert_store(certpath, NULL, 0);
 }
\ No newline at end of file
@@ -0,0 +1,144 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: event_loop.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "debug.h"
+#include "event_loop.h"
+
+int init_event_loop(event_loop_t* loop)
+{
+    loop->running = 0;
+    loop->released = NULL;
+    loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(loop->epoll_fd < 0)
+    {
+        PRINT_ERROR("Cannot create the event loop");
+        perror("");
+        return EVENT_LOOP_ERROR;
+    }
+    return EVENT_LOOP_OK;
+}
+
+int event_loop_add(event_loop_t* loop, event_source_t* source, uint32_t events)
+{
+    struct epoll_event event = {.events = events, .data.ptr = source};
+    source->next_released = NULL;
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd, &event) < 0)
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot add file descriptor %d to the event loop", source->fd);
+        return EVENT_LOOP_ERROR;
+    }
+    return EVENT_LOOP_OK;
+}
+
+int event_loop_modify(event_loop_t* loop, event_source_t* source, uint32_t events)
+{
+    struct epoll_event event = {.events = events, .data.ptr = source};
+    if(epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &event) < 0)
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot modify file descriptor %d in the event loop", source->fd);
+        return EVENT_LOOP_ERROR;
+    }
+    return EVENT_LOOP_OK;
+}
+
+/* Stop watching a source and close its file descriptor. Its release callback runs after the current
+   batch of events, so events already returned by epoll for this source are safely ignored */
+void event_loop_close(event_loop_t* loop, event_source_t* source)
+{
+    if(source->fd < 0)
+    {
+        return;
+    }
+    epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+    close(source->fd);
+    source->fd = -1;
+
+    if(source->release)
+    {
+        source->next_released = loop->released;
+        loop->released = source;
+    }
+}
+
+static void release_closed_sources(event_loop_t* loop)
+{
+    while(loop->released)
+    {
+        event_source_t* source = loop->released;
+        loop->released = source->next_released;
+        source->release(source);
+    }
+}
+
+/* Sources closed outside of run_event_loop, e.g. during the cleanup, are released here */
+void cleanup_event_loop(event_loop_t* loop)
+{
+    release_closed_sources(loop);
+    if(loop->epoll_fd >= 0)
+    {
+        close(loop->epoll_fd);
+        loop->epoll_fd = -1;
+    }
+}
+
+/* Dispatch events to the handlers of their sources until running is cleared */
+int run_event_loop(event_loop_t* loop)
+{
+    struct epoll_event events[EVENT_LOOP_MAX_EVENTS];
+
+    loop->running = 1;
+    while(loop->running)
+    {
+        int num_events = epoll_wait(loop->epoll_fd, events, EVENT_LOOP_MAX_EVENTS, -1);
+        if(num_events < 0)
+        {
+            if(EINTR == errno)
+            {
+                continue;
+            }
+            PRINT_ERROR("Waiting for events failed");
+            perror("");
+            return EVENT_LOOP_ERROR;
+        }
+
+        for(int i = 0; i < num_events; i++)
+        {
+            event_source_t* source = events[i].data.ptr;
+            if(source->fd >= 0)
+            {
+                source->handler(source, events[i].events);
+            }
+        }
+        release_closed_sources(loop);
+    }
+    return EVENT_LOOP_OK;
+}
@@ -0,0 +1,478 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: executor.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "debug.h"
+#include "verify.h"
+#include "executor.h"
+#include "ingest.h"
+#include "run_script.h"
+#include "bash_pool.h"
+#include "server.h"
+#include "stats.h"
+
+static void start_waiting_jobs(executor_t* executor);
+static void retire_jobs(executor_t* executor);
+
+/* The buffer of the job stays allocated, the next script of the job is exchanged for it */
+static void free_job_script(script_job_t* job)
+{
+    if(job->mapped)
+    {
+        munmap(job->mapped, job->mapped_size);
+        job->mapped = NULL;
+    }
+    job->script = NULL;
+}
+
+/* A retired job is kept with its buffer for a later script, unless enough of them are kept already */
+static void release_job(script_job_t* job)
+{
+    executor_t* executor = job->executor;
+
+    if(--job->refs > 0)
+    {
+        return;
+    }
+    free_job_script(job);
+    free_script_result(&job->result);
+
+    if(!executor->stopped && executor->num_spare_jobs < EXECUTOR_MAX_SPARE_JOBS)
+    {
+        job->next_spare = executor->spare_jobs;
+        executor->spare_jobs = job;
+        executor->num_spare_jobs++;
+        return;
+    }
+    free(job->buffer);
+    free(job);
+}
+
+static void release_channel(event_source_t* source)
+{
+    release_job(((job_channel_t*) source)->job);
+}
+
+static int add_channel(script_job_t* job, job_channel_t* channel, int fd, uint32_t events, event_handler_t handler)
+{
+    channel->job = job;
+    channel->source.fd = fd;
+    channel->source.handler = handler;
+    channel->source.release = release_channel;
+    if(EVENT_LOOP_OK != event_loop_add(job->executor->loop, &channel->source, events))
+    {
+        close(fd);
+        channel->source.fd = -1;
+        return EXECUTOR_ERROR;
+    }
+    job->refs++;
+    return EXECUTOR_OK;
+}
+
+static void close_channel(script_job_t* job, job_channel_t* channel)
+{
+    event_loop_close(job->executor->loop, &channel->source);
+}
+
+/* The child exited and its output is drained: free its slot and retire what can be retired */
+static void finish_job(script_job_t* job)
+{
+    executor_t* executor = job->executor;
+
+    close_channel(job, &job->input);
+    free_job_script(job);
+    job->done = 1;
+    executor->running--;
+
+    start_waiting_jobs(executor);
+    retire_jobs(executor);
+
+    /* The refill thread replaces the interpreters taken while the executor was busy once a script is over */
+    if(executor->pool)
+    {
+        refill_bash_pool(executor->pool);
+        print_bash_pool_stats(executor->pool);
+    }
+}
+
+static void check_job_finished(script_job_t* job)
+{
+    if(job->exited && job->output.source.fd < 0)
+    {
+        finish_job(job);
+    }
+}
+
+static void handle_input_event(event_source_t* source, uint32_t events)
+{
+    script_job_t* job = ((job_channel_t*) source)->job;
+    (void) events;
+
+    ssize_t written = write(source->fd, job->script + job->written, job->script_size - job->written);
+    if(written < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno))
+    {
+        return;
+    }
+    if(written > 0)
+    {
+        job->written += written;
+    }
+
+    /* Bash may exit without reading the whole script (EPIPE), it is not an error of the server */
+    if(written < 0 || job->written == job->script_size)
+    {
+        close_channel(job, &job->input);
+    }
+}
+
+/* The output is moved to the sink of the job by the kernel, it never goes through the server */
+static void handle_output_event(event_source_t* source, uint32_t events)
+{
+    script_job_t* job = ((job_channel_t*) source)->job;
+    (void) events;
+
+    for(int i = 0; i < EXECUTOR_MAX_READS_PER_EVENT; i++)
+    {
+        int drain_ret = drain_output(&job->result.output, source->fd);
+        if(OUTPUT_SINK_AGAIN == drain_ret)
+        {
+            return;
+        }
+        if(OUTPUT_SINK_OK == drain_ret)
+        {
+            continue;
+        }
+
+        /* Stop at the end of the output, when it cannot be kept anymore or when it reached the limit */
+        if(OUTPUT_SINK_LIMIT == drain_ret)
+        {
+            kill(job->pid, SIGKILL);
+        }
+        close_channel(job, &job->output);
+        check_job_finished(job);
+        return;
+    }
+}
+
+static void handle_process_event(event_source_t* source, uint32_t events)
+{
+    script_job_t* job = ((job_channel_t*) source)->job;
+    int status;
+    struct rusage usage;
+    (void) events;
+
+    set_log_request(job->id);
+    pid_t pid = wait4(job->pid, &status, WNOHANG, &usage);
+    if(0 == pid || (pid < 0 && EINTR == errno))
+    {
+        return;
+    }
+    if(pid < 0)
+    {
+        PRINT_ERROR_DEBUG(debug, "Error waiting for bash");
+    }
+    else
+    {
+        finish_script_result(&job->result, job->id, status, &job->start, &usage);
+    }
+
+    job->exited = 1;
+    close_channel(job, &job->process);
+    check_job_finished(job);
+}
+
+/* Spawn bash for a job and let the event loop feed it and collect its output and exit status */
+static int start_job(script_job_t* job)
+{
+    int stdin_fd, output_fd;
+
+    set_log_request(job->id);
+    if(OUTPUT_SINK_OK != open_output_sink(&job->result.output, job->id))
+    {
+        return EXECUTOR_ERROR;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &job->start);
+    job->pid = acquire_bash(job->executor->pool, job->id, &stdin_fd, &output_fd);
+    if(job->pid < 0)
+    {
+        return EXECUTOR_ERROR;
+    }
+
+    int pidfd = syscall(SYS_pidfd_open, job->pid, 0);
+    fcntl(output_fd, F_SETFL, fcntl(output_fd, F_GETFL) | O_NONBLOCK);
+
+    if(pidfd < 0 || EXECUTOR_OK != add_channel(job, &job->process, pidfd, EPOLLIN, handle_process_event))
+    {
+        close(output_fd);
+        output_fd = -1;
+    }
+    if(output_fd < 0 || EXECUTOR_OK != add_channel(job, &job->output, output_fd, EPOLLIN, handle_output_event))
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot watch bash from the event loop");
+        close(stdin_fd);
+        close_channel(job, &job->process);
+        kill(job->pid, SIGKILL);
+        waitpid(job->pid, NULL, 0);
+        job->pid = -1;
+        return EXECUTOR_ERROR;
+    }
+
+    if(0 == job->script_size)
+    {
+        close(stdin_fd);
+    }
+    else if(EXECUTOR_OK != add_channel(job, &job->input, stdin_fd, EPOLLOUT, handle_input_event))
+    {
+        /* Without its stdin, bash reads an empty script and exits */
+        PRINT_ERROR_DEBUG(debug, "Cannot write the script to bash");
+    }
+
+    PRINT_DEBUG(debug, "Script #%ld started as process %d", job->id, (int) job->pid);
+    return EXECUTOR_OK;
+}
+
+static void start_waiting_jobs(executor_t* executor)
+{
+    while(executor->waiting_head && executor->running < executor->max_children)
+    {
+        script_job_t* job = executor->waiting_head;
+        executor->waiting_head = job->next_waiting;
+        if(!executor->waiting_head)
+        {
+            executor->waiting_tail = NULL;
+        }
+
+        if(EXECUTOR_OK == start_job(job))
+        {
+            executor->running++;
+        }
+        else
+        {
+            PRINT_ERROR("Cannot execute script #%ld", job->id);
+            stats_count(STATS_EXECUTION_FAILURES, 1);
+            free_job_script(job);
+            job->done = 1;
+        }
+    }
+}
+
+/* Hand over the finished jobs in submission order, a job still running holds back the ones after it */
+static void retire_jobs(executor_t* executor)
+{
+    while(executor->head && executor->head->done)
+    {
+        script_job_t* job = executor->head;
+        executor->head = job->next;
+        if(!executor->head)
+        {
+            executor->tail = NULL;
+        }
+
+        set_log_request(job->id);
+        if(job->pid > 0)
+        {
+            if(!job->on_done)
+            {
+                print_script_output(job->id, &job->result);
+            }
+            print_script_exit(job->id, &job->result);
+        }
+        if(job->on_done)
+        {
+            job->on_done(job, job->ctx);
+        }
+        release_job(job);
+    }
+}
+
+int init_executor(executor_t* executor, event_loop_t* loop, int max_children, bash_pool_t* pool)
+{
+    memset(executor, 0, sizeof(executor_t));
+    executor->loop = loop;
+    executor->pool = pool;
+    executor->max_children = (max_children > 0) ? max_children : EXECUTOR_DEFAULT_MAX_CHILDREN;
+    return EXECUTOR_OK;
+}
+
+/* Kill the scripts still running and drop every job that is not retired */
+void cleanup_executor(executor_t* executor)
+{
+    executor->stopped = 1;
+    while(executor->head)
+    {
+        script_job_t* job = executor->head;
+        executor->head = job->next;
+
+        if(job->pid > 0 && !job->exited)
+        {
+            kill(job->pid, SIGKILL);
+            waitpid(job->pid, NULL, 0);
+        }
+        close_channel(job, &job->input);
+        close_channel(job, &job->output);
+        close_channel(job, &job->process);
+        release_job(job);
+    }
+    executor->tail = NULL;
+    executor->waiting_head = NULL;
+    executor->waiting_tail = NULL;
+    executor->running = 0;
+
+    while(executor->spare_jobs)
+    {
+        script_job_t* job = executor->spare_jobs;
+        executor->spare_jobs = job->next_spare;
+        free(job->buffer);
+        free(job);
+    }
+    executor->num_spare_jobs = 0;
+}
+
+/* Take the place of a script in submission order before its verdict is known, so that scripts verified out of
+   order are still retired in the order they were received. The job holds back the later ones until resume_script.
+   sink is where the output of the script goes, an OUTPUT_SINK_CLIENT output is left to on_done */
+script_job_t* reserve_script(executor_t* executor, long id, int sink, job_done_t on_done, void* ctx)
+{
+    script_job_t* job = executor->spare_jobs;
+    char* buffer = NULL;
+    size_t buffer_size = 0;
+
+    if(job)
+    {
+        executor->spare_jobs = job->next_spare;
+        executor->num_spare_jobs--;
+        buffer = job->buffer;
+        buffer_size = job->buffer_size;
+    }
+    else if(NULL == (job = malloc(sizeof(script_job_t))))
+    {
+        PRINT_ERROR("Memory allocation failed");
+        return NULL;
+    }
+
+    memset(job, 0, sizeof(script_job_t));
+    job->buffer = buffer;
+    job->buffer_size = buffer_size;
+    job->executor = executor;
+    job->id = id;
+    job->verdict = VERIFY_SIGNATURE_ERROR;
+    job->pid = -1;
+    job->refs = 1;
+    job->on_done = on_done;
+    job->ctx = ctx;
+    job->input.source.fd = -1;
+    job->output.source.fd = -1;
+    job->process.source.fd = -1;
+    init_script_result(&job->result, sink);
+
+    if(executor->tail)
+    {
+        executor->tail->next = job;
+    }
+    else
+    {
+        executor->head = job;
+    }
+    executor->tail = job;
+    return job;
+}
+
+/* Give a reserved job its verdict. It is executed once a child slot is free if the verdict is valid, otherwise
+   it only keeps its place. signer is the name of the certificate that validated the script, or NULL.
+   signed_script may be NULL for a request that could not be parsed */
+void resume_script(script_job_t* job, signed_script_t* signed_script, int verdict, const char* signer)
+{
+    executor_t* executor = job->executor;
+
+    job->verdict = verdict;
+
+    /* Double check that the signature is valid in case execution flow was hijacked */
+    if(signed_script && VERIFY_SIGNATURE_VALID == verdict && VERIFY_SIGNATURE_VALID == signed_script->valid)
+    {
+        if(signer)
+        {
+            snprintf(job->signer, sizeof(job->signer), "%s", signer);
+        }
+        job->script_size = signed_script->script_size;
+        if(signed_script->mapped)
+        {
+            /* The sealed file cannot change, the job keeps its mapping instead of a copy of the script */
+            size_t script_offset = signed_script->script - signed_script->mapped;
+            job->mapped = detach_ingest_mapping(signed_script, &job->mapped_size);
+            job->script = job->mapped + script_offset;
+        }
+        else
+        {
+            /* The job takes the buffer the script was received in and leaves its own for the next files */
+            size_t script_offset = signed_script->script - signed_script->buffer;
+            size_t buffer_size;
+            char* buffer = detach_ingest_buffer(signed_script, job->buffer, job->buffer_size, &buffer_size);
+            if(buffer)
+            {
+                job->buffer = buffer;
+                job->buffer_size = buffer_size;
+                job->script = buffer + script_offset;
+            }
+        }
+        if(!job->script)
+        {
+            PRINT_ERROR("Memory allocation failed");
+            job->done = 1;
+        }
+    }
+    else
+    {
+        job->done = 1;
+    }
+
+    if(!job->done)
+    {
+        if(executor->waiting_tail)
+        {
+            executor->waiting_tail->next_waiting = job;
+        }
+        else
+        {
+            executor->waiting_head = job;
+        }
+        executor->waiting_tail = job;
+        start_waiting_jobs(executor);
+    }
+
+    retire_jobs(executor);
+}
@@ -0,0 +1,790 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: ingest.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+#include "base64.h"
+#include "debug.h"
+#include "ingest.h"
+#include "merkle.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
+
+size_t max_script_size = MAX_SCRIPT_SIZE;
+
+/* Largest line of chunk hashes of a v2 script of at most max_size bytes, without its newline */
+static size_t max_chunk_hashes_line_size(size_t chunk_size, size_t max_size)
+{
+    size_t num_chunks = max_size / chunk_size + 1;
+    return 4 * ((num_chunks * SHA256_DIGEST_LENGTH + 2) / 3);
+}
+
+/* The signature line, its newline, the chunk hashes of a v2 script cut in the smallest chunks and their newline,
+   the largest script, one byte to detect a larger script and one to terminate it */
+static size_t max_buffer_size(void)
+{
+    return MAX_SIGNATURE_LINE_SIZE + 1 + max_chunk_hashes_line_size(MIN_CHUNK_SIZE, max_script_size) + 1 + max_script_size + 2;
+}
+
+int init_ingest(signed_script_t* signed_script)
+{
+    signed_script->buffer = malloc(INGEST_INITIAL_BUFFER_SIZE);
+    signed_script->mapped = NULL;
+    signed_script->chunk_hashes = NULL;
+    signed_script->chunk_hashes_size = 0;
+    signed_script->digest_ctx = EVP_MD_CTX_new();
+
+    if (NULL == signed_script->buffer || NULL == signed_script->digest_ctx)
+    {
+        PRINT_ERROR("Memory allocation failed");
+        cleanup_ingest(signed_script);
+        return INGEST_ERROR;
+    }
+    signed_script->buffer_size = INGEST_INITIAL_BUFFER_SIZE;
+    begin_ingest(signed_script);
+    return INGEST_OK;
+}
+
+static void release_mapping(signed_script_t* signed_script)
+{
+    if(signed_script->mapped)
+    {
+        munmap(signed_script->mapped, signed_script->mapped_size);
+        signed_script->mapped = NULL;
+        signed_script->mapped_size = 0;
+    }
+}
+
+void cleanup_ingest(signed_script_t* signed_script)
+{
+    release_mapping(signed_script);
+    free(signed_script->buffer);
+    free(signed_script->chunk_hashes);
+    EVP_MD_CTX_free(signed_script->digest_ctx);
+    signed_script->buffer = NULL;
+    signed_script->chunk_hashes = NULL;
+    signed_script->digest_ctx = NULL;
+    signed_script->buffer_size = 0;
+    signed_script->chunk_hashes_size = 0;
+}
+
+/* Start receiving a new file in the buffer of signed_script */
+void begin_ingest(signed_script_t* signed_script)
+{
+    set_log_request(0);
+    release_mapping(signed_script);
+    signed_script->received_size = 0;
+    signed_script->script_offset = 0;
+    signed_script->signature_line_size = 0;
+    signed_script->script_digest_ready = 0;
+    signed_script->format = SIGNED_SCRIPT_V1;
+    signed_script->num_chunks = 0;
+    signed_script->chunks_checked = 0;
+}
+
+/* Return where the next bytes of the file should be written and how many fit there.
+   The buffer grows as needed up to the size of the largest acceptable file */
+char* ingest_reserve(signed_script_t* signed_script, size_t* available)
+{
+    /* Always keep one byte to terminate the script */
+    size_t free_size = signed_script->buffer_size - signed_script->received_size - 1;
+
+    if (free_size < INGEST_MIN_READ_SIZE && signed_script->buffer_size < max_buffer_size())
+    {
+        size_t new_size = 2 * signed_script->buffer_size;
+        if (new_size > max_buffer_size())
+        {
+            new_size = max_buffer_size();
+        }
+
+        char* new_buffer = realloc(signed_script->buffer, new_size);
+        if (NULL == new_buffer)
+        {
+            PRINT_ERROR("Memory allocation failed");
+            *available = 0;
+            return NULL;
+        }
+        signed_script->buffer = new_buffer;
+        signed_script->buffer_size = new_size;
+        free_size = new_size - signed_script->received_size - 1;
+    }
+
+    *available = free_size;
+    return (free_size > 0) ? signed_script->buffer + signed_script->received_size : NULL;
+}
+
+/* Parse the "SVS2 <chunk size> " prefix of a v2 signature line. Returns the size of the prefix, 0 for a v1 file,
+   or -1 if the chunk size is not acceptable */
+static int parse_format(signed_script_t* signed_script, const char* line, size_t line_size)
+{
+    size_t prefix_size = sizeof(SIGNED_SCRIPT_V2_PREFIX) - 1;
+    size_t chunk_size = 0;
+    size_t i;
+
+    signed_script->format = SIGNED_SCRIPT_V1;
+    if (line_size < prefix_size || memcmp(line, SIGNED_SCRIPT_V2_PREFIX, prefix_size) != 0)
+    {
+        return 0;
+    }
+
+    for (i = prefix_size; i < line_size && i < SIGNED_SCRIPT_V2_MAX_PREFIX_SIZE - 1 && line[i] >= '0' && line[i] <= '9'; i++)
+    {
+        chunk_size = 10 * chunk_size + (line[i] - '0');
+    }
+    if (i == prefix_size || i >= line_size || line[i] != ' ' || chunk_size < MIN_CHUNK_SIZE || chunk_size > MAX_CHUNK_SIZE ||
+        (chunk_size & (chunk_size - 1)) != 0)
+    {
+        PRINT_ERROR_DEBUG(debug, "The chunk size of the v2 signed script is not acceptable");
+        return -1;
+    }
+
+    signed_script->format = SIGNED_SCRIPT_V2;
+    signed_script->chunk_size = chunk_size;
+    return i + 1;
+}
+
+/* Decode the line of chunk hashes of a v2 file, which starts at line. Returns its size with the newline or -1 */
+static long parse_chunk_hashes(signed_script_t* signed_script, const char* line, size_t available)
+{
+    size_t max_size = max_chunk_hashes_line_size(signed_script->chunk_size, signed_script->mapped ? INGEST_MAX_MAPPED_SIZE : max_script_size);
+    char* line_end = memchr(line, '\n', (available > max_size + 1) ? max_size + 1 : available);
+    if (!line_end)
+    {
+        PRINT_ERROR_DEBUG(debug, "The chunk hashes of the v2 signed script are missing or too long");
+        return -1;
+    }
+
+    size_t line_size = line_end - line;
+    size_t decoded_size = BASE64_DECODED_SIZE(line_size);
+    if (decoded_size > signed_script->chunk_hashes_size)
+    {
+        unsigned char* chunk_hashes = realloc(signed_script->chunk_hashes, decoded_size);
+        if (NULL == chunk_hashes)
+        {
+            PRINT_ERROR("Memory allocation failed");
+            return -1;
+        }
+        signed_script->chunk_hashes = chunk_hashes;
+        signed_script->chunk_hashes_size = decoded_size;
+    }
+
+    size_t consumed;
+    int decoded = base64_decode(signed_script->chunk_hashes, signed_script->chunk_hashes_size, line, line_size, &consumed);
+    if (decoded <= 0 || consumed != line_size || decoded % SHA256_DIGEST_LENGTH != 0)
+    {
+        PRINT_ERROR_DEBUG(debug, "The chunk hashes of the v2 signed script cannot be decoded");
+        return -1;
+    }
+    signed_script->num_chunks = decoded / SHA256_DIGEST_LENGTH;
+    signed_script->chunks_checked = 0;
+    return line_size + 1;
+}
+
+/* Look for the end of the header in the bytes received from scan_from. The header is the signature line, followed
+   in a v2 file by the chunk hashes. They are decoded right away so that every chunk is checked as soon as it is
+   complete */
+static int locate_header(signed_script_t* signed_script, size_t scan_from)
+{
+    char* buffer = signed_script->buffer;
+
+    if (0 == signed_script->signature_line_size)
+    {
+        char* sigend = memchr(buffer + scan_from, '\n', signed_script->received_size - scan_from);
+        if (!sigend)
+        {
+            if (signed_script->received_size > MAX_SIGNATURE_LINE_SIZE)
+            {
+                PRINT_ERROR_DEBUG(debug, "The signature line is too long");
+                return INGEST_ERROR;
+            }
+            return INGEST_OK;
+        }
+        signed_script->signature_line_size = sigend - buffer + 1;
+        if (parse_format(signed_script, buffer, signed_script->signature_line_size - 1) < 0)
+        {
+            return INGEST_ERROR;
+        }
+        if (SIGNED_SCRIPT_V1 == signed_script->format)
+        {
+            signed_script->script_offset = signed_script->signature_line_size;
+            return INGEST_OK;
+        }
+        scan_from = signed_script->signature_line_size;
+    }
+
+    char* hashes_end = memchr(buffer + scan_from, '\n', signed_script->received_size - scan_from);
+    if (!hashes_end)
+    {
+        if (signed_script->received_size - signed_script->signature_line_size > max_chunk_hashes_line_size(signed_script->chunk_size, max_script_size))
+        {
+            PRINT_ERROR_DEBUG(debug, "The chunk hashes of the v2 signed script are too long");
+            return INGEST_ERROR;
+        }
+        return INGEST_OK;
+    }
+    signed_script->script_offset = hashes_end - buffer + 1;
+    if (parse_chunk_hashes(signed_script, buffer + signed_script->signature_line_size,
+                           signed_script->script_offset - signed_script->signature_line_size) < 0)
+    {
+        return INGEST_ERROR;
+    }
+    return INGEST_OK;
+}
+
+/* Compare the hash of the chunk being received with the one listed in the header */
+static int finish_chunk(signed_script_t* signed_script)
+{
+    unsigned char leaf[SHA256_DIGEST_LENGTH];
+    if (!EVP_DigestFinal_ex(signed_script->digest_ctx, leaf, NULL))
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot compute the digest of the chunk");
+        return INGEST_ERROR;
+    }
+    if (memcmp(leaf, signed_script->chunk_hashes + signed_script->chunks_checked * SHA256_DIGEST_LENGTH, SHA256_DIGEST_LENGTH) != 0)
+    {
+        PRINT_ERROR_DEBUG(debug, "Chunk %lu of the v2 signed script does not match its hash", signed_script->chunks_checked);
+        return INGEST_REJECTED;
+    }
+    signed_script->chunks_checked++;
+    return INGEST_OK;
+}
+
+/* Hash the received bytes of a v2 script from hashed_from chunk by chunk, a file is rejected at its first bad chunk
+   or as soon as it is longer than its chunks */
+static int check_received_chunks(signed_script_t* signed_script, size_t hashed_from)
+{
+    size_t chunk_size = signed_script->chunk_size;
+
+    while (hashed_from < signed_script->received_size)
+    {
+        size_t chunk_start = signed_script->script_offset + signed_script->chunks_checked * chunk_size;
+        if (hashed_from == chunk_start)
+        {
+            if (signed_script->chunks_checked == signed_script->num_chunks)
+            {
+                PRINT_ERROR_DEBUG(debug, "The v2 signed script is longer than its %lu chunks", signed_script->num_chunks);
+                return INGEST_REJECTED;
+            }
+            if (MERKLE_OK != merkle_leaf_init(signed_script->digest_ctx))
+            {
+                PRINT_ERROR_DEBUG(debug, "Cannot initialize the digest of the chunk");
+                return INGEST_ERROR;
+            }
+        }
+
+        size_t end = chunk_start + chunk_size;
+        if (end > signed_script->received_size)
+        {
+            end = signed_script->received_size;
+        }
+        if (!EVP_DigestUpdate(signed_script->digest_ctx, signed_script->buffer + hashed_from, end - hashed_from))
+        {
+            PRINT_ERROR_DEBUG(debug, "Cannot update the digest of the chunk");
+            return INGEST_ERROR;
+        }
+        hashed_from = end;
+
+        if (end == chunk_start + chunk_size)
+        {
+            int ret = finish_chunk(signed_script);
+            if (INGEST_OK != ret)
+            {
+                return ret;
+            }
+        }
+    }
+    return INGEST_OK;
+}
+
+/* Account for size bytes written at the position returned by ingest_reserve. The header is located as soon as it
+   is complete and the script is hashed as it arrives, chunk by chunk for a v2 file */
+int ingest_append(signed_script_t* signed_script, size_t size)
+{
+    size_t hashed_from = signed_script->received_size;
+    signed_script->received_size += size;
+
+    if (0 == hashed_from)
+    {
+        signed_script->ingest_start = stats_now();
+    }
+
+    if (0 == signed_script->script_offset)
+    {
+        int ret = locate_header(signed_script, hashed_from);
+        if (INGEST_OK != ret || 0 == signed_script->script_offset)
+        {
+            return ret;
+        }
+
+        if (SIGNED_SCRIPT_V1 == signed_script->format && !EVP_DigestInit_ex(signed_script->digest_ctx, EVP_sha256(), NULL))
+        {
+            PRINT_ERROR_DEBUG(debug, "Cannot initialize the digest of the script");
+            return INGEST_ERROR;
+        }
+        hashed_from = signed_script->script_offset;
+    }
+
+    if (signed_script->received_size - signed_script->script_offset > max_script_size)
+    {
+        PRINT_ERROR_DEBUG(debug, "The script is larger than %lu bytes", max_script_size);
+        return INGEST_TOO_LARGE;
+    }
+
+    if (SIGNED_SCRIPT_V2 == signed_script->format)
+    {
+        return check_received_chunks(signed_script, hashed_from);
+    }
+
+    if (signed_script->received_size > hashed_from &&
+        !EVP_DigestUpdate(signed_script->digest_ctx, signed_script->buffer + hashed_from, signed_script->received_size - hashed_from))
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot update the digest of the script");
+        return INGEST_ERROR;
+    }
+
+    return INGEST_OK;
+}
+
+/* Take a file passed by a client instead of receiving its bytes. A file sealed against any change is mapped and
+   parsed in place, the script is hashed and executed from the mapping. Any other regular file could change
+   between the verification and the execution, so it is copied to the buffer like a received file */
+int ingest_file(signed_script_t* signed_script, int fd)
+{
+    struct stat st;
+    if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        PRINT_ERROR_DEBUG(debug, "The passed file descriptor is not a regular file");
+        return INGEST_ERROR;
+    }
+    signed_script->ingest_start = stats_now();
+
+    int seals = fcntl(fd, F_GET_SEALS);
+    if(seals >= 0 && INGEST_REQUIRED_SEALS == (seals & INGEST_REQUIRED_SEALS))
+    {
+        if(0 == st.st_size)
+        {
+            return INGEST_OK;
+        }
+        if(st.st_size > INGEST_MAX_MAPPED_SIZE)
+        {
+            PRINT_ERROR_DEBUG(debug, "The passed file is larger than %ld bytes", INGEST_MAX_MAPPED_SIZE);
+            return INGEST_TOO_LARGE;
+        }
+        void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if(MAP_FAILED == map)
+        {
+            PRINT_ERROR_DEBUG(debug, "Cannot map the passed file");
+            return INGEST_ERROR;
+        }
+        signed_script->mapped = map;
+        signed_script->mapped_size = st.st_size;
+        signed_script->received_size = st.st_size;
+        return INGEST_OK;
+    }
+
+    PRINT_DEBUG(debug, "The passed file is not sealed, it is copied");
+    int ingest_ret = INGEST_OK;
+    while(INGEST_OK == ingest_ret)
+    {
+        size_t available;
+        char* free_space = ingest_reserve(signed_script, &available);
+        if(NULL == free_space)
+        {
+            return INGEST_ERROR;
+        }
+        ssize_t read_size = pread(fd, free_space, available, signed_script->received_size);
+        if(read_size < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if(read_size <= 0)
+        {
+            return (read_size < 0) ? INGEST_ERROR : INGEST_OK;
+        }
+        ingest_ret = ingest_append(signed_script, read_size);
+    }
+    return ingest_ret;
+}
+
+/* Hand over the mapping of a passed file, so that it outlives the reuse of signed_script. The caller unmaps it */
+char* detach_ingest_mapping(signed_script_t* signed_script, size_t* mapped_size)
+{
+    char* mapped = signed_script->mapped;
+    *mapped_size = signed_script->mapped_size;
+    signed_script->mapped = NULL;
+    signed_script->mapped_size = 0;
+    return mapped;
+}
+
+/* Hand over the buffer holding the received file, so that its script outlives the reuse of signed_script without
+   being copied. The next files are received in spare, a buffer of spare_size bytes handed over earlier, or in a new
+   buffer if spare is NULL. Returns the buffer and sets buffer_size to its size, or NULL if no buffer is left */
+char* detach_ingest_buffer(signed_script_t* signed_script, char* spare, size_t spare_size, size_t* buffer_size)
+{
+    if (NULL == spare)
+    {
+        spare = malloc(INGEST_INITIAL_BUFFER_SIZE);
+        spare_size = INGEST_INITIAL_BUFFER_SIZE;
+        if (NULL == spare)
+        {
+            PRINT_ERROR("Memory allocation failed");
+            return NULL;
+        }
+    }
+
+    char* buffer = signed_script->buffer;
+    *buffer_size = signed_script->buffer_size;
+    signed_script->buffer = spare;
+    signed_script->buffer_size = spare_size;
+    signed_script->received_size = 0;
+    signed_script->signature = NULL;
+    signed_script->script = NULL;
+    return buffer;
+}
+
+/* Check the chunks of a v2 script that were not checked as they arrived, then build the signed message from the
+   Merkle root. Its sha256 takes the place of the digest of the script */
+static int end_chunks(signed_script_t* signed_script)
+{
+    size_t num_chunks = merkle_num_chunks(signed_script->script_size, signed_script->chunk_size);
+    if (num_chunks != signed_script->num_chunks)
+    {
+        PRINT_ERROR("The v2 signed script has %lu chunks but %lu chunk hashes", num_chunks, signed_script->num_chunks);
+        return INGEST_REJECTED;
+    }
+
+    if (signed_script->mapped)
+    {
+        /* The whole script is there at once, its chunks are checked in parallel */
+        size_t bad_chunk;
+        int ret = check_merkle_chunks(signed_script->script, signed_script->script_size, signed_script->chunk_size,
+                                      signed_script->chunk_hashes, &bad_chunk);
+        if (MERKLE_MISMATCH == ret)
+        {
+            PRINT_ERROR("Chunk %lu of the v2 signed script does not match its hash", bad_chunk);
+            return INGEST_REJECTED;
+        }
+        if (MERKLE_OK != ret)
+        {
+            PRINT_ERROR_DEBUG(debug, "Cannot check the chunks of the script");
+            return INGEST_ERROR;
+        }
+    }
+    else if (signed_script->chunks_checked < num_chunks)
+    {
+        /* The last chunk is shorter, or the script is empty */
+        if (0 == signed_script->script_size && MERKLE_OK != merkle_leaf_init(signed_script->digest_ctx))
+        {
+            PRINT_ERROR_DEBUG(debug, "Cannot initialize the digest of the chunk");
+            return INGEST_ERROR;
+        }
+        int ret = finish_chunk(signed_script);
+        if (INGEST_REJECTED == ret)
+        {
+            PRINT_ERROR("The last chunk of the v2 signed script does not match its hash");
+        }
+        if (INGEST_OK != ret)
+        {
+            return ret;
+        }
+    }
+
+    unsigned char* message = signed_script->signed_message;
+    uint32_t chunk_size = signed_script->chunk_size;
+    uint64_t script_size = signed_script->script_size;
+    memcpy(message, SIGNED_SCRIPT_V2_MAGIC, 4);
+    for (int i = 0; i < 4; i++)
+    {
+        message[4 + i] = chunk_size >> (8 * (3 - i));
+    }
+    for (int i = 0; i < 8; i++)
+    {
+        message[8 + i] = script_size >> (8 * (7 - i));
+    }
+    if (MERKLE_OK != merkle_root(signed_script->digest_ctx, signed_script->chunk_hashes, num_chunks, message + 16) ||
+        !EVP_DigestInit_ex(signed_script->digest_ctx, EVP_sha256(), NULL) ||
+        !EVP_DigestUpdate(signed_script->digest_ctx, message, SIGNED_MESSAGE_V2_SIZE) ||
+        !EVP_DigestFinal_ex(signed_script->digest_ctx, signed_script->script_digest, NULL))
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot compute the Merkle root of the script");
+        return INGEST_ERROR;
+    }
+    signed_script->script_digest_ready = 1;
+    return INGEST_OK;
+}
+
+/* The whole file is received: parse it and finish the digest of the script */
+int end_ingest(signed_script_t* signed_script)
+{
+    if (INGEST_OK != parse_signed_script(signed_script, signed_script->received_size))
+    {
+        return INGEST_ERROR;
+    }
+
+    if (SIGNED_SCRIPT_V2 == signed_script->format)
+    {
+        return end_chunks(signed_script);
+    }
+
+    /* A mapped script is hashed when it is verified, straight from the mapping */
+    if (signed_script->mapped)
+    {
+        return INGEST_OK;
+    }
+
+    if (!EVP_DigestFinal_ex(signed_script->digest_ctx, signed_script->script_digest, NULL))
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot compute the digest of the script");
+        return INGEST_ERROR;
+    }
+    signed_script->script_digest_ready = 1;
+    return INGEST_OK;
+}
+
+/* The writer is done: number the received script, announce it and parse it.
+   ingest_ret is the status returned while receiving the file */
+int complete_ingest(signed_script_t* signed_script, int ingest_ret)
+{
+    /* Nothing was written, e.g. the previous writer closed the pipe after it was reopened */
+    if(INGEST_OK == ingest_ret && 0 == signed_script->received_size)
+    {
+        PRINT_DEBUG(debug, "The fifo named pipe was closed without receiving any data");
+        return INGEST_EMPTY;
+    }
+
+    /* Number the script, the counter is shared between all workers */
+    signed_script->id = __atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED);
+    stats_count(STATS_SCRIPTS_RECEIVED, 1);
+    stats_count(STATS_BYTES_INGESTED, signed_script->received_size);
+
+    set_log_request(signed_script->id);
+    trace_begin(signed_script->id);
+
+    /* The banner is one message so that banners of different workers do not mix */
+    PRINT_INFO(" \n \n"
+               "============================================\n"
+               "========== Received script #%ld ==============\n"
+               "============================================", signed_script->id);
+
+    if(INGEST_TOO_LARGE == ingest_ret)
+    {
+        PRINT_ERROR("The received script is larger than %lu bytes", max_script_size);
+        stats_count(STATS_INGEST_ERRORS, 1);
+        return INGEST_ERROR;
+    }
+    if(INGEST_REJECTED == ingest_ret)
+    {
+        PRINT_ERROR("The script was rejected while it was received, it does not match its chunk hashes");
+        stats_count(STATS_INGEST_ERRORS, 1);
+        return INGEST_ERROR;
+    }
+    if(INGEST_OK != ingest_ret)
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot read the file from the fifo named pipe");
+        stats_count(STATS_INGEST_ERRORS, 1);
+        return INGEST_ERROR;
+    }
+
+    if(INGEST_OK != end_ingest(signed_script))
+    {
+        stats_count(STATS_INGEST_ERRORS, 1);
+        return INGEST_ERROR;
+    }
+    stats_record_since(STATS_INGEST, signed_script->ingest_start);
+    trace_span(signed_script->id, STATS_INGEST, signed_script->ingest_start, NULL, NULL);
+    return INGEST_OK;
+}
+
+/* Convert a hex string to bytes, returns the number of bytes or -1 */
+static int parse_hex(unsigned char* out, size_t out_size, const char* hex, size_t hex_size)
+{
+    if(0 == hex_size || hex_size % 2 != 0 || hex_size / 2 > out_size)
+    {
+        return -1;
+    }
+
+    for(size_t i = 0; i < hex_size; i++)
+    {
+        int nibble;
+        char c = hex[i];
+        if(c >= '0' && c <= '9')
+        {
+            nibble = c - '0';
+        }
+        else if(c >= 'a' && c <= 'f')
+        {
+            nibble = c - 'a' + 10;
+        }
+        else if(c >= 'A' && c <= 'F')
+        {
+            nibble = c - 'A' + 10;
+        }
+        else
+        {
+            return -1;
+        }
+
+        if(i % 2 == 0)
+        {
+            out[i / 2] = nibble << 4;
+        }
+        else
+        {
+            out[i / 2] |= nibble;
+        }
+    }
+    return hex_size / 2;
+}
+
+/* Split a received file into its signature and its script. The first line is either
+   "<base64 signature>" or "<hex key identifier>:<base64 signature>" */
+int parse_signed_script(signed_script_t* signed_script, size_t file_size)
+{
+    char* file = signed_script->mapped ? signed_script->mapped : signed_script->buffer;
+    signed_script->signature = file;
+    signed_script->signature_size = 0;
+    signed_script->script_size = 0;
+    signed_script->key_id_size = 0;
+    signed_script->decoded_signature_size = 0;
+    signed_script->script_digest_ready = 0;
+
+    /* A received file had its newline located as it arrived. A mapped file is not scanned for it beforehand,
+       the decoder stops at the first byte after the base64 signature, which must be the newline */
+    size_t line_size = signed_script->signature_line_size ? signed_script->signature_line_size - 1 :
+                       ((file_size > MAX_SIGNATURE_LINE_SIZE + 1) ? MAX_SIGNATURE_LINE_SIZE + 1 : file_size);
+
+    /* A v2 signature line starts with its format and chunk size */
+    int prefix_size = parse_format(signed_script, file, line_size);
+    if(prefix_size < 0)
+    {
+        return INGEST_ERROR;
+    }
+    char* line = file + prefix_size;
+    line_size -= prefix_size;
+    signed_script->signature = line;
+
+    /* Parse the optional key identifier hint, it is only looked for where it fits */
+    char* hint_end = memchr(line, KEY_ID_HINT_SEPARATOR, (line_size > MAX_KEY_ID_HINT_SIZE) ? MAX_KEY_ID_HINT_SIZE : line_size);
+    if(hint_end && memchr(line, '\n', hint_end - line))
+    {
+        hint_end = NULL;
+    }
+    if(hint_end)
+    {
+        int key_id_size = parse_hex(signed_script->key_id, sizeof(signed_script->key_id), line, hint_end - line);
+        if(key_id_size <= 0)
+        {
+            PRINT_ERROR_DEBUG(debug, "Cannot parse the key identifier from the file");
+            return INGEST_ERROR;
+        }
+        signed_script->key_id_size = key_id_size;
+        signed_script->signature = hint_end + 1;
+    }
+
+    /* Decode the signature while looking for its end, one character more than the largest signature is enough
+       to tell that it is too long */
+    size_t signature_limit = line_size - (signed_script->signature - line);
+    if(signature_limit > MAX_SIGNATURE_SIZE + 1)
+    {
+        signature_limit = MAX_SIGNATURE_SIZE + 1;
+    }
+    uint64_t start = stats_now();
+    int decoded_size = base64_decode(signed_script->decoded_signature, sizeof(signed_script->decoded_signature),
+                                     signed_script->signature, signature_limit, &signed_script->signature_size);
+    stats_record_since(STATS_DECODE, start);
+    trace_span(signed_script->id, STATS_DECODE, start, NULL, NULL);
+
+    /* Ensure that the signature size is acceptable */
+    if (signed_script->signature_size < MIN_SIGNATURE_SIZE || signed_script->signature_size > MAX_SIGNATURE_SIZE)
+    {
+        PRINT_ERROR_DEBUG(debug, "Signature size in the file (size = %ld) is not acceptable", signed_script->signature_size);
+        return INGEST_ERROR;
+    }
+
+    char* sigend = signed_script->signature + signed_script->signature_size;
+    if(sigend >= file + file_size || *sigend != '\n')
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot parse the signature from the file");
+        return INGEST_ERROR;
+    }
+    if(decoded_size <= 0)
+    {
+        PRINT_ERROR_DEBUG(debug, "Decoding signature failed, it is not valid base64");
+        return INGEST_ERROR;
+    }
+    signed_script->decoded_signature_size = decoded_size;
+
+    /* The chunk hashes of a v2 file follow, those of a received file were decoded as soon as they arrived */
+    char* script = sigend + 1;
+    if(SIGNED_SCRIPT_V2 == signed_script->format)
+    {
+        if(signed_script->script_offset)
+        {
+            script = file + signed_script->script_offset;
+        }
+        else
+        {
+            long hashes_size = parse_chunk_hashes(signed_script, script, file + file_size - script);
+            if(hashes_size < 0)
+            {
+                return INGEST_ERROR;
+            }
+            script += hashes_size;
+        }
+    }
+
+    /* Parse the script */
+    signed_script->script = script;
+    signed_script->script_size = file_size - (signed_script->script - file);
+    if(!signed_script->mapped)
+    {
+        signed_script->script[signed_script->script_size] = '\0';
+    }
+
+    PRINT_DEBUG(debug, "Script #%ld is parsed successfuly", signed_script->id);
+    PRINT_DEBUG(debug, "Size of the recieved file is %lu", file_size);
+    PRINT_DEBUG(debug, "Size of the signature is %lu", signed_script->signature_size);
+    PRINT_DEBUG(debug, "Size of the key identifier is %lu", signed_script->key_id_size);
+    if(SIGNED_SCRIPT_V2 == signed_script->format)
+    {
+        PRINT_DEBUG(debug, "The script is signed in %lu chunks of %lu bytes", signed_script->num_chunks, signed_script->chunk_size);
+    }
+    PRINT_DEBUG(debug, "Size of the script is %lu", signed_script->script_size);
+    PRINT_DEBUG(debug, "Signature value\n===>\n%.*s\n<===", (int)signed_script->signature_size, signed_script->signature);
+    PRINT_DEBUG(debug, "Script content\n===>\n%.*s\n<===", (int) signed_script->script_size, signed_script->script);
+
+    return INGEST_OK;
+}
\ No newline at end of file
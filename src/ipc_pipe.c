@@ -32,24 +32,23 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "debug.h"
 #include "ipc_pipe.h"
+#include "ingest.h"
 #include "server.h"
 
-int init_pipe(signed_script_t* signed_script)
+int init_pipe(signed_script_t* signed_script, const char* pipe_path)
 {
     /* Allocate memory for buffer */
-    signed_script->signature = malloc(MAX_FILE_SIZE);
-
-    if (NULL == signed_script->signature)
+    if (INGEST_OK != init_ingest(signed_script))
     {
-        PRINT_ERROR("Memory allocation failed");
         return READ_PIPE_INIT_ERROR;
     }
 
-    remove(SERVER_PIPE_PATH);
-    if(mkfifo(SERVER_PIPE_PATH, 0666) < 0)
+    remove(pipe_path);
+    if(mkfifo(pipe_path, 0666) < 0)
     {
         PRINT_ERROR("Cannot create a fifo named pipe");
         perror("");
@@ -60,73 +59,81 @@ int init_pipe(signed_script_t* signed_script)
     return READ_PIPE_INIT_OK;
 }
 
-int read_from_pipe(signed_script_t* signed_script)
+int read_from_pipe(signed_script_t* signed_script, const char* pipe_path)
 {
-    int file_size;
     int fifo_fd;
+    int ingest_ret = INGEST_OK;
 
     signed_script->signature_size = 0;
     signed_script->script_size = 0;
 
     /* Open the fifo pipe to receive files */
-    fifo_fd = open(SERVER_PIPE_PATH, O_RDONLY);
+    fifo_fd = open(pipe_path, O_RDONLY);
     if(fifo_fd < 0)
     {
         PRINT_ERROR_DEBUG(debug, "Cannot open the fifo named pipe");
         return READ_PIPE_ERROR;
     }
 
-    /* Read one file. This is blocking */
-    file_size = read(fifo_fd, signed_script->signature, MAX_FILE_SIZE);
-
-    PRINT_INFO(" ");
-    PRINT_INFO(" ");
-    PRINT_INFO("============================================");
-    PRINT_INFO("========== Received script #%ld ==============", ++counter);
-    PRINT_INFO("============================================");
-
-    /* Close the fifo pipe after reading one file */
-    if(close(fifo_fd) < 0)
+    /* Read one file until the writer closes the pipe. This is blocking */
+    begin_ingest(signed_script);
+    for(;;)
     {
-        PRINT_ERROR_DEBUG(debug, "Cannot close the fifo named pipe");
-        return READ_PIPE_ERROR;
+        size_t available;
+        char* free_space = ingest_reserve(signed_script, &available);
+        if(NULL == free_space)
+        {
+            ingest_ret = INGEST_ERROR;
+            break;
+        }
+
+        ssize_t read_size = read(fifo_fd, free_space, available);
+        if(read_size < 0 && EINTR == errno)
+        {
+            continue;
+        }
+        if(read_size <= 0)
+        {
+            ingest_ret = (read_size < 0) ? INGEST_ERROR : INGEST_OK;
+            break;
+        }
+
+        ingest_ret = ingest_append(signed_script, read_size);
+        if(INGEST_OK != ingest_ret)
+        {
+            break;
+        }
     }
 
-    /* Stop if the size is zero */
-    if(file_size == 0)
+    /* Discard the rest of a file that was not read to its end, whatever stopped its ingest, like the fifo
+       listener does. Otherwise it would be read as the next file */
+    if(INGEST_OK != ingest_ret)
     {
-        PRINT_ERROR("The received file is empty file");
-        return READ_PIPE_ERROR;
+        char discard[INGEST_MIN_READ_SIZE];
+        ssize_t read_size;
+        while((read_size = read(fifo_fd, discard, sizeof(discard))) != 0)
+        {
+            if(read_size < 0 && EINTR != errno)
+            {
+                break;
+            }
+        }
     }
 
-    /* Parse the signature part */
-    char* sigend = strchr(signed_script->signature, '\n');
-    if(!sigend)
+    /* Close the fifo pipe after reading one file */
+    if(close(fifo_fd) < 0)
     {
-        PRINT_ERROR_DEBUG(debug, "Cannot parse the signature from the file");
+        PRINT_ERROR_DEBUG(debug, "Cannot close the fifo named pipe");
         return READ_PIPE_ERROR;
     }
 
-    signed_script->signature_size = sigend - signed_script->signature;
-
-    /* Ensure that the signature size is acceptable */
-    if (signed_script->signature_size < MIN_SIGNATURE_SIZE || signed_script->signature_size > MAX_SIGNATURE_SIZE)
+    switch(complete_ingest(signed_script, ingest_ret))
     {
-        PRINT_ERROR_DEBUG(debug, "Signature size in the file (size = %ld) is not acceptable", signed_script->signature_size);
-        return READ_PIPE_ERROR;
+        case INGEST_OK:
+            return READ_PIPE_OK;
+        case INGEST_EMPTY:
+            return READ_PIPE_EMPTY;
+        default:
+            return READ_PIPE_ERROR;
     }
-
-    /* Parse the script */
-    signed_script->script = signed_script->signature + signed_script->signature_size + 1;
-    signed_script->script_size = file_size - signed_script->signature_size - 1;
-    signed_script->script[signed_script->script_size] = '\0';
-
-    PRINT_DEBUG(debug, "Script #%ld is parsed successfuly", counter);
-    PRINT_DEBUG(debug, "Size of the recieved file is %d", file_size);
-    PRINT_DEBUG(debug, "Size of the signature is %lu", signed_script->signature_size);
-    PRINT_DEBUG(debug, "Size of the script is %lu", signed_script->script_size);
-    PRINT_DEBUG(debug, "Signature value\n===>\n%.*s\n<===", (int)signed_script->signature_size, signed_script->signature);
-    PRINT_DEBUG(debug, "Script content\n===>\n%.*s\n<===", (int) signed_script->script_size, signed_script->script);
-
-    return READ_PIPE_OK;
 }
\ No newline at end of file
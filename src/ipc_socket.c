@@ -0,0 +1,655 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: ipc_socket.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "debug.h"
+#include "ingest.h"
+#include "ipc_socket.h"
+#include "run_script.h"
+#include "verify.h"
+#include "server.h"
+#include "stats.h"
+#include "trace.h"
+
+#define SOCKET_MAX_READS_PER_EVENT      16
+
+static void handle_connection_event(event_source_t* source, uint32_t events);
+
+/* A request whose reply is sent or dropped is kept for the next requests of the connection */
+static void recycle_request(socket_connection_t* conn, socket_request_t* request)
+{
+    if(conn->num_spare_requests < SOCKET_MAX_SPARE_REQUESTS)
+    {
+        request->next_spare = conn->spare_requests;
+        conn->spare_requests = request;
+        conn->num_spare_requests++;
+        return;
+    }
+    free(request);
+}
+
+static void free_queued_reply(socket_connection_t* conn, queued_reply_t* reply)
+{
+    if(reply->output_fd >= 0)
+    {
+        close(reply->output_fd);
+    }
+    recycle_request(conn, (socket_request_t*) reply);
+}
+
+static void free_connection(socket_connection_t* conn)
+{
+    socket_server_t* server = conn->server;
+
+    server->num_connections--;
+    if(conn->prev)
+    {
+        conn->prev->next = conn->next;
+    }
+    else
+    {
+        server->connections = conn->next;
+    }
+    if(conn->next)
+    {
+        conn->next->prev = conn->prev;
+    }
+    if(conn->passed_fd >= 0)
+    {
+        close(conn->passed_fd);
+    }
+    while(conn->replies_head)
+    {
+        queued_reply_t* reply = conn->replies_head;
+        conn->replies_head = reply->next;
+        free_queued_reply(conn, reply);
+    }
+    while(conn->spare_requests)
+    {
+        socket_request_t* request = conn->spare_requests;
+        conn->spare_requests = request->next_spare;
+        free(request);
+    }
+    cleanup_ingest(&conn->signed_script);
+    free(conn);
+}
+
+/* The connection is closed, it is freed once its pending requests are answered */
+static void release_connection(event_source_t* source)
+{
+    socket_connection_t* conn = (socket_connection_t*) source;
+    PRINT_DEBUG(debug, "Connection closed");
+    conn->released = 1;
+    if(0 == conn->pending)
+    {
+        free_connection(conn);
+    }
+}
+
+static void put_uint32(unsigned char* buffer, uint32_t value)
+{
+    value = htonl(value);
+    memcpy(buffer, &value, sizeof(value));
+}
+
+static void put_reply_header(unsigned char* buffer, uint32_t type, uint32_t request, size_t size)
+{
+    put_uint32(buffer, type);
+    put_uint32(buffer + 4, request);
+    put_uint32(buffer + 8, size);
+}
+
+/* Send the queued replies until the socket is full. The output frames go from the sink to the socket
+   inside the kernel, only the frame headers are written by the server */
+static int flush_replies(socket_connection_t* conn)
+{
+    while(conn->replies_head)
+    {
+        queued_reply_t* reply = conn->replies_head;
+        ssize_t sent;
+
+        if(reply->header_sent < SOCKET_REPLY_HEADER_SIZE)
+        {
+            sent = send(conn->source.fd, reply->header + reply->header_sent, SOCKET_REPLY_HEADER_SIZE - reply->header_sent, MSG_NOSIGNAL);
+            reply->header_sent += (sent > 0) ? sent : 0;
+        }
+        else if(reply->chunk_remaining > 0)
+        {
+            off_t offset = reply->output_sent;
+            sent = sendfile(conn->source.fd, reply->output_fd, &offset, reply->chunk_remaining);
+            if(0 == sent)
+            {
+                return SOCKET_ERROR;
+            }
+            reply->output_sent += (sent > 0) ? sent : 0;
+            reply->chunk_remaining -= (sent > 0) ? sent : 0;
+        }
+        else if(reply->output_sent < reply->output_size)
+        {
+            /* Start the next output frame */
+            reply->chunk_remaining = reply->output_size - reply->output_sent;
+            if(reply->chunk_remaining > SOCKET_REPLY_CHUNK_SIZE)
+            {
+                reply->chunk_remaining = SOCKET_REPLY_CHUNK_SIZE;
+            }
+            put_reply_header(reply->header, SOCKET_REPLY_OUTPUT, reply->request, reply->chunk_remaining);
+            reply->header_sent = 0;
+            continue;
+        }
+        else if(reply->result_sent < reply->result_size)
+        {
+            sent = send(conn->source.fd, reply->result + reply->result_sent, reply->result_size - reply->result_sent, MSG_NOSIGNAL);
+            reply->result_sent += (sent > 0) ? sent : 0;
+        }
+        else
+        {
+            conn->replies_head = reply->next;
+            if(!conn->replies_head)
+            {
+                conn->replies_tail = NULL;
+            }
+            conn->num_replies--;
+            free_queued_reply(conn, reply);
+            continue;
+        }
+
+        if(sent < 0 && EINTR != errno)
+        {
+            return (EAGAIN == errno || EWOULDBLOCK == errno) ? SOCKET_AGAIN : SOCKET_ERROR;
+        }
+    }
+    return SOCKET_OK;
+}
+
+/* Watch the connection for room to send its replies, and stop reading requests while too many replies wait */
+static void update_connection_events(socket_connection_t* conn)
+{
+    uint32_t events = (!conn->held && conn->num_replies < SOCKET_MAX_QUEUED_REPLIES) ? EPOLLIN : 0;
+    if(conn->replies_head)
+    {
+        events |= EPOLLOUT;
+    }
+    if(events != conn->events && EVENT_LOOP_OK == event_loop_modify(conn->server->loop, &conn->source, events))
+    {
+        conn->events = events;
+    }
+}
+
+/* Queue the output of the script followed by its verdict. The reply takes over the sink of the output */
+static void queue_reply(socket_connection_t* conn, socket_request_t* request, int verdict, const char* signer, script_result_t* result)
+{
+    queued_reply_t* reply = &request->reply;
+    size_t name_size = 0;
+
+    memset(reply, 0, sizeof(queued_reply_t));
+    reply->request = request->request;
+    reply->output_fd = -1;
+    reply->header_sent = SOCKET_REPLY_HEADER_SIZE;
+    if(result->output.fd >= 0 && result->output.size > 0)
+    {
+        reply->output_fd = result->output.fd;
+        reply->output_size = result->output.size;
+        result->output.fd = -1;
+    }
+
+    if(VERIFY_SIGNATURE_VALID == verdict && signer)
+    {
+        name_size = strnlen(signer, MAX_CERT_NAME_SIZE);
+        memcpy(reply->result + SOCKET_REPLY_HEADER_SIZE + 8, signer, name_size);
+    }
+    put_reply_header(reply->result, SOCKET_REPLY_RESULT, reply->request, 8 + name_size);
+    put_uint32(reply->result + SOCKET_REPLY_HEADER_SIZE, (uint32_t) verdict);
+    put_uint32(reply->result + SOCKET_REPLY_HEADER_SIZE + 4, (uint32_t) result->exit_status);
+    reply->result_size = SOCKET_REPLY_HEADER_SIZE + 8 + name_size;
+
+    if(conn->replies_tail)
+    {
+        conn->replies_tail->next = reply;
+    }
+    else
+    {
+        conn->replies_head = reply;
+    }
+    conn->replies_tail = reply;
+    conn->num_replies++;
+}
+
+/* Answer a request, the reply is dropped if the client already left. What the client cannot take right away
+   is sent when the event loop reports room on the connection, the loop never waits for a client */
+void socket_reply(socket_request_t* request, int verdict, const char* signer, script_result_t* result)
+{
+    socket_connection_t* conn = request->conn;
+    long id = request->id;
+    uint64_t start = stats_now();
+
+    if(conn->source.fd >= 0)
+    {
+        queue_reply(conn, request, verdict, signer, result);
+        if(SOCKET_ERROR == flush_replies(conn))
+        {
+            event_loop_close(conn->server->loop, &conn->source);
+        }
+        else
+        {
+            update_connection_events(conn);
+        }
+    }
+    else
+    {
+        recycle_request(conn, request);
+    }
+    stats_record_since(STATS_OUTPUT, start);
+    trace_span(id, STATS_OUTPUT, start, NULL, NULL);
+
+    conn->pending--;
+    if(conn->released && 0 == conn->pending)
+    {
+        free_connection(conn);
+    }
+}
+
+/* The whole request is received: hand it over to be verified and executed */
+static void complete_request(socket_connection_t* conn)
+{
+    socket_server_t* server = conn->server;
+    int ingest_ret = complete_ingest(&conn->signed_script, conn->ingest_ret);
+    socket_request_t* request = conn->spare_requests;
+
+    conn->header_received = 0;
+    if(request)
+    {
+        conn->spare_requests = request->next_spare;
+        conn->num_spare_requests--;
+    }
+    else
+    {
+        request = malloc(sizeof(socket_request_t));
+    }
+    if(!request)
+    {
+        PRINT_ERROR("Memory allocation failed");
+        event_loop_close(server->loop, &conn->source);
+        return;
+    }
+    request->conn = conn;
+    request->request = conn->request;
+    request->id = conn->signed_script.id;
+    conn->pending++;
+
+    if(INGEST_OK != ingest_ret)
+    {
+        PRINT_INFO("Error occured while parsing script #%ld. Skipping...", conn->signed_script.id);
+    }
+    conn->ingest_ret = ingest_ret;
+    if(SOCKET_BUSY == server->on_request((INGEST_OK == ingest_ret) ? &conn->signed_script : NULL, request, server->ctx))
+    {
+        conn->held = request;
+        conn->next_held = NULL;
+        if(server->held_tail)
+        {
+            server->held_tail->next_held = conn;
+        }
+        else
+        {
+            server->held_head = conn;
+        }
+        server->held_tail = conn;
+    }
+}
+
+/* Offer the held requests to the handler again, in the order they were held. The connections whose request
+   is taken are read again, the others keep waiting for the next resume */
+void resume_socket_server(socket_server_t* server)
+{
+    while(server->held_head)
+    {
+        socket_connection_t* conn = server->held_head;
+        if(SOCKET_BUSY == server->on_request((INGEST_OK == conn->ingest_ret) ? &conn->signed_script : NULL, conn->held, server->ctx))
+        {
+            return;
+        }
+        server->held_head = conn->next_held;
+        if(!server->held_head)
+        {
+            server->held_tail = NULL;
+        }
+        conn->held = NULL;
+        if(conn->source.fd >= 0)
+        {
+            update_connection_events(conn);
+        }
+    }
+}
+
+/* Read the frame header, a file descriptor passed by the client arrives along with its first byte */
+static ssize_t receive_header(socket_connection_t* conn, char* free_space, size_t available)
+{
+    struct iovec iov = {.iov_base = free_space, .iov_len = available};
+    union
+    {
+        struct cmsghdr align;
+        char buffer[CMSG_SPACE(SOCKET_MAX_PASSED_FDS * sizeof(int))];
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer)};
+
+    ssize_t read_size = recvmsg(conn->source.fd, &msg, MSG_CMSG_CLOEXEC);
+    if(read_size <= 0)
+    {
+        return read_size;
+    }
+
+    for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+    {
+        if(SOL_SOCKET != cmsg->cmsg_level || SCM_RIGHTS != cmsg->cmsg_type)
+        {
+            continue;
+        }
+        size_t num_fds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for(size_t i = 0; i < num_fds; i++)
+        {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+            if(conn->passed_fd < 0)
+            {
+                conn->passed_fd = fd;
+            }
+            else
+            {
+                close(fd);
+            }
+        }
+    }
+    return read_size;
+}
+
+/* The header announced a passed file: take it instead of reading the request from the connection */
+static void ingest_passed_file(socket_connection_t* conn)
+{
+    if(conn->passed_fd < 0)
+    {
+        PRINT_ERROR_DEBUG(debug, "No file descriptor was passed with the request");
+        conn->ingest_ret = INGEST_ERROR;
+        return;
+    }
+    conn->ingest_ret = ingest_file(&conn->signed_script, conn->passed_fd);
+    close(conn->passed_fd);
+    conn->passed_fd = -1;
+}
+
+static void receive_requests(socket_connection_t* conn)
+{
+    event_loop_t* loop = conn->server->loop;
+    char discard[INGEST_MIN_READ_SIZE];
+
+    for(int i = 0; i < SOCKET_MAX_READS_PER_EVENT && conn->source.fd >= 0 && !conn->held; i++)
+    {
+        char* free_space;
+        size_t available;
+        int reading_header = conn->header_received < SOCKET_FRAME_HEADER_SIZE;
+
+        if(reading_header)
+        {
+            free_space = (char*) conn->header + conn->header_received;
+            available = SOCKET_FRAME_HEADER_SIZE - conn->header_received;
+        }
+        else
+        {
+            /* Once a request is rejected, the rest of it is read and discarded */
+            free_space = discard;
+            available = sizeof(discard);
+            if(INGEST_OK == conn->ingest_ret)
+            {
+                free_space = ingest_reserve(&conn->signed_script, &available);
+                if(NULL == free_space)
+                {
+                    conn->ingest_ret = INGEST_ERROR;
+                    free_space = discard;
+                    available = sizeof(discard);
+                }
+            }
+
+            /* Never read into the next request */
+            if(available > conn->frame_remaining)
+            {
+                available = conn->frame_remaining;
+            }
+        }
+
+        ssize_t read_size = reading_header ? receive_header(conn, free_space, available)
+                                           : recv(conn->source.fd, free_space, available, 0);
+        if(read_size < 0)
+        {
+            if(EAGAIN == errno || EWOULDBLOCK == errno)
+            {
+                return;
+            }
+            if(EINTR == errno)
+            {
+                continue;
+            }
+            event_loop_close(loop, &conn->source);
+            return;
+        }
+
+        /* The client left, a partially received request is dropped */
+        if(0 == read_size)
+        {
+            event_loop_close(loop, &conn->source);
+            return;
+        }
+
+        if(reading_header)
+        {
+            conn->header_received += read_size;
+            if(conn->header_received < SOCKET_FRAME_HEADER_SIZE)
+            {
+                continue;
+            }
+
+            uint32_t frame_size;
+            memcpy(&frame_size, conn->header, sizeof(frame_size));
+            frame_size = ntohl(frame_size);
+            conn->request++;
+            conn->ingest_ret = INGEST_OK;
+            begin_ingest(&conn->signed_script);
+            if(SOCKET_FRAME_PASSED_FD == frame_size)
+            {
+                conn->frame_remaining = 0;
+                ingest_passed_file(conn);
+            }
+            else
+            {
+                conn->frame_remaining = frame_size;
+                /* A file descriptor sent with a regular request is not used */
+                if(conn->passed_fd >= 0)
+                {
+                    close(conn->passed_fd);
+                    conn->passed_fd = -1;
+                }
+            }
+        }
+        else
+        {
+            conn->frame_remaining -= read_size;
+            if(INGEST_OK == conn->ingest_ret)
+            {
+                conn->ingest_ret = ingest_append(&conn->signed_script, read_size);
+            }
+        }
+
+        if(0 == conn->frame_remaining)
+        {
+            complete_request(conn);
+        }
+    }
+}
+
+static void handle_connection_event(event_source_t* source, uint32_t events)
+{
+    socket_connection_t* conn = (socket_connection_t*) source;
+
+    if((events & EPOLLOUT) && SOCKET_ERROR == flush_replies(conn))
+    {
+        event_loop_close(conn->server->loop, &conn->source);
+        return;
+    }
+    /* A hang up is reported even while nothing is read, the held request stays pending until it is resumed */
+    if(conn->held && (events & (EPOLLHUP | EPOLLERR)))
+    {
+        event_loop_close(conn->server->loop, &conn->source);
+        return;
+    }
+    if(events & ~EPOLLOUT)
+    {
+        receive_requests(conn);
+    }
+    if(conn->source.fd >= 0)
+    {
+        update_connection_events(conn);
+    }
+}
+
+static void handle_accept_event(event_source_t* source, uint32_t events)
+{
+    socket_server_t* server = (socket_server_t*) source;
+    (void) events;
+
+    for(;;)
+    {
+        int fd = accept4(server->source.fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0)
+        {
+            if(EAGAIN != errno && EWOULDBLOCK != errno && EINTR != errno)
+            {
+                PRINT_ERROR_DEBUG(debug, "Cannot accept a connection");
+            }
+            return;
+        }
+
+        socket_connection_t* conn = calloc(1, sizeof(socket_connection_t));
+        if(!conn || INGEST_OK != init_ingest(&conn->signed_script))
+        {
+            PRINT_ERROR("Memory allocation failed");
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->server = server;
+        conn->passed_fd = -1;
+        conn->source.fd = fd;
+        conn->source.handler = handle_connection_event;
+        conn->source.release = release_connection;
+        conn->events = EPOLLIN;
+
+        if(EVENT_LOOP_OK != event_loop_add(server->loop, &conn->source, EPOLLIN))
+        {
+            cleanup_ingest(&conn->signed_script);
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conn->next = server->connections;
+        if(conn->next)
+        {
+            conn->next->prev = conn;
+        }
+        server->connections = conn;
+        server->num_connections++;
+        PRINT_DEBUG(debug, "Accepted a connection, %d connections open", server->num_connections);
+    }
+}
+
+/* Listen for clients on a unix domain socket */
+int init_socket_server(socket_server_t* server, event_loop_t* loop, const char* path, request_handler_t on_request, void* ctx)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        PRINT_ERROR("The socket path %s is too long", path);
+        return SOCKET_ERROR;
+    }
+    strcpy(addr.sun_path, path);
+
+    memset(server, 0, sizeof(socket_server_t));
+    server->loop = loop;
+    server->on_request = on_request;
+    server->ctx = ctx;
+    strncpy(server->path, path, sizeof(server->path) - 1);
+
+    server->source.fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(server->source.fd < 0)
+    {
+        PRINT_ERROR("Cannot create the unix domain socket");
+        return SOCKET_ERROR;
+    }
+    server->source.handler = handle_accept_event;
+    server->source.release = NULL;
+
+    remove(path);
+    if(bind(server->source.fd, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(server->source.fd, SOCKET_BACKLOG) < 0)
+    {
+        PRINT_ERROR("Cannot listen on the unix domain socket %s", path);
+        perror("");
+        close(server->source.fd);
+        server->source.fd = -1;
+        return SOCKET_ERROR;
+    }
+    chmod(path, 0666);
+
+    if(EVENT_LOOP_OK != event_loop_add(loop, &server->source, EPOLLIN))
+    {
+        close(server->source.fd);
+        server->source.fd = -1;
+        return SOCKET_ERROR;
+    }
+
+    PRINT_INFO("Listening on %s", path);
+    return SOCKET_OK;
+}
+
+/* Stop listening and close the connections, each one is freed once its pending requests are answered */
+void cleanup_socket_server(socket_server_t* server)
+{
+    for(socket_connection_t* conn = server->connections; conn; conn = conn->next)
+    {
+        event_loop_close(server->loop, &conn->source);
+    }
+    event_loop_close(server->loop, &server->source);
+    remove(server->path);
+}
@@ -0,0 +1,283 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: listener.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include "ingest.h"
+#include "listener.h"
+#include "server.h"
+
+static void handle_fifo_event(event_source_t* source, uint32_t events);
+
+/* Open the fifo without waiting for a writer. It stays open from one writer to the next: once a writer
+   left, the fifo reports a hang up until the next one connects, so it is watched edge-triggered and read
+   until EAGAIN or the end of the script, which is the end of file seen once the writer closed the fifo */
+static int open_fifo(fifo_source_t* fifo)
+{
+    fifo->source.fd = open(fifo->path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if(fifo->source.fd < 0)
+    {
+        PRINT_ERROR("Cannot open the fifo named pipe %s", fifo->path);
+        return LISTENER_ERROR;
+    }
+    fifo->source.handler = handle_fifo_event;
+    fifo->source.release = NULL;
+
+    begin_ingest(&fifo->signed_script);
+    fifo->ingest_ret = INGEST_OK;
+
+    if(EVENT_LOOP_OK != event_loop_add(fifo->listener->loop, &fifo->source, EPOLLIN | EPOLLET))
+    {
+        close(fifo->source.fd);
+        fifo->source.fd = -1;
+        return LISTENER_ERROR;
+    }
+    return LISTENER_OK;
+}
+
+/* The writer closed the fifo: hand the script over and start the next one on the same descriptor */
+static void complete_fifo_script(fifo_source_t* fifo)
+{
+    listener_t* listener = fifo->listener;
+
+    int ingest_ret = complete_ingest(&fifo->signed_script, fifo->ingest_ret);
+    if(INGEST_EMPTY != ingest_ret)
+    {
+        /* Ties the number of the script to the fifo it came from, for the clients writing to several fifos */
+        PRINT_INFO("Script #%ld was received on %s", fifo->signed_script.id, fifo->path);
+    }
+
+    switch(ingest_ret)
+    {
+        case INGEST_OK:
+            /* A busy handler gets the fifo closed, its writers wait in open until the script is taken */
+            if(LISTENER_BUSY == listener->on_script(&fifo->signed_script, listener->ctx))
+            {
+                event_loop_close(listener->loop, &fifo->source);
+                fifo->held = 1;
+                return;
+            }
+            break;
+        case INGEST_EMPTY:
+            break;
+        default:
+            PRINT_INFO("Error occured while parsing script #%ld. Skipping...", fifo->signed_script.id);
+            break;
+    }
+
+    begin_ingest(&fifo->signed_script);
+    fifo->ingest_ret = INGEST_OK;
+}
+
+static void handle_fifo_event(event_source_t* source, uint32_t events)
+{
+    fifo_source_t* fifo = (fifo_source_t*) source;
+    char discard[INGEST_MIN_READ_SIZE];
+    (void) events;
+
+    for(int i = 0; i < LISTENER_MAX_READS_PER_EVENT; i++)
+    {
+        char* free_space = discard;
+        size_t available = sizeof(discard);
+
+        /* Once a script is rejected, the rest of it is read and discarded until the writer leaves */
+        if(INGEST_OK == fifo->ingest_ret)
+        {
+            free_space = ingest_reserve(&fifo->signed_script, &available);
+            if(NULL == free_space)
+            {
+                fifo->ingest_ret = INGEST_ERROR;
+                free_space = discard;
+                available = sizeof(discard);
+            }
+        }
+
+        ssize_t read_size = read(fifo->source.fd, free_space, available);
+        if(read_size < 0)
+        {
+            if(EAGAIN == errno || EWOULDBLOCK == errno)
+            {
+                return;
+            }
+            if(EINTR == errno)
+            {
+                continue;
+            }
+            fifo->ingest_ret = INGEST_ERROR;
+            complete_fifo_script(fifo);
+            return;
+        }
+
+        if(0 == read_size)
+        {
+            complete_fifo_script(fifo);
+            return;
+        }
+
+        if(INGEST_OK == fifo->ingest_ret)
+        {
+            fifo->ingest_ret = ingest_append(&fifo->signed_script, read_size);
+        }
+    }
+
+    /* Let the other sources run: rearming the fifo reports it again since it is still readable */
+    if(EVENT_LOOP_OK != event_loop_modify(fifo->listener->loop, &fifo->source, EPOLLIN | EPOLLET))
+    {
+        PRINT_ERROR("Stopped listening on %s", fifo->path);
+        event_loop_close(fifo->listener->loop, &fifo->source);
+    }
+}
+
+/* Listen on every named pipe found in fifo_dir */
+int init_fifo_listener(listener_t* listener, event_loop_t* loop, const char* fifo_dir, script_handler_t on_script, void* ctx)
+{
+    DIR *dir;
+    struct dirent *entry;
+    struct stat st;
+    int max_fifos = 0;
+
+    listener->loop = loop;
+    listener->on_script = on_script;
+    listener->ctx = ctx;
+    listener->fifos = NULL;
+    listener->num_fifos = 0;
+    listener->next_resumed = 0;
+
+    dir = opendir(fifo_dir);
+    if (!dir) 
+    {
+        PRINT_ERROR("Cannot open the fifo directory %s", fifo_dir);
+        return LISTENER_ERROR;
+    }
+
+    while ((entry = readdir(dir)) != NULL) 
+    {
+        char path[MAX_FILEPATH_CHARS_SIZE + 1];
+        int len = snprintf(path, MAX_FILEPATH_CHARS_SIZE, "%s%c%s", fifo_dir, '/', entry->d_name);
+        if(len < 0 || len >= MAX_FILEPATH_CHARS_SIZE)
+        {
+            PRINT_WARN_DEBUG(debug, "Skipping %s since the full path name is too long", entry->d_name);
+            continue;
+        }
+
+        /* Only listen on named pipes */
+        if(stat(path, &st) < 0 || !S_ISFIFO(st.st_mode))
+        {
+            continue;
+        }
+
+        if(listener->num_fifos == max_fifos)
+        {
+            max_fifos = max_fifos ? 2 * max_fifos : 16;
+            fifo_source_t* fifos = realloc(listener->fifos, max_fifos * sizeof(fifo_source_t));
+            if(!fifos)
+            {
+                PRINT_ERROR("Memory allocation failed");
+                closedir(dir);
+                cleanup_listener(listener);
+                return LISTENER_ERROR;
+            }
+            listener->fifos = fifos;
+        }
+
+        fifo_source_t* fifo = &listener->fifos[listener->num_fifos];
+        memset(fifo, 0, sizeof(fifo_source_t));
+        fifo->source.fd = -1;
+        fifo->listener = listener;
+        strcpy(fifo->path, path);
+        if(INGEST_OK != init_ingest(&fifo->signed_script))
+        {
+            closedir(dir);
+            cleanup_listener(listener);
+            return LISTENER_ERROR;
+        }
+        listener->num_fifos++;
+    }
+    closedir(dir);
+
+    if(0 == listener->num_fifos)
+    {
+        PRINT_ERROR("No fifo named pipe found in %s", fifo_dir);
+        return LISTENER_ERROR;
+    }
+
+    /* The fifos are opened once the array does not move anymore since the event loop points into it */
+    for(int i = 0; i < listener->num_fifos; i++)
+    {
+        if(LISTENER_OK != open_fifo(&listener->fifos[i]))
+        {
+            cleanup_listener(listener);
+            return LISTENER_ERROR;
+        }
+        PRINT_INFO("Listening on %s", listener->fifos[i].path);
+    }
+
+    return LISTENER_OK;
+}
+
+/* Offer the held scripts to the handler again, starting after the fifo served first last time. The fifos
+   whose script is taken are reopened, the others keep waiting for the next resume */
+void resume_fifo_listener(listener_t* listener)
+{
+    for(int i = 0; i < listener->num_fifos; i++)
+    {
+        fifo_source_t* fifo = &listener->fifos[(listener->next_resumed + i) % listener->num_fifos];
+        if(!fifo->held)
+        {
+            continue;
+        }
+        if(LISTENER_BUSY == listener->on_script(&fifo->signed_script, listener->ctx))
+        {
+            listener->next_resumed = (listener->next_resumed + i) % listener->num_fifos;
+            return;
+        }
+        fifo->held = 0;
+        if(LISTENER_OK != open_fifo(fifo))
+        {
+            PRINT_ERROR("Stopped listening on %s", fifo->path);
+        }
+    }
+}
+
+void cleanup_listener(listener_t* listener)
+{
+    for(int i = 0; i < listener->num_fifos; i++)
+    {
+        event_loop_close(listener->loop, &listener->fifos[i].source);
+        cleanup_ingest(&listener->fifos[i].signed_script);
+    }
+    free(listener->fifos);
+    listener->fifos = NULL;
+    listener->num_fifos = 0;
+}
@@ -0,0 +1,525 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: logger.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/sendfile.h>
+
+#include "logger.h"
+
+/* How long a thread waits before retrying when the ring buffer is full and the policy is to block */
+#define LOG_FULL_WAIT_US                50
+/* The writer also wakes up on its own, in case a wakeup was missed */
+#define LOG_IDLE_WAIT_MS                100
+/* Buffer used when the raw bytes of a record cannot be sent to the stream from their file by the kernel */
+#define LOG_COPY_BUFFER_SIZE            16384
+
+static const char* const level_labels[] = {"DEBUG", "INFO ", "WARN ", "ERROR"};
+
+/* The date and time of the last second a record was written at, formatted once per second */
+typedef struct log_clock
+{
+    time_t second;
+    char text[32];
+} log_clock_t;
+
+static logger_t logger;
+static __thread long current_request = 0;
+
+/* Later messages of the calling thread are tagged with request_id */
+void set_log_request(long request_id)
+{
+    current_request = request_id;
+}
+
+int parse_log_policy(const char* name)
+{
+    if(0 == strcmp(name, "block"))
+    {
+        return LOG_POLICY_BLOCK;
+    }
+    if(0 == strcmp(name, "drop"))
+    {
+        return LOG_POLICY_DROP;
+    }
+    return LOGGER_ERROR;
+}
+
+static const char* record_text(const log_record_t* record)
+{
+    return record->heap_text ? record->heap_text : record->inline_text;
+}
+
+static void format_prefix(char* prefix, size_t size, const log_record_t* record, log_clock_t* clock)
+{
+    time_t second = record->time_ns / 1000000000ULL;
+    if(second != clock->second)
+    {
+        struct tm tm;
+        localtime_r(&second, &tm);
+        strftime(clock->text, sizeof(clock->text), "%Y-%m-%d %H:%M:%S", &tm);
+        clock->second = second;
+    }
+
+    unsigned long us = (record->time_ns % 1000000000ULL) / 1000;
+    if(record->request_id > 0)
+    {
+        snprintf(prefix, size, "%s.%06lu #%ld %s: ", clock->text, us, record->request_id, level_labels[record->level]);
+    }
+    else
+    {
+        snprintf(prefix, size, "%s.%06lu - %s: ", clock->text, us, level_labels[record->level]);
+    }
+}
+
+/* Write every line of text with the prefix, empty lines are left empty */
+static void write_lines(FILE* stream, const char* prefix, const char* text, size_t size)
+{
+    for(;;)
+    {
+        const char* eol = memchr(text, '\n', size);
+        size_t line_size = eol ? (size_t) (eol - text) : size;
+        if(line_size > 0)
+        {
+            fputs(prefix, stream);
+            fwrite(text, 1, line_size, stream);
+        }
+        fputc('\n', stream);
+        if(!eol)
+        {
+            return;
+        }
+        text = eol + 1;
+        size -= line_size + 1;
+    }
+}
+
+/* Send size bytes of fd to the stream inside the kernel. A stream that cannot be spliced into, such as a
+   terminal, gets them through a buffer */
+static void write_file(FILE* stream, int fd, size_t size)
+{
+    off_t offset = 0;
+
+    fflush(stream);
+    while((size_t) offset < size)
+    {
+        ssize_t sent = sendfile(fileno(stream), fd, &offset, size - offset);
+        if(sent <= 0 && EINTR != errno)
+        {
+            break;
+        }
+    }
+
+    char buffer[LOG_COPY_BUFFER_SIZE];
+    while((size_t) offset < size)
+    {
+        size_t chunk = (size - offset < sizeof(buffer)) ? size - offset : sizeof(buffer);
+        ssize_t read_size = pread(fd, buffer, chunk, offset);
+        if(read_size <= 0)
+        {
+            return;
+        }
+        fwrite(buffer, 1, read_size, stream);
+        offset += read_size;
+    }
+}
+
+static void write_record(const log_record_t* record, log_clock_t* clock)
+{
+    FILE* stream = (LOG_LEVEL_ERROR == record->level) ? stderr : stdout;
+    const char* text = record_text(record);
+    size_t raw_text_size = (record->raw_fd < 0) ? record->raw_size : 0;
+    char prefix[96];
+
+    format_prefix(prefix, sizeof(prefix), record, clock);
+
+    flockfile(stream);
+    write_lines(stream, prefix, text, record->head_size);
+    if(record->raw_fd >= 0)
+    {
+        write_file(stream, record->raw_fd, record->raw_size);
+    }
+    else if(record->raw_size > 0)
+    {
+        fwrite(text + record->head_size, 1, record->raw_size, stream);
+    }
+    if(record->tail_size > 0)
+    {
+        write_lines(stream, prefix, text + record->head_size + raw_text_size, record->tail_size);
+    }
+    funlockfile(stream);
+}
+
+static void free_record(log_record_t* record)
+{
+    free(record->heap_text);
+    if(record->raw_fd >= 0)
+    {
+        close(record->raw_fd);
+    }
+}
+
+static void wake_writer(void)
+{
+    if(__atomic_load_n(&logger.sleeping, __ATOMIC_SEQ_CST))
+    {
+        pthread_mutex_lock(&logger.lock);
+        pthread_cond_signal(&logger.wakeup);
+        pthread_mutex_unlock(&logger.lock);
+    }
+}
+
+/* Claim the next free slot of the ring buffer. Returns NULL if it is full and the policy is to drop */
+static log_slot_t* claim_slot(int policy, size_t* pos)
+{
+    *pos = __atomic_load_n(&logger.enqueue_pos, __ATOMIC_RELAXED);
+    for(;;)
+    {
+        log_slot_t* slot = &logger.slots[*pos & logger.mask];
+        size_t sequence = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        intptr_t diff = (intptr_t) sequence - (intptr_t) *pos;
+
+        if(0 == diff)
+        {
+            /* On failure pos is updated with the position claimed by another thread */
+            if(__atomic_compare_exchange_n(&logger.enqueue_pos, pos, *pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                return slot;
+            }
+        }
+        else if(diff < 0)
+        {
+            /* The slot still holds a record the writer did not write: the ring buffer is full */
+            if(LOG_POLICY_DROP == policy)
+            {
+                return NULL;
+            }
+            wake_writer();
+            usleep(LOG_FULL_WAIT_US);
+            *pos = __atomic_load_n(&logger.enqueue_pos, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            *pos = __atomic_load_n(&logger.enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* Hand a record over to the writer thread, or write it right away if the logger is not running */
+static void submit_record(log_record_t* record, int policy)
+{
+    record->request_id = current_request;
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record->time_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+
+    if(!__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE))
+    {
+        log_clock_t clock = {.second = -1};
+        write_record(record, &clock);
+        free_record(record);
+        return;
+    }
+
+    size_t pos;
+    log_slot_t* slot = claim_slot(policy, &pos);
+    if(NULL == slot)
+    {
+        __atomic_add_fetch(&logger.dropped, 1, __ATOMIC_RELAXED);
+        free_record(record);
+        return;
+    }
+
+    /* Only the used part of the inline text is copied */
+    size_t copy_size = offsetof(log_record_t, inline_text);
+    if(NULL == record->heap_text)
+    {
+        copy_size += record->head_size + ((record->raw_fd < 0) ? record->raw_size : 0) + record->tail_size;
+    }
+    memcpy(&slot->record, record, copy_size);
+    __atomic_store_n(&slot->sequence, pos + 1, __ATOMIC_RELEASE);
+
+    /* The record must be visible before the writer is found asleep, see log_writer */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    wake_writer();
+}
+
+void log_message(int level, const char* format, ...)
+{
+    log_record_t record;
+    va_list args;
+
+    va_start(args, format);
+    int size = vsnprintf(record.inline_text, sizeof(record.inline_text), format, args);
+    va_end(args);
+    if(size < 0)
+    {
+        return;
+    }
+
+    record.heap_text = NULL;
+    if((size_t) size >= sizeof(record.inline_text))
+    {
+        record.heap_text = malloc(size + 1);
+        if(record.heap_text)
+        {
+            va_start(args, format);
+            vsnprintf(record.heap_text, size + 1, format, args);
+            va_end(args);
+        }
+        else
+        {
+            size = sizeof(record.inline_text) - 1;
+        }
+    }
+
+    record.level = level;
+    record.head_size = size;
+    record.raw_size = 0;
+    record.raw_fd = -1;
+    record.tail_size = 0;
+    submit_record(&record, logger.policy);
+}
+
+/* Log data as it is between the lines of head and tail. It is never dropped, whatever the policy */
+void log_block(int level, const char* head, const char* data, size_t size, const char* tail)
+{
+    log_record_t record;
+    size_t head_size = strlen(head);
+    size_t tail_size = strlen(tail);
+    char* text = record.inline_text;
+
+    record.heap_text = NULL;
+    if(head_size + size + tail_size > sizeof(record.inline_text))
+    {
+        text = record.heap_text = malloc(head_size + size + tail_size);
+        if(NULL == text)
+        {
+            log_message(LOG_LEVEL_ERROR, "Memory allocation failed");
+            return;
+        }
+    }
+    memcpy(text, head, head_size);
+    memcpy(text + head_size, data, size);
+    memcpy(text + head_size + size, tail, tail_size);
+
+    record.level = level;
+    record.head_size = head_size;
+    record.raw_size = size;
+    record.raw_fd = -1;
+    record.tail_size = tail_size;
+    submit_record(&record, LOG_POLICY_BLOCK);
+}
+
+/* Log the first size bytes of the file fd as they are between the lines of head and tail. The writer sends them
+   from a duplicate of fd, the caller may close fd right away. It is never dropped, whatever the policy */
+void log_file_block(int level, const char* head, int fd, size_t size, const char* tail)
+{
+    log_record_t record;
+    size_t head_size = strlen(head);
+    size_t tail_size = strlen(tail);
+    char* text = record.inline_text;
+
+    record.raw_fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+    record.heap_text = NULL;
+    if(head_size + tail_size > sizeof(record.inline_text))
+    {
+        text = record.heap_text = malloc(head_size + tail_size);
+    }
+    if(NULL == text || record.raw_fd < 0)
+    {
+        log_message(LOG_LEVEL_ERROR, "Cannot log the content of a file");
+        free_record(&record);
+        return;
+    }
+    memcpy(text, head, head_size);
+    memcpy(text + head_size, tail, tail_size);
+
+    record.level = level;
+    record.head_size = head_size;
+    record.raw_size = size;
+    record.tail_size = tail_size;
+    submit_record(&record, LOG_POLICY_BLOCK);
+}
+
+/* Write the records waiting in the ring buffer, returns how many were written */
+static int drain_ring(log_clock_t* clock)
+{
+    int written = 0;
+    for(;;)
+    {
+        log_slot_t* slot = &logger.slots[logger.dequeue_pos & logger.mask];
+        if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != logger.dequeue_pos + 1)
+        {
+            return written;
+        }
+
+        write_record(&slot->record, clock);
+        free_record(&slot->record);
+
+        /* The slot is free again for the producers of the next round */
+        __atomic_store_n(&slot->sequence, logger.dequeue_pos + logger.mask + 1, __ATOMIC_RELEASE);
+        logger.dequeue_pos++;
+        written++;
+    }
+}
+
+static int ring_empty(void)
+{
+    log_slot_t* slot = &logger.slots[logger.dequeue_pos & logger.mask];
+    return __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != logger.dequeue_pos + 1;
+}
+
+static void report_dropped(log_clock_t* clock)
+{
+    long dropped = __atomic_load_n(&logger.dropped, __ATOMIC_RELAXED);
+    if(dropped == logger.dropped_reported)
+    {
+        return;
+    }
+
+    log_record_t record = {.request_id = 0, .level = LOG_LEVEL_WARN, .heap_text = NULL, .raw_size = 0, .raw_fd = -1, .tail_size = 0};
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    record.time_ns = (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+    record.head_size = snprintf(record.inline_text, sizeof(record.inline_text), "%ld log messages were dropped because the log buffer was full",
+                                dropped - logger.dropped_reported);
+    write_record(&record, clock);
+    logger.dropped_reported = dropped;
+}
+
+/* The writer thread. The streams are flushed whenever there is nothing left to write */
+static void* log_writer(void* arg)
+{
+    log_clock_t clock = {.second = -1};
+    (void) arg;
+
+    for(;;)
+    {
+        if(drain_ring(&clock) > 0)
+        {
+            continue;
+        }
+        report_dropped(&clock);
+        fflush(stdout);
+        fflush(stderr);
+
+        pthread_mutex_lock(&logger.lock);
+        __atomic_store_n(&logger.sleeping, 1, __ATOMIC_SEQ_CST);
+        /* A producer that published a record before sleeping was set wakes nobody up, so look again */
+        if(ring_empty())
+        {
+            if(logger.stopping)
+            {
+                pthread_mutex_unlock(&logger.lock);
+                break;
+            }
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += LOG_IDLE_WAIT_MS * 1000000L;
+            deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+            deadline.tv_nsec %= 1000000000L;
+            pthread_cond_timedwait(&logger.wakeup, &logger.lock, &deadline);
+        }
+        __atomic_store_n(&logger.sleeping, 0, __ATOMIC_SEQ_CST);
+        pthread_mutex_unlock(&logger.lock);
+    }
+    return NULL;
+}
+
+/* Start the writer thread. capacity is rounded up to a power of two. Messages logged before are written
+   right away by the thread logging them. The logger is stopped at exit */
+int start_logger(size_t capacity, int policy)
+{
+    size_t slots = 2;
+    while(slots < capacity)
+    {
+        slots *= 2;
+    }
+
+    logger.slots = malloc(slots * sizeof(log_slot_t));
+    if(NULL == logger.slots)
+    {
+        fprintf(stderr, "Memory allocation failed\n");
+        return LOGGER_ERROR;
+    }
+    for(size_t i = 0; i < slots; i++)
+    {
+        logger.slots[i].sequence = i;
+    }
+    logger.mask = slots - 1;
+    logger.policy = policy;
+    logger.enqueue_pos = 0;
+    logger.dequeue_pos = 0;
+    logger.dropped = 0;
+    logger.dropped_reported = 0;
+    logger.sleeping = 0;
+    logger.stopping = 0;
+    pthread_mutex_init(&logger.lock, NULL);
+    pthread_cond_init(&logger.wakeup, NULL);
+
+    if(0 != pthread_create(&logger.thread, NULL, log_writer, NULL))
+    {
+        fprintf(stderr, "Cannot start the log writer\n");
+        free(logger.slots);
+        logger.slots = NULL;
+        return LOGGER_ERROR;
+    }
+
+    __atomic_store_n(&logger.running, 1, __ATOMIC_RELEASE);
+    atexit(stop_logger);
+    return LOGGER_OK;
+}
+
+/* Write what is left in the ring buffer and stop the writer thread */
+void stop_logger(void)
+{
+    if(!__atomic_load_n(&logger.running, __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+
+    /* Later messages are written by the threads logging them */
+    __atomic_store_n(&logger.running, 0, __ATOMIC_RELEASE);
+
+    pthread_mutex_lock(&logger.lock);
+    logger.stopping = 1;
+    pthread_cond_signal(&logger.wakeup);
+    pthread_mutex_unlock(&logger.lock);
+    pthread_join(logger.thread, NULL);
+
+    /* The slots are not freed, a thread that found the logger running may still be claiming one */
+}
@@ -0,0 +1,196 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: merkle.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+
+#include "debug.h"
+#include "merkle.h"
+#include "parallel.h"
+
+typedef struct chunk_checker
+{
+    const char* data;
+    size_t size;
+    size_t chunk_size;
+    const unsigned char* leaves;
+    size_t num_chunks;
+    size_t next_chunk;
+    size_t bad_chunk;       // first chunk found not to match its leaf, num_chunks if none
+    int error;
+} chunk_checker_t;
+
+/* Threads helping the verifiers check the chunks of sealed v2 scripts, started once for the whole server */
+static parallel_pool_t chunk_pool;
+
+/* Number of chunks of data, an empty script still has one empty chunk */
+size_t merkle_num_chunks(size_t size, size_t chunk_size)
+{
+    return (0 == size) ? 1 : (size + chunk_size - 1) / chunk_size;
+}
+
+/* Start the hash of a leaf, the chunk is then added with EVP_DigestUpdate */
+int merkle_leaf_init(EVP_MD_CTX* md_ctx)
+{
+    static const unsigned char prefix = MERKLE_LEAF_PREFIX;
+    if(!EVP_DigestInit_ex(md_ctx, EVP_sha256(), NULL) || !EVP_DigestUpdate(md_ctx, &prefix, 1))
+    {
+        return MERKLE_ERROR;
+    }
+    return MERKLE_OK;
+}
+
+int merkle_leaf(EVP_MD_CTX* md_ctx, const char* chunk, size_t chunk_size, unsigned char* leaf)
+{
+    if(MERKLE_OK != merkle_leaf_init(md_ctx) || !EVP_DigestUpdate(md_ctx, chunk, chunk_size) || !EVP_DigestFinal_ex(md_ctx, leaf, NULL))
+    {
+        return MERKLE_ERROR;
+    }
+    return MERKLE_OK;
+}
+
+/* Hash the leaves pairwise up to the root, a node without sibling moves up unchanged. The levels are computed in
+   place, so leaves is overwritten */
+int merkle_root(EVP_MD_CTX* md_ctx, unsigned char* leaves, size_t num_leaves, unsigned char* root)
+{
+    static const unsigned char prefix = MERKLE_NODE_PREFIX;
+
+    if(0 == num_leaves)
+    {
+        return MERKLE_ERROR;
+    }
+    while(num_leaves > 1)
+    {
+        size_t num_nodes = 0;
+        for(size_t i = 0; i < num_leaves; i += 2, num_nodes++)
+        {
+            unsigned char* node = leaves + num_nodes * SHA256_DIGEST_LENGTH;
+            if(i + 1 == num_leaves)
+            {
+                memmove(node, leaves + i * SHA256_DIGEST_LENGTH, SHA256_DIGEST_LENGTH);
+                continue;
+            }
+            if(!EVP_DigestInit_ex(md_ctx, EVP_sha256(), NULL) || !EVP_DigestUpdate(md_ctx, &prefix, 1)
+               || !EVP_DigestUpdate(md_ctx, leaves + i * SHA256_DIGEST_LENGTH, 2 * SHA256_DIGEST_LENGTH)
+               || !EVP_DigestFinal_ex(md_ctx, node, NULL))
+            {
+                return MERKLE_ERROR;
+            }
+        }
+        num_leaves = num_nodes;
+    }
+    memcpy(root, leaves, SHA256_DIGEST_LENGTH);
+    return MERKLE_OK;
+}
+
+static void check_chunks(void* arg)
+{
+    chunk_checker_t* checker = (chunk_checker_t*) arg;
+    unsigned char leaf[SHA256_DIGEST_LENGTH];
+    EVP_MD_CTX* md_ctx = EVP_MD_CTX_new();
+
+    if(!md_ctx)
+    {
+        __atomic_store_n(&checker->error, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    for(;;)
+    {
+        size_t i = __atomic_fetch_add(&checker->next_chunk, 1, __ATOMIC_RELAXED);
+        /* Every thread stops once a chunk is found not to match */
+        if(i >= checker->num_chunks || i > __atomic_load_n(&checker->bad_chunk, __ATOMIC_RELAXED) ||
+           __atomic_load_n(&checker->error, __ATOMIC_RELAXED))
+        {
+            break;
+        }
+        size_t offset = i * checker->chunk_size;
+        size_t size = (checker->size - offset < checker->chunk_size) ? checker->size - offset : checker->chunk_size;
+        if(MERKLE_OK != merkle_leaf(md_ctx, checker->data + offset, size, leaf))
+        {
+            __atomic_store_n(&checker->error, 1, __ATOMIC_RELAXED);
+            break;
+        }
+        if(memcmp(leaf, checker->leaves + i * SHA256_DIGEST_LENGTH, SHA256_DIGEST_LENGTH) != 0)
+        {
+            /* Keep the first bad chunk, as a sequential check would */
+            size_t bad = __atomic_load_n(&checker->bad_chunk, __ATOMIC_RELAXED);
+            while(i < bad && !__atomic_compare_exchange_n(&checker->bad_chunk, &bad, i, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+            }
+        }
+    }
+    EVP_MD_CTX_free(md_ctx);
+}
+
+/* Start the chunk pool, with one thread per CPU but the one of the verifier that calls check_merkle_chunks.
+   Until it is started, the chunks are checked by the verifiers alone */
+int start_merkle_pool(void)
+{
+    long num_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_threads > MERKLE_MAX_THREADS)
+    {
+        num_threads = MERKLE_MAX_THREADS;
+    }
+    return (PARALLEL_OK == init_parallel_pool(&chunk_pool, num_threads - 1)) ? MERKLE_OK : MERKLE_ERROR;
+}
+
+void stop_merkle_pool(void)
+{
+    cleanup_parallel_pool(&chunk_pool);
+}
+
+/* Check every chunk of data against its leaf, with the threads of the chunk pool as the size of data is worth
+   them, or alone while they check the chunks of another script. leaves must hold merkle_num_chunks(size, chunk_size)
+   hashes. On MERKLE_MISMATCH, bad_chunk is the first chunk that does not match */
+int check_merkle_chunks(const char* data, size_t size, size_t chunk_size, const unsigned char* leaves, size_t* bad_chunk)
+{
+    chunk_checker_t checker = {.data = data, .size = size, .chunk_size = chunk_size, .leaves = leaves,
+                               .num_chunks = merkle_num_chunks(size, chunk_size), .next_chunk = 0, .error = 0};
+
+    checker.bad_chunk = checker.num_chunks;
+
+    /* Small scripts are only checked by the calling thread, the others by at most every thread of the pool */
+    size_t num_threads = checker.num_chunks / MERKLE_CHUNKS_PER_THREAD;
+    if(num_threads > MERKLE_MAX_THREADS)
+    {
+        num_threads = MERKLE_MAX_THREADS;
+    }
+    run_parallel(&chunk_pool, (int) num_threads, check_chunks, &checker);
+
+    if(checker.error)
+    {
+        return MERKLE_ERROR;
+    }
+    if(checker.bad_chunk < checker.num_chunks)
+    {
+        *bad_chunk = checker.bad_chunk;
+        return MERKLE_MISMATCH;
+    }
+    return MERKLE_OK;
+}
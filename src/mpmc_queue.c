@@ -0,0 +1,133 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: mpmc_queue.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "debug.h"
+#include "mpmc_queue.h"
+
+/* The capacity is rounded up to a power of two so that a position maps to its cell with a mask */
+int init_mpmc_queue(mpmc_queue_t* queue, size_t capacity)
+{
+    size_t size = 2;
+    while(size < capacity)
+    {
+        size *= 2;
+    }
+
+    queue->cells = malloc(size * sizeof(mpmc_cell_t));
+    if(NULL == queue->cells)
+    {
+        PRINT_ERROR("Memory allocation failed");
+        return MPMC_QUEUE_ERROR;
+    }
+    for(size_t i = 0; i < size; i++)
+    {
+        queue->cells[i].sequence = i;
+        queue->cells[i].item = NULL;
+    }
+    queue->mask = size - 1;
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+    return MPMC_QUEUE_OK;
+}
+
+void free_mpmc_queue(mpmc_queue_t* queue)
+{
+    free(queue->cells);
+    queue->cells = NULL;
+}
+
+/* Never waits: returns MPMC_QUEUE_FULL if every cell is still in use */
+int mpmc_push(mpmc_queue_t* queue, void* item)
+{
+    size_t pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+    mpmc_cell_t* cell;
+
+    for(;;)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long) (sequence - pos);
+
+        if(0 == diff)
+        {
+            /* The cell is free, take the position unless another producer got it first */
+            if(__atomic_compare_exchange_n(&queue->enqueue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if(diff < 0)
+        {
+            return MPMC_QUEUE_FULL;
+        }
+        else
+        {
+            pos = __atomic_load_n(&queue->enqueue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->item = item;
+    __atomic_store_n(&cell->sequence, pos + 1, __ATOMIC_RELEASE);
+    return MPMC_QUEUE_OK;
+}
+
+/* Never waits: returns MPMC_QUEUE_EMPTY if no item is published yet */
+int mpmc_pop(mpmc_queue_t* queue, void** item)
+{
+    size_t pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+    mpmc_cell_t* cell;
+
+    for(;;)
+    {
+        cell = &queue->cells[pos & queue->mask];
+        size_t sequence = __atomic_load_n(&cell->sequence, __ATOMIC_ACQUIRE);
+        long diff = (long) (sequence - (pos + 1));
+
+        if(0 == diff)
+        {
+            if(__atomic_compare_exchange_n(&queue->dequeue_pos, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if(diff < 0)
+        {
+            return MPMC_QUEUE_EMPTY;
+        }
+        else
+        {
+            pos = __atomic_load_n(&queue->dequeue_pos, __ATOMIC_RELAXED);
+        }
+    }
+
+    *item = cell->item;
+    /* The cell is free again for the producer that wraps around to it */
+    __atomic_store_n(&cell->sequence, pos + queue->mask + 1, __ATOMIC_RELEASE);
+    return MPMC_QUEUE_OK;
+}
@@ -0,0 +1,204 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: output_sink.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "debug.h"
+#include "output_sink.h"
+#include "stats.h"
+
+int output_sink_type = OUTPUT_SINK_LOG;
+char output_dir[MAX_FILEPATH_CHARS_SIZE + 1] = ".";
+size_t output_limit = OUTPUT_DEFAULT_LIMIT;
+int output_limit_policy = OUTPUT_LIMIT_TRUNCATE;
+
+/* The output beyond the limit is spliced into /dev/null, it is never read by the server */
+static int null_fd = -1;
+static pthread_once_t null_once = PTHREAD_ONCE_INIT;
+
+static void open_null(void)
+{
+    null_fd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+}
+
+int parse_output_sink(const char* name)
+{
+    if(0 == strcmp(name, "log"))
+    {
+        return OUTPUT_SINK_LOG;
+    }
+    if(0 == strcmp(name, "file"))
+    {
+        return OUTPUT_SINK_FILE;
+    }
+    return OUTPUT_SINK_ERROR;
+}
+
+int parse_output_limit_policy(const char* name)
+{
+    if(0 == strcmp(name, "truncate"))
+    {
+        return OUTPUT_LIMIT_TRUNCATE;
+    }
+    if(0 == strcmp(name, "kill"))
+    {
+        return OUTPUT_LIMIT_KILL;
+    }
+    return OUTPUT_SINK_ERROR;
+}
+
+void init_output_sink(output_sink_t* sink, int type)
+{
+    sink->type = type;
+    sink->fd = -1;
+    sink->size = 0;
+    sink->discarded = 0;
+    sink->limited = 0;
+    sink->path[0] = '\0';
+}
+
+/* Create the file the output of script id is moved to */
+int open_output_sink(output_sink_t* sink, long id)
+{
+    if(OUTPUT_SINK_FILE == sink->type)
+    {
+        snprintf(sink->path, sizeof(sink->path), OUTPUT_FILE_FORMAT, output_dir, id);
+        sink->fd = open(sink->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    }
+    else
+    {
+        sink->fd = memfd_create("script_output", MFD_CLOEXEC);
+    }
+
+    if(sink->fd < 0)
+    {
+        PRINT_ERROR("Cannot create the output of script #%ld: %s", id, strerror(errno));
+        return OUTPUT_SINK_ERROR;
+    }
+    return OUTPUT_SINK_OK;
+}
+
+void close_output_sink(output_sink_t* sink)
+{
+    if(sink->fd >= 0)
+    {
+        close(sink->fd);
+        sink->fd = -1;
+    }
+}
+
+/* Copy through the server when the kernel cannot splice into the sink */
+static ssize_t copy_to_sink(int pipe_fd, int fd, size_t size)
+{
+    char buffer[OUTPUT_COPY_BUFFER_SIZE];
+    ssize_t read_size = read(pipe_fd, buffer, (size < sizeof(buffer)) ? size : sizeof(buffer));
+    if(read_size <= 0 || fd < 0)
+    {
+        return read_size;
+    }
+    ssize_t written = 0;
+    while(written < read_size)
+    {
+        ssize_t n = write(fd, buffer + written, read_size - written);
+        if(n > 0)
+        {
+            written += n;
+        }
+        else if(n < 0 && EINTR != errno)
+        {
+            return -1;
+        }
+    }
+    return read_size;
+}
+
+/* Move what the script wrote to its pipe into the sink, at most OUTPUT_SPLICE_SIZE bytes per call. The bytes beyond
+   the limit are discarded, and OUTPUT_SINK_LIMIT is returned once there are some if the policy is to kill the script */
+int drain_output(output_sink_t* sink, int pipe_fd)
+{
+    size_t size = OUTPUT_SPLICE_SIZE;
+    int fd = sink->fd;
+    int discard = (sink->size >= output_limit);
+
+    if(discard)
+    {
+        pthread_once(&null_once, open_null);
+        fd = null_fd;
+    }
+    else if(output_limit - sink->size < size)
+    {
+        size = output_limit - sink->size;
+    }
+
+    ssize_t moved;
+    do
+    {
+        if(fd < 0)
+        {
+            moved = copy_to_sink(pipe_fd, -1, size);
+        }
+        else
+        {
+            moved = splice(pipe_fd, NULL, fd, NULL, size, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if(moved < 0 && EINVAL == errno)
+            {
+                moved = copy_to_sink(pipe_fd, fd, size);
+            }
+        }
+    }
+    while(moved < 0 && EINTR == errno);
+
+    if(moved < 0)
+    {
+        return (EAGAIN == errno || EWOULDBLOCK == errno) ? OUTPUT_SINK_AGAIN : OUTPUT_SINK_ERROR;
+    }
+    if(0 == moved)
+    {
+        return OUTPUT_SINK_END;
+    }
+
+    if(!discard)
+    {
+        sink->size += moved;
+        return OUTPUT_SINK_OK;
+    }
+
+    sink->discarded += moved;
+    if(!sink->limited)
+    {
+        sink->limited = 1;
+        stats_count(STATS_OUTPUT_LIMITED, 1);
+    }
+    return (OUTPUT_LIMIT_KILL == output_limit_policy) ? OUTPUT_SINK_LIMIT : OUTPUT_SINK_OK;
+}
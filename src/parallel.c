@@ -0,0 +1,162 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: parallel.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "debug.h"
+#include "parallel.h"
+
+static void* parallel_thread(void* arg)
+{
+    parallel_pool_t* pool = (parallel_pool_t*) arg;
+    unsigned long last_job = 0;
+
+    pthread_mutex_lock(&pool->mutex);
+    for(;;)
+    {
+        while(!pool->stop && (pool->job == last_job || 0 == pool->num_wanted))
+        {
+            pthread_cond_wait(&pool->job_ready, &pool->mutex);
+        }
+        if(pool->stop)
+        {
+            break;
+        }
+        last_job = pool->job;
+        pool->num_wanted--;
+        pool->num_running++;
+        parallel_task_t task = pool->task;
+        void* task_arg = pool->arg;
+        pthread_mutex_unlock(&pool->mutex);
+
+        task(task_arg);
+
+        pthread_mutex_lock(&pool->mutex);
+        if(0 == --pool->num_running)
+        {
+            pthread_cond_signal(&pool->job_done);
+        }
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    return NULL;
+}
+
+/* Start num_threads threads waiting for jobs. A pool whose threads could not all be started keeps the others,
+   one without any thread runs the jobs on their caller alone */
+int init_parallel_pool(parallel_pool_t* pool, int num_threads)
+{
+    memset(pool, 0, sizeof(parallel_pool_t));
+    if(num_threads <= 0)
+    {
+        return PARALLEL_OK;
+    }
+    pool->threads = calloc(num_threads, sizeof(pthread_t));
+    if(NULL == pool->threads)
+    {
+        PRINT_ERROR("Memory allocation failed");
+        return PARALLEL_ERROR;
+    }
+    pthread_mutex_init(&pool->busy, NULL);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->job_ready, NULL);
+    pthread_cond_init(&pool->job_done, NULL);
+
+    for(int i = 0; i < num_threads; i++)
+    {
+        if(0 != pthread_create(&pool->threads[i], NULL, parallel_thread, pool))
+        {
+            PRINT_ERROR("Cannot start parallel thread %d", i);
+            break;
+        }
+        pool->num_threads++;
+    }
+    return PARALLEL_OK;
+}
+
+/* Run task on the calling thread and on up to num_threads - 1 threads of the pool. The calling thread runs it
+   too, so the job completes even if the pool has no thread or is busy with the job of another caller.
+   Returns the number of threads that ran the task */
+int run_parallel(parallel_pool_t* pool, int num_threads, parallel_task_t task, void* arg)
+{
+    int num_helpers = (num_threads - 1 < pool->num_threads) ? num_threads - 1 : pool->num_threads;
+
+    if(num_helpers <= 0 || 0 != pthread_mutex_trylock(&pool->busy))
+    {
+        task(arg);
+        return 1;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->task = task;
+    pool->arg = arg;
+    pool->job++;
+    pool->num_wanted = num_helpers;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->mutex);
+
+    task(arg);
+
+    /* The calling thread only returns once no work is left, the threads that did not join yet are not needed */
+    pthread_mutex_lock(&pool->mutex);
+    int num_joined = num_helpers - pool->num_wanted;
+    pool->num_wanted = 0;
+    while(pool->num_running > 0)
+    {
+        pthread_cond_wait(&pool->job_done, &pool->mutex);
+    }
+    pthread_mutex_unlock(&pool->mutex);
+    pthread_mutex_unlock(&pool->busy);
+
+    return 1 + num_joined;
+}
+
+void cleanup_parallel_pool(parallel_pool_t* pool)
+{
+    if(NULL == pool->threads)
+    {
+        return;
+    }
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->job_ready);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for(int i = 0; i < pool->num_threads; i++)
+    {
+        pthread_join(pool->threads[i], NULL);
+    }
+    free(pool->threads);
+    pool->threads = NULL;
+    pool->num_threads = 0;
+
+    pthread_cond_destroy(&pool->job_done);
+    pthread_cond_destroy(&pool->job_ready);
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_mutex_destroy(&pool->busy);
+}
@@ -24,18 +24,251 @@
  * SOFTWARE.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
 
 #include "debug.h"
 #include "verify.h"
 #include "run_script.h"
+#include "bash_pool.h"
 #include "server.h"
+#include "stats.h"
+#include "trace.h"
 
-int run_script(signed_script_t* signed_script)
+void init_script_result(script_result_t* result, int sink)
+{
+    result->exit_status = -1;
+    result->term_signal = 0;
+    init_output_sink(&result->output, sink);
+    result->wall_time_us = 0;
+    result->user_time_us = 0;
+    result->system_time_us = 0;
+}
+
+void free_script_result(script_result_t* result)
+{
+    close_output_sink(&result->output);
+    init_script_result(result, result->output.type);
+}
+
+static long elapsed_us(const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000000L + (end->tv_nsec - start->tv_nsec) / 1000;
+}
+
+static long timeval_us(const struct timeval* tv)
+{
+    return tv->tv_sec * 1000000L + tv->tv_usec;
+}
+
+/* Start bash with its stdin and its stdout/stderr connected to pipes, and envp as its environment */
+pid_t spawn_bash(int* stdin_fd, int* output_fd, char* const envp[])
+{
+    int in_pipe[2];
+    int out_pipe[2];
+    pid_t pid = -1;
+
+    /* The pipes are close-on-exec so that scripts started by other workers do not inherit them */
+    if (pipe2(in_pipe, O_CLOEXEC) < 0)
+    {
+        PRINT_ERROR_DEBUG(debug, "Error creating pipe to bash");
+        return -1;
+    }
+    if (pipe2(out_pipe, O_CLOEXEC) < 0)
+    {
+        PRINT_ERROR_DEBUG(debug, "Error creating pipe from bash");
+        close(in_pipe[0]);
+        close(in_pipe[1]);
+        return -1;
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t default_signals;
+    char* argv[] = {BASH_PATH, NULL};
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, in_pipe[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, out_pipe[1], STDERR_FILENO);
+
+    /* The server ignores SIGPIPE, the script gets the default behaviour back */
+    posix_spawnattr_init(&attr);
+    sigemptyset(&default_signals);
+    sigaddset(&default_signals, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &default_signals);
+
+    /* It does not inherit the signals blocked by the server either, such as SIGUSR1 of the stats reporter */
+    sigset_t unblocked_signals;
+    sigemptyset(&unblocked_signals);
+    posix_spawnattr_setsigmask(&attr, &unblocked_signals);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+    int err = posix_spawn(&pid, BASH_PATH, &actions, &attr, argv, envp);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(in_pipe[0]);
+    close(out_pipe[1]);
+
+    if (0 != err)
+    {
+        PRINT_ERROR_DEBUG(debug, "Error starting %s: %s", BASH_PATH, strerror(err));
+        close(in_pipe[1]);
+        close(out_pipe[0]);
+        return -1;
+    }
+
+    /* The script is written without blocking so that the output keeps being drained meanwhile */
+    fcntl(in_pipe[1], F_SETFL, fcntl(in_pipe[1], F_GETFL) | O_NONBLOCK);
+    *stdin_fd = in_pipe[1];
+    *output_fd = out_pipe[0];
+    return pid;
+}
+
+/* Record how script id ended and the resources it used, start is when its bash was spawned */
+void finish_script_result(script_result_t* result, long id, int status, const struct timespec* start, const struct rusage* usage)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result->exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    result->term_signal = WIFSIGNALED(status) ? WTERMSIG(status) : 0;
+    result->wall_time_us = elapsed_us(start, &end);
+    result->user_time_us = timeval_us(&usage->ru_utime);
+    result->system_time_us = timeval_us(&usage->ru_stime);
+
+    stats_record(STATS_EXECUTE, (uint64_t) (end.tv_sec - start->tv_sec) * 1000000000ULL + end.tv_nsec - start->tv_nsec);
+    trace_span(id, STATS_EXECUTE, (uint64_t) start->tv_sec * 1000000000ULL + start->tv_nsec, NULL, NULL);
+    stats_count(STATS_OUTPUT_BYTES, result->output.size);
+}
+
+/* Print the output of a script, or where it was written. The output is one message of the logger so that outputs
+   of workers do not mix, the logger sends it from the sink to stdout without copying it through the server */
+void print_script_output(long id, const script_result_t* result)
+{
+    const output_sink_t* output = &result->output;
+    uint64_t start = stats_now();
+
+    if(OUTPUT_SINK_FILE == output->type)
+    {
+        PRINT_INFO("Output of script #%ld written to %s (%zu bytes)", id, output->path, output->size);
+    }
+    else if(output->fd >= 0)
+    {
+        log_file_block(LOG_LEVEL_INFO,
+                       "++++++++++++ SCRIPT OUTPUT ++++++++++++++++\n"
+                       "++++++++++++++++ START ++++++++++++++++++++",
+                       output->fd, output->size,
+                       "+++++++++++++++++ END +++++++++++++++++++++\n"
+                       "+++++++++++++++++++++++++++++++++++++++++++");
+    }
+    stats_record_since(STATS_OUTPUT, start);
+    trace_span(id, STATS_OUTPUT, start, NULL, NULL);
+}
+
+void print_script_exit(long id, const script_result_t* result)
+{
+    if (result->output.limited && OUTPUT_LIMIT_KILL == output_limit_policy)
+    {
+        PRINT_INFO("Script #%ld was killed, its output reached the limit of %zu bytes", id, output_limit);
+    }
+    else if (result->output.limited)
+    {
+        PRINT_INFO("The output of script #%ld was truncated to %zu bytes, %zu bytes were discarded", id, output_limit, result->output.discarded);
+    }
+    if (result->term_signal)
+    {
+        PRINT_INFO("Script #%ld was killed by signal %d", id, result->term_signal);
+    }
+    PRINT_INFO("Script #%ld exited with status %d (wall %ld us, user %ld us, system %ld us)",
+               id, result->exit_status, result->wall_time_us, result->user_time_us, result->system_time_us);
+}
+
+/* Feed the script to bash and move its output to the sink until bash closes its end of the pipe */
+static int exchange_with_bash(signed_script_t* signed_script, pid_t pid, int stdin_fd, int output_fd, script_result_t* result)
+{
+    size_t written = 0;
+    int ret = EXECUTING_SCRIPT_OK;
+
+    if (0 == signed_script->script_size)
+    {
+        close(stdin_fd);
+        stdin_fd = -1;
+    }
+
+    while (output_fd >= 0)
+    {
+        struct pollfd fds[2] = {
+            {.fd = output_fd, .events = POLLIN},
+            {.fd = stdin_fd, .events = POLLOUT},
+        };
+        if (poll(fds, (stdin_fd >= 0) ? 2 : 1, -1) < 0)
+        {
+            if (EINTR == errno)
+            {
+                continue;
+            }
+            ret = EXECUTING_SCRIPT_FAILED;
+            break;
+        }
+
+        if (stdin_fd >= 0 && fds[1].revents)
+        {
+            ssize_t n = write(stdin_fd, signed_script->script + written, signed_script->script_size - written);
+            if (n > 0)
+            {
+                written += n;
+            }
+            /* Bash may exit without reading the whole script (EPIPE), it is not an error of the server */
+            if ((n < 0 && EAGAIN != errno && EINTR != errno) || written == signed_script->script_size)
+            {
+                close(stdin_fd);
+                stdin_fd = -1;
+            }
+        }
+
+        if (fds[0].revents)
+        {
+            int drain_ret = drain_output(&result->output, output_fd);
+            if (OUTPUT_SINK_LIMIT == drain_ret)
+            {
+                kill(pid, SIGKILL);
+            }
+            if (OUTPUT_SINK_OK != drain_ret && OUTPUT_SINK_AGAIN != drain_ret)
+            {
+                ret = (OUTPUT_SINK_ERROR == drain_ret) ? EXECUTING_SCRIPT_FAILED : ret;
+                close(output_fd);
+                output_fd = -1;
+            }
+        }
+    }
+
+    if (stdin_fd >= 0)
+    {
+        close(stdin_fd);
+    }
+    if (output_fd >= 0)
+    {
+        close(output_fd);
+    }
+    return ret;
+}
+
+/* Execute a verified script with an interpreter of the pool (which may be NULL). Its output goes to the sink
+   set with --output, or to the sink of result if result is not NULL */
+int run_script(signed_script_t* signed_script, bash_pool_t* pool, script_result_t* result)
 {
    /* Double check that the signature is valid in case execution flow was hijacked */
     if (VERIFY_SIGNATURE_VALID != signed_script->valid)
@@ -44,49 +277,70 @@ int run_script(signed_script_t* signed_script)
         return EXECUTING_SCRIPT_FAILED;
     }
 
-    /* Open a pipe to bash as a child process */
-    FILE *pipe = popen(BASH_COMMAND, "w");
-    if (!pipe) 
+    set_log_request(signed_script->id);
+
+    script_result_t local_result;
+    script_result_t* res = result;
+    if (!res)
+    {
+        init_script_result(&local_result, output_sink_type);
+        res = &local_result;
+    }
+    if (OUTPUT_SINK_OK != open_output_sink(&res->output, signed_script->id))
     {
-        PRINT_ERROR_DEBUG(debug, "Error opening pipe to bash");
         return EXECUTING_SCRIPT_FAILED;
     }
 
-    /* Write the script content to the pipe (i.e., execute it)*/
-    fputs(signed_script->script, pipe);
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
-    /* Close the pipe */
-    if (pclose(pipe) < 0) 
+    int stdin_fd, output_fd;
+    pid_t pid = acquire_bash(pool, signed_script->id, &stdin_fd, &output_fd);
+    if (pid < 0)
     {
-        PRINT_ERROR_DEBUG(debug, "Error closing pipe");
+        if (!result)
+        {
+            free_script_result(&local_result);
+        }
         return EXECUTING_SCRIPT_FAILED;
     }
 
-    /* Open the file containing the result of the script */
-    FILE *fd = fopen(BASH_OUTPUT_FILE, "r");
-    if (!fd) 
+    int ret = exchange_with_bash(signed_script, pid, stdin_fd, output_fd, res);
+
+    /* Reap bash, which also gives its resource usage */
+    int status;
+    struct rusage usage;
+    while (wait4(pid, &status, 0, &usage) < 0)
     {
-        PRINT_ERROR_DEBUG(debug, "Error opening output file of bash");
-        return EXECUTING_SCRIPT_FAILED;
+        if (EINTR != errno)
+        {
+            PRINT_ERROR_DEBUG(debug, "Error waiting for bash");
+            if (!result)
+            {
+                free_script_result(&local_result);
+            }
+            return EXECUTING_SCRIPT_FAILED;
+        }
     }
+    finish_script_result(res, signed_script->id, status, &start, &usage);
 
-    /* Read and print the output of the script */
-    PRINT_INFO("++++++++++++ SCRIPT OUTPUT ++++++++++++++++");
-    PRINT_INFO("++++++++++++++++ START ++++++++++++++++++++");
-    char buffer[SCRIPT_OUTPUT_BUFFER_SIZE];
-    while (NULL != fgets(buffer, SCRIPT_OUTPUT_BUFFER_SIZE, fd)) 
+    if (!result)
     {
-        printf("%s", buffer);
+        print_script_output(signed_script->id, res);
     }
-    PRINT_INFO("+++++++++++++++++ END +++++++++++++++++++++");
-    PRINT_INFO("+++++++++++++++++++++++++++++++++++++++++++");
+    print_script_exit(signed_script->id, res);
 
-    /* Close the pipe */
-    if (fclose(fd) < 0) 
+    if (!result)
     {
-        PRINT_ERROR_DEBUG(debug, "Error closing output file of bash");
-        return EXECUTING_SCRIPT_FAILED;
+        free_script_result(&local_result);
+    }
+
+    /* The script is over, the refill thread can replace the interpreter it used */
+    if (pool)
+    {
+        refill_bash_pool(pool);
+        print_bash_pool_stats(pool);
     }
 
-    return EXECUTING_SCRIPT_OK;
+    return ret;
 }
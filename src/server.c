@@ -29,6 +29,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <getopt.h>
+#include <signal.h>
 #include <unistd.h>
 #include <openssl/err.h>
 
@@ -38,22 +40,172 @@
 #include "server.h"
 #include "ipc_pipe.h"
 #include "cert_utils.h"
+#include "cert_registry.h"
+#include "worker.h"
+#include "verify_pool.h"
+#include "verify_cache.h"
+#include "ingest.h"
+#include "executor.h"
+#include "bash_pool.h"
+#include "batch.h"
+#include "stats.h"
+#include "output_sink.h"
+#include "trace.h"
+#include "merkle.h"
+
+/* Long options without a short equivalent */
+#define OPT_VERIFY_BATCH    256
+#define OPT_STATS_FIFO      257
+#define OPT_STATS_FORMAT    258
+#define OPT_LOG_BUFFER      259
+#define OPT_LOG_POLICY      260
+#define OPT_CERT_CACHE      261
+#define OPT_OUTPUT          262
+#define OPT_OUTPUT_DIR      263
+#define OPT_OUTPUT_LIMIT    264
+#define OPT_OUTPUT_POLICY   265
+#define OPT_TRACE           266
+#define OPT_TRACE_SAMPLE    267
+
+static const struct option long_options[] =
+{
+    {"verify-batch", required_argument, NULL, OPT_VERIFY_BATCH},
+    {"stats-fifo", required_argument, NULL, OPT_STATS_FIFO},
+    {"stats-format", required_argument, NULL, OPT_STATS_FORMAT},
+    {"log-buffer", required_argument, NULL, OPT_LOG_BUFFER},
+    {"log-policy", required_argument, NULL, OPT_LOG_POLICY},
+    {"cert-cache", required_argument, NULL, OPT_CERT_CACHE},
+    {"output", required_argument, NULL, OPT_OUTPUT},
+    {"output-dir", required_argument, NULL, OPT_OUTPUT_DIR},
+    {"output-limit", required_argument, NULL, OPT_OUTPUT_LIMIT},
+    {"output-limit-policy", required_argument, NULL, OPT_OUTPUT_POLICY},
+    {"trace", required_argument, NULL, OPT_TRACE},
+    {"trace-sample", required_argument, NULL, OPT_TRACE_SAMPLE},
+    {NULL, 0, NULL, 0}
+};
 
 
     
 int debug = DEBUG_DISABLED;
 long int counter = 0;
 
+/* Parse a comma separated list of CPUs (e.g. "0,2,4") */
+static int parse_cpu_list(char* list, int* cpus, int max_cpus)
+{
+    int num_cpus = 0;
+    char* saveptr = NULL;
+
+    for(char* tok = strtok_r(list, ",", &saveptr); tok != NULL; tok = strtok_r(NULL, ",", &saveptr))
+    {
+        char* end = NULL;
+        long cpu = strtol(tok, &end, 10);
+        if(end == tok || *end != '\0' || cpu < 0 || num_cpus >= max_cpus)
+        {
+            return ERROR;
+        }
+        cpus[num_cpus++] = (int) cpu;
+    }
+    return num_cpus;
+}
+
+/* Parse a size in bytes with an optional K or M suffix (e.g. "16M") */
+static long parse_size(const char* str)
+{
+    char* end = NULL;
+    long size = strtol(str, &end, 10);
+    if(end == str || size < 0)
+    {
+        return ERROR;
+    }
+
+    if(*end == 'K' || *end == 'k')
+    {
+        size *= 1024;
+        end++;
+    }
+    else if(*end == 'M' || *end == 'm')
+    {
+        size *= 1024 * 1024;
+        end++;
+    }
+    return (*end == '\0') ? size : ERROR;
+}
+
+static void print_usage(const char* prog)
+{
+    fprintf(stderr, "Usage: %s [-d] [-c <certs_path>] [-w <num_workers>] [-a <cpu_list>] [-C <entries>] [-N <entries>] [-m <size>] [-f <fifo_dir>] [-u <socket_path>] [-j <children>] [-V <verifiers>]\n", prog);
+    fprintf(stderr, "       %*s [-P <size>] [-R <eager|deferred>] [--stats-fifo <path>] [--stats-format <prometheus|json>] [--log-buffer <records>]\n", (int) strlen(prog), "");
+    fprintf(stderr, "       %*s [--log-policy <block|drop>] [--cert-cache <file>] [--output <log|file>] [--output-dir <dir>]\n", (int) strlen(prog), "");
+    fprintf(stderr, "       %*s [--output-limit <size>] [--output-limit-policy <truncate|kill>] [--trace <file>] [--trace-sample <fraction>]\n", (int) strlen(prog), "");
+    fprintf(stderr, "       %s [-d] [-c <certs_path>] [-w <num_threads>] [-m <size>] [--cert-cache <file>] --verify-batch <dir|manifest>\n", prog);
+    fprintf(stderr, "       -d : enable debug\n");
+    fprintf(stderr, "       -c <certs_path> : specify certificates directory\n");
+    fprintf(stderr, "       -w <num_workers> : start num_workers workers, each listening on its own fifo (fifo.0 ... fifo.N-1)\n");
+    fprintf(stderr, "       -a <cpu_list> : pin the workers to the comma separated list of CPUs (round robin)\n");
+    fprintf(stderr, "       -C <entries> : capacity of the verification cache of each worker, 0 disables it (default: %d)\n", VERIFY_CACHE_DEFAULT_CAPACITY);
+    fprintf(stderr, "       -N <entries> : capacity of the cache of invalid verdicts (default: capacity / %d)\n", VERIFY_CACHE_NEGATIVE_RATIO);
+    fprintf(stderr, "       -m <size> : largest accepted script in bytes, K and M suffixes are allowed (default: %dM)\n", MAX_SCRIPT_SIZE / (1024 * 1024));
+    fprintf(stderr, "       -f <fifo_dir> : listen on every fifo named pipe of fifo_dir from one event loop\n");
+    fprintf(stderr, "       -u <socket_path> : accept scripts on a unix domain socket and reply with the verdict and output\n");
+    fprintf(stderr, "       -j <children> : with -f and -u, number of scripts executed at the same time (default: %d)\n", EXECUTOR_DEFAULT_MAX_CHILDREN);
+    fprintf(stderr, "       -V <verifiers> : with -f and -u, number of threads verifying the scripts while the event loop receives the next ones,\n");
+    fprintf(stderr, "                        0 verifies them on the event loop (default: number of CPUs, at most %d)\n", VERIFY_POOL_MAX_VERIFIERS);
+    fprintf(stderr, "       -P <size> : keep size bash interpreters started in advance for each worker, 0 disables it (default: 0)\n");
+    fprintf(stderr, "       -R <eager|deferred> : replace a used interpreter right away or once its script finished (default: deferred)\n");
+    fprintf(stderr, "       --stats-fifo <path> : print the statistics to every reader of the fifo named pipe path. They are also printed to stderr on SIGUSR1\n");
+    fprintf(stderr, "       --stats-format <prometheus|json> : format of the statistics (default: prometheus)\n");
+    fprintf(stderr, "       --log-buffer <records> : number of messages the logger can hold before they are written (default: %d)\n", LOG_DEFAULT_CAPACITY);
+    fprintf(stderr, "       --log-policy <block|drop> : when the logger is full, wait for room or drop the message (default: block)\n");
+    fprintf(stderr, "       --cert-cache <file> : keep the certificates validated at startup in file, so that the next start only validates the changed ones\n");
+    fprintf(stderr, "       --output <log|file> : print the output of the scripts received on named pipes, or write it to the output directory (default: log).\n");
+    fprintf(stderr, "                             The output of a script received on the socket is sent to its client\n");
+    fprintf(stderr, "       --output-dir <dir> : directory of the output files, script.<number>.out (default: .)\n");
+    fprintf(stderr, "       --output-limit <size> : most output bytes kept per script, K and M suffixes are allowed (default: %ldM)\n", OUTPUT_DEFAULT_LIMIT / (1024 * 1024));
+    fprintf(stderr, "       --output-limit-policy <truncate|kill> : discard the output beyond the limit, or kill the script (default: truncate)\n");
+    fprintf(stderr, "       --trace <file> : write the spans of the stages of the scripts to file, in the Chrome trace event format\n");
+    fprintf(stderr, "       --trace-sample <fraction> : fraction of the scripts traced, between 0 and 1 (default: 1)\n");
+    fprintf(stderr, "       --verify-batch <dir|manifest> : verify every *%s file of dir, or every file listed in manifest, print a verdict per file and exit.\n", BATCH_FILE_SUFFIX);
+    fprintf(stderr, "                                       Nothing is executed. -w sets the number of threads (default: number of CPUs)\n");
+}
+
 int main(int argc, char *argv[]) 
 {
     int opt;
-    int verify_sig_ret = VERIFY_SIGNATURE_INVALID;
-    signed_script_t signed_script = {.script = NULL, .signature = NULL, .script_size = 0, .signature_size = 0, .valid = VERIFY_SIGNATURE_INVALID};
-    cert_container_t* certs = NULL;
+    cert_store_t* certs = NULL;
+    cert_registry_t registry;
     char certs_path[300];
     certs_path[0] = '\0';
+    int num_workers = 0;
+    int cpus[MAX_WORKERS];
+    int num_cpus = 0;
+    worker_t* workers = NULL;
+    long cache_capacity = VERIFY_CACHE_DEFAULT_CAPACITY;
+    long negative_cache_capacity = -1;
+    long script_size_limit;
+    long output_size_limit;
+    char fifo_dir[MAX_FILEPATH_CHARS_SIZE + 1];
+    fifo_dir[0] = '\0';
+    char socket_path[MAX_FILEPATH_CHARS_SIZE + 1];
+    socket_path[0] = '\0';
+    int max_children = EXECUTOR_DEFAULT_MAX_CHILDREN;
+    int num_verifiers = -1;
+    int pool_size = 0;
+    int pool_refill = BASH_POOL_REFILL_DEFERRED;
+    char batch_target[MAX_FILEPATH_CHARS_SIZE + 1];
+    batch_target[0] = '\0';
+    char stats_fifo[MAX_FILEPATH_CHARS_SIZE + 1];
+    stats_fifo[0] = '\0';
+    int stats_format = STATS_FORMAT_PROMETHEUS;
+    long log_capacity = LOG_DEFAULT_CAPACITY;
+    int log_policy = LOG_POLICY_BLOCK;
+    char cert_cache[MAX_FILEPATH_CHARS_SIZE + 1];
+    cert_cache[0] = '\0';
+    char trace_file[MAX_FILEPATH_CHARS_SIZE + 1];
+    trace_file[0] = '\0';
+    double trace_sample_rate = TRACE_DEFAULT_SAMPLE_RATE;
+    char* end;
 
-    while ((opt = getopt(argc, argv, "dc:")) != -1) 
+    while ((opt = getopt_long(argc, argv, "dc:w:a:C:N:m:f:u:j:V:P:R:", long_options, NULL)) != -1) 
     {
         switch (opt) 
         {
@@ -64,71 +216,328 @@ int main(int argc, char *argv[])
                 strncpy(certs_path, optarg, sizeof(certs_path) - 1);
                 certs_path[sizeof(certs_path) - 1] = '\0';
                 break;
+            case 'w':
+                num_workers = atoi(optarg);
+                if(num_workers < 1 || num_workers > MAX_WORKERS)
+                {
+                    fprintf(stderr, "The number of workers must be between 1 and %d\n", MAX_WORKERS);
+                    return ERROR;
+                }
+                break;
+            case 'a':
+                num_cpus = parse_cpu_list(optarg, cpus, MAX_WORKERS);
+                if(num_cpus <= 0)
+                {
+                    fprintf(stderr, "Invalid CPU list %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+            case 'C':
+                cache_capacity = atol(optarg);
+                if(cache_capacity < 0)
+                {
+                    fprintf(stderr, "Invalid cache capacity %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+            case 'N':
+                negative_cache_capacity = atol(optarg);
+                if(negative_cache_capacity < 0)
+                {
+                    fprintf(stderr, "Invalid cache capacity %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+            case 'm':
+                script_size_limit = parse_size(optarg);
+                if(script_size_limit <= 0)
+                {
+                    fprintf(stderr, "Invalid script size %s\n", optarg);
+                    return ERROR;
+                }
+                max_script_size = script_size_limit;
+                break;
+            case 'f':
+                strncpy(fifo_dir, optarg, sizeof(fifo_dir) - 1);
+                fifo_dir[sizeof(fifo_dir) - 1] = '\0';
+                break;
+            case 'u':
+                strncpy(socket_path, optarg, sizeof(socket_path) - 1);
+                socket_path[sizeof(socket_path) - 1] = '\0';
+                break;
+            case 'j':
+                max_children = atoi(optarg);
+                if(max_children < 1)
+                {
+                    fprintf(stderr, "The number of children must be at least 1\n");
+                    return ERROR;
+                }
+                break;
+            case 'V':
+                num_verifiers = atoi(optarg);
+                if(num_verifiers < 0 || num_verifiers > VERIFY_POOL_MAX_VERIFIERS)
+                {
+                    fprintf(stderr, "The number of verifiers must be between 0 and %d\n", VERIFY_POOL_MAX_VERIFIERS);
+                    return ERROR;
+                }
+                break;
+            case 'P':
+                pool_size = atoi(optarg);
+                if(pool_size < 0 || pool_size > BASH_POOL_MAX_SIZE)
+                {
+                    fprintf(stderr, "The size of the interpreter pool must be between 0 and %d\n", BASH_POOL_MAX_SIZE);
+                    return ERROR;
+                }
+                break;
+            case 'R':
+                if(0 == strcmp(optarg, "eager"))
+                {
+                    pool_refill = BASH_POOL_REFILL_EAGER;
+                }
+                else if(0 == strcmp(optarg, "deferred"))
+                {
+                    pool_refill = BASH_POOL_REFILL_DEFERRED;
+                }
+                else
+                {
+                    fprintf(stderr, "Invalid refill policy %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+            case OPT_VERIFY_BATCH:
+                strncpy(batch_target, optarg, sizeof(batch_target) - 1);
+                batch_target[sizeof(batch_target) - 1] = '\0';
+                break;
+            case OPT_STATS_FIFO:
+                strncpy(stats_fifo, optarg, sizeof(stats_fifo) - 1);
+                stats_fifo[sizeof(stats_fifo) - 1] = '\0';
+                break;
+            case OPT_STATS_FORMAT:
+                stats_format = parse_stats_format(optarg);
+                if(STATS_ERROR == stats_format)
+                {
+                    fprintf(stderr, "Invalid stats format %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+            case OPT_LOG_BUFFER:
+                log_capacity = atol(optarg);
+                if(log_capacity < 1)
+                {
+                    fprintf(stderr, "Invalid log buffer size %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+            case OPT_LOG_POLICY:
+                log_policy = parse_log_policy(optarg);
+                if(LOGGER_ERROR == log_policy)
+                {
+                    fprintf(stderr, "Invalid log policy %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+            case OPT_CERT_CACHE:
+                strncpy(cert_cache, optarg, sizeof(cert_cache) - 1);
+                cert_cache[sizeof(cert_cache) - 1] = '\0';
+                break;
+            case OPT_OUTPUT:
+                output_sink_type = parse_output_sink(optarg);
+                if(OUTPUT_SINK_ERROR == output_sink_type)
+                {
+                    fprintf(stderr, "Invalid output %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+            case OPT_OUTPUT_DIR:
+                strncpy(output_dir, optarg, sizeof(output_dir) - 1);
+                output_dir[sizeof(output_dir) - 1] = '\0';
+                break;
+            case OPT_OUTPUT_LIMIT:
+                output_size_limit = parse_size(optarg);
+                if(output_size_limit <= 0)
+                {
+                    fprintf(stderr, "Invalid output limit %s\n", optarg);
+                    return ERROR;
+                }
+                output_limit = output_size_limit;
+                break;
+            case OPT_OUTPUT_POLICY:
+                output_limit_policy = parse_output_limit_policy(optarg);
+                if(OUTPUT_SINK_ERROR == output_limit_policy)
+                {
+                    fprintf(stderr, "Invalid output limit policy %s\n", optarg);
+                    return ERROR;
+                }
+                break;
+            case OPT_TRACE:
+                strncpy(trace_file, optarg, sizeof(trace_file) - 1);
+                trace_file[sizeof(trace_file) - 1] = '\0';
+                break;
+            case OPT_TRACE_SAMPLE:
+                trace_sample_rate = strtod(optarg, &end);
+                if(end == optarg || *end != '\0' || !(trace_sample_rate >= 0 && trace_sample_rate <= 1))
+                {
+                    fprintf(stderr, "Invalid trace sample rate %s\n", optarg);
+                    return ERROR;
+                }
+                break;
             default:
-                fprintf(stderr, "Usage: %s [-d] [-c <certs_path>]\n", argv[0]);
-                fprintf(stderr, "       -d : enable debug\n");
-                fprintf(stderr, "       -c <certs_path> : specify certificates directory\n");
+                print_usage(argv[0]);
                 return ERROR;
         }
     }
    
-    if(strlen(certs_path) == 0)
+    if((strlen(fifo_dir) > 0 || strlen(socket_path) > 0) && num_workers > 0)
     {
-        certs = load_certs(SERVER_DEFAULT_CERTS_PATH);
+        fprintf(stderr, "-f and -u cannot be used together with -w\n");
+        return ERROR;
     }
-    else
+
+    if(strlen(batch_target) > 0 && (strlen(fifo_dir) > 0 || strlen(socket_path) > 0))
     {
-        certs = load_certs(certs_path);
+        fprintf(stderr, "--verify-batch cannot be used together with -f and -u\n");
+        return ERROR;
     }
 
+    if(OUTPUT_SINK_FILE == output_sink_type && 0 != access(output_dir, W_OK | X_OK))
+    {
+        fprintf(stderr, "Cannot write the output files to %s\n", output_dir);
+        return ERROR;
+    }
+
+    if(debug && !LOG_DEBUG_COMPILED)
+    {
+        fprintf(stderr, "This is a release build, -d has no effect\n");
+    }
+
+    /* A script that exits before reading all its input must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* The statistics are dumped by their own thread, every other thread must block its signal.
+       The batch mode prints its report itself, so its messages are written synchronously */
+    if(0 == strlen(batch_target))
+    {
+        block_stats_signal();
+        if(LOGGER_OK != start_logger(log_capacity, log_policy))
+        {
+            return ERROR;
+        }
+    }
+
+    if(strlen(certs_path) == 0)
+    {
+        strncpy(certs_path, SERVER_DEFAULT_CERTS_PATH, sizeof(certs_path) - 1);
+        certs_path[sizeof(certs_path) - 1] = '\0';
+    }
+    certs = load_cert_store(certs_path, strlen(cert_cache) > 0 ? cert_cache : NULL, 0);
+
     if(NULL == certs)
     {
         PRINT_ERROR("Cannot load any certificate");
         return ERROR;
     }
 
+    /* The batch mode only verifies, it uses -w threads or one per CPU */
+    if(strlen(batch_target) > 0)
+    {
+        int num_threads = (num_workers > 0) ? num_workers : (int) sysconf(_SC_NPROCESSORS_ONLN);
+        int batch_ret = run_verify_batch(certs, batch_target, num_threads > 0 ? num_threads : 1);
+        cleanup_certs(&certs);
+        EVP_cleanup();
+        ERR_free_strings();
+        return (BATCH_OK == batch_ret) ? OK : ERROR;
+    }
 
-    if(READ_PIPE_OK != init_pipe(&signed_script))
+    /* The statistics are dumped by their own threads, the workers only record them */
+    if(STATS_OK != start_stats_reporter(strlen(stats_fifo) > 0 ? stats_fifo : NULL, stats_format))
     {
-        PRINT_ERROR("Cannot open a fifo named pipe");
         return ERROR;
     }
+    if(TRACE_OK != start_trace(strlen(trace_file) > 0 ? trace_file : NULL, trace_sample_rate))
+    {
+        return ERROR;
+    }
+
+    /* From now on the certificates are reloaded whenever their directory changes */
+    init_cert_registry(&registry, certs, certs_path, strlen(cert_cache) > 0 ? cert_cache : NULL);
+    certs = NULL;
+    start_cert_watcher(&registry);
 
-    for(;;)
+    if(negative_cache_capacity < 0)
     {
-        if (READ_PIPE_ERROR == read_from_pipe(&signed_script))
+        negative_cache_capacity = (cache_capacity + VERIFY_CACHE_NEGATIVE_RATIO - 1) / VERIFY_CACHE_NEGATIVE_RATIO;
+    }
+
+    /* With -f and -u the server serves all the fifos of a directory and the socket clients from an event loop on the main thread */
+    if(strlen(fifo_dir) > 0 || strlen(socket_path) > 0)
+    {
+        if(num_verifiers < 0)
         {
-            PRINT_INFO("Error occured while parsing script #%ld. Skipping...", counter);
-            continue;
+            num_verifiers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+            num_verifiers = (num_verifiers < 1) ? 1 : (num_verifiers > VERIFY_POOL_MAX_VERIFIERS) ? VERIFY_POOL_MAX_VERIFIERS : num_verifiers;
         }
-
-        else
+        /* The chunks of the sealed v2 scripts of the socket clients are checked with the chunk pool. Started
+           after the event loop is pinned, its threads would inherit its CPU */
+        if(strlen(socket_path) > 0 && MERKLE_OK != start_merkle_pool())
+        {
+            return ERROR;
+        }
+        workers = calloc(1, sizeof(worker_t));
+        if(NULL == workers || WORKER_INIT_OK != init_worker(&workers[0], 0, NULL, num_cpus > 0 ? cpus[0] : WORKER_NOT_PINNED, &registry, cache_capacity, negative_cache_capacity, pool_size, pool_refill))
+        {
+            PRINT_ERROR("Cannot initialize the worker");
+            return ERROR;
+        }
+        if(WORKER_INIT_OK != run_event_worker(&workers[0], strlen(fifo_dir) > 0 ? fifo_dir : NULL, strlen(socket_path) > 0 ? socket_path : NULL, max_children, num_verifiers))
+        {
+            return ERROR;
+        }
+        stop_merkle_pool();
+        free_verify_cache(&workers[0].cache);
+        cleanup_verify_ctx(&workers[0].verifier);
+        cleanup_bash_pool(&workers[0].pool);
+    }
+    /* Without -w the server runs a single worker on the main thread using the default fifo */
+    else if(0 == num_workers)
+    {
+        workers = calloc(1, sizeof(worker_t));
+        if(NULL == workers || WORKER_INIT_OK != init_worker(&workers[0], 0, SERVER_PIPE_PATH, num_cpus > 0 ? cpus[0] : WORKER_NOT_PINNED, &registry, cache_capacity, negative_cache_capacity, pool_size, pool_refill))
         {
-            verify_sig_ret = verify_signature(certs, &signed_script);
+            PRINT_ERROR("Cannot open a fifo named pipe");
+            return ERROR;
+        }
+        worker_loop(&workers[0]);
+    }
+    else
+    {
+        workers = calloc(num_workers, sizeof(worker_t));
+        if(NULL == workers)
+        {
+            PRINT_ERROR("Memory allocation failed");
+            return ERROR;
+        }
 
-            if(VERIFY_SIGNATURE_VALID == verify_sig_ret)
-            {
-                PRINT_INFO("Script #%ld has VALID signature, executing...", counter);
-                if (EXECUTING_SCRIPT_OK != run_script(&signed_script))
-                {
-                    PRINT_ERROR("Failed to execute the script");
-                }
-            }
-            else if(VERIFY_SIGNATURE_INVALID == verify_sig_ret)
-            {
-                PRINT_INFO("The script has INVALID signature, skipping...\n");
-            }
-            else
+        for(int i = 0; i < num_workers; i++)
+        {
+            char pipe_path[MAX_PIPE_PATH_SIZE];
+            snprintf(pipe_path, sizeof(pipe_path), WORKER_PIPE_PATH_FORMAT, i);
+            if(WORKER_INIT_OK != init_worker(&workers[i], i, pipe_path, num_cpus > 0 ? cpus[i % num_cpus] : WORKER_NOT_PINNED, &registry, cache_capacity, negative_cache_capacity, pool_size, pool_refill))
             {
-                PRINT_ERROR("Error occured while verifying the signature");
-                ERR_print_errors_fp(stderr);
+                PRINT_ERROR("Cannot initialize worker %d", i);
+                return ERROR;
             }
         }
+
+        if(WORKER_INIT_OK != start_workers(workers, num_workers))
+        {
+            return ERROR;
+        }
+        join_workers(workers, num_workers);
     }
 
 
-    cleanup_certs(&certs);
-    free(signed_script.signature);
+    free(workers);
+    cleanup_cert_registry(&registry);
     EVP_cleanup();
     ERR_free_strings();
     return OK;
@@ -0,0 +1,492 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: stats.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "debug.h"
+#include "server.h"
+#include "stats.h"
+
+/* Time given to the reader of the stats fifo to read the end of a dump before the fifo is reopened */
+#define STATS_FIFO_REOPEN_DELAY_US      100000
+
+static const char* const stage_names[STATS_NUM_STAGES] =
+{
+    "ingest", "decode", "verify_queue", "verify_attempt", "verify", "spawn", "execute", "output"
+};
+
+typedef struct stats_counter_desc
+{
+    const char* name;           // key in the json dump
+    const char* metric;         // prometheus metric
+    const char* label;          // prometheus label, or NULL
+} stats_counter_desc_t;
+
+static const stats_counter_desc_t counter_descs[STATS_NUM_COUNTERS] =
+{
+    {"scripts_received",                 "svs_scripts_received_total",         NULL},
+    {"bytes_ingested",                   "svs_ingested_bytes_total",           NULL},
+    {"ingest_errors",                    "svs_ingest_errors_total",            NULL},
+    {"verdicts_valid",                   "svs_verdicts_total",                 "verdict=\"valid\""},
+    {"verdicts_invalid",                 "svs_verdicts_total",                 "verdict=\"invalid\""},
+    {"verdicts_error",                   "svs_verdicts_total",                 "verdict=\"error\""},
+    {"key_id_lookups",                   "svs_key_id_lookups_total",           NULL},
+    {"execution_failures",               "svs_execution_failures_total",       NULL},
+    {"output_bytes",                     "svs_output_bytes_total",             NULL},
+    {"verify_stalls",                    "svs_verify_queue_stalls_total",      NULL},
+    {"verify_steals",                    "svs_verify_steals_total",            NULL},
+    {"outputs_limited",                  "svs_outputs_limited_total",          NULL},
+    {"verify_cache_hits",                "svs_verify_cache_hits_total",        "cache=\"positive\""},
+    {"negative_verify_cache_hits",       "svs_verify_cache_hits_total",        "cache=\"negative\""},
+    {"verify_cache_misses",              "svs_verify_cache_misses_total",      "cache=\"positive\""},
+    {"negative_verify_cache_misses",     "svs_verify_cache_misses_total",      "cache=\"negative\""},
+    {"verify_cache_evictions",           "svs_verify_cache_evictions_total",   "cache=\"positive\""},
+    {"negative_verify_cache_evictions",  "svs_verify_cache_evictions_total",   "cache=\"negative\""},
+    {"interpreter_warm_hits",            "svs_interpreter_warm_hits_total",    NULL},
+    {"interpreter_cold_spawns",          "svs_interpreter_cold_spawns_total",  NULL},
+    {"interpreters_discarded",           "svs_interpreters_discarded_total",   NULL},
+};
+
+static const double quantiles[] = {0.5, 0.9, 0.99};
+#define NUM_QUANTILES   (sizeof(quantiles) / sizeof(quantiles[0]))
+
+static pthread_mutex_t shards_lock = PTHREAD_MUTEX_INITIALIZER;
+static stats_shard_t* shards = NULL;
+static __thread stats_shard_t* local_shard = NULL;
+
+static char stats_fifo_path[MAX_FILEPATH_CHARS_SIZE + 1];
+static int stats_format = STATS_FORMAT_PROMETHEUS;
+
+/* The shard of the calling thread, created on its first record. NULL if it cannot be allocated */
+static stats_shard_t* get_shard(void)
+{
+    if(local_shard)
+    {
+        return local_shard;
+    }
+
+    stats_shard_t* shard = calloc(1, sizeof(stats_shard_t));
+    if(NULL == shard)
+    {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&shards_lock);
+    shard->next = shards;
+    shards = shard;
+    pthread_mutex_unlock(&shards_lock);
+
+    local_shard = shard;
+    return shard;
+}
+
+/* Only the owning thread writes a shard, so a plain increment is enough. The relaxed atomic
+   accesses only keep the values read by a concurrent dump whole */
+static inline void shard_add(uint64_t* value, uint64_t delta)
+{
+    __atomic_store_n(value, __atomic_load_n(value, __ATOMIC_RELAXED) + delta, __ATOMIC_RELAXED);
+}
+
+static inline uint64_t shard_load(const uint64_t* value)
+{
+    return __atomic_load_n(value, __ATOMIC_RELAXED);
+}
+
+static int bucket_index(uint64_t value)
+{
+    if(value < STATS_SUB_BUCKETS)
+    {
+        return (int) value;
+    }
+
+    int shift = 63 - __builtin_clzll(value) - STATS_SUB_BUCKET_BITS;
+    int sub_bucket = (int) ((value >> shift) & (STATS_SUB_BUCKETS - 1));
+    return (shift + 1) * STATS_SUB_BUCKETS + sub_bucket;
+}
+
+/* Largest value that falls in a bucket */
+static uint64_t bucket_upper_bound(int index)
+{
+    if(index < STATS_SUB_BUCKETS)
+    {
+        return index;
+    }
+
+    int shift = index / STATS_SUB_BUCKETS - 1;
+    uint64_t lower = (uint64_t) (STATS_SUB_BUCKETS + index % STATS_SUB_BUCKETS) << shift;
+    return lower + ((uint64_t) 1 << shift) - 1;
+}
+
+const char* stats_stage_name(int stage)
+{
+    return (stage >= 0 && stage < STATS_NUM_STAGES) ? stage_names[stage] : "unknown";
+}
+
+uint64_t stats_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+void stats_record(int histogram, uint64_t value)
+{
+    stats_shard_t* shard = get_shard();
+    if(NULL == shard)
+    {
+        return;
+    }
+
+    stats_histogram_t* hist = &shard->histograms[histogram];
+    shard_add(&hist->buckets[bucket_index(value)], 1);
+    shard_add(&hist->count, 1);
+    shard_add(&hist->sum, value);
+    if(value > shard_load(&hist->max))
+    {
+        __atomic_store_n(&hist->max, value, __ATOMIC_RELAXED);
+    }
+}
+
+/* Record the time elapsed since start, a value returned by stats_now */
+void stats_record_since(int stage, uint64_t start)
+{
+    stats_record(stage, stats_now() - start);
+}
+
+void stats_count(int counter, uint64_t value)
+{
+    stats_shard_t* shard = get_shard();
+    if(shard)
+    {
+        shard_add(&shard->counters[counter], value);
+    }
+}
+
+/* Add up the shards of all the threads */
+static void collect_stats(stats_shard_t* total)
+{
+    memset(total, 0, sizeof(stats_shard_t));
+
+    pthread_mutex_lock(&shards_lock);
+    for(stats_shard_t* shard = shards; shard != NULL; shard = shard->next)
+    {
+        for(int h = 0; h < STATS_NUM_HISTOGRAMS; h++)
+        {
+            stats_histogram_t* from = &shard->histograms[h];
+            stats_histogram_t* to = &total->histograms[h];
+            for(int b = 0; b < STATS_NUM_BUCKETS; b++)
+            {
+                to->buckets[b] += shard_load(&from->buckets[b]);
+            }
+            to->count += shard_load(&from->count);
+            to->sum += shard_load(&from->sum);
+            uint64_t max = shard_load(&from->max);
+            to->max = (max > to->max) ? max : to->max;
+        }
+        for(int c = 0; c < STATS_NUM_COUNTERS; c++)
+        {
+            total->counters[c] += shard_load(&shard->counters[c]);
+        }
+    }
+    pthread_mutex_unlock(&shards_lock);
+}
+
+/* The buckets are read one by one while the threads record, so their sum is used rather than count */
+static uint64_t histogram_percentile(const stats_histogram_t* hist, double quantile)
+{
+    uint64_t total = 0;
+    for(int b = 0; b < STATS_NUM_BUCKETS; b++)
+    {
+        total += hist->buckets[b];
+    }
+    if(0 == total)
+    {
+        return 0;
+    }
+
+    /* The rank of the percentile is rounded up */
+    uint64_t rank = (uint64_t) (quantile * total);
+    rank += (rank < quantile * total || 0 == rank) ? 1 : 0;
+
+    uint64_t seen = 0;
+    for(int b = 0; b < STATS_NUM_BUCKETS; b++)
+    {
+        seen += hist->buckets[b];
+        if(seen >= rank)
+        {
+            uint64_t bound = bucket_upper_bound(b);
+            return (bound < hist->max) ? bound : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+/* A histogram of plain values, not durations, as a prometheus summary */
+static void dump_prometheus_values(FILE* stream, const stats_histogram_t* hist, const char* metric, const char* help)
+{
+    fprintf(stream, "# HELP %s %s\n", metric, help);
+    fprintf(stream, "# TYPE %s summary\n", metric);
+    for(size_t q = 0; q < NUM_QUANTILES; q++)
+    {
+        fprintf(stream, "%s{quantile=\"%g\"} %lu\n", metric, quantiles[q], histogram_percentile(hist, quantiles[q]));
+    }
+    fprintf(stream, "%s_sum %lu\n", metric, hist->sum);
+    fprintf(stream, "%s_count %lu\n", metric, hist->count);
+}
+
+static void dump_prometheus(FILE* stream, const stats_shard_t* total)
+{
+    fprintf(stream, "# HELP svs_stage_duration_seconds Time spent in each stage of the handling of a script\n");
+    fprintf(stream, "# TYPE svs_stage_duration_seconds summary\n");
+    for(int s = 0; s < STATS_NUM_STAGES; s++)
+    {
+        const stats_histogram_t* hist = &total->histograms[s];
+        for(size_t q = 0; q < NUM_QUANTILES; q++)
+        {
+            fprintf(stream, "svs_stage_duration_seconds{stage=\"%s\",quantile=\"%g\"} %.9f\n",
+                    stage_names[s], quantiles[q], histogram_percentile(hist, quantiles[q]) / 1e9);
+        }
+        fprintf(stream, "svs_stage_duration_seconds_sum{stage=\"%s\"} %.9f\n", stage_names[s], hist->sum / 1e9);
+        fprintf(stream, "svs_stage_duration_seconds_count{stage=\"%s\"} %lu\n", stage_names[s], hist->count);
+    }
+
+    fprintf(stream, "# HELP svs_stage_duration_max_seconds Longest time spent in each stage\n");
+    fprintf(stream, "# TYPE svs_stage_duration_max_seconds gauge\n");
+    for(int s = 0; s < STATS_NUM_STAGES; s++)
+    {
+        fprintf(stream, "svs_stage_duration_max_seconds{stage=\"%s\"} %.9f\n", stage_names[s], total->histograms[s].max / 1e9);
+    }
+
+    dump_prometheus_values(stream, &total->histograms[STATS_CERT_POSITION], "svs_cert_hit_position",
+                           "Position in the certificate list of the certificate that validated a signature");
+    dump_prometheus_values(stream, &total->histograms[STATS_VERIFY_QUEUE_DEPTH], "svs_verify_queue_depth",
+                           "Scripts already waiting for a verifier thread when one more is queued");
+
+    for(int c = 0; c < STATS_NUM_COUNTERS; c++)
+    {
+        /* Labelled counters share their metric, its type is printed once */
+        if(0 == c || 0 != strcmp(counter_descs[c].metric, counter_descs[c - 1].metric))
+        {
+            fprintf(stream, "# TYPE %s counter\n", counter_descs[c].metric);
+        }
+        if(counter_descs[c].label)
+        {
+            fprintf(stream, "%s{%s} %lu\n", counter_descs[c].metric, counter_descs[c].label, total->counters[c]);
+        }
+        else
+        {
+            fprintf(stream, "%s %lu\n", counter_descs[c].metric, total->counters[c]);
+        }
+    }
+}
+
+static void dump_json_values(FILE* stream, const stats_histogram_t* hist, const char* name)
+{
+    fprintf(stream, "\"%s\":{\"count\":%lu", name, hist->count);
+    for(size_t q = 0; q < NUM_QUANTILES; q++)
+    {
+        fprintf(stream, ",\"p%g\":%lu", quantiles[q] * 100, histogram_percentile(hist, quantiles[q]));
+    }
+    fprintf(stream, ",\"max\":%lu}", hist->max);
+}
+
+static void dump_json(FILE* stream, const stats_shard_t* total)
+{
+    fprintf(stream, "{\"stages\":{");
+    for(int s = 0; s < STATS_NUM_STAGES; s++)
+    {
+        const stats_histogram_t* hist = &total->histograms[s];
+        fprintf(stream, "%s\"%s\":{\"count\":%lu,\"mean_us\":%.3f", (s > 0) ? "," : "", stage_names[s], hist->count,
+                hist->count ? hist->sum / 1e3 / hist->count : 0.0);
+        for(size_t q = 0; q < NUM_QUANTILES; q++)
+        {
+            fprintf(stream, ",\"p%g_us\":%.3f", quantiles[q] * 100, histogram_percentile(hist, quantiles[q]) / 1e3);
+        }
+        fprintf(stream, ",\"max_us\":%.3f}", hist->max / 1e3);
+    }
+
+    fprintf(stream, "},");
+    dump_json_values(stream, &total->histograms[STATS_CERT_POSITION], "cert_hit_position");
+    fprintf(stream, ",");
+    dump_json_values(stream, &total->histograms[STATS_VERIFY_QUEUE_DEPTH], "verify_queue_depth");
+    fprintf(stream, ",\"counters\":{");
+
+    for(int c = 0; c < STATS_NUM_COUNTERS; c++)
+    {
+        fprintf(stream, "%s\"%s\":%lu", (c > 0) ? "," : "", counter_descs[c].name, total->counters[c]);
+    }
+    fprintf(stream, "}}\n");
+}
+
+/* Print the statistics of all the threads */
+int stats_dump(FILE* stream, int format)
+{
+    stats_shard_t* total = malloc(sizeof(stats_shard_t));
+    if(NULL == total)
+    {
+        PRINT_ERROR("Memory allocation failed");
+        return STATS_ERROR;
+    }
+    collect_stats(total);
+
+    flockfile(stream);
+    if(STATS_FORMAT_JSON == format)
+    {
+        dump_json(stream, total);
+    }
+    else
+    {
+        dump_prometheus(stream, total);
+    }
+    funlockfile(stream);
+    fflush(stream);
+
+    free(total);
+    return STATS_OK;
+}
+
+int parse_stats_format(const char* name)
+{
+    if(0 == strcmp(name, "prometheus"))
+    {
+        return STATS_FORMAT_PROMETHEUS;
+    }
+    if(0 == strcmp(name, "json"))
+    {
+        return STATS_FORMAT_JSON;
+    }
+    return STATS_ERROR;
+}
+
+/* SIGUSR1 is handled by the reporter thread. It must be blocked before any other thread is started
+   so that they all inherit the mask */
+void block_stats_signal(void)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+}
+
+static void* signal_reporter(void* arg)
+{
+    (void) arg;
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+
+    for(;;)
+    {
+        int sig;
+        if(0 == sigwait(&set, &sig))
+        {
+            stats_dump(stderr, stats_format);
+        }
+    }
+    return NULL;
+}
+
+/* Every reader of the fifo gets one dump: opening the fifo blocks until a reader opens it, and the
+   dump ends when the fifo is closed. A reader that does not read it all within STATS_FIFO_REOPEN_DELAY_US
+   gets a second dump */
+static void* fifo_reporter(void* arg)
+{
+    (void) arg;
+
+    for(;;)
+    {
+        int fd = open(stats_fifo_path, O_WRONLY);
+        if(fd < 0)
+        {
+            if(EINTR == errno)
+            {
+                continue;
+            }
+            PRINT_ERROR("Cannot open the stats fifo %s", stats_fifo_path);
+            return NULL;
+        }
+
+        FILE* stream = fdopen(fd, "w");
+        if(NULL == stream)
+        {
+            close(fd);
+            continue;
+        }
+        stats_dump(stream, stats_format);
+        fclose(stream);
+
+        /* New readers wait in open meanwhile */
+        usleep(STATS_FIFO_REOPEN_DELAY_US);
+    }
+    return NULL;
+}
+
+/* Dump the statistics to stderr on SIGUSR1, and to every reader of fifo_path if it is not NULL */
+int start_stats_reporter(const char* fifo_path, int format)
+{
+    pthread_t thread;
+    stats_format = format;
+
+    if(0 != pthread_create(&thread, NULL, signal_reporter, NULL))
+    {
+        PRINT_ERROR("Cannot start the stats reporter");
+        return STATS_ERROR;
+    }
+    pthread_detach(thread);
+
+    if(NULL == fifo_path)
+    {
+        return STATS_OK;
+    }
+
+    strncpy(stats_fifo_path, fifo_path, sizeof(stats_fifo_path) - 1);
+    stats_fifo_path[sizeof(stats_fifo_path) - 1] = '\0';
+    remove(stats_fifo_path);
+    if(mkfifo(stats_fifo_path, 0666) < 0)
+    {
+        PRINT_ERROR("Cannot create the stats fifo %s", stats_fifo_path);
+        return STATS_ERROR;
+    }
+
+    if(0 != pthread_create(&thread, NULL, fifo_reporter, NULL))
+    {
+        PRINT_ERROR("Cannot start the stats reporter");
+        return STATS_ERROR;
+    }
+    pthread_detach(thread);
+    PRINT_INFO("Statistics are available on %s", stats_fifo_path);
+    return STATS_OK;
+}
@@ -0,0 +1,166 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: trace.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "debug.h"
+#include "stats.h"
+#include "trace.h"
+
+static int trace_fd = -1;
+static int trace_pid;
+/* A script is sampled when the 53 high bits of the hash of its number are below the threshold */
+static uint64_t sample_threshold;
+static __thread int thread_id = 0;
+
+/* Mix the bits of the number of a script, consecutive numbers are sampled independently */
+static uint64_t hash_id(long id)
+{
+    uint64_t x = (uint64_t) id + 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+static void write_event(const char* event, int size)
+{
+    if(size <= 0 || size >= TRACE_EVENT_SIZE)
+    {
+        return;
+    }
+    while(write(trace_fd, event, size) < 0 && EINTR == errno);
+}
+
+/* Copy a string into a JSON string without its quotes, returns the number of characters written */
+static int escape_json(char* out, size_t out_size, const char* in)
+{
+    size_t n = 0;
+    for(; *in && n + 7 < out_size; in++)
+    {
+        unsigned char c = (unsigned char) *in;
+        if('"' == c || '\\' == c)
+        {
+            out[n++] = '\\';
+            out[n++] = c;
+        }
+        else if(c < 0x20)
+        {
+            n += snprintf(out + n, out_size - n, "\\u%04x", c);
+        }
+        else
+        {
+            out[n++] = c;
+        }
+    }
+    out[n] = '\0';
+    return (int) n;
+}
+
+int start_trace(const char* path, double sample_rate)
+{
+    if(NULL == path)
+    {
+        return TRACE_OK;
+    }
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if(fd < 0)
+    {
+        PRINT_ERROR("Cannot open the trace file %s: %s", path, strerror(errno));
+        return TRACE_ERROR;
+    }
+
+    trace_pid = getpid();
+    sample_threshold = (uint64_t) (sample_rate * (double) (1ULL << 53));
+    trace_fd = fd;
+
+    /* Every next event starts with a comma, the array is never left with a trailing one */
+    char event[TRACE_EVENT_SIZE];
+    write_event(event, snprintf(event, sizeof(event), "[{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"server\"}}",
+                                trace_pid));
+    PRINT_INFO("Tracing %g%% of the scripts to %s", sample_rate * 100, path);
+    return TRACE_OK;
+}
+
+int trace_sampled(long id)
+{
+    return trace_fd >= 0 && (hash_id(id) >> 11) < sample_threshold;
+}
+
+/* Name the row of a sampled script when it is numbered, and keep the rows in the order of the scripts */
+void trace_begin(long id)
+{
+    if(!trace_sampled(id))
+    {
+        return;
+    }
+
+    char event[TRACE_EVENT_SIZE];
+    write_event(event, snprintf(event, sizeof(event),
+                                ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"name\":\"script #%ld\"}}"
+                                ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,\"tid\":%ld,\"args\":{\"sort_index\":%ld}}",
+                                trace_pid, id, id, trace_pid, id, id));
+}
+
+/* Write the span of a stage of script id, from start until now. arg_name may be NULL */
+void trace_span(long id, int stage, uint64_t start, const char* arg_name, const char* arg_value)
+{
+    if(!trace_sampled(id))
+    {
+        return;
+    }
+
+    uint64_t duration = stats_now() - start;
+    if(0 == thread_id)
+    {
+        thread_id = (int) syscall(SYS_gettid);
+    }
+
+    char arg[TRACE_EVENT_SIZE / 2];
+    arg[0] = '\0';
+    if(arg_name)
+    {
+        int size = snprintf(arg, sizeof(arg), ",\"%s\":\"", arg_name);
+        size += escape_json(arg + size, sizeof(arg) - size - 1, arg_value ? arg_value : "");
+        arg[size++] = '"';
+        arg[size] = '\0';
+    }
+
+    /* Timestamps are in microseconds, the nanoseconds are kept as decimals */
+    char event[TRACE_EVENT_SIZE];
+    write_event(event, snprintf(event, sizeof(event),
+                                ",\n{\"name\":\"%s\",\"cat\":\"svs\",\"ph\":\"X\",\"ts\":%lu.%03lu,\"dur\":%lu.%03lu,\"pid\":%d,\"tid\":%ld,"
+                                "\"args\":{\"thread\":%d%s}}",
+                                stats_stage_name(stage), (unsigned long) (start / 1000), (unsigned long) (start % 1000),
+                                (unsigned long) (duration / 1000), (unsigned long) (duration % 1000), trace_pid, id, thread_id, arg));
+}
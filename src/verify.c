@@ -38,116 +38,230 @@
 #include "verify.h"
 #include "server.h"
 #include "cert_utils.h"
+#include "stats.h"
+#include "trace.h"
 
-int decode_signature(unsigned char* decoded_signature, const char* signature, size_t signature_size)
+int init_verify_ctx(verify_ctx_t* ctx)
 {
-    EVP_ENCODE_CTX* encoding_ctx = NULL;
-    int decoded_signature_size;
+    memset(ctx, 0, sizeof(verify_ctx_t));
+    ctx->md_ctx = EVP_MD_CTX_new();
+    ctx->eddsa_ctx = EVP_MD_CTX_new();
+    /* Set up for SHA-256 once, every digest then only resets the state of the context */
+    if(!ctx->md_ctx || !ctx->eddsa_ctx || !EVP_DigestInit_ex(ctx->md_ctx, EVP_sha256(), NULL))
+    {
+        PRINT_ERROR("Cannot create the verification contexts");
+        cleanup_verify_ctx(ctx);
+        return VERIFY_CTX_ERROR;
+    }
+    return VERIFY_CTX_OK;
+}
+
+static void free_pkey_ctxs(verify_ctx_t* ctx)
+{
+    for(int i = 0; i < ctx->num_pkey_ctxs; i++)
+    {
+        EVP_PKEY_CTX_free(ctx->pkey_ctxs[i]);
+    }
+    free(ctx->pkey_ctxs);
+    ctx->pkey_ctxs = NULL;
+    ctx->num_pkey_ctxs = 0;
+}
 
-    /* Create context for decoding signature from base64 */
-    encoding_ctx = EVP_ENCODE_CTX_new();
-    if (!encoding_ctx) 
+void cleanup_verify_ctx(verify_ctx_t* ctx)
+{
+    free_pkey_ctxs(ctx);
+    EVP_MD_CTX_free(ctx->md_ctx);
+    EVP_MD_CTX_free(ctx->eddsa_ctx);
+    ctx->md_ctx = NULL;
+    ctx->eddsa_ctx = NULL;
+}
+
+/* The contexts of a replaced store are dropped, the slots of the new one are filled as its certificates are used */
+static int use_store(verify_ctx_t* ctx, cert_store_t* store)
+{
+    if(ctx->store_generation == store->generation && ctx->pkey_ctxs)
+    {
+        return OK;
+    }
+    free_pkey_ctxs(ctx);
+    ctx->pkey_ctxs = calloc(store->count > 0 ? store->count : 1, sizeof(EVP_PKEY_CTX*));
+    if(!ctx->pkey_ctxs)
+    {
+        PRINT_ERROR("Memory allocation failed");
+        return ERROR;
+    }
+    ctx->num_pkey_ctxs = store->count;
+    ctx->store_generation = store->generation;
+    return OK;
+}
+
+/* Compute the sha256 of the script once, it is shared by the cache and the verification */
+int compute_script_digest(verify_ctx_t* ctx, signed_script_t* signed_script)
+{
+    if(signed_script->script_digest_ready)
+    {
+        return OK;
+    }
+
+    if(!EVP_DigestInit_ex(ctx->md_ctx, NULL, NULL)
+        || !EVP_DigestUpdate(ctx->md_ctx, signed_script->script, signed_script->script_size)
+        || !EVP_DigestFinal_ex(ctx->md_ctx, signed_script->script_digest, NULL))
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot compute the digest of the script");
+        return ERROR;
+    }
+    signed_script->script_digest_ready = 1;
+    return OK;
+}
+
+/* Verify a pure EdDSA signature over the whole script, or over the signed message of a v2 script */
+static int verify_eddsa(verify_ctx_t* ctx, EVP_PKEY* pub_key, const unsigned char* decoded_signature, int decoded_signature_size, signed_script_t* signed_script)
+{
+    /* EdDSA does not take a digest algorithm */
+    EVP_MD_CTX_reset(ctx->eddsa_ctx);
+    if (!EVP_DigestVerifyInit(ctx->eddsa_ctx, NULL, NULL, NULL, pub_key)) 
     {
-        PRINT_ERROR_DEBUG(debug, "Cannot create context for decoding signature");
         return -1;
     }
 
-    /* Convert signature from base64 to binary */
-    EVP_DecodeInit(encoding_ctx);
-    
-    if(EVP_DecodeUpdate(encoding_ctx, decoded_signature, &decoded_signature_size, (const unsigned char *)signature, signature_size) < 0)
+    if (SIGNED_SCRIPT_V2 == signed_script->format)
+    {
+        return EVP_DigestVerify(ctx->eddsa_ctx, decoded_signature, decoded_signature_size,
+                                signed_script->signed_message, SIGNED_MESSAGE_V2_SIZE);
+    }
+    return EVP_DigestVerify(ctx->eddsa_ctx, decoded_signature, decoded_signature_size,
+                            (const unsigned char*) signed_script->script, signed_script->script_size);
+}
+
+/* Verify a signature over the sha256 digest of the script, which is computed once for all certificates */
+static int verify_prehashed(verify_ctx_t* ctx, cert_container_t* cert, const unsigned char* decoded_signature, int decoded_signature_size, signed_script_t* signed_script)
+{
+    if (OK != compute_script_digest(ctx, signed_script))
     {
-        PRINT_ERROR_DEBUG(debug, "Decoding signature failed in EVP_DecodeUpdate");
-        EVP_ENCODE_CTX_free(encoding_ctx);
         return -1;
     }
 
-    int d;
-    if(EVP_DecodeFinal(encoding_ctx, decoded_signature, &d) < 0)
+    /* The context of the certificate is already set up for the verification, it is duplicated once per thread */
+    if (cert->index >= ctx->num_pkey_ctxs)
     {
-        PRINT_ERROR_DEBUG(debug, "Decoding signature failed in EVP_DecodeFinal");
-        EVP_ENCODE_CTX_free(encoding_ctx);
         return -1;
     }
+    EVP_PKEY_CTX* pkey_ctx = ctx->pkey_ctxs[cert->index];
+    if (!pkey_ctx) 
+    {
+        pkey_ctx = EVP_PKEY_CTX_dup(cert->verify_template);
+        if (!pkey_ctx) 
+        {
+            PRINT_ERROR("Cannot create context for verification");
+            return -1;
+        }
+        ctx->pkey_ctxs[cert->index] = pkey_ctx;
+    }
+
+    return EVP_PKEY_verify(pkey_ctx, decoded_signature, decoded_signature_size,
+                           signed_script->script_digest, SHA256_DIGEST_LENGTH);
+}
 
-    EVP_ENCODE_CTX_free(encoding_ctx);
-    return decoded_signature_size;
+/* Verify the signature of the script with one certificate. Returns 1 if valid, 0 if invalid and -1 on error */
+static int verify_with_cert(verify_ctx_t* ctx, cert_container_t* cert, int decoded_signature_size, signed_script_t* signed_script)
+{
+    int ret_verification;
+    uint64_t start = stats_now();
 
+    if (cert->verify_template) 
+    {
+        ret_verification = verify_prehashed(ctx, cert, signed_script->decoded_signature, decoded_signature_size, signed_script);
+    }
+    else 
+    {
+        ret_verification = verify_eddsa(ctx, cert->pub_key, signed_script->decoded_signature, decoded_signature_size, signed_script);
+    }
+    stats_record_since(STATS_VERIFY_ATTEMPT, start);
+    trace_span(signed_script->id, STATS_VERIFY_ATTEMPT, start, "cert", cert->name);
+
+    if (1 == ret_verification) 
+    {
+        PRINT_DEBUG(debug, "The signature is validated under certificate %s", cert->name);
+        return 1;
+    } 
+    else if (0 == ret_verification) 
+    {
+        PRINT_WARN_DEBUG(debug, "The signature cannot be validated with with certificate %s", cert->name);
+        return 0;
+    } 
+    PRINT_WARN_DEBUG(debug, "Error occured while verifying with certificate %s", cert->name);
+    return -1;
 }
 
-int verify_signature(cert_container_t* certs, signed_script_t* signed_script)
+int verify_signature(verify_ctx_t* ctx, cert_store_t* store, signed_script_t* signed_script)
 {
-    EVP_MD_CTX* digest_ctx = NULL;
-    unsigned char decoded_signature[MAX_SIGNATURE_SIZE];
-    int decoded_signature_size;
+    int decoded_signature_size = signed_script->decoded_signature_size;
     int ret = VERIFY_SIGNATURE_ERROR;
+    int ret_verification;
 
     signed_script->valid = VERIFY_SIGNATURE_INVALID; // reset because signed_script struct might be reused
+    signed_script->signer = NULL;
 
-    /* Decode the signature */
-    decoded_signature_size = decode_signature(decoded_signature, signed_script->signature, signed_script->signature_size);
+    /* The signature was decoded when the file was parsed */
     if(decoded_signature_size <= 0)
     {
-        PRINT_ERROR("Decoding signature failed");
+        PRINT_ERROR("The script has no decoded signature");
         return VERIFY_SIGNATURE_ERROR;
     }
 
-    for(cert_container_t* cert_curr = certs; cert_curr != NULL; cert_curr = cert_curr->next)
+    if(OK != use_store(ctx, store))
     {
-        /* Create context for verifying signature */
-        digest_ctx = EVP_MD_CTX_new();
-        if (!digest_ctx) 
-        {
-            PRINT_ERROR("Cannot create context for digest");
-            return VERIFY_SIGNATURE_ERROR;
-        }
+        return VERIFY_SIGNATURE_ERROR;
+    }
 
-        /* Initialize context with the chosen digest algorithm */
-        /* Note that we use X509_get0_pubkey so no need to free the returned public key */
-        if (!EVP_DigestVerifyInit(digest_ctx, NULL, EVP_sha256(), NULL, X509_get0_pubkey(cert_curr->cert))) 
+    /* If the script names its certificate, only that certificate is tried */
+    if(signed_script->key_id_size > 0)
+    {
+        stats_count(STATS_KEY_ID_LOOKUPS, 1);
+        cert_container_t* cert = find_cert_by_id(store, signed_script->key_id, signed_script->key_id_size);
+        if(NULL == cert)
         {
-            PRINT_ERROR_DEBUG(debug, "Cannot initialize verification context for certificate %s", cert_curr->name);
-            EVP_MD_CTX_free(digest_ctx);
-            continue;
+            PRINT_WARN_DEBUG(debug, "No loaded certificate matches the key identifier of the script");
+            return VERIFY_SIGNATURE_INVALID;
         }
 
-        /* Update the context with the script contents */
-        if (!EVP_DigestVerifyUpdate(digest_ctx, signed_script->script, signed_script->script_size)) 
+        ret_verification = verify_with_cert(ctx, cert, decoded_signature_size, signed_script);
+        if (1 == ret_verification) 
         {
-            PRINT_ERROR_DEBUG(debug, "Cannot update verification context for certificate %s", cert_curr->name);
-            EVP_MD_CTX_free(digest_ctx);
-            continue;
+            signed_script->signer = cert;
+            signed_script->valid = VERIFY_SIGNATURE_VALID; // set for redundency check
+            return VERIFY_SIGNATURE_VALID;
         }
+        return (0 == ret_verification) ? VERIFY_SIGNATURE_INVALID : VERIFY_SIGNATURE_ERROR;
+    }
 
-        /* Verify the signature */
-        int ret_verification = EVP_DigestVerifyFinal(digest_ctx, decoded_signature, decoded_signature_size);
+    /* Every certificate may have been removed by a reload, then no signature is valid */
+    if(NULL == store->certs)
+    {
+        return VERIFY_SIGNATURE_INVALID;
+    }
 
+    uint64_t position = 0;
+    for(cert_container_t* cert_curr = store->certs; cert_curr != NULL; cert_curr = cert_curr->next, position++)
+    {
+        ret_verification = verify_with_cert(ctx, cert_curr, decoded_signature_size, signed_script);
 
         if (1 == ret_verification) 
         {
-            PRINT_DEBUG(debug, "The signature is validated under certificate %s", cert_curr->name);
+            stats_record(STATS_CERT_POSITION, position);
+            signed_script->signer = cert_curr;
             signed_script->valid = VERIFY_SIGNATURE_VALID; // set for redundency check
-            EVP_MD_CTX_free(digest_ctx);
             /* If the signature is validated by one certificate, return immediately with VALID */
             return VERIFY_SIGNATURE_VALID;
         } 
         else if (0 == ret_verification) 
         {
-            PRINT_WARN_DEBUG(debug, "The signature cannot be validated with with certificate %s", cert_curr->name);
             ret = VERIFY_SIGNATURE_INVALID;
-            EVP_MD_CTX_free(digest_ctx);
-            continue;
         } 
-        else 
-        {
-            PRINT_WARN_DEBUG(debug, "Error occured while verifying with certificate %s", cert_curr->name);
-            EVP_MD_CTX_free(digest_ctx);
-            continue;
-        }
     }
 
     /* If signature cannot be validated and at least one certificate gives invalid signature on verification, 
        the function returns INVALID otherwise, it returns ERROR */
     return ret;
 
-}
+}
\ No newline at end of file
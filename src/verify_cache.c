@@ -0,0 +1,313 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: verify_cache.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <openssl/evp.h>
+
+#include "debug.h"
+#include "verify.h"
+#include "verify_cache.h"
+#include "server.h"
+#include "cert_utils.h"
+#include "stats.h"
+
+static int init_lru_cache(lru_cache_t* lru, size_t capacity, int stats_hits, int stats_misses, int stats_evictions)
+{
+    memset(lru, 0, sizeof(lru_cache_t));
+    lru->stats_hits = stats_hits;
+    lru->stats_misses = stats_misses;
+    lru->stats_evictions = stats_evictions;
+    if(0 == capacity)
+    {
+        return VERIFY_CACHE_INIT_OK;
+    }
+
+    /* Use a power of two number of buckets, at least as many as entries */
+    lru->num_buckets = 1;
+    while(lru->num_buckets < capacity)
+    {
+        lru->num_buckets <<= 1;
+    }
+
+    lru->entries = calloc(capacity, sizeof(verify_cache_entry_t));
+    lru->buckets = calloc(lru->num_buckets, sizeof(verify_cache_entry_t*));
+    if(!lru->entries || !lru->buckets)
+    {
+        PRINT_ERROR("Memory allocation failed");
+        free(lru->entries);
+        free(lru->buckets);
+        memset(lru, 0, sizeof(lru_cache_t));
+        return VERIFY_CACHE_INIT_ERROR;
+    }
+    lru->capacity = capacity;
+    return VERIFY_CACHE_INIT_OK;
+}
+
+static void flush_lru_cache(lru_cache_t* lru)
+{
+    if(lru->buckets)
+    {
+        memset(lru->buckets, 0, lru->num_buckets * sizeof(verify_cache_entry_t*));
+    }
+    lru->size = 0;
+    lru->lru_head = NULL;
+    lru->lru_tail = NULL;
+}
+
+/* The key is made of two SHA-256 digests, its first bytes are already uniformly distributed */
+static size_t lru_bucket(const lru_cache_t* lru, const unsigned char* key)
+{
+    uint64_t h1, h2;
+    memcpy(&h1, key, sizeof(h1));
+    memcpy(&h2, key + SHA256_DIGEST_LENGTH, sizeof(h2));
+    return (size_t)(h1 ^ h2) & (lru->num_buckets - 1);
+}
+
+static void lru_unlink(lru_cache_t* lru, verify_cache_entry_t* entry)
+{
+    if(entry->lru_prev)
+    {
+        entry->lru_prev->lru_next = entry->lru_next;
+    }
+    else
+    {
+        lru->lru_head = entry->lru_next;
+    }
+
+    if(entry->lru_next)
+    {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    }
+    else
+    {
+        lru->lru_tail = entry->lru_prev;
+    }
+}
+
+static void lru_push_front(lru_cache_t* lru, verify_cache_entry_t* entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = lru->lru_head;
+    if(lru->lru_head)
+    {
+        lru->lru_head->lru_prev = entry;
+    }
+    lru->lru_head = entry;
+    if(!lru->lru_tail)
+    {
+        lru->lru_tail = entry;
+    }
+}
+
+static verify_cache_entry_t* lru_lookup(lru_cache_t* lru, const unsigned char* key)
+{
+    if(0 == lru->capacity)
+    {
+        return NULL;
+    }
+
+    for(verify_cache_entry_t* entry = lru->buckets[lru_bucket(lru, key)]; entry != NULL; entry = entry->hash_next)
+    {
+        if(0 == memcmp(entry->key, key, VERIFY_CACHE_KEY_SIZE))
+        {
+            /* Move the entry to the front, it is now the most recently used */
+            lru_unlink(lru, entry);
+            lru_push_front(lru, entry);
+            lru->hits++;
+            stats_count(lru->stats_hits, 1);
+            return entry;
+        }
+    }
+    lru->misses++;
+    stats_count(lru->stats_misses, 1);
+    return NULL;
+}
+
+static void lru_insert(lru_cache_t* lru, const unsigned char* key, int verdict, cert_container_t* cert)
+{
+    verify_cache_entry_t* entry;
+
+    if(0 == lru->capacity)
+    {
+        return;
+    }
+
+    if(lru->size < lru->capacity)
+    {
+        entry = &lru->entries[lru->size++];
+    }
+    else
+    {
+        /* Evict the least recently used entry and reuse it */
+        entry = lru->lru_tail;
+        lru_unlink(lru, entry);
+
+        verify_cache_entry_t** link = &lru->buckets[lru_bucket(lru, entry->key)];
+        while(*link != entry)
+        {
+            link = &(*link)->hash_next;
+        }
+        *link = entry->hash_next;
+        lru->evictions++;
+        stats_count(lru->stats_evictions, 1);
+    }
+
+    memcpy(entry->key, key, VERIFY_CACHE_KEY_SIZE);
+    entry->verdict = verdict;
+    entry->cert = cert;
+
+    size_t bucket = lru_bucket(lru, key);
+    entry->hash_next = lru->buckets[bucket];
+    lru->buckets[bucket] = entry;
+    lru_push_front(lru, entry);
+}
+
+int init_verify_cache(verify_cache_t* cache, size_t capacity, size_t negative_capacity)
+{
+    cache->store_generation = 0;
+    if(VERIFY_CACHE_INIT_OK != init_lru_cache(&cache->positive, capacity, STATS_CACHE_HITS, STATS_CACHE_MISSES, STATS_CACHE_EVICTIONS))
+    {
+        return VERIFY_CACHE_INIT_ERROR;
+    }
+    if(VERIFY_CACHE_INIT_OK != init_lru_cache(&cache->negative, negative_capacity, STATS_NEGATIVE_CACHE_HITS, STATS_NEGATIVE_CACHE_MISSES,
+                                              STATS_NEGATIVE_CACHE_EVICTIONS))
+    {
+        free_verify_cache(cache);
+        return VERIFY_CACHE_INIT_ERROR;
+    }
+    return VERIFY_CACHE_INIT_OK;
+}
+
+void free_verify_cache(verify_cache_t* cache)
+{
+    free(cache->positive.entries);
+    free(cache->positive.buckets);
+    free(cache->negative.entries);
+    free(cache->negative.buckets);
+    memset(cache, 0, sizeof(verify_cache_t));
+}
+
+void flush_verify_cache(verify_cache_t* cache)
+{
+    flush_lru_cache(&cache->positive);
+    flush_lru_cache(&cache->negative);
+}
+
+/* Build the cache key: sha256 of the script followed by sha256 of the signature line (key identifier and signature).
+   The sizes are hashed first so that the same bytes split differently between the two give another key */
+static int compute_cache_key(verify_ctx_t* ctx, unsigned char* key, signed_script_t* signed_script)
+{
+    if(OK != compute_script_digest(ctx, signed_script))
+    {
+        return VERIFY_SIGNATURE_ERROR;
+    }
+    memcpy(key, signed_script->script_digest, SHA256_DIGEST_LENGTH);
+
+    uint32_t sizes[2] = {(uint32_t) signed_script->key_id_size, (uint32_t) signed_script->signature_size};
+    if(!EVP_DigestInit_ex(ctx->md_ctx, NULL, NULL)
+        || !EVP_DigestUpdate(ctx->md_ctx, sizes, sizeof(sizes))
+        || !EVP_DigestUpdate(ctx->md_ctx, signed_script->key_id, signed_script->key_id_size)
+        || !EVP_DigestUpdate(ctx->md_ctx, signed_script->signature, signed_script->signature_size)
+        || !EVP_DigestFinal_ex(ctx->md_ctx, key + SHA256_DIGEST_LENGTH, NULL))
+    {
+        return VERIFY_SIGNATURE_ERROR;
+    }
+    return OK;
+}
+
+/* Same as verify_signature but reuses the verdict of a previously seen script and signature */
+int verify_signature_cached(verify_cache_t* cache, verify_ctx_t* ctx, cert_store_t* store, signed_script_t* signed_script)
+{
+    unsigned char key[VERIFY_CACHE_KEY_SIZE];
+    verify_cache_entry_t* entry;
+    int ret;
+
+    if(NULL == cache || (0 == cache->positive.capacity && 0 == cache->negative.capacity))
+    {
+        return verify_signature(ctx, store, signed_script);
+    }
+
+    /* The verdicts are only meaningful for the certificate set they were computed with */
+    if(cache->store_generation != store->generation)
+    {
+        if(cache->positive.size > 0 || cache->negative.size > 0)
+        {
+            PRINT_DEBUG(debug, "Certificate store changed, flushing the verification cache");
+        }
+        flush_verify_cache(cache);
+        cache->store_generation = store->generation;
+    }
+
+    signed_script->valid = VERIFY_SIGNATURE_INVALID; // reset because signed_script struct might be reused
+    signed_script->signer = NULL;
+
+    if(OK != compute_cache_key(ctx, key, signed_script))
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot compute the verification cache key");
+        return verify_signature(ctx, store, signed_script);
+    }
+
+    entry = lru_lookup(&cache->positive, key);
+    if(entry)
+    {
+        PRINT_DEBUG(debug, "Verification cache hit, the signature was validated under certificate %s", entry->cert->name);
+        signed_script->signer = entry->cert;
+        signed_script->valid = VERIFY_SIGNATURE_VALID; // set for redundency check
+        return VERIFY_SIGNATURE_VALID;
+    }
+
+    entry = lru_lookup(&cache->negative, key);
+    if(entry)
+    {
+        PRINT_DEBUG(debug, "Verification cache hit, the signature is known to be invalid");
+        return entry->verdict;
+    }
+
+    ret = verify_signature(ctx, store, signed_script);
+
+    /* Errors are not cached since they may be transient */
+    if(VERIFY_SIGNATURE_VALID == ret)
+    {
+        lru_insert(&cache->positive, key, ret, signed_script->signer);
+    }
+    else if(VERIFY_SIGNATURE_INVALID == ret)
+    {
+        lru_insert(&cache->negative, key, ret, NULL);
+    }
+
+    return ret;
+}
+
+void print_verify_cache_stats(verify_cache_t* cache)
+{
+    PRINT_DEBUG(debug, "Verification cache: %lu/%lu valid entries, hits %lu, misses %lu, evictions %lu",
+        cache->positive.size, cache->positive.capacity, cache->positive.hits, cache->positive.misses, cache->positive.evictions);
+    PRINT_DEBUG(debug, "Verification cache: %lu/%lu invalid entries, hits %lu, misses %lu, evictions %lu",
+        cache->negative.size, cache->negative.capacity, cache->negative.hits, cache->negative.misses, cache->negative.evictions);
+}
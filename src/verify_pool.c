@@ -0,0 +1,424 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: verify_pool.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <openssl/err.h>
+
+#include "debug.h"
+#include "ingest.h"
+#include "stats.h"
+#include "trace.h"
+#include "verify_pool.h"
+
+static const char* verdict_name(int verdict)
+{
+    switch(verdict)
+    {
+        case VERIFY_SIGNATURE_VALID:
+            return "VALID";
+        case VERIFY_SIGNATURE_INVALID:
+            return "INVALID";
+        default:
+            return "ERROR";
+    }
+}
+
+/* Verify one received script, returns the verdict of the verification */
+int check_script(verify_cache_t* cache, verify_ctx_t* ctx, cert_store_t* certs, signed_script_t* signed_script)
+{
+    set_log_request(signed_script->id);
+
+    uint64_t start = stats_now();
+    int verify_sig_ret = verify_signature_cached(cache, ctx, certs, signed_script);
+    stats_record_since(STATS_VERIFY, start);
+    trace_span(signed_script->id, STATS_VERIFY, start, "verdict", verdict_name(verify_sig_ret));
+    print_verify_cache_stats(cache);
+
+    if(VERIFY_SIGNATURE_VALID == verify_sig_ret)
+    {
+        stats_count(STATS_VERDICT_VALID, 1);
+        PRINT_INFO("Script #%ld has VALID signature, executing...", signed_script->id);
+    }
+    else if(VERIFY_SIGNATURE_INVALID == verify_sig_ret)
+    {
+        stats_count(STATS_VERDICT_INVALID, 1);
+        PRINT_INFO("The script has INVALID signature, skipping...\n");
+    }
+    else
+    {
+        stats_count(STATS_VERDICT_ERROR, 1);
+        PRINT_ERROR("Error occured while verifying the signature");
+        ERR_print_errors_fp(stderr);
+    }
+    return verify_sig_ret;
+}
+
+/* The same signature always goes to the same verifier, a replayed script finds its verdict in that cache */
+static int home_verifier(verify_pool_t* pool, signed_script_t* signed_script)
+{
+    uint32_t hash = 2166136261u;
+    for(int i = 0; i < signed_script->decoded_signature_size && i < 8; i++)
+    {
+        hash = (hash ^ signed_script->decoded_signature[i]) * 16777619u;
+    }
+    return (int) (hash % (uint32_t) pool->num_verifiers);
+}
+
+/* The own queue of the verifier first, then the queues of the others starting from the next one */
+static verify_request_t* take_request(verifier_t* verifier)
+{
+    verify_pool_t* pool = verifier->pool;
+    void* item;
+
+    for(int i = 0; i < pool->num_verifiers; i++)
+    {
+        verifier_t* victim = &pool->verifiers[(verifier->id + i) % pool->num_verifiers];
+        if(MPMC_QUEUE_OK == mpmc_pop(&victim->queue, &item))
+        {
+            if(i > 0)
+            {
+                stats_count(STATS_VERIFY_STEALS, 1);
+            }
+            return (verify_request_t*) item;
+        }
+    }
+    return NULL;
+}
+
+static void wait_for_push(verify_pool_t* pool, unsigned long pushes)
+{
+    pthread_mutex_lock(&pool->retry_lock);
+    __atomic_add_fetch(&pool->num_retrying, 1, __ATOMIC_SEQ_CST);
+    while(pushes == __atomic_load_n(&pool->pushes, __ATOMIC_SEQ_CST) && !__atomic_load_n(&pool->stopping, __ATOMIC_ACQUIRE))
+    {
+        pthread_cond_wait(&pool->retry_wakeup, &pool->retry_lock);
+    }
+    __atomic_sub_fetch(&pool->num_retrying, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&pool->retry_lock);
+}
+
+/* Wake up the verifiers that missed a request, the lock is only taken if there are any */
+static void wake_retrying_verifiers(verify_pool_t* pool)
+{
+    if(__atomic_load_n(&pool->num_retrying, __ATOMIC_SEQ_CST) > 0)
+    {
+        pthread_mutex_lock(&pool->retry_lock);
+        pthread_cond_broadcast(&pool->retry_wakeup);
+        pthread_mutex_unlock(&pool->retry_lock);
+    }
+}
+
+static void* verifier_loop(void* arg)
+{
+    verifier_t* verifier = (verifier_t*) arg;
+    verify_pool_t* pool = verifier->pool;
+    uint64_t one = 1;
+
+    for(;;)
+    {
+        if(0 != sem_wait(&pool->queued))
+        {
+            continue;
+        }
+        if(__atomic_load_n(&pool->stopping, __ATOMIC_ACQUIRE))
+        {
+            break;
+        }
+
+        /* Every post follows a push, but another verifier may have taken that request and left a later one
+           in a queue already looked at. That one was pushed after the pass started, the verifier sleeps until
+           there is such a push and looks again */
+        verify_request_t* request = NULL;
+        while(!__atomic_load_n(&pool->stopping, __ATOMIC_ACQUIRE))
+        {
+            unsigned long pushes = __atomic_load_n(&pool->pushes, __ATOMIC_SEQ_CST);
+            if(NULL != (request = take_request(verifier)))
+            {
+                break;
+            }
+            wait_for_push(pool, pushes);
+        }
+        if(!request)
+        {
+            break;
+        }
+        stats_record_since(STATS_VERIFY_QUEUE, request->queued);
+        trace_span(request->signed_script.id, STATS_VERIFY_QUEUE, request->queued, NULL, NULL);
+
+        cert_store_t* certs = enter_certs(pool->registry, verifier->reader);
+        request->verdict = check_script(&verifier->cache, &verifier->ctx, certs, &request->signed_script);
+        request->signer[0] = '\0';
+        if(request->signed_script.signer)
+        {
+            snprintf(request->signer, sizeof(request->signer), "%s", request->signed_script.signer->name);
+        }
+        request->signed_script.signer = NULL;
+        exit_certs(pool->registry, verifier->reader);
+
+        /* done holds every request, it cannot be full */
+        mpmc_push(&pool->done, request);
+        if(write(pool->source.fd, &one, sizeof(one)) != sizeof(one))
+        {
+            PRINT_ERROR_DEBUG(debug, "Cannot wake up the event loop");
+        }
+    }
+    return NULL;
+}
+
+/* Runs on the event loop: hand the verified scripts to the executor and recycle their requests */
+static void handle_verified(event_source_t* source, uint32_t events)
+{
+    verify_pool_t* pool = (verify_pool_t*) source;
+    uint64_t count;
+    void* item;
+    (void) events;
+
+    if(read(source->fd, &count, sizeof(count)) < 0 && EAGAIN != errno)
+    {
+        PRINT_ERROR_DEBUG(debug, "Cannot read the eventfd of the verifiers");
+    }
+
+    while(MPMC_QUEUE_OK == mpmc_pop(&pool->done, &item))
+    {
+        verify_request_t* request = (verify_request_t*) item;
+        resume_script(request->job, &request->signed_script, request->verdict, request->signer[0] ? request->signer : NULL);
+        request->job = NULL;
+        pool->free_requests[pool->num_free++] = request;
+    }
+
+    /* The sources that held their script can hand it over now */
+    if(pool->full && pool->num_free > 0)
+    {
+        pool->full = 0;
+        pool->on_room(pool->room_ctx);
+    }
+}
+
+/* Returns VERIFY_POOL_OK if a request is free for the next queue_verification. Otherwise the caller holds its
+   script and stops receiving, and on_room is called once a request is free again */
+int verify_pool_room(verify_pool_t* pool)
+{
+    if(0 == pool->num_free)
+    {
+        stats_count(STATS_VERIFY_STALLS, 1);
+        pool->full = 1;
+        return VERIFY_POOL_FULL;
+    }
+    return VERIFY_POOL_OK;
+}
+
+/* Move the script into a free request and queue it for the verifiers. The caller keeps receiving in the empty
+   buffers of the request. Returns VERIFY_POOL_FULL if every request is in use, see verify_pool_room */
+int queue_verification(verify_pool_t* pool, signed_script_t* signed_script, script_job_t* job)
+{
+    if(VERIFY_POOL_OK != verify_pool_room(pool))
+    {
+        return VERIFY_POOL_FULL;
+    }
+
+    verify_request_t* request = pool->free_requests[--pool->num_free];
+    signed_script_t empty = request->signed_script;
+    request->signed_script = *signed_script;
+    *signed_script = empty;
+    request->job = job;
+
+    /* The semaphore counts the requests no verifier has taken yet */
+    int depth = 0;
+    sem_getvalue(&pool->queued, &depth);
+    stats_record(STATS_VERIFY_QUEUE_DEPTH, depth > 0 ? depth : 0);
+    request->queued = stats_now();
+
+    /* Every queue can hold all the requests, it cannot be full */
+    mpmc_push(&pool->verifiers[home_verifier(pool, &request->signed_script)].queue, request);
+    __atomic_add_fetch(&pool->pushes, 1, __ATOMIC_SEQ_CST);
+    wake_retrying_verifiers(pool);
+    sem_post(&pool->queued);
+    return VERIFY_POOL_OK;
+}
+
+static int init_verifier(verify_pool_t* pool, verifier_t* verifier, int id, size_t cache_capacity, size_t negative_cache_capacity)
+{
+    verifier->pool = pool;
+    verifier->id = id;
+
+    verifier->reader = register_cert_reader(pool->registry);
+    if(CERT_REGISTRY_ERROR == verifier->reader)
+    {
+        return VERIFY_POOL_ERROR;
+    }
+
+    if(VERIFY_CACHE_INIT_OK != init_verify_cache(&verifier->cache, cache_capacity, negative_cache_capacity))
+    {
+        PRINT_ERROR("Cannot create the verification cache of verifier %d", id);
+        return VERIFY_POOL_ERROR;
+    }
+
+    if(VERIFY_CTX_OK != init_verify_ctx(&verifier->ctx))
+    {
+        free_verify_cache(&verifier->cache);
+        return VERIFY_POOL_ERROR;
+    }
+
+    if(MPMC_QUEUE_OK != init_mpmc_queue(&verifier->queue, pool->num_requests))
+    {
+        free_verify_cache(&verifier->cache);
+        cleanup_verify_ctx(&verifier->ctx);
+        return VERIFY_POOL_ERROR;
+    }
+    return VERIFY_POOL_OK;
+}
+
+/* Start num_verifiers threads verifying the scripts queued by the event loop. Each verifier has its own cache
+   and contexts, they only share the certificates */
+int init_verify_pool(verify_pool_t* pool, event_loop_t* loop, cert_registry_t* registry, int num_verifiers, size_t cache_capacity,
+                     size_t negative_cache_capacity, verify_room_t on_room, void* room_ctx)
+{
+    memset(pool, 0, sizeof(verify_pool_t));
+    pool->loop = loop;
+    pool->registry = registry;
+    pool->on_room = on_room;
+    pool->room_ctx = room_ctx;
+    pthread_mutex_init(&pool->retry_lock, NULL);
+    pthread_cond_init(&pool->retry_wakeup, NULL);
+    pool->source.fd = -1;
+    pool->num_requests = num_verifiers * VERIFY_POOL_REQUESTS_PER_VERIFIER;
+    if(0 != sem_init(&pool->queued, 0, 0))
+    {
+        PRINT_ERROR("Cannot create the semaphore of the verifiers");
+        return VERIFY_POOL_ERROR;
+    }
+
+    pool->verifiers = calloc(num_verifiers, sizeof(verifier_t));
+    pool->requests = calloc(pool->num_requests, sizeof(verify_request_t));
+    pool->free_requests = calloc(pool->num_requests, sizeof(verify_request_t*));
+    if(!pool->verifiers || !pool->requests || !pool->free_requests)
+    {
+        PRINT_ERROR("Memory allocation failed");
+        cleanup_verify_pool(pool);
+        return VERIFY_POOL_ERROR;
+    }
+
+    for(int i = 0; i < pool->num_requests; i++)
+    {
+        if(INGEST_OK != init_ingest(&pool->requests[i].signed_script))
+        {
+            cleanup_verify_pool(pool);
+            return VERIFY_POOL_ERROR;
+        }
+        pool->free_requests[pool->num_free++] = &pool->requests[i];
+    }
+
+    if(MPMC_QUEUE_OK != init_mpmc_queue(&pool->done, pool->num_requests))
+    {
+        cleanup_verify_pool(pool);
+        return VERIFY_POOL_ERROR;
+    }
+
+    pool->source.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    pool->source.handler = handle_verified;
+    pool->source.release = NULL;
+    if(pool->source.fd < 0 || EVENT_LOOP_OK != event_loop_add(loop, &pool->source, EPOLLIN))
+    {
+        PRINT_ERROR("Cannot watch the verifiers from the event loop");
+        cleanup_verify_pool(pool);
+        return VERIFY_POOL_ERROR;
+    }
+
+    /* num_verifiers only counts the verifiers that are set up, the cleanup relies on it */
+    for(int i = 0; i < num_verifiers; i++)
+    {
+        if(VERIFY_POOL_OK != init_verifier(pool, &pool->verifiers[i], i, cache_capacity, negative_cache_capacity))
+        {
+            cleanup_verify_pool(pool);
+            return VERIFY_POOL_ERROR;
+        }
+        pool->num_verifiers++;
+    }
+
+    for(int i = 0; i < pool->num_verifiers; i++)
+    {
+        if(0 != pthread_create(&pool->verifiers[i].thread, NULL, verifier_loop, &pool->verifiers[i]))
+        {
+            PRINT_ERROR("Cannot start verifier %d", i);
+            cleanup_verify_pool(pool);
+            return VERIFY_POOL_ERROR;
+        }
+        pool->num_started++;
+    }
+
+    PRINT_INFO("%d verifier threads are ready", pool->num_verifiers);
+    return VERIFY_POOL_OK;
+}
+
+/* Stop the verifiers, the requests still queued are dropped */
+void cleanup_verify_pool(verify_pool_t* pool)
+{
+    __atomic_store_n(&pool->stopping, 1, __ATOMIC_RELEASE);
+    for(int i = 0; i < pool->num_started; i++)
+    {
+        sem_post(&pool->queued);
+    }
+    pthread_mutex_lock(&pool->retry_lock);
+    pthread_cond_broadcast(&pool->retry_wakeup);
+    pthread_mutex_unlock(&pool->retry_lock);
+    for(int i = 0; i < pool->num_started; i++)
+    {
+        pthread_join(pool->verifiers[i].thread, NULL);
+    }
+    for(int i = 0; i < pool->num_verifiers; i++)
+    {
+        verifier_t* verifier = &pool->verifiers[i];
+        free_verify_cache(&verifier->cache);
+        cleanup_verify_ctx(&verifier->ctx);
+        free_mpmc_queue(&verifier->queue);
+    }
+
+    if(pool->source.fd >= 0)
+    {
+        event_loop_close(pool->loop, &pool->source);
+    }
+    free_mpmc_queue(&pool->done);
+    for(int i = 0; pool->requests && i < pool->num_requests; i++)
+    {
+        cleanup_ingest(&pool->requests[i].signed_script);
+    }
+    sem_destroy(&pool->queued);
+    pthread_mutex_destroy(&pool->retry_lock);
+    pthread_cond_destroy(&pool->retry_wakeup);
+    free(pool->verifiers);
+    free(pool->requests);
+    free(pool->free_requests);
+    pool->verifiers = NULL;
+    pool->requests = NULL;
+    pool->free_requests = NULL;
+    pool->num_verifiers = 0;
+    pool->num_started = 0;
+}
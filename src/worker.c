@@ -0,0 +1,349 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: worker.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <openssl/err.h>
+
+#include "debug.h"
+#include "verify.h"
+#include "run_script.h"
+#include "server.h"
+#include "ipc_pipe.h"
+#include "ingest.h"
+#include "event_loop.h"
+#include "listener.h"
+#include "ipc_socket.h"
+#include "executor.h"
+#include "verify_pool.h"
+#include "stats.h"
+#include "worker.h"
+
+/* Prepare a worker: its own fifo named pipe and its own signed_script_t buffer */
+int init_worker(worker_t* worker, int id, const char* pipe_path, int cpu, cert_registry_t* registry, size_t cache_capacity, size_t negative_cache_capacity,
+                int pool_size, int pool_refill)
+{
+    worker->id = id;
+    worker->cpu = cpu;
+    worker->registry = registry;
+    worker->executor = NULL;
+    worker->verifiers = NULL;
+    worker->listener = NULL;
+    worker->socket_server = NULL;
+    worker->signed_script = (signed_script_t){.buffer = NULL, .digest_ctx = NULL, .script = NULL, .signature = NULL, .script_size = 0, .signature_size = 0, .valid = VERIFY_SIGNATURE_INVALID, .id = 0};
+
+    worker->reader = register_cert_reader(registry);
+    if(CERT_REGISTRY_ERROR == worker->reader)
+    {
+        return WORKER_INIT_ERROR;
+    }
+
+    if(VERIFY_CACHE_INIT_OK != init_verify_cache(&worker->cache, cache_capacity, negative_cache_capacity))
+    {
+        PRINT_ERROR("Cannot create the verification cache of worker %d", id);
+        return WORKER_INIT_ERROR;
+    }
+
+    if(VERIFY_CTX_OK != init_verify_ctx(&worker->verifier))
+    {
+        free_verify_cache(&worker->cache);
+        return WORKER_INIT_ERROR;
+    }
+
+    if(BASH_POOL_OK != init_bash_pool(&worker->pool, pool_size, pool_refill))
+    {
+        free_verify_cache(&worker->cache);
+        cleanup_verify_ctx(&worker->verifier);
+        return WORKER_INIT_ERROR;
+    }
+
+    /* Workers serving a fifo directory receive their scripts from the listener */
+    if(NULL == pipe_path)
+    {
+        worker->pipe_path[0] = '\0';
+        return WORKER_INIT_OK;
+    }
+
+    strncpy(worker->pipe_path, pipe_path, sizeof(worker->pipe_path) - 1);
+    worker->pipe_path[sizeof(worker->pipe_path) - 1] = '\0';
+
+    if(READ_PIPE_INIT_OK != init_pipe(&worker->signed_script, worker->pipe_path))
+    {
+        PRINT_ERROR("Cannot open the fifo named pipe %s", worker->pipe_path);
+        return WORKER_INIT_ERROR;
+    }
+
+    return WORKER_INIT_OK;
+}
+
+/* Verify one received script and execute it if its signature is valid. The output of the script is
+   printed, or kept in result if result is not NULL. Returns the verdict of the verification */
+int handle_script(worker_t* worker, signed_script_t* signed_script, script_result_t* result)
+{
+    /* The certificates are only held while verifying, a reload does not wait for the script to run */
+    cert_store_t* certs = enter_certs(worker->registry, worker->reader);
+    int verify_sig_ret = check_script(&worker->cache, &worker->verifier, certs, signed_script);
+    signed_script->signer = NULL;
+    exit_certs(worker->registry, worker->reader);
+
+    if(VERIFY_SIGNATURE_VALID == verify_sig_ret && EXECUTING_SCRIPT_OK != run_script(signed_script, &worker->pool, result))
+    {
+        PRINT_ERROR("Failed to execute the script");
+        stats_count(STATS_EXECUTION_FAILURES, 1);
+    }
+    return verify_sig_ret;
+}
+
+static void pin_worker(worker_t* worker)
+{
+    if(WORKER_NOT_PINNED != worker->cpu)
+    {
+        cpu_set_t cpuset;
+        CPU_ZERO(&cpuset);
+        CPU_SET(worker->cpu, &cpuset);
+        if(0 != pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset))
+        {
+            PRINT_ERROR("Cannot pin worker %d to CPU %d", worker->id, worker->cpu);
+        }
+        else
+        {
+            PRINT_DEBUG(debug, "Worker %d is pinned to CPU %d", worker->id, worker->cpu);
+        }
+    }
+}
+
+/* Main loop of a worker. It never returns under normal operation */
+void* worker_loop(void* arg)
+{
+    worker_t* worker = (worker_t*) arg;
+
+    pin_worker(worker);
+
+    for(;;)
+    {
+        int read_ret = read_from_pipe(&worker->signed_script, worker->pipe_path);
+        if (READ_PIPE_EMPTY == read_ret)
+        {
+            continue;
+        }
+        if (READ_PIPE_ERROR == read_ret)
+        {
+            PRINT_INFO("Error occured while parsing script #%ld. Skipping...", worker->signed_script.id);
+            continue;
+        }
+
+        handle_script(worker, &worker->signed_script, NULL);
+    }
+
+    return NULL;
+}
+
+/* Hand a received script to the verifier threads, or verify it right away on the event loop if there are
+   none. The job keeps the place of the script in the executor meanwhile. The callers check that the verifiers
+   have room first, see verifiers_busy */
+static void dispatch_script(worker_t* worker, signed_script_t* signed_script, script_job_t* job)
+{
+    if(signed_script && worker->verifiers && VERIFY_POOL_OK == queue_verification(worker->verifiers, signed_script, job))
+    {
+        return;
+    }
+
+    /* The executor copies the name of the signer, the certificates are not needed after it */
+    int verdict = VERIFY_SIGNATURE_ERROR;
+    cert_store_t* certs = enter_certs(worker->registry, worker->reader);
+    if(signed_script)
+    {
+        verdict = check_script(&worker->cache, &worker->verifier, certs, signed_script);
+    }
+    resume_script(job, signed_script, verdict, (signed_script && signed_script->signer) ? signed_script->signer->name : NULL);
+    if(signed_script)
+    {
+        signed_script->signer = NULL;
+    }
+    exit_certs(worker->registry, worker->reader);
+}
+
+/* When every request of the verifiers is in use, the fifo or connection holds its script and stops receiving,
+   instead of the event loop verifying it. The loop goes on serving the other sources meanwhile */
+static int verifiers_busy(worker_t* worker, signed_script_t* signed_script)
+{
+    return signed_script && worker->verifiers && VERIFY_POOL_FULL == verify_pool_room(worker->verifiers);
+}
+
+/* Called by the verifiers once a request is free again */
+static void resume_held_scripts(void* ctx)
+{
+    worker_t* worker = (worker_t*) ctx;
+
+    if(worker->listener)
+    {
+        resume_fifo_listener(worker->listener);
+    }
+    if(worker->socket_server)
+    {
+        resume_socket_server(worker->socket_server);
+    }
+}
+
+static int handle_listener_script(signed_script_t* signed_script, void* ctx)
+{
+    worker_t* worker = (worker_t*) ctx;
+
+    if(verifiers_busy(worker, signed_script))
+    {
+        return LISTENER_BUSY;
+    }
+    script_job_t* job = reserve_script(worker->executor, signed_script->id, output_sink_type, NULL, NULL);
+    if(job)
+    {
+        dispatch_script(worker, signed_script, job);
+    }
+    return LISTENER_OK;
+}
+
+static void reply_to_client(script_job_t* job, void* ctx)
+{
+    socket_reply((socket_request_t*) ctx, job->verdict, job->signer, &job->result);
+}
+
+static int handle_socket_request(signed_script_t* signed_script, socket_request_t* request, void* ctx)
+{
+    worker_t* worker = (worker_t*) ctx;
+
+    if(verifiers_busy(worker, signed_script))
+    {
+        return SOCKET_BUSY;
+    }
+    script_job_t* job = reserve_script(worker->executor, signed_script ? signed_script->id : 0, OUTPUT_SINK_CLIENT, reply_to_client, request);
+    if(!job)
+    {
+        script_result_t result;
+        init_script_result(&result, OUTPUT_SINK_CLIENT);
+        socket_reply(request, VERIFY_SIGNATURE_ERROR, NULL, &result);
+        return SOCKET_OK;
+    }
+    dispatch_script(worker, signed_script, job);
+    return SOCKET_OK;
+}
+
+/* Serve every fifo of fifo_dir and the clients of the unix domain socket from one event loop. The loop receives
+   and parses the scripts, num_verifiers threads verify them meanwhile (the loop itself if it is 0) and up to
+   max_children of them are executed at the same time. Either of fifo_dir and socket_path may be NULL.
+   It never returns under normal operation */
+int run_event_worker(worker_t* worker, const char* fifo_dir, const char* socket_path, int max_children, int num_verifiers)
+{
+    event_loop_t loop;
+    executor_t executor;
+    verify_pool_t verifiers;
+    listener_t listener = {.num_fifos = 0, .fifos = NULL};
+    socket_server_t socket_server;
+    int ret = WORKER_INIT_ERROR;
+
+    if(EVENT_LOOP_OK != init_event_loop(&loop))
+    {
+        return WORKER_INIT_ERROR;
+    }
+
+    /* Started before the loop is pinned, the verifiers would inherit its CPU */
+    if(num_verifiers > 0)
+    {
+        if(VERIFY_POOL_OK != init_verify_pool(&verifiers, &loop, worker->registry, num_verifiers, worker->cache.positive.capacity,
+                                              worker->cache.negative.capacity, resume_held_scripts, worker))
+        {
+            cleanup_event_loop(&loop);
+            return WORKER_INIT_ERROR;
+        }
+        worker->verifiers = &verifiers;
+    }
+
+    pin_worker(worker);
+    init_executor(&executor, &loop, max_children, &worker->pool);
+    worker->executor = &executor;
+
+    worker->listener = &listener;
+    worker->socket_server = socket_path ? &socket_server : NULL;
+    if(fifo_dir && LISTENER_OK != init_fifo_listener(&listener, &loop, fifo_dir, handle_listener_script, worker))
+    {
+        socket_path = NULL;
+    }
+    else if(socket_path && SOCKET_OK != init_socket_server(&socket_server, &loop, socket_path, handle_socket_request, worker))
+    {
+        socket_path = NULL;
+    }
+    else if(EVENT_LOOP_OK == run_event_loop(&loop))
+    {
+        ret = WORKER_INIT_OK;
+    }
+
+    /* The verifiers are stopped first, the requests they still hold refer to jobs of the executor */
+    if(worker->verifiers)
+    {
+        cleanup_verify_pool(&verifiers);
+        worker->verifiers = NULL;
+    }
+    if(socket_path)
+    {
+        cleanup_socket_server(&socket_server);
+    }
+    cleanup_listener(&listener);
+    cleanup_executor(&executor);
+    cleanup_event_loop(&loop);
+    worker->executor = NULL;
+    worker->listener = NULL;
+    worker->socket_server = NULL;
+    return ret;
+}
+
+/* Start one thread per worker, all workers must be initialized with init_worker */
+int start_workers(worker_t* workers, int num_workers)
+{
+    for(int i = 0; i < num_workers; i++)
+    {
+        if(0 != pthread_create(&workers[i].thread, NULL, worker_loop, &workers[i]))
+        {
+            PRINT_ERROR("Cannot start worker %d", i);
+            return WORKER_INIT_ERROR;
+        }
+        PRINT_INFO("Worker %d is listening on %s", i, workers[i].pipe_path);
+    }
+    return WORKER_INIT_OK;
+}
+
+void join_workers(worker_t* workers, int num_workers)
+{
+    for(int i = 0; i < num_workers; i++)
+    {
+        pthread_join(workers[i].thread, NULL);
+        cleanup_ingest(&workers[i].signed_script);
+        free_verify_cache(&workers[i].cache);
+        cleanup_verify_ctx(&workers[i].verifier);
+        cleanup_bash_pool(&workers[i].pool);
+    }
+}
@@ -0,0 +1,485 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: alloc_test.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Counts the heap allocations of the server code for one script once the server is warm, from its reception to
+ * its reply: the script is received on the unix domain socket or on a fifo named pipe, verified on the event loop
+ * or by a verifier thread, reserved and resumed in the executor, executed by bash and answered to its client or
+ * logged. malloc, calloc and realloc are wrapped at link time for the server code, OpenSSL and the C library are
+ * not counted. Run with make check, it exits with an error if the server code allocates once warm.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include "debug.h"
+#include "cert_registry.h"
+#include "cert_utils.h"
+#include "event_loop.h"
+#include "executor.h"
+#include "ipc_socket.h"
+#include "listener.h"
+#include "logger.h"
+#include "verify.h"
+#include "verify_cache.h"
+#include "verify_pool.h"
+#include "server.h"
+
+/* Globals normally defined by the server */
+int debug = DEBUG_DISABLED;
+long int counter = 0;
+
+#define WARMUP_SCRIPTS                  20
+#define COUNTED_SCRIPTS                 50
+#define DIR_SIZE                        64
+#define PATH_SIZE                       (DIR_SIZE + 16)
+#define SCRIPT                          "echo alloc test\n"
+
+/* One event worker as run_event_worker sets it up, with the handlers of worker.c */
+typedef struct alloc_test
+{
+    event_loop_t loop;
+    executor_t executor;
+    verify_pool_t verifiers;
+    int use_verifiers;                  // otherwise the scripts are verified on the event loop
+    cert_registry_t* registry;
+    int reader;
+    verify_ctx_t verifier;
+    verify_cache_t cache;
+    int verdict;                        // of the last script retired
+    int exit_status;
+} alloc_test_t;
+
+static long app_allocs = 0;
+static char work_dir[] = "/tmp/alloc_test.XXXXXX";
+
+void* __real_malloc(size_t size);
+void* __real_calloc(size_t num, size_t size);
+void* __real_realloc(void* ptr, size_t size);
+
+void* __wrap_malloc(size_t size)
+{
+    __atomic_add_fetch(&app_allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void* __wrap_calloc(size_t num, size_t size)
+{
+    __atomic_add_fetch(&app_allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(num, size);
+}
+
+void* __wrap_realloc(void* ptr, size_t size)
+{
+    __atomic_add_fetch(&app_allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+static int add_extension(X509* cert, int nid, const char* value)
+{
+    X509V3_CTX ctx;
+    X509V3_set_ctx_nodb(&ctx);
+    X509V3_set_ctx(&ctx, cert, cert, NULL, NULL, 0);
+    X509_EXTENSION* ext = X509V3_EXT_conf_nid(NULL, &ctx, nid, value);
+    if(!ext)
+    {
+        return ERROR;
+    }
+    X509_add_ext(cert, ext, -1);
+    X509_EXTENSION_free(ext);
+    return OK;
+}
+
+/* Write a self-signed code signing certificate accepted by load_certs */
+static int write_cert(EVP_PKEY* pkey, const char* path)
+{
+    int ret = ERROR;
+    X509* cert = X509_new();
+    FILE* fp = NULL;
+
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 24 * 3600);
+    X509_set_pubkey(cert, pkey);
+    X509_NAME_add_entry_by_txt(X509_get_subject_name(cert), "CN", MBSTRING_ASC, (unsigned char*) "alloc test", -1, -1, 0);
+    X509_set_issuer_name(cert, X509_get_subject_name(cert));
+
+    if(OK == add_extension(cert, NID_key_usage, "critical,digitalSignature")
+       && OK == add_extension(cert, NID_ext_key_usage, "codeSigning")
+       && OK == add_extension(cert, NID_subject_key_identifier, "hash")
+       && X509_sign(cert, pkey, EVP_sha256()) > 0
+       && NULL != (fp = fopen(path, "w")))
+    {
+        ret = PEM_write_X509(fp, cert) ? OK : ERROR;
+        fclose(fp);
+    }
+    X509_free(cert);
+    return ret;
+}
+
+/* Sign the script the way tests/tools/sign_scripts.sh does: base64 signature, newline, script */
+static char* sign_script(EVP_PKEY* pkey, size_t* signed_size)
+{
+    unsigned char signature[MAX_SIGNATURE_SIZE];
+    size_t signature_size = sizeof(signature);
+    char* signed_file = NULL;
+    EVP_MD_CTX* md_ctx = EVP_MD_CTX_new();
+
+    if(md_ctx
+       && EVP_DigestSignInit(md_ctx, NULL, EVP_sha256(), NULL, pkey) > 0
+       && EVP_DigestSign(md_ctx, signature, &signature_size, (const unsigned char*) SCRIPT, strlen(SCRIPT)) > 0)
+    {
+        signed_file = malloc(4 * ((signature_size + 2) / 3) + 1 + strlen(SCRIPT) + 1);
+    }
+    EVP_MD_CTX_free(md_ctx);
+    if(!signed_file)
+    {
+        return NULL;
+    }
+
+    int encoded_size = EVP_EncodeBlock((unsigned char*) signed_file, signature, signature_size);
+    signed_file[encoded_size] = '\n';
+    memcpy(signed_file + encoded_size + 1, SCRIPT, strlen(SCRIPT));
+    *signed_size = encoded_size + 1 + strlen(SCRIPT);
+    return signed_file;
+}
+
+/* Same as dispatch_script of worker.c */
+static void dispatch_script(alloc_test_t* test, signed_script_t* signed_script, script_job_t* job)
+{
+    if(signed_script && test->use_verifiers && VERIFY_POOL_OK == queue_verification(&test->verifiers, signed_script, job))
+    {
+        return;
+    }
+
+    int verdict = VERIFY_SIGNATURE_ERROR;
+    cert_store_t* certs = enter_certs(test->registry, test->reader);
+    if(signed_script)
+    {
+        verdict = check_script(&test->cache, &test->verifier, certs, signed_script);
+    }
+    resume_script(job, signed_script, verdict, (signed_script && signed_script->signer) ? signed_script->signer->name : NULL);
+    if(signed_script)
+    {
+        signed_script->signer = NULL;
+    }
+    exit_certs(test->registry, test->reader);
+}
+
+static void finish_script(alloc_test_t* test, script_job_t* job)
+{
+    test->verdict = job->verdict;
+    test->exit_status = job->result.exit_status;
+    test->loop.running = 0;
+}
+
+/* The context is the request, the test is found from the loop of the executor, its first member */
+static void reply_to_client(script_job_t* job, void* ctx)
+{
+    socket_reply((socket_request_t*) ctx, job->verdict, job->signer, &job->result);
+    finish_script((alloc_test_t*) job->executor->loop, job);
+}
+
+static int handle_socket_request(signed_script_t* signed_script, socket_request_t* request, void* ctx)
+{
+    alloc_test_t* test = (alloc_test_t*) ctx;
+    script_job_t* job = reserve_script(&test->executor, signed_script ? signed_script->id : 0, OUTPUT_SINK_CLIENT, reply_to_client, request);
+    if(job)
+    {
+        dispatch_script(test, signed_script, job);
+    }
+    return SOCKET_OK;
+}
+
+/* What retire_jobs does for a script received on a fifo, the loop is stopped once it is logged */
+static void log_output(script_job_t* job, void* ctx)
+{
+    print_script_output(job->id, &job->result);
+    finish_script((alloc_test_t*) ctx, job);
+}
+
+static int handle_listener_script(signed_script_t* signed_script, void* ctx)
+{
+    alloc_test_t* test = (alloc_test_t*) ctx;
+    script_job_t* job = reserve_script(&test->executor, signed_script->id, OUTPUT_SINK_LOG, log_output, test);
+    if(job)
+    {
+        dispatch_script(test, signed_script, job);
+    }
+    return LISTENER_OK;
+}
+
+static int write_all(int fd, const void* data, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t written = write(fd, data, size);
+        if(written < 0 && EINTR != errno)
+        {
+            return ERROR;
+        }
+        data = (const char*) data + ((written > 0) ? written : 0);
+        size -= (written > 0) ? written : 0;
+    }
+    return OK;
+}
+
+static int read_all(int fd, void* data, size_t size)
+{
+    while(size > 0)
+    {
+        ssize_t read_size = read(fd, data, size);
+        if(read_size <= 0 && !(read_size < 0 && EINTR == errno))
+        {
+            return ERROR;
+        }
+        data = (char*) data + ((read_size > 0) ? read_size : 0);
+        size -= (read_size > 0) ? read_size : 0;
+    }
+    return OK;
+}
+
+/* Read the reply frames of one request up to its result */
+static int read_reply(int fd)
+{
+    unsigned char header[SOCKET_REPLY_HEADER_SIZE];
+    char payload[SOCKET_REPLY_CHUNK_SIZE];
+    uint32_t type;
+
+    do
+    {
+        uint32_t size;
+        if(OK != read_all(fd, header, sizeof(header)))
+        {
+            return ERROR;
+        }
+        memcpy(&type, header, sizeof(type));
+        memcpy(&size, header + 8, sizeof(size));
+        type = ntohl(type);
+        size = ntohl(size);
+        if(size > sizeof(payload) || OK != read_all(fd, payload, size))
+        {
+            return ERROR;
+        }
+    } while(SOCKET_REPLY_RESULT != type);
+    return OK;
+}
+
+/* Send one script to the server and run the event loop until it is retired */
+static int send_script(alloc_test_t* test, int client, const char* fifo_path, const char* signed_file, size_t signed_size)
+{
+    int ret = ERROR;
+
+    test->verdict = VERIFY_SIGNATURE_ERROR;
+    if(client >= 0)
+    {
+        uint32_t length = htonl(signed_size);
+        ret = (OK == write_all(client, &length, sizeof(length)) && OK == write_all(client, signed_file, signed_size)) ? OK : ERROR;
+    }
+    else
+    {
+        int fd = open(fifo_path, O_WRONLY | O_NONBLOCK);
+        ret = (fd >= 0 && OK == write_all(fd, signed_file, signed_size)) ? OK : ERROR;
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    if(OK != ret || EVENT_LOOP_OK != run_event_loop(&test->loop) || (client >= 0 && OK != read_reply(client)))
+    {
+        return ERROR;
+    }
+    return (VERIFY_SIGNATURE_VALID == test->verdict && 0 == test->exit_status) ? OK : ERROR;
+}
+
+/* Allocations of the server code per script once warm, or -1 if a script failed */
+static double count_allocs(alloc_test_t* test, int client, const char* fifo_path, const char* signed_file, size_t signed_size)
+{
+    long start = 0;
+
+    for(int i = 0; i < WARMUP_SCRIPTS + COUNTED_SCRIPTS; i++)
+    {
+        if(WARMUP_SCRIPTS == i)
+        {
+            start = __atomic_load_n(&app_allocs, __ATOMIC_RELAXED);
+        }
+        if(OK != send_script(test, client, fifo_path, signed_file, signed_size))
+        {
+            return -1;
+        }
+    }
+    return (double) (__atomic_load_n(&app_allocs, __ATOMIC_RELAXED) - start) / COUNTED_SCRIPTS;
+}
+
+/* Serve a fifo and the socket as an event worker does, with or without verifier threads, and count the allocations
+   of the scripts sent to each of them */
+static int run_source_checks(cert_registry_t* registry, int use_verifiers, const char* signed_file, size_t signed_size, FILE* results)
+{
+    alloc_test_t test;
+    listener_t listener = {.num_fifos = 0, .fifos = NULL};
+    socket_server_t socket_server;
+    char fifo_dir[DIR_SIZE];
+    char fifo_path[PATH_SIZE];
+    char socket_path[PATH_SIZE];
+    int client = -1;
+    int ret = ERROR;
+
+    memset(&test, 0, sizeof(test));
+    test.registry = registry;
+    test.use_verifiers = use_verifiers;
+    snprintf(fifo_dir, sizeof(fifo_dir), "%s/fifos.%d", work_dir, use_verifiers);
+    snprintf(fifo_path, sizeof(fifo_path), "%s/fifo", fifo_dir);
+    snprintf(socket_path, sizeof(socket_path), "%s/socket.%d", work_dir, use_verifiers);
+    if(0 != mkdir(fifo_dir, 0700) || 0 != mkfifo(fifo_path, 0600) || EVENT_LOOP_OK != init_event_loop(&test.loop))
+    {
+        fprintf(stderr, "Cannot create the fifo named pipe and the event loop\n");
+        return ERROR;
+    }
+
+    /* The verification cache is disabled so that every script is verified */
+    test.reader = register_cert_reader(registry);
+    if(VERIFY_CTX_OK != init_verify_ctx(&test.verifier) || VERIFY_CACHE_INIT_OK != init_verify_cache(&test.cache, 0, 0)
+       || (use_verifiers && VERIFY_POOL_OK != init_verify_pool(&test.verifiers, &test.loop, registry, 1, 0, 0, NULL, NULL)))
+    {
+        fprintf(stderr, "Cannot create the verification contexts\n");
+        cleanup_event_loop(&test.loop);
+        return ERROR;
+    }
+    init_executor(&test.executor, &test.loop, 1, NULL);
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    if(LISTENER_OK == init_fifo_listener(&listener, &test.loop, fifo_dir, handle_listener_script, &test)
+       && SOCKET_OK == init_socket_server(&socket_server, &test.loop, socket_path, handle_socket_request, &test)
+       && (client = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0)) >= 0
+       && 0 == connect(client, (struct sockaddr*) &addr, sizeof(addr)))
+    {
+        const char* mode = use_verifiers ? "verifier thread" : "event loop";
+        double socket_allocs = count_allocs(&test, client, NULL, signed_file, signed_size);
+        double fifo_allocs = count_allocs(&test, -1, fifo_path, signed_file, signed_size);
+
+        fprintf(results, "socket, verified on the %s: %.2f allocations per script\n", mode, socket_allocs);
+        fprintf(results, "fifo, verified on the %s: %.2f allocations per script\n", mode, fifo_allocs);
+        ret = (0 == socket_allocs && 0 == fifo_allocs) ? OK : ERROR;
+        if(socket_allocs < 0 || fifo_allocs < 0)
+        {
+            fprintf(stderr, "A script was not verified and executed\n");
+        }
+        cleanup_socket_server(&socket_server);
+    }
+    else
+    {
+        fprintf(stderr, "Cannot serve the fifo named pipe and the socket\n");
+    }
+
+    if(client >= 0)
+    {
+        close(client);
+    }
+    if(use_verifiers)
+    {
+        cleanup_verify_pool(&test.verifiers);
+    }
+    cleanup_listener(&listener);
+    cleanup_executor(&test.executor);
+    cleanup_event_loop(&test.loop);
+    free_verify_cache(&test.cache);
+    cleanup_verify_ctx(&test.verifier);
+    return ret;
+}
+
+static int remove_entry(const char* path, const struct stat* st, int flag, struct FTW* ftw)
+{
+    (void) st;
+    (void) flag;
+    (void) ftw;
+    return remove(path);
+}
+
+int main(void)
+{
+    char cert_dir[DIR_SIZE];
+    char cert_path[PATH_SIZE];
+    cert_registry_t registry;
+    size_t signed_size = 0;
+    char* signed_file = NULL;
+    int ret = EXIT_FAILURE;
+
+    /* The results go to stdout, the messages and the outputs logged by the server are silenced */
+    FILE* results = fdopen(dup(STDOUT_FILENO), "w");
+    if(!results || !freopen("/dev/null", "w", stdout) || !mkdtemp(work_dir))
+    {
+        fprintf(stderr, "Cannot redirect the output and create the working directory\n");
+        return EXIT_FAILURE;
+    }
+    snprintf(cert_dir, sizeof(cert_dir), "%s/certs", work_dir);
+    snprintf(cert_path, sizeof(cert_path), "%s/cert.pem", cert_dir);
+
+    EVP_PKEY* pkey = EVP_PKEY_Q_keygen(NULL, NULL, "RSA", (size_t) 2048);
+    cert_store_t* store = NULL;
+    if(pkey && 0 == mkdir(cert_dir, 0700) && OK == write_cert(pkey, cert_path))
+    {
+        store = load_certs(cert_dir);
+        signed_file = sign_script(pkey, &signed_size);
+    }
+
+    if(!store || !signed_file || CERT_REGISTRY_OK != init_cert_registry(&registry, store, cert_dir, NULL))
+    {
+        fprintf(stderr, "Cannot create the certificate and sign the script\n");
+        cleanup_certs(&store);
+    }
+    else
+    {
+        start_logger(LOG_DEFAULT_CAPACITY, LOG_POLICY_BLOCK);
+        int inline_ret = run_source_checks(&registry, 0, signed_file, signed_size, results);
+        int pool_ret = run_source_checks(&registry, 1, signed_file, signed_size, results);
+        ret = (OK == inline_ret && OK == pool_ret) ? EXIT_SUCCESS : EXIT_FAILURE;
+        stop_logger();
+        cleanup_cert_registry(&registry);
+    }
+
+    free(signed_file);
+    EVP_PKEY_free(pkey);
+    nftw(work_dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    fclose(results);
+    return ret;
+}
@@ -0,0 +1,296 @@
+/*
+ * Project Name: Script Verification Service
+ * Filename: base64_test.c
+ *
+ * Copyright © 2024 Mohamad Mansouri
+ * All rights reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Checks every base64 kernel the CPU supports against the scalar kernel and against OpenSSL: signatures of every
+ * size up to MAX_SIGNATURE_SIZE are decoded with each kernel, then malformed signatures must be rejected the same
+ * way by all of them: bad padding, non-zero trailing bits, bytes outside of the alphabet at every position and
+ * signatures that decode to more than MAX_SIGNATURE_SIZE bytes. Run with make check, it exits with an error if
+ * any check fails.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#include "base64.h"
+#include "server.h"
+
+/* Room after the output buffer to catch a kernel storing beyond out_size */
+#define GUARD_SIZE                      64
+#define GUARD_BYTE                      0xA5
+
+/* Valid text placed before the malformed ends so that the SIMD kernels decode whole registers before reaching them */
+#define PREFIX                          "QUJDREVGR0hJSktMTU5PUFFSU1RVVldYWVphYmNkZWZnaGlqa2xtbm9wcXJzdHV2"
+
+typedef struct decoding
+{
+    int size;                                   // decoded size or BASE64_ERROR
+    size_t consumed;
+    unsigned char out[2 * MAX_SIGNATURE_SIZE + GUARD_SIZE];
+} decoding_t;
+
+typedef struct malformed
+{
+    const char* text;                           // followed by a newline, like the signature line
+    int size;                                   // expected decoded size, without the prefix
+    size_t consumed;                            // expected length of the text, checked if it is decoded
+} malformed_t;
+
+static const malformed_t malformed_texts[] =
+{
+    /* Padding */
+    {"QQ==",        1,              4},
+    {"QUI=",        2,              4},
+    {"QQ=",         BASE64_ERROR,   0},
+    {"QQ",          BASE64_ERROR,   0},
+    {"QUI",         BASE64_ERROR,   0},
+    {"Q",           BASE64_ERROR,   0},
+    {"Q=",          BASE64_ERROR,   0},
+    {"Q==",         BASE64_ERROR,   0},
+    {"Q===",        BASE64_ERROR,   0},
+    {"=",           BASE64_ERROR,   0},
+    {"==",          BASE64_ERROR,   0},
+    {"QUI==",       BASE64_ERROR,   0},
+    {"QUJD=",       BASE64_ERROR,   0},
+    {"QUJD==",      BASE64_ERROR,   0},
+    /* The text ends at its padding, the caller rejects what follows */
+    {"QQ===",       1,              4},
+    {"QQ==QUJD",    1,              4},
+    {"QUI=QUJD",    2,              4},
+    /* Non-zero trailing bits */
+    {"QR==",        BASE64_ERROR,   0},
+    {"Q/==",        BASE64_ERROR,   0},
+    {"QUJ=",        BASE64_ERROR,   0},
+    {"QUL=",        BASE64_ERROR,   0},
+    {"QU/=",        BASE64_ERROR,   0},
+};
+
+static long num_checks = 0;
+static long num_failures = 0;
+
+static void check(int ok, const char* kernel, const char* what, size_t size)
+{
+    num_checks++;
+    if(!ok)
+    {
+        num_failures++;
+        if(num_failures <= 20)
+        {
+            fprintf(stderr, "FAILED: %s kernel, %s (%zu)\n", kernel, what, size);
+        }
+    }
+}
+
+/* Decode with the selected kernel into an out_size buffer followed by a guard */
+static void decode(decoding_t* decoding, const char* text, size_t text_size, size_t out_size)
+{
+    memset(decoding->out, GUARD_BYTE, sizeof(decoding->out));
+    decoding->consumed = 0;
+    decoding->size = base64_decode(decoding->out, out_size, text, text_size, &decoding->consumed);
+}
+
+static int guard_intact(const decoding_t* decoding, size_t out_size)
+{
+    for(size_t i = out_size; i < out_size + GUARD_SIZE; i++)
+    {
+        if(GUARD_BYTE != decoding->out[i])
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int same_decoding(const decoding_t* a, const decoding_t* b)
+{
+    if(a->size != b->size)
+    {
+        return 0;
+    }
+    if(BASE64_ERROR == a->size)
+    {
+        return 1;
+    }
+    return a->consumed == b->consumed && 0 == memcmp(a->out, b->out, a->size);
+}
+
+/* Random data of every size up to MAX_SIGNATURE_SIZE, encoded by OpenSSL */
+static void check_round_trips(int kernel)
+{
+    const char* name = base64_kernel_name(kernel);
+    static unsigned char data[MAX_SIGNATURE_SIZE];
+    static char text[4 * (MAX_SIGNATURE_SIZE / 3 + 1) + 2];
+    static unsigned char openssl_out[MAX_SIGNATURE_SIZE + 3];
+    static decoding_t decoding, scalar;
+
+    for(size_t size = 0; size <= MAX_SIGNATURE_SIZE; size += (size < 256 || size > MAX_SIGNATURE_SIZE - 64) ? 1 : 7)
+    {
+        RAND_bytes(data, size);
+        size_t text_size = EVP_EncodeBlock((unsigned char*) text, data, size);
+        text[text_size] = '\n';
+
+        select_base64_kernel(BASE64_KERNEL_SCALAR);
+        decode(&scalar, text, text_size + 1, MAX_SIGNATURE_SIZE);
+        select_base64_kernel(kernel);
+        decode(&decoding, text, text_size + 1, MAX_SIGNATURE_SIZE);
+
+        check(decoding.size == (int) size && 0 == memcmp(decoding.out, data, size), name, "round trip", size);
+        check(decoding.consumed == text_size, name, "consumed length of a round trip", size);
+        check(guard_intact(&decoding, MAX_SIGNATURE_SIZE), name, "write beyond the output", size);
+        check(same_decoding(&decoding, &scalar), name, "same decoding as the scalar kernel", size);
+
+        /* The kernels store whole registers, an output of exactly the decoded size must not be overrun */
+        decode(&decoding, text, text_size + 1, size);
+        check(decoding.size == (int) size && 0 == memcmp(decoding.out, data, size), name, "round trip into an exact output", size);
+        check(guard_intact(&decoding, size), name, "write beyond an exact output", size);
+
+        /* OpenSSL decodes the padding as zero bytes */
+        int openssl_size = EVP_DecodeBlock(openssl_out, (unsigned char*) text, text_size);
+        int padding = (text_size > 0 && '=' == text[text_size - 1]) + (text_size > 1 && '=' == text[text_size - 2]);
+        check(openssl_size - padding == decoding.size && 0 == memcmp(openssl_out, decoding.out, size), name,
+              "same decoding as OpenSSL", size);
+    }
+
+    /* Every character of the alphabet, in both halves of the SIMD registers */
+    const char* alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    snprintf(text, sizeof(text), "%s%s\n", alphabet + 32, alphabet);
+    int openssl_size = EVP_DecodeBlock(openssl_out, (unsigned char*) text, 96);
+    decode(&decoding, text, 97, MAX_SIGNATURE_SIZE);
+    check(openssl_size == decoding.size && 0 == memcmp(openssl_out, decoding.out, openssl_size), name, "alphabet", 96);
+}
+
+/* A byte outside of the alphabet ends the text wherever it is: the text before it is decoded if it is made of
+   whole groups, rejected otherwise */
+static void check_non_alphabet(int kernel)
+{
+    const char* name = base64_kernel_name(kernel);
+    static unsigned char data[96];
+    static char text[130];
+    static decoding_t decoding, scalar;
+
+    RAND_bytes(data, sizeof(data));
+    EVP_EncodeBlock((unsigned char*) text, data, sizeof(data));
+    for(int byte = 0; byte < 256; byte++)
+    {
+        if(memchr("ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/=", byte, 65))
+        {
+            continue;
+        }
+        for(size_t position = 0; position < 128; position++)
+        {
+            char saved = text[position];
+            text[position] = (char) byte;
+
+            select_base64_kernel(BASE64_KERNEL_SCALAR);
+            decode(&scalar, text, 128, MAX_SIGNATURE_SIZE);
+            select_base64_kernel(kernel);
+            decode(&decoding, text, 128, MAX_SIGNATURE_SIZE);
+
+            if(0 == position % 4)
+            {
+                check(decoding.size == (int) (position / 4 * 3) && 0 == memcmp(decoding.out, data, decoding.size) &&
+                      decoding.consumed == position, name, "non-alphabet byte after whole groups", byte);
+            }
+            else
+            {
+                check(BASE64_ERROR == decoding.size, name, "non-alphabet byte inside a group", byte);
+            }
+            check(same_decoding(&decoding, &scalar), name, "same non-alphabet handling as the scalar kernel", byte);
+            text[position] = saved;
+        }
+    }
+}
+
+static void check_malformed(int kernel)
+{
+    const char* name = base64_kernel_name(kernel);
+    static char text[256];
+    static decoding_t decoding;
+
+    select_base64_kernel(kernel);
+    for(size_t i = 0; i < sizeof(malformed_texts) / sizeof(malformed_texts[0]); i++)
+    {
+        const malformed_t* malformed = &malformed_texts[i];
+        for(int with_prefix = 0; with_prefix < 2; with_prefix++)
+        {
+            const char* prefix = with_prefix ? PREFIX : "";
+            size_t prefix_size = strlen(prefix);
+            int text_size = snprintf(text, sizeof(text), "%s%s\n", prefix, malformed->text);
+            decode(&decoding, text, text_size, MAX_SIGNATURE_SIZE);
+
+            int expected = (BASE64_ERROR == malformed->size) ? BASE64_ERROR : (int) (prefix_size / 4 * 3) + malformed->size;
+            check(decoding.size == expected, name, malformed->text, prefix_size);
+            if(BASE64_ERROR != expected)
+            {
+                check(decoding.consumed == prefix_size + malformed->consumed, name, malformed->text, prefix_size);
+            }
+        }
+    }
+}
+
+/* The decoded signature must fit in MAX_SIGNATURE_SIZE bytes */
+static void check_too_long(int kernel)
+{
+    const char* name = base64_kernel_name(kernel);
+    static unsigned char data[2 * MAX_SIGNATURE_SIZE];
+    static char text[4 * (2 * MAX_SIGNATURE_SIZE / 3 + 1) + 2];
+    static decoding_t decoding;
+    const size_t sizes[] = {MAX_SIGNATURE_SIZE + 1, MAX_SIGNATURE_SIZE + 2, MAX_SIGNATURE_SIZE + 3,
+                            MAX_SIGNATURE_SIZE + 100, 2 * MAX_SIGNATURE_SIZE};
+
+    select_base64_kernel(kernel);
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        RAND_bytes(data, sizes[i]);
+        size_t text_size = EVP_EncodeBlock((unsigned char*) text, data, sizes[i]);
+        text[text_size] = '\n';
+        decode(&decoding, text, text_size + 1, MAX_SIGNATURE_SIZE);
+        check(BASE64_ERROR == decoding.size, name, "decoded size above MAX_SIGNATURE_SIZE", sizes[i]);
+        check(guard_intact(&decoding, MAX_SIGNATURE_SIZE), name, "write beyond the output", sizes[i]);
+    }
+}
+
+int main(void)
+{
+    for(int kernel = 0; kernel < BASE64_NUM_KERNELS; kernel++)
+    {
+        if(!base64_kernel_supported(kernel))
+        {
+            printf("base64 %s kernel: not supported by this CPU, skipped\n", base64_kernel_name(kernel));
+            continue;
+        }
+        long checks = num_checks, failures = num_failures;
+        check_round_trips(kernel);
+        check_non_alphabet(kernel);
+        check_malformed(kernel);
+        check_too_long(kernel);
+        printf("base64 %s kernel: %ld checks, %ld failed\n", base64_kernel_name(kernel), num_checks - checks, num_failures - failures);
+    }
+    return (0 == num_failures) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,329 @@
+#!/usr/bin/env python3
+# Closed-loop load generator. Starts the server in a temporary directory with one fifo named pipe per lane (-f),
+# pre-signs a corpus of scripts with the keys of tests/keys in the proportions of --mix and the sizes of --sizes,
+# corrupts a fraction of them so that their signature is invalid, then drives the fifos from --concurrency lanes
+# for --duration seconds and reports the achieved throughput and the end-to-end latency percentiles.
+#
+# Each lane writes one script to its fifo and waits until the server logged its outcome before sending the next one.
+# With --rate the scripts are due at a fixed rate instead of as fast as possible, and the latency of a script is
+# measured from the time it was due, so the time spent waiting for a lane is counted as well.
+#
+# The server logs the fifo each script was received on along with its number. A lane has one script in flight at a
+# time, so that line ties the number to the request, and the verdict or exit status logged under that number is
+# attributed to it. An entry of the corpus is never in flight twice.
+#
+# Arguments after -- are passed to the server, e.g. -- -C 0 to measure the verification without the cache.
+# The log sink (the default --output) is required.
+#
+# usage: loadgen.py [--server <path>] [--keys <dir>] [--certs <dir>] [--mix <key=weight,...>] [--sizes <size=weight,...>]
+#                   [--invalid <fraction>] [--corpus <entries>] [--concurrency <lanes>] [--rate <scripts/s>]
+#                   [--duration <seconds>] [--warmup <seconds>] [--timeout <seconds>] [-- <server options>]
+
+import argparse
+import base64
+import collections
+import os
+import random
+import re
+import shutil
+import signal
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+TOOLS_PATH = os.path.dirname(os.path.abspath(__file__))
+REPO_PATH = os.path.normpath(os.path.join(TOOLS_PATH, "..", ".."))
+
+# The keys generated by tests/tools/generate_certs.sh
+DEFAULT_MIX = "rsa_4096=1,rsa_2048=1,dsa_2048=1,eddsa_448=1"
+# From tiny scripts up to MAX_SCRIPT_SIZE, the default -m of the server
+DEFAULT_SIZES = "256=8,4K=4,64K=2,1M=1,4M=1"
+
+PADDING_LINE_SIZE = 1024
+
+LOG_LINE = re.compile(r"^\S+ \S+ #(\d+) (\w+) : (.*)$")
+RECEIVED = re.compile(r"^Script #\d+ was received on (.*)$")
+EXITED = re.compile(r"^Script #\d+ exited with status (-?\d+)")
+
+
+def parse_size(text):
+    units = {"K": 1024, "M": 1024 * 1024}
+    if text[-1:].upper() in units:
+        return int(text[:-1]) * units[text[-1:].upper()]
+    return int(text)
+
+
+def parse_weights(text, parse_key):
+    weights = []
+    for item in text.split(","):
+        key, _, weight = item.partition("=")
+        weights.append((parse_key(key), float(weight) if weight else 1.0))
+    return weights
+
+
+def sign(key_path, eddsa, script_path, signature_path):
+    # Same commands as tests/tools/sign_scripts.sh: EdDSA signs the script itself, the others its sha256 digest
+    if eddsa:
+        command = ["openssl", "pkeyutl", "-sign", "-rawin", "-inkey", key_path, "-in", script_path, "-out", signature_path]
+    else:
+        command = ["openssl", "dgst", "-sha256", "-sign", key_path, "-out", signature_path, script_path]
+    subprocess.run(command, check=True)
+
+
+def build_corpus(args, work_path):
+    mix = parse_weights(args.mix, str)
+    sizes = parse_weights(args.sizes, parse_size)
+    rng = random.Random(args.seed)
+    script_path = os.path.join(work_path, "script.sh")
+    signature_path = os.path.join(work_path, "signature")
+    corpus = []
+
+    for index in range(args.corpus):
+        key = rng.choices([k for k, _ in mix], [w for _, w in mix])[0]
+        size = rng.choices([s for s, _ in sizes], [w for _, w in sizes])[0]
+        invalid = rng.random() < args.invalid
+
+        # The signature line takes some of the size, the rest is padded with comments
+        body = ("#!/bin/bash\necho loadgen %d\n" % index).encode()
+        padding = max(0, size - len(body) - 1024)
+        line = b"#" + b"x" * (PADDING_LINE_SIZE - 2) + b"\n"
+        body += line * (padding // len(line)) + b"#" * (padding % len(line))
+        with open(script_path, "wb") as f:
+            f.write(body)
+
+        sign(os.path.join(args.keys, key + ".key"), key.startswith("eddsa"), script_path, signature_path)
+        with open(signature_path, "rb") as f:
+            signature = f.read()
+        if invalid:
+            # The signature no longer matches the script
+            body = body.replace(b"echo loadgen", b"echo LOADGEN", 1)
+        data = base64.b64encode(signature) + b"\n" + body
+        corpus.append({"index": index, "key": key, "size": len(data), "invalid": invalid, "data": data})
+
+    return corpus
+
+
+class Request:
+    def __init__(self, entry, due):
+        self.entry = entry
+        self.due = due
+        self.request_id = None
+        self.done = threading.Event()
+        self.outcome = None
+        self.completed = None
+
+
+class LoadGenerator:
+    def __init__(self, args, corpus, fifo_path):
+        self.args = args
+        self.corpus = corpus
+        self.fifo_path = fifo_path
+        self.lock = threading.Lock()
+        self.free_entries = collections.deque(random.Random(args.seed).sample(range(len(corpus)), len(corpus)))
+        self.entry_available = threading.Condition(self.lock)
+        self.lane_requests = {}
+        self.requests_by_id = {}
+        self.next_due = None
+        self.results = []
+        self.timeouts = 0
+
+    # Called for every line the server prints
+    def on_line(self, line):
+        now = time.monotonic()
+        match = LOG_LINE.match(line)
+        if not match:
+            return
+
+        request_id, message = int(match.group(1)), match.group(3)
+        received = RECEIVED.match(message)
+        if received:
+            with self.lock:
+                request = self.lane_requests.get(os.path.basename(received.group(1)))
+                if request is not None and request.request_id is None:
+                    request.request_id = request_id
+                    self.requests_by_id[request_id] = request
+            return
+
+        exited = EXITED.match(message)
+        if exited:
+            outcome = "valid" if exited.group(1) == "0" else "failed"
+        elif message.startswith("The script has INVALID signature"):
+            outcome = "invalid"
+        else:
+            return
+        with self.lock:
+            request = self.requests_by_id.pop(request_id, None)
+        if request is not None:
+            self.complete(request, outcome, now)
+
+    def complete(self, request, outcome, now):
+        request.outcome = outcome
+        request.completed = now
+        request.done.set()
+
+    def take_entry(self):
+        with self.lock:
+            while not self.free_entries:
+                self.entry_available.wait()
+            return self.corpus[self.free_entries.popleft()]
+
+    def release_entry(self, lane_name, request):
+        with self.lock:
+            self.lane_requests.pop(lane_name, None)
+            self.requests_by_id.pop(request.request_id, None)
+            self.free_entries.append(request.entry["index"])
+            self.entry_available.notify()
+
+    def next_due_time(self):
+        if not self.args.rate:
+            return time.monotonic()
+        with self.lock:
+            due = self.next_due
+            self.next_due += 1.0 / self.args.rate
+        return due
+
+    def run_lane(self, lane, start, end):
+        lane_name = "lane.%d" % lane
+        path = os.path.join(self.fifo_path, lane_name)
+        while True:
+            due = self.next_due_time()
+            if due >= end:
+                return
+            delay = due - time.monotonic()
+            if delay > 0:
+                time.sleep(delay)
+
+            entry = self.take_entry()
+            request = Request(entry, due)
+            with self.lock:
+                self.lane_requests[lane_name] = request
+
+            with open(path, "wb") as fifo:
+                fifo.write(entry["data"])
+
+            if not request.done.wait(self.args.timeout):
+                with self.lock:
+                    self.timeouts += 1
+            elif due >= start:
+                with self.lock:
+                    self.results.append(request)
+            self.release_entry(lane_name, request)
+
+    def run(self):
+        now = time.monotonic()
+        start = now + self.args.warmup
+        end = start + self.args.duration
+        self.next_due = now
+        lanes = [threading.Thread(target=self.run_lane, args=(i, start, end)) for i in range(self.args.concurrency)]
+        for lane in lanes:
+            lane.start()
+        for lane in lanes:
+            lane.join()
+        return self.args.duration
+
+
+def percentile(sorted_values, fraction):
+    if not sorted_values:
+        return 0.0
+    rank = max(0, min(len(sorted_values) - 1, int(fraction * len(sorted_values) + 0.5) - 1))
+    return sorted_values[rank]
+
+
+def print_row(name, requests):
+    latencies = sorted(r.completed - r.due for r in requests)
+    print("%-12s %8d %10.3f %10.3f %10.3f %10.3f" % (name, len(latencies), percentile(latencies, 0.5) * 1000,
+                                                    percentile(latencies, 0.99) * 1000, percentile(latencies, 0.999) * 1000,
+                                                    (latencies[-1] if latencies else 0.0) * 1000))
+
+
+def report(generator, elapsed):
+    results = generator.results
+    outcomes = collections.Counter(r.outcome for r in results)
+    print("%d scripts in %.1f s: %.1f scripts/s (%d valid, %d invalid, %d failed, %d timed out)"
+          % (len(results), elapsed, len(results) / elapsed, outcomes["valid"], outcomes["invalid"], outcomes["failed"],
+             generator.timeouts))
+    print("%-12s %8s %10s %10s %10s %10s" % ("", "scripts", "p50 ms", "p99 ms", "p999 ms", "max ms"))
+    print_row("all", results)
+    for key in sorted(set(r.entry["key"] for r in results)):
+        print_row(key, [r for r in results if r.entry["key"] == key and not r.entry["invalid"]])
+    print_row("invalid", [r for r in results if r.entry["invalid"]])
+
+
+def read_server_output(server, generator, listening, lanes):
+    count = 0
+    for raw in server.stdout:
+        line = raw.decode(errors="replace").rstrip("\n")
+        if count < lanes and " : Listening on " in line:
+            count += 1
+            if count == lanes:
+                listening.set()
+        generator.on_line(line)
+
+
+def main():
+    argv = sys.argv[1:]
+    server_args = []
+    if "--" in argv:
+        server_args = argv[argv.index("--") + 1:]
+        argv = argv[:argv.index("--")]
+
+    parser = argparse.ArgumentParser(description="Closed-loop load generator for the fifo named pipes of the server")
+    parser.add_argument("--server", default=os.path.join(REPO_PATH, "server"))
+    parser.add_argument("--keys", default=os.path.join(REPO_PATH, "tests", "keys"))
+    parser.add_argument("--certs", default=os.path.join(REPO_PATH, "tests", "certificates"))
+    parser.add_argument("--mix", default=DEFAULT_MIX, help="keys and their weights (default: %s)" % DEFAULT_MIX)
+    parser.add_argument("--sizes", default=DEFAULT_SIZES, help="script sizes and their weights (default: %s)" % DEFAULT_SIZES)
+    parser.add_argument("--invalid", type=float, default=0.05, help="fraction of invalid signatures (default: 0.05)")
+    parser.add_argument("--corpus", type=int, default=64, help="number of pre-signed scripts (default: 64)")
+    parser.add_argument("--concurrency", type=int, default=4, help="number of lanes (default: 4)")
+    parser.add_argument("--rate", type=float, default=0, help="scripts per second, 0 sends as fast as possible (default: 0)")
+    parser.add_argument("--duration", type=float, default=10, help="measured seconds (default: 10)")
+    parser.add_argument("--warmup", type=float, default=1, help="seconds not measured before (default: 1)")
+    parser.add_argument("--timeout", type=float, default=30, help="seconds to wait for one script (default: 30)")
+    parser.add_argument("--seed", type=int, default=1)
+    args = parser.parse_args(argv)
+
+    if args.corpus < args.concurrency:
+        parser.error("--corpus must be at least --concurrency, an entry is never in flight twice")
+
+    work_path = tempfile.mkdtemp(prefix="svs_loadgen.")
+    server = None
+    try:
+        print("Signing %d scripts..." % args.corpus, file=sys.stderr)
+        corpus = build_corpus(args, work_path)
+
+        fifo_path = os.path.join(work_path, "lanes")
+        os.mkdir(fifo_path)
+        for lane in range(args.concurrency):
+            os.mkfifo(os.path.join(fifo_path, "lane.%d" % lane))
+
+        generator = LoadGenerator(args, corpus, fifo_path)
+        listening = threading.Event()
+        with open(os.path.join(work_path, "server.err"), "wb") as server_err:
+            server = subprocess.Popen([os.path.abspath(args.server), "-c", os.path.abspath(args.certs), "-f", fifo_path] + server_args,
+                                      cwd=work_path, stdout=subprocess.PIPE, stderr=server_err)
+        reader = threading.Thread(target=read_server_output, args=(server, generator, listening, args.concurrency), daemon=True)
+        reader.start()
+        if not listening.wait(30):
+            print("The server did not start, see %s" % os.path.join(work_path, "server.err"), file=sys.stderr)
+            return 1
+
+        print("Running %d lanes for %.1f s..." % (args.concurrency, args.warmup + args.duration), file=sys.stderr)
+        elapsed = generator.run()
+        report(generator, elapsed)
+        return 0
+    finally:
+        if server is not None:
+            server.send_signal(signal.SIGINT)
+            try:
+                server.wait(10)
+            except subprocess.TimeoutExpired:
+                server.kill()
+                server.wait()
+        shutil.rmtree(work_path, ignore_errors=True)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,88 @@
+#!/usr/bin/env python3
+# Send signed scripts to the server over its unix domain socket and print the replies.
+# All the scripts are sent on one connection before reading the replies.
+# With --memfd, every script is written to a sealed memfd whose file descriptor is passed to the server
+# instead of the content of the script.
+#
+# usage: send_script.py [--memfd] <socket_path> <signed_script> [<signed_script> ...]
+
+import fcntl
+import os
+import socket
+import struct
+import sys
+
+REPLY_OUTPUT = 1
+REPLY_RESULT = 2
+
+VERDICTS = {0: "VALID", -1: "ERROR", -2: "INVALID"}
+
+FRAME_PASSED_FD = 0xFFFFFFFF
+
+
+def recv_exact(sock, size):
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise ConnectionError("connection closed by the server")
+        data += chunk
+    return data
+
+
+def send_memfd(sock, data):
+    fd = os.memfd_create("signed_script", os.MFD_CLOEXEC | os.MFD_ALLOW_SEALING)
+    try:
+        os.write(fd, data)
+        fcntl.fcntl(fd, fcntl.F_ADD_SEALS, fcntl.F_SEAL_WRITE | fcntl.F_SEAL_SHRINK | fcntl.F_SEAL_GROW | fcntl.F_SEAL_SEAL)
+        sock.sendmsg([struct.pack("!I", FRAME_PASSED_FD)], [(socket.SOL_SOCKET, socket.SCM_RIGHTS, struct.pack("i", fd))])
+    finally:
+        os.close(fd)
+
+
+def main():
+    args = sys.argv[1:]
+    use_memfd = len(args) > 0 and args[0] == "--memfd"
+    if use_memfd:
+        args = args[1:]
+    if len(args) < 2:
+        print("usage: %s [--memfd] <socket_path> <signed_script> [<signed_script> ...]" % sys.argv[0], file=sys.stderr)
+        return 1
+
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(args[0])
+
+    files = args[1:]
+    for path in files:
+        with open(path, "rb") as f:
+            data = f.read()
+        if use_memfd:
+            send_memfd(sock, data)
+        else:
+            sock.sendall(struct.pack("!I", len(data)) + data)
+
+    for path in files:
+        output = b""
+        while True:
+            kind, request, size = struct.unpack("!III", recv_exact(sock, 12))
+            payload = recv_exact(sock, size)
+            if kind == REPLY_OUTPUT:
+                output += payload
+            elif kind == REPLY_RESULT:
+                verdict, exit_status = struct.unpack("!ii", payload[:8])
+                signer = payload[8:].decode(errors="replace")
+                break
+        print("#%d %s: %s" % (request, path, VERDICTS.get(verdict, verdict)), end="")
+        if signer:
+            print(" (signed by %s)" % signer, end="")
+        if exit_status >= 0:
+            print(", exit status %d" % exit_status, end="")
+        print()
+        sys.stdout.write(output.decode(errors="replace"))
+
+    sock.close()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -5,6 +5,7 @@ tmpsigtxt=/tmp/signature.sha256.txt
 
 script_path=../scripts
 keys_path=../keys
+certs_path=../certificates
 
 # Function to sign a script with a specific key
 generate_signed_script() {
@@ -15,6 +16,34 @@ generate_signed_script() {
     cp $tmpsigtxt $script_path/$2.sh.signed
 }
 
+# Function to sign a script with a specific key and prefix the signature with
+# the SHA-256 fingerprint of the matching certificate as a key identifier hint
+generate_signed_script_with_key_id() {
+    openssl dgst -sha256 -sign $keys_path/$1.key -out $tmpsigraw $script_path/$3.sh
+    openssl x509 -in $certs_path/$2 -noout -fingerprint -sha256 | cut -d '=' -f 2 | tr -d ':\n' > $tmpsigtxt
+    echo -n ':' >> $tmpsigtxt
+    base64 -w 0 $tmpsigraw >> $tmpsigtxt
+    echo >> $tmpsigtxt
+    cat $script_path/$3.sh >> $tmpsigtxt
+    cp $tmpsigtxt $script_path/$3.sh.keyid.signed
+}
+
+# Function to sign a script with an EdDSA key. EdDSA signs the script itself
+# rather than its sha256 digest
+generate_signed_script_eddsa() {
+    openssl pkeyutl -sign -rawin -inkey $keys_path/$1.key -in $script_path/$2.sh -out $tmpsigraw
+    base64 -w 0 $tmpsigraw > $tmpsigtxt
+    echo >> $tmpsigtxt
+    cat $script_path/$2.sh >> $tmpsigtxt
+    cp $tmpsigtxt $script_path/$2.sh.eddsa.signed
+}
+
 generate_signed_script rsa_4096 script
 generate_signed_script dsa_2048 script_long_input
-generate_signed_script rsa_2048 script_long_output
\ No newline at end of file
+generate_signed_script rsa_2048 script_long_output
+
+generate_signed_script_with_key_id rsa_4096 rsa_4096_sha256_cert.pem script
+generate_signed_script_with_key_id dsa_2048 dsa_2048_sha512_cert.pem script_long_input
+generate_signed_script_with_key_id rsa_2048 rsa_2048_sha512_cert.pem script_long_output
+
+generate_signed_script_eddsa eddsa_448 script
@@ -0,0 +1,107 @@
+#!/bin/bash
+
+# Sign scripts in the v2 format: the script is cut in chunks of chunk_size bytes,
+# every chunk is hashed as a leaf of a Merkle tree and the signature covers the
+# signed message "SVS2" | chunk size (4 bytes) | script size (8 bytes) | root,
+# all sizes big endian. The signed file is
+#     SVS2 <chunk size> [<key identifier>:]<base64 signature>
+#     <base64 of the sha256 of every chunk>
+#     <script>
+# Leaves are sha256(0x00 | chunk), inner nodes sha256(0x01 | left | right) and a
+# node without sibling moves up to the next level unchanged.
+
+chunk_size=${CHUNK_SIZE:-4096}
+
+tmpdir=$(mktemp -d)
+trap 'rm -rf $tmpdir' EXIT
+
+script_path=../scripts
+keys_path=../keys
+certs_path=../certificates
+
+# Write the value $1 as $2 big endian bytes
+be_bytes() {
+    for ((i = $2 - 1; i >= 0; i--)); do
+        printf "\\x$(printf '%02x' $((($1 >> (8 * i)) & 255)))"
+    done
+}
+
+# Hash the chunks of the script $1 to $tmpdir/leaves and build the signed message
+# in $tmpdir/message
+build_signed_message() {
+    rm -f $tmpdir/chunk.* $tmpdir/node.*
+    split -b $chunk_size -a 6 -d $1 $tmpdir/chunk.
+    # An empty script has one empty chunk
+    [ -e $tmpdir/chunk.000000 ] || touch $tmpdir/chunk.000000
+
+    nodes=()
+    for chunk in $tmpdir/chunk.*; do
+        { printf '\x00'; cat $chunk; } | openssl dgst -sha256 -binary > $chunk.leaf
+        nodes+=($chunk.leaf)
+    done
+    cat "${nodes[@]}" > $tmpdir/leaves
+
+    level=0
+    while [ ${#nodes[@]} -gt 1 ]; do
+        next=()
+        for ((n = 0; n < ${#nodes[@]}; n += 2)); do
+            if [ $((n + 1)) -lt ${#nodes[@]} ]; then
+                { printf '\x01'; cat ${nodes[n]} ${nodes[n + 1]}; } | openssl dgst -sha256 -binary > $tmpdir/node.$level.$n
+                next+=($tmpdir/node.$level.$n)
+            else
+                next+=(${nodes[n]})
+            fi
+        done
+        nodes=("${next[@]}")
+        level=$((level + 1))
+    done
+
+    { printf 'SVS2'; be_bytes $chunk_size 4; be_bytes $(stat -c %s $1) 8; cat ${nodes[0]}; } > $tmpdir/message
+}
+
+# Write the signed file $3 from the signature in $tmpdir/signature, the optional
+# key identifier $2 and the script $1
+write_signed_script() {
+    {
+        echo -n "SVS2 $chunk_size "
+        [ -n "$2" ] && echo -n "$2:"
+        base64 -w 0 $tmpdir/signature
+        echo
+        base64 -w 0 $tmpdir/leaves
+        echo
+        cat $1
+    } > $3
+}
+
+# Function to sign a script with a specific key, the signature covers the sha256
+# digest of the signed message
+generate_signed_script_v2() {
+    build_signed_message $script_path/$2.sh
+    openssl dgst -sha256 -sign $keys_path/$1.key -out $tmpdir/signature $tmpdir/message
+    write_signed_script $script_path/$2.sh "" $script_path/$2.sh.v2.signed
+}
+
+# Same with the SHA-256 fingerprint of the matching certificate as a key identifier hint
+generate_signed_script_v2_with_key_id() {
+    build_signed_message $script_path/$3.sh
+    openssl dgst -sha256 -sign $keys_path/$1.key -out $tmpdir/signature $tmpdir/message
+    key_id=$(openssl x509 -in $certs_path/$2 -noout -fingerprint -sha256 | cut -d '=' -f 2 | tr -d ':\n')
+    write_signed_script $script_path/$3.sh $key_id $script_path/$3.sh.v2.keyid.signed
+}
+
+# Function to sign a script with an EdDSA key, which signs the signed message itself
+generate_signed_script_v2_eddsa() {
+    build_signed_message $script_path/$2.sh
+    openssl pkeyutl -sign -rawin -inkey $keys_path/$1.key -in $tmpdir/message -out $tmpdir/signature
+    write_signed_script $script_path/$2.sh "" $script_path/$2.sh.v2.eddsa.signed
+}
+
+generate_signed_script_v2 rsa_4096 script
+generate_signed_script_v2 dsa_2048 script_long_input
+generate_signed_script_v2 rsa_2048 script_long_output
+
+generate_signed_script_v2_with_key_id rsa_4096 rsa_4096_sha256_cert.pem script
+generate_signed_script_v2_with_key_id dsa_2048 dsa_2048_sha512_cert.pem script_long_input
+
+generate_signed_script_v2_eddsa eddsa_448 script
+generate_signed_script_v2_eddsa eddsa_448 script_long_input